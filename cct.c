@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+#define CCT_INITIAL_NODES 256    /* node pool size of a new tree */
+#define CCT_NAME_MAX 256         /* longest frame name in folded output */
+
+/*
+ * Calling-context tree.
+ *
+ * Nodes live in one growable pool and refer to their parent by index;
+ * node 0 is the synthetic root.  Children are not linked from their
+ * parent: a single open-addressed table maps (parent, pc) to the child
+ * index, so a node costs only its own record plus one table slot and
+ * memory grows with the number of distinct call paths, not samples.
+ */
+
+struct cct_node {
+    void *pc;
+    uint32_t parent;
+    uint64_t self;
+    uint64_t total;
+};
+
+struct backtrace_cct {
+    struct cct_node *nodes;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *slots;      /* child index, 0 = empty (the root is no child) */
+    uint32_t mask;        /* slot count - 1, a power of two minus one */
+};
+
+static inline uint32_t
+cct_slot(uint32_t parent, void *pc, uint32_t mask)
+{
+    uint64_t h = ((uint64_t)(uintptr_t)pc ^ ((uint64_t)parent << 32)) *
+                 0x9e3779b97f4a7c15ULL;
+
+    return (uint32_t)(h >> 32) & mask;
+}
+
+backtrace_cct_t *
+backtrace_cct_new(void)
+{
+    backtrace_cct_t *cct;
+
+    cct = calloc(1, sizeof(*cct));
+    if (cct == NULL)
+        return NULL;
+    cct->cap = CCT_INITIAL_NODES;
+    cct->nodes = malloc(cct->cap * sizeof(*cct->nodes));
+    cct->mask = cct->cap * 2 - 1;
+    cct->slots = calloc(cct->mask + 1, sizeof(*cct->slots));
+    if (cct->nodes == NULL || cct->slots == NULL) {
+        backtrace_cct_free(cct);
+        return NULL;
+    }
+    memset(&cct->nodes[0], 0, sizeof(cct->nodes[0]));
+    cct->count = 1;
+    return cct;
+}
+
+void
+backtrace_cct_free(backtrace_cct_t *cct)
+{
+    if (cct == NULL)
+        return;
+    free(cct->nodes);
+    free(cct->slots);
+    free(cct);
+}
+
+/* Double the pool and the child table, keeping the load factor <= 1/2 */
+static int
+cct_grow(backtrace_cct_t *cct)
+{
+    struct cct_node *nodes;
+    uint32_t *slots, mask, i, s;
+
+    if (cct->cap > UINT32_MAX / 4) {
+        errno = ENOMEM;
+        return -1;
+    }
+    nodes = realloc(cct->nodes, cct->cap * 2 * sizeof(*nodes));
+    if (nodes == NULL)
+        return -1;
+    cct->nodes = nodes;
+
+    mask = cct->cap * 4 - 1;
+    slots = calloc((size_t)mask + 1, sizeof(*slots));
+    if (slots == NULL)
+        return -1;
+    for (i = 1; i < cct->count; i++) {
+        s = cct_slot(nodes[i].parent, nodes[i].pc, mask);
+        while (slots[s] != 0)
+            s = (s + 1) & mask;
+        slots[s] = i;
+    }
+    free(cct->slots);
+    cct->slots = slots;
+    cct->mask = mask;
+    cct->cap *= 2;
+    return 0;
+}
+
+/* Find or create the child of PARENT for PC; the pool must have room */
+static uint32_t
+cct_child(backtrace_cct_t *cct, uint32_t parent, void *pc)
+{
+    struct cct_node *n;
+    uint32_t s, idx;
+
+    s = cct_slot(parent, pc, cct->mask);
+    while ((idx = cct->slots[s]) != 0) {
+        n = &cct->nodes[idx];
+        if (n->pc == pc && n->parent == parent)
+            return idx;
+        s = (s + 1) & cct->mask;
+    }
+
+    idx = cct->count++;
+    n = &cct->nodes[idx];
+    n->pc = pc;
+    n->parent = parent;
+    n->self = 0;
+    n->total = 0;
+    cct->slots[s] = idx;
+    return idx;
+}
+
+int
+backtrace_cct_insert(backtrace_cct_t *cct, void *const *buffer, int size,
+                     uint64_t count)
+{
+    uint32_t cur = 0;
+    int i;
+
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Reserve room for a wholly new path so an insert never half-fails */
+    while ((uint64_t)cct->count + (uint64_t)size > cct->cap) {
+        if (cct_grow(cct) != 0)
+            return -1;
+    }
+
+    /* backtrace() stores the innermost frame first; insert root-first */
+    cct->nodes[0].total += count;
+    for (i = size - 1; i >= 0; i--) {
+        cur = cct_child(cct, cur, buffer[i]);
+        cct->nodes[cur].total += count;
+    }
+    cct->nodes[cur].self += count;
+    return 0;
+}
+
+size_t
+backtrace_cct_nodes(const backtrace_cct_t *cct)
+{
+    return cct->count - 1;
+}
+
+uint64_t
+backtrace_cct_total(const backtrace_cct_t *cct)
+{
+    return cct->nodes[0].total;
+}
+
+/* Folded-format name of one frame: symbol, module+offset or address */
+static void
+cct_frame_name(void *pc, char *buf, size_t len)
+{
+    struct backtrace_frame f;
+    const char *base;
+    char *p;
+
+    backtrace_resolve(&pc, 1, &f);
+    if (f.symbol != NULL) {
+        snprintf(buf, len, "%s", f.symbol);
+    } else if (f.module_name != NULL) {
+        base = strrchr(f.module_name, '/');
+        snprintf(buf, len, "%s+0x%tx", base ? base + 1 : f.module_name,
+                 (char *)pc - (char *)f.module_base);
+    } else {
+        snprintf(buf, len, "%p", pc);
+    }
+    /* ';' separates frames and ' ' ends the stack in folded output */
+    for (p = buf; *p != '\0'; p++) {
+        if (*p == ';' || *p == ' ')
+            *p = '_';
+    }
+}
+
+int
+backtrace_cct_write_folded(const backtrace_cct_t *cct, int fd)
+{
+    char name[CCT_NAME_MAX];
+    uint32_t *offs, *path;
+    uint32_t i, n, depth, maxdepth = 0;
+    char *names = NULL, *line = NULL, *p;
+    size_t used = 0, cap = 0, linecap, len;
+    ssize_t written;
+    int rc = -1;
+
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    if (cct->count <= 1)
+        return 0;
+
+    /* Symbolize every node once into a packed name arena */
+    offs = malloc((size_t)cct->count * sizeof(*offs));
+    if (offs == NULL)
+        return -1;
+    for (i = 1; i < cct->count; i++) {
+        cct_frame_name(cct->nodes[i].pc, name, sizeof(name));
+        len = strlen(name) + 1;
+        if (used + len > cap) {
+            cap = (cap * 2 > used + len) ? cap * 2 : used + len + 4096;
+            p = realloc(names, cap);
+            if (p == NULL)
+                goto out;
+            names = p;
+        }
+        memcpy(names + used, name, len);
+        offs[i] = (uint32_t)used;
+        used += len;
+
+        for (depth = 0, n = i; n != 0; n = cct->nodes[n].parent)
+            depth++;
+        if (depth > maxdepth)
+            maxdepth = depth;
+    }
+
+    path = malloc((size_t)maxdepth * sizeof(*path));
+    linecap = (size_t)maxdepth * CCT_NAME_MAX + 32;
+    line = malloc(linecap);
+    if (path == NULL || line == NULL) {
+        free(path);
+        goto out;
+    }
+
+    for (i = 1; i < cct->count; i++) {
+        if (cct->nodes[i].self == 0)
+            continue;
+        for (depth = 0, n = i; n != 0; n = cct->nodes[n].parent)
+            path[depth++] = n;
+
+        p = line;
+        while (depth-- > 0) {
+            p += snprintf(p, linecap - (size_t)(p - line), "%s%s",
+                          names + offs[path[depth]], depth ? ";" : "");
+        }
+        p += snprintf(p, linecap - (size_t)(p - line), " %llu\n",
+                      (unsigned long long)cct->nodes[i].self);
+        written = write(fd, line, (size_t)(p - line));
+        (void)written;
+    }
+    free(path);
+    rc = 0;
+
+out:
+    free(offs);
+    free(names);
+    free(line);
+    return rc;
+}
@@ -0,0 +1,602 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+#include "modmap.h"
+
+/*
+ * Live profiling control endpoint.
+ *
+ * A background thread accepts one connection at a time on a local
+ * AF_UNIX socket, reads one command line, streams the response and
+ * closes the connection.  Only peers running as the same user, or root,
+ * are served.
+ *
+ * Stacks of other threads are taken by a SIGPROF handler that exists
+ * only while a command needs it: a CPU timer sends it to running threads
+ * for cpu-profile, tgkill() to every thread for threads.  The handler
+ * walks the frame records and appends to the current sample buffer with
+ * one atomic increment.  The control thread swaps in the spare buffer,
+ * waits for handlers already inside the old one to leave, and reads it
+ * at leisure, so request threads never wait on it.
+ */
+
+#define CONTROL_MAX_DEPTH 64
+#define CONTROL_BUFFER_SAMPLES 1024
+#define CONTROL_DEFAULT_HZ 99
+#define CONTROL_MAX_HZ 1000
+#define CONTROL_MAX_SECONDS 3600
+#define CONTROL_DRAIN_MS 100
+#define CONTROL_READ_MS 5000
+#define CONTROL_THREADS_MS 1000
+#define CONTROL_LINE_MAX 256
+
+struct control_sample {
+    pid_t tid;
+    int depth;
+    void *frames[CONTROL_MAX_DEPTH];
+};
+
+struct control_buffer {
+    atomic_uint next;
+    struct control_sample samples[CONTROL_BUFFER_SAMPLES];
+};
+
+static struct control_buffer *_Atomic control_current;
+static atomic_int control_inflight;
+static atomic_ulong control_dropped;
+
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t control_thread;
+static int control_running;
+static int control_listen_fd = -1;
+static int control_stop_pipe[2] = { -1, -1 };
+static char control_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static struct control_buffer *control_buffers[2];
+static unsigned long control_commands;
+static unsigned long long control_samples;
+
+static pid_t
+control_gettid(void)
+{
+    return (pid_t)syscall(SYS_gettid);
+}
+
+/* SIGPROF handler: async-signal-safe, never blocks */
+static void
+control_signal(int sig, siginfo_t *info, void *uc)
+{
+    struct control_buffer *buf;
+    struct control_sample *s;
+    void *frames[CONTROL_MAX_DEPTH + 2];
+    unsigned slot;
+    int saved = errno, n, skip = 2;
+
+    (void)sig;
+    (void)info;
+    atomic_fetch_add(&control_inflight, 1);
+    buf = atomic_load(&control_current);
+    if (buf != NULL) {
+        slot = atomic_fetch_add_explicit(&buf->next, 1, memory_order_relaxed);
+        if (slot >= CONTROL_BUFFER_SAMPLES) {
+            atomic_fetch_add_explicit(&control_dropped, 1, memory_order_relaxed);
+        } else {
+            s = &buf->samples[slot];
+            s->tid = control_gettid();
+            s->depth = 0;
+            /*
+             * Frames 0 and 1 are this handler and the signal trampoline;
+             * the walk then continues in the interrupted code's callers.
+             * The interrupted pc itself comes from the signal context.
+             */
+#if defined(__x86_64__)
+            s->frames[s->depth++] = (void *)((ucontext_t *)uc)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+            s->frames[s->depth++] = (void *)((ucontext_t *)uc)->uc_mcontext.pc;
+#else
+            (void)uc;
+#endif
+            /* The walker itself: backtrace() in shadow mode has no handler frames */
+            n = backtrace_ex(frames, CONTROL_MAX_DEPTH + 2, NULL);
+            for (; skip < n && s->depth < CONTROL_MAX_DEPTH; skip++)
+                s->frames[s->depth++] = frames[skip];
+        }
+    }
+    atomic_fetch_sub(&control_inflight, 1);
+    errno = saved;
+}
+
+/*
+ * Install SPARE as the current buffer and return the previous one once
+ * no handler is writing to it any more.
+ */
+static struct control_buffer *
+control_swap(struct control_buffer *spare)
+{
+    struct control_buffer *old;
+
+    if (spare != NULL)
+        atomic_store_explicit(&spare->next, 0, memory_order_relaxed);
+    old = atomic_exchange(&control_current, spare);
+    while (atomic_load(&control_inflight) != 0)
+        sched_yield();
+    return old;
+}
+
+static unsigned
+control_filled(struct control_buffer *buf)
+{
+    unsigned n = atomic_load_explicit(&buf->next, memory_order_relaxed);
+
+    return n < CONTROL_BUFFER_SAMPLES ? n : CONTROL_BUFFER_SAMPLES;
+}
+
+static int
+control_write(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int
+control_printf(int fd, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static int
+control_printf(int fd, const char *format, ...)
+{
+    char buf[512];
+    va_list ap;
+    int n;
+
+    va_start(ap, format);
+    n = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    if (n < 0)
+        return -1;
+    return control_write(fd, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+/* Wait up to MS milliseconds; returns 1 if asked to stop */
+static int
+control_sleep(int ms)
+{
+    struct pollfd pfd = { control_stop_pipe[0], POLLIN, 0 };
+
+    return poll(&pfd, 1, ms) > 0;
+}
+
+/* Install the handler and a fresh buffer; undone by control_sampling_end() */
+static int
+control_sampling_begin(struct sigaction *old)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = control_signal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    atomic_store(&control_dropped, 0);
+    control_swap(control_buffers[0]);
+    if (sigaction(SIGPROF, &sa, old) != 0) {
+        control_swap(NULL);
+        return -1;
+    }
+    return 0;
+}
+
+static struct control_buffer *
+control_sampling_end(const struct sigaction *old)
+{
+    struct control_buffer *last = control_swap(NULL);
+
+    /*
+     * A SIGPROF can still be pending, e.g. for a thread that blocks it.
+     * Its default action would kill the process, so the handler stays
+     * installed in that case; with no buffer it just returns.
+     */
+    if (old->sa_handler != SIG_DFL || (old->sa_flags & SA_SIGINFO) != 0)
+        sigaction(SIGPROF, old, NULL);
+    return last;
+}
+
+static void
+control_insert(backtrace_cct_t *cct, struct control_buffer *buf)
+{
+    unsigned i, n = control_filled(buf);
+
+    for (i = 0; i < n; i++) {
+        backtrace_cct_insert(cct, buf->samples[i].frames, buf->samples[i].depth, 1);
+        control_samples++;
+    }
+}
+
+static void
+control_cpu_profile(int fd, long seconds, long hz)
+{
+    struct sigaction old;
+    struct sigevent sev;
+    struct itimerspec its;
+    struct control_buffer *full, *spare = control_buffers[1];
+    struct timespec end, now;
+    backtrace_cct_t *cct;
+    timer_t timer;
+    int stopped = 0;
+
+    if (seconds <= 0 || seconds > CONTROL_MAX_SECONDS || hz <= 0 || hz > CONTROL_MAX_HZ) {
+        control_printf(fd, "error: cpu-profile takes 1-%d seconds at 1-%d Hz\n",
+                       CONTROL_MAX_SECONDS, CONTROL_MAX_HZ);
+        return;
+    }
+    cct = backtrace_cct_new();
+    if (cct == NULL) {
+        control_printf(fd, "error: %s\n", strerror(errno));
+        return;
+    }
+
+    /* Process CPU time: the signal goes to whichever thread is running */
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGPROF;
+    if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &sev, &timer) != 0) {
+        control_printf(fd, "error: timer_create: %s\n", strerror(errno));
+        backtrace_cct_free(cct);
+        return;
+    }
+    if (control_sampling_begin(&old) != 0) {
+        control_printf(fd, "error: sigaction: %s\n", strerror(errno));
+        timer_delete(timer);
+        backtrace_cct_free(cct);
+        return;
+    }
+    its.it_interval.tv_sec = hz == 1 ? 1 : 0;
+    its.it_interval.tv_nsec = hz == 1 ? 0 : 1000000000L / hz;
+    its.it_value = its.it_interval;
+    timer_settime(timer, 0, &its, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += seconds;
+    do {
+        stopped = control_sleep(CONTROL_DRAIN_MS);
+        /* Swap buffers so that a long profile needs no large buffer */
+        full = control_swap(spare);
+        control_insert(cct, full);
+        spare = full;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (!stopped && (now.tv_sec < end.tv_sec ||
+                          (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec)));
+
+    timer_delete(timer);
+    full = control_sampling_end(&old);
+    control_insert(cct, full);
+
+    backtrace_cct_write_folded(cct, fd);
+    backtrace_cct_free(cct);
+}
+
+static void
+control_threads(int fd)
+{
+    struct sigaction old;
+    struct control_buffer *buf;
+    struct control_sample *s;
+    struct dirent *d;
+    char comm[64], path[64];
+    pid_t self = control_gettid(), tid;
+    unsigned sent = 0, i, waited;
+    char **symbols;
+    int j;
+    DIR *dp;
+    FILE *fp;
+
+    dp = opendir("/proc/self/task");
+    if (dp == NULL) {
+        control_printf(fd, "error: /proc/self/task: %s\n", strerror(errno));
+        return;
+    }
+    if (control_sampling_begin(&old) != 0) {
+        control_printf(fd, "error: sigaction: %s\n", strerror(errno));
+        closedir(dp);
+        return;
+    }
+    while ((d = readdir(dp)) != NULL) {
+        tid = (pid_t)atoi(d->d_name);
+        if (tid > 0 && tid != self &&
+            syscall(SYS_tgkill, getpid(), tid, SIGPROF) == 0)
+            sent++;
+    }
+    closedir(dp);
+
+    /* Threads that block SIGPROF never answer */
+    for (waited = 0; waited < CONTROL_THREADS_MS &&
+         atomic_load(&control_buffers[0]->next) < sent; waited += 10) {
+        if (control_sleep(10))
+            break;
+    }
+    buf = control_sampling_end(&old);
+
+    for (i = 0; i < control_filled(buf); i++) {
+        s = &buf->samples[i];
+        comm[0] = '\0';
+        snprintf(path, sizeof(path), "/proc/self/task/%d/comm", (int)s->tid);
+        if ((fp = fopen(path, "r")) != NULL) {
+            if (fgets(comm, sizeof(comm), fp) != NULL)
+                comm[strcspn(comm, "\n")] = '\0';
+            fclose(fp);
+        }
+        control_printf(fd, "Thread %d (%s):\n", (int)s->tid, comm);
+        symbols = backtrace_symbols(s->frames, s->depth);
+        for (j = 0; symbols != NULL && j < s->depth; j++)
+            control_printf(fd, "  #%-2d %s\n", j, symbols[j]);
+        free(symbols);
+        control_samples++;
+    }
+    if (control_filled(buf) < sent)
+        control_printf(fd, "# %u of %u threads did not answer\n",
+                       sent - control_filled(buf), sent);
+}
+
+static void
+control_heap(int fd)
+{
+#ifdef __GLIBC__
+    FILE *fp;
+    int dupfd = dup(fd);
+
+    if (dupfd < 0 || (fp = fdopen(dupfd, "w")) == NULL) {
+        if (dupfd >= 0)
+            close(dupfd);
+        control_printf(fd, "error: %s\n", strerror(errno));
+        return;
+    }
+    malloc_info(0, fp);
+    fclose(fp);
+#else
+    control_printf(fd, "error: heap snapshots need glibc\n");
+#endif
+}
+
+static void
+control_stats(int fd)
+{
+    const struct modmap *map;
+    struct dirent *d;
+    int threads = 0, modules, token;
+    DIR *dp;
+
+    if ((dp = opendir("/proc/self/task")) != NULL) {
+        while ((d = readdir(dp)) != NULL)
+            threads += d->d_name[0] != '.';
+        closedir(dp);
+    }
+    token = modmap_enter();
+    map = modmap_current();
+    modules = map != NULL ? map->count : 0;
+    modmap_exit(token);
+    control_printf(fd,
+                   "pid %d\n"
+                   "threads %d\n"
+                   "modules %d\n"
+                   "commands %lu\n"
+                   "samples %llu\n"
+                   "dropped %lu\n",
+                   (int)getpid(), threads, modules,
+                   control_commands, control_samples,
+                   atomic_load(&control_dropped));
+}
+
+static void
+control_command(int fd, char *line)
+{
+    char *cmd, *arg1, *arg2, *save;
+
+    cmd = strtok_r(line, " \t\r\n", &save);
+    arg1 = strtok_r(NULL, " \t\r\n", &save);
+    arg2 = strtok_r(NULL, " \t\r\n", &save);
+    if (cmd == NULL)
+        return;
+    control_commands++;
+
+    if (strcmp(cmd, "cpu-profile") == 0)
+        control_cpu_profile(fd, arg1 ? atol(arg1) : 10,
+                            arg2 ? atol(arg2) : CONTROL_DEFAULT_HZ);
+    else if (strcmp(cmd, "threads") == 0)
+        control_threads(fd);
+    else if (strcmp(cmd, "heap") == 0)
+        control_heap(fd);
+    else if (strcmp(cmd, "stats") == 0)
+        control_stats(fd);
+    else if (strcmp(cmd, "help") == 0)
+        control_printf(fd, "cpu-profile [seconds [hz]]  folded CPU stacks\n"
+                           "threads                     stacks of all threads\n"
+                           "heap                        allocator state (XML)\n"
+                           "stats                       counters\n");
+    else
+        control_printf(fd, "error: unknown command '%s', try help\n", cmd);
+}
+
+static void
+control_serve(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    char line[CONTROL_LINE_MAX];
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    size_t used = 0;
+    ssize_t n;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+        (cred.uid != 0 && cred.uid != geteuid()))
+        return;
+
+    /* One command line per connection */
+    while (used < sizeof(line) - 1 && memchr(line, '\n', used) == NULL) {
+        if (poll(&pfd, 1, CONTROL_READ_MS) <= 0)
+            return;
+        n = read(fd, line + used, sizeof(line) - 1 - used);
+        if (n <= 0)
+            break;
+        used += (size_t)n;
+    }
+    line[used] = '\0';
+    control_command(fd, line);
+}
+
+static void *
+control_main(void *arg)
+{
+    struct pollfd pfds[2];
+    int fd;
+
+    (void)arg;
+    pfds[0].fd = control_listen_fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = control_stop_pipe[0];
+    pfds[1].events = POLLIN;
+    for (;;) {
+        if (poll(pfds, 2, -1) < 0 && errno != EINTR)
+            break;
+        if (pfds[1].revents != 0)
+            break;
+        if ((pfds[0].revents & POLLIN) == 0)
+            continue;
+        fd = accept4(control_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        control_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static void
+control_cleanup(void)
+{
+    if (control_listen_fd >= 0)
+        close(control_listen_fd);
+    if (control_stop_pipe[0] >= 0) {
+        close(control_stop_pipe[0]);
+        close(control_stop_pipe[1]);
+    }
+    if (control_path[0] != '\0' && control_path[0] != '@')
+        unlink(control_path);
+    free(control_buffers[0]);
+    free(control_buffers[1]);
+    control_buffers[0] = control_buffers[1] = NULL;
+    control_listen_fd = control_stop_pipe[0] = control_stop_pipe[1] = -1;
+    control_path[0] = '\0';
+}
+
+int
+backtrace_control_start(const char *path)
+{
+    struct sockaddr_un addr;
+    sigset_t all, old;
+    socklen_t len;
+    struct stat st;
+    size_t plen = strlen(path);
+    int rc = -1;
+
+    if (plen == 0 || plen >= sizeof(addr.sun_path)) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&control_lock);
+    if (control_running) {
+        pthread_mutex_unlock(&control_lock);
+        errno = EBUSY;
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, plen);
+    memcpy(control_path, path, plen + 1);
+    len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + plen);
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';     /* Linux abstract namespace */
+    } else if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);                /* left behind by an earlier run */
+    }
+
+    control_buffers[0] = calloc(1, sizeof(struct control_buffer));
+    control_buffers[1] = calloc(1, sizeof(struct control_buffer));
+    if (control_buffers[0] == NULL || control_buffers[1] == NULL ||
+        pipe2(control_stop_pipe, O_CLOEXEC) != 0)
+        goto out;
+    control_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (control_listen_fd < 0 ||
+        bind(control_listen_fd, (struct sockaddr *)&addr, len) != 0) {
+        control_path[0] = '\0';      /* not ours to unlink */
+        goto out;
+    }
+    if ((path[0] != '@' && chmod(path, 0600) != 0) ||
+        listen(control_listen_fd, 4) != 0)
+        goto out;
+
+    /* The thread takes no signals of its own, SIGPIPE included */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&control_thread, NULL, control_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        errno = rc;
+        rc = -1;
+        goto out;
+    }
+    control_running = 1;
+
+out:
+    if (rc != 0)
+        control_cleanup();
+    pthread_mutex_unlock(&control_lock);
+    return rc;
+}
+
+void
+backtrace_control_stop(void)
+{
+    char c = 0;
+
+    pthread_mutex_lock(&control_lock);
+    if (control_running) {
+        if (write(control_stop_pipe[1], &c, 1) != 1)
+            pthread_cancel(control_thread);
+        pthread_join(control_thread, NULL);
+        control_running = 0;
+        control_cleanup();
+    }
+    pthread_mutex_unlock(&control_lock);
+}
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+/*
+ * Offline ELF symbol index.
+ *
+ * The file is mapped read-only and its function symbols are collected
+ * into one array sorted by address, so a lookup is a binary search and
+ * names point straight into the mapped string table.  The full symbol
+ * table is preferred; stripped files fall back to the dynamic symbols.
+ */
+
+struct elf_sym {
+    uint64_t value;
+    uint64_t size;
+    uint32_t name;                   /* offset into strtab */
+};
+
+struct backtrace_elf {
+    void *map;
+    size_t len;
+    const char *strtab;
+    size_t strtab_len;
+    struct elf_sym *syms;
+    size_t count;
+    unsigned char build_id[BACKTRACE_BUILD_ID_MAX];
+    int build_id_len;
+};
+
+static int
+sym_cmp(const void *a, const void *b)
+{
+    const struct elf_sym *x = a, *y = b;
+
+    return (x->value > y->value) - (x->value < y->value);
+}
+
+static void
+elf_read_build_id(backtrace_elf_t *elf, const ElfW(Shdr) *sh)
+{
+    const char *p = (const char *)elf->map + sh->sh_offset;
+    const char *end = p + sh->sh_size;
+    size_t align = sh->sh_addralign == 8 ? 8 : 4;
+    const ElfW(Nhdr) *note;
+
+    while (p + sizeof(*note) <= end) {
+        note = (const ElfW(Nhdr) *)p;
+        p += sizeof(*note);
+        if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+            memcmp(p, "GNU", 4) == 0) {
+            p += (note->n_namesz + align - 1) & ~(align - 1);
+            if (note->n_descsz <= BACKTRACE_BUILD_ID_MAX &&
+                p + note->n_descsz <= end) {
+                memcpy(elf->build_id, p, note->n_descsz);
+                elf->build_id_len = (int)note->n_descsz;
+            }
+            return;
+        }
+        p += (note->n_namesz + align - 1) & ~(align - 1);
+        p += (note->n_descsz + align - 1) & ~(align - 1);
+    }
+}
+
+/* Collect the function symbols of section SYMSEC */
+static int
+elf_load_symbols(backtrace_elf_t *elf, const ElfW(Shdr) *shdrs, int shnum,
+                 const ElfW(Shdr) *symsec)
+{
+    const ElfW(Shdr) *strsec;
+    const ElfW(Sym) *sym;
+    size_t i, n;
+
+    if (symsec->sh_link >= (ElfW(Word))shnum ||
+        symsec->sh_offset + symsec->sh_size > elf->len)
+        return -1;
+    strsec = &shdrs[symsec->sh_link];
+    if (strsec->sh_offset + strsec->sh_size > elf->len)
+        return -1;
+    elf->strtab = (const char *)elf->map + strsec->sh_offset;
+    elf->strtab_len = strsec->sh_size;
+
+    n = symsec->sh_size / sizeof(ElfW(Sym));
+    elf->syms = malloc((n ? n : 1) * sizeof(*elf->syms));
+    if (elf->syms == NULL)
+        return -1;
+
+    sym = (const ElfW(Sym) *)((const char *)elf->map + symsec->sh_offset);
+    for (i = 0; i < n; i++) {
+        if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC ||
+            sym[i].st_shndx == SHN_UNDEF || sym[i].st_value == 0 ||
+            sym[i].st_name >= elf->strtab_len)
+            continue;
+        elf->syms[elf->count].value = sym[i].st_value;
+        elf->syms[elf->count].size = sym[i].st_size;
+        elf->syms[elf->count].name = sym[i].st_name;
+        elf->count++;
+    }
+    qsort(elf->syms, elf->count, sizeof(*elf->syms), sym_cmp);
+    return 0;
+}
+
+backtrace_elf_t *
+backtrace_elf_open(const char *path)
+{
+    const ElfW(Ehdr) *eh;
+    const ElfW(Shdr) *shdrs, *symtab = NULL, *dynsym = NULL;
+    backtrace_elf_t *elf;
+    struct stat st;
+    int fd, i;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*eh)) {
+        close(fd);
+        errno = ENOEXEC;
+        return NULL;
+    }
+
+    elf = calloc(1, sizeof(*elf));
+    if (elf == NULL) {
+        close(fd);
+        return NULL;
+    }
+    elf->len = (size_t)st.st_size;
+    elf->map = mmap(NULL, elf->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (elf->map == MAP_FAILED) {
+        free(elf);
+        return NULL;
+    }
+
+    /* Only files of our own class and byte order are indexed */
+    eh = elf->map;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32) ||
+        eh->e_shentsize != sizeof(ElfW(Shdr)) ||
+        eh->e_shoff + (size_t)eh->e_shnum * sizeof(ElfW(Shdr)) > elf->len) {
+        backtrace_elf_close(elf);
+        errno = ENOEXEC;
+        return NULL;
+    }
+
+    shdrs = (const ElfW(Shdr) *)((const char *)elf->map + eh->e_shoff);
+    for (i = 0; i < eh->e_shnum; i++) {
+        if (shdrs[i].sh_type == SHT_SYMTAB)
+            symtab = &shdrs[i];
+        else if (shdrs[i].sh_type == SHT_DYNSYM)
+            dynsym = &shdrs[i];
+        else if (shdrs[i].sh_type == SHT_NOTE && elf->build_id_len == 0 &&
+                 shdrs[i].sh_offset + shdrs[i].sh_size <= elf->len)
+            elf_read_build_id(elf, &shdrs[i]);
+    }
+
+    if (symtab == NULL)
+        symtab = dynsym;
+    if (symtab != NULL &&
+        elf_load_symbols(elf, shdrs, eh->e_shnum, symtab) != 0) {
+        backtrace_elf_close(elf);
+        errno = ENOEXEC;
+        return NULL;
+    }
+    return elf;
+}
+
+const char *
+backtrace_elf_lookup(const backtrace_elf_t *elf, uint64_t vaddr,
+                     uint64_t *offset)
+{
+    size_t lo = 0, hi = elf->count, mid;
+    const struct elf_sym *s;
+
+    /* Last symbol starting at or below VADDR */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (elf->syms[mid].value <= vaddr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    s = &elf->syms[lo - 1];
+    if (s->size != 0 && vaddr >= s->value + s->size)
+        return NULL;
+    if (offset != NULL)
+        *offset = vaddr - s->value;
+    return elf->strtab + s->name;
+}
+
+int
+backtrace_elf_build_id(const backtrace_elf_t *elf,
+                       const unsigned char **build_id)
+{
+    *build_id = elf->build_id;
+    return elf->build_id_len;
+}
+
+void
+backtrace_elf_close(backtrace_elf_t *elf)
+{
+    if (elf == NULL)
+        return;
+    if (elf->map != NULL && elf->map != MAP_FAILED)
+        munmap(elf->map, elf->len);
+    free(elf->syms);
+    free(elf);
+}
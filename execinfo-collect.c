@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+#define DEFAULT_RINGS 64
+#define DEFAULT_RING_SIZE (256 * 1024)
+#define DEFAULT_INTERVAL_MS 100
+#define DEFAULT_SEGMENT_SECONDS 60
+#define NAME_MAX_LEN 512
+
+/*
+ * execinfo-collect: drain the shared-memory rings of every process that
+ * attached with backtrace_shm_attach(), merge their samples by stack ID
+ * and write one profile when stopped.
+ *
+ * The default output is a stack-count dump: module lines, then stack
+ * lines sorted by ID with module-relative frames, innermost first.
+ * With -f the stacks are symbolized from the modules' ELF files and
+ * written as folded stacks for flame graph tools instead.  With -p every
+ * sample is also stored, timestamped, in a directory of columnar profile
+ * segments rotated every -w seconds.
+ *
+ * With -a the samples come from another process instead, which need not
+ * link the library: every -i milliseconds each of its threads is
+ * briefly stopped with ptrace and its stack read.
+ */
+
+struct stack {
+    uint64_t id;
+    uint64_t count;
+    int depth;
+    struct backtrace_shm_frame *frames;
+};
+
+struct profile {
+    struct stack *slots;             /* open-addressed by id, id 0 = empty */
+    size_t used;
+    size_t mask;
+    uint64_t samples;
+    backtrace_profile_writer_t *store; /* -p segments, or NULL */
+};
+
+struct module_ref {
+    const struct backtrace_module *mod;
+    backtrace_elf_t *elf;
+    int elf_tried;
+};
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: execinfo-collect [-r rings] [-s ring_bytes] [-i interval_ms]\n"
+            "                        [-t seconds] [-o file] [-f] [-p dir [-w seconds]]\n"
+            "                        (name | -a pid)\n");
+    exit(2);
+}
+
+static int
+profile_grow(struct profile *p)
+{
+    struct stack *slots, *s;
+    size_t mask = p->mask ? p->mask * 2 + 1 : 1023, i, j;
+
+    slots = calloc(mask + 1, sizeof(*slots));
+    if (slots == NULL)
+        return -1;
+    for (i = 0; p->slots != NULL && i <= p->mask; i++) {
+        s = &p->slots[i];
+        if (s->id == 0)
+            continue;
+        for (j = s->id & mask; slots[j].id != 0; j = (j + 1) & mask)
+            ;
+        slots[j] = *s;
+    }
+    free(p->slots);
+    p->slots = slots;
+    p->mask = mask;
+    return 0;
+}
+
+static int
+merge_sample(const struct backtrace_shm_sample *sample, void *ctx)
+{
+    struct profile *p = ctx;
+    struct stack *s;
+    size_t i;
+
+    if ((p->used + 1) * 2 > p->mask + 1 && profile_grow(p) != 0)
+        return 1;
+    if (p->store != NULL &&
+        backtrace_profile_record_frames(p->store, 0, sample->frames, sample->depth,
+                                        sample->count) != 0) {
+        fprintf(stderr, "execinfo-collect: profile segment: %s\n", strerror(errno));
+        return 1;
+    }
+    p->samples += sample->count;
+    for (i = sample->id & p->mask; p->slots[i].id != 0; i = (i + 1) & p->mask) {
+        if (p->slots[i].id == sample->id) {
+            p->slots[i].count += sample->count;
+            return 0;
+        }
+    }
+    s = &p->slots[i];
+    s->frames = malloc((size_t)sample->depth * sizeof(*s->frames) + 1);
+    if (s->frames == NULL)
+        return 1;
+    memcpy(s->frames, sample->frames, (size_t)sample->depth * sizeof(*s->frames));
+    s->id = sample->id;
+    s->count = sample->count;
+    s->depth = sample->depth;
+    p->used++;
+    return 0;
+}
+
+/* Take one sample of every thread of the attached process */
+static int
+sample_remote(backtrace_remote_t *remote, pid_t pid, struct profile *p)
+{
+    struct backtrace_shm_frame frames[EXECINFO_MAX_FRAMES];
+    struct backtrace_shm_sample sample;
+    pid_t *tids;
+    int n, m, i;
+
+    n = backtrace_remote_threads(remote, NULL, 0);
+    if (n <= 0 || (tids = malloc((size_t)n * sizeof(*tids))) == NULL)
+        return -1;
+    /* Threads started since the first call are counted but not stored */
+    m = backtrace_remote_threads(remote, tids, n);
+    if (m < n)
+        n = m;
+    sample.pid = (int)pid;
+    sample.count = 1;
+    sample.frames = frames;
+    for (i = 0; i < n; i++) {
+        sample.depth = backtrace_remote_sample(remote, tids[i], frames,
+                                               EXECINFO_MAX_FRAMES, &sample.id);
+        if (sample.depth > 0 && merge_sample(&sample, p) != 0)
+            break;
+    }
+    free(tids);
+    return 0;
+}
+
+static int
+stack_cmp(const void *a, const void *b)
+{
+    const struct stack *x = a, *y = b;
+
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/* Number of MOD in REFS, adding it on first use */
+static int
+module_ref(struct module_ref **refs, int *nrefs, const struct backtrace_module *mod)
+{
+    struct module_ref *r;
+    int i;
+
+    for (i = 0; i < *nrefs; i++) {
+        if ((*refs)[i].mod == mod)
+            return i;
+    }
+    if (*nrefs == 0 || (*nrefs >= 16 && (*nrefs & (*nrefs - 1)) == 0)) {
+        r = realloc(*refs, (size_t)(*nrefs ? *nrefs * 2 : 16) * sizeof(*r));
+        if (r == NULL)
+            return -1;
+        *refs = r;
+    }
+    r = &(*refs)[*nrefs];
+    r->mod = mod;
+    r->elf = NULL;
+    r->elf_tried = 0;
+    return (*nrefs)++;
+}
+
+static void
+write_dump(FILE *out, struct stack *stacks, size_t n, struct module_ref *refs,
+           int nrefs, int *ids)
+{
+    const struct backtrace_module *mod;
+    size_t i;
+    int j, k;
+
+    fprintf(out, "# execinfo stack-count 1\n");
+    for (j = 0; j < nrefs; j++) {
+        mod = refs[j].mod;
+        fprintf(out, "module %d %016llx ", j, (unsigned long long)mod->key);
+        for (k = 0; k < mod->build_id_len; k++)
+            fprintf(out, "%02x", mod->build_id[k]);
+        fprintf(out, "%s %s\n", mod->build_id_len ? "" : "-", mod->path);
+    }
+    for (i = 0; i < n; i++) {
+        fprintf(out, "stack %016llx %llu", (unsigned long long)stacks[i].id,
+                (unsigned long long)stacks[i].count);
+        for (j = 0; j < stacks[i].depth; j++, ids++) {
+            if (*ids < 0)
+                fprintf(out, " ?+0x%llx",
+                        (unsigned long long)stacks[i].frames[j].offset);
+            else
+                fprintf(out, " %d+0x%llx", *ids,
+                        (unsigned long long)stacks[i].frames[j].offset);
+        }
+        fputc('\n', out);
+    }
+}
+
+/* Folded-format name of a frame, from the module's ELF symbols if found */
+static void
+frame_name(struct module_ref *ref, uint64_t offset, char *buf, size_t len)
+{
+    const unsigned char *id;
+    const char *sym = NULL, *base;
+    char *p;
+
+    if (ref == NULL) {
+        snprintf(buf, len, "0x%llx", (unsigned long long)offset);
+        return;
+    }
+    if (!ref->elf_tried) {
+        ref->elf_tried = 1;
+        ref->elf = backtrace_elf_open(ref->mod->path);
+        /* A rebuilt file on disk would give wrong names */
+        if (ref->elf != NULL && ref->mod->build_id_len > 0 &&
+            (backtrace_elf_build_id(ref->elf, &id) != ref->mod->build_id_len ||
+             memcmp(id, ref->mod->build_id, (size_t)ref->mod->build_id_len) != 0)) {
+            backtrace_elf_close(ref->elf);
+            ref->elf = NULL;
+        }
+    }
+    if (ref->elf != NULL)
+        sym = backtrace_elf_lookup(ref->elf, offset, NULL);
+    if (sym != NULL) {
+        snprintf(buf, len, "%s", sym);
+    } else {
+        base = strrchr(ref->mod->path, '/');
+        snprintf(buf, len, "%s+0x%llx", base ? base + 1 : ref->mod->path,
+                 (unsigned long long)offset);
+    }
+    for (p = buf; *p != '\0'; p++) {
+        if (*p == ';' || *p == ' ')
+            *p = '_';
+    }
+}
+
+static void
+write_folded(FILE *out, struct stack *stacks, size_t n, struct module_ref *refs,
+             int *ids)
+{
+    char name[NAME_MAX_LEN];
+    size_t i;
+    int j;
+
+    for (i = 0; i < n; ids += stacks[i].depth, i++) {
+        for (j = stacks[i].depth - 1; j >= 0; j--) {
+            frame_name(ids[j] < 0 ? NULL : &refs[ids[j]],
+                       stacks[i].frames[j].offset, name, sizeof(name));
+            fprintf(out, "%s%s", name, j ? ";" : "");
+        }
+        fprintf(out, " %llu\n", (unsigned long long)stacks[i].count);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct timespec interval, now, deadline = { 0, 0 };
+    struct module_ref *refs = NULL;
+    struct profile prof = { NULL, 0, 0, 0, NULL };
+    struct stack *stacks;
+    const char *output = NULL, *store = NULL;
+    backtrace_shm_t *shm = NULL;
+    backtrace_remote_t *remote = NULL;
+    struct sigaction sa;
+    size_t ring_size = DEFAULT_RING_SIZE, i, n, frames = 0;
+    long interval_ms = DEFAULT_INTERVAL_MS, seconds = 0;
+    long segment_seconds = DEFAULT_SEGMENT_SECONDS;
+    int rings = DEFAULT_RINGS, folded = 0, nrefs = 0, opt, j, *ids, *id;
+    pid_t pid = 0;
+    FILE *out = stdout;
+
+    while ((opt = getopt(argc, argv, "r:s:i:t:o:fp:w:a:")) != -1) {
+        switch (opt) {
+        case 'r': rings = atoi(optarg); break;
+        case 's': ring_size = strtoul(optarg, NULL, 0); break;
+        case 'i': interval_ms = atol(optarg); break;
+        case 't': seconds = atol(optarg); break;
+        case 'o': output = optarg; break;
+        case 'f': folded = 1; break;
+        case 'p': store = optarg; break;
+        case 'w': segment_seconds = atol(optarg); break;
+        case 'a': pid = (pid_t)atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind + (pid > 0 ? 0 : 1) != argc || interval_ms <= 0 || segment_seconds <= 0)
+        usage();
+
+    if (store != NULL &&
+        (prof.store = backtrace_profile_writer_new(store,
+                (uint64_t)segment_seconds * 1000000000ULL)) == NULL) {
+        fprintf(stderr, "execinfo-collect: %s: %s\n", store, strerror(errno));
+        return 1;
+    }
+
+    if (pid > 0) {
+        remote = backtrace_remote_attach(pid);
+        if (remote == NULL) {
+            fprintf(stderr, "execinfo-collect: %d: %s\n", (int)pid, strerror(errno));
+            return 1;
+        }
+    } else {
+        shm = backtrace_shm_create(argv[optind], rings, ring_size);
+        if (shm == NULL) {
+            fprintf(stderr, "execinfo-collect: %s: %s\n", argv[optind], strerror(errno));
+            return 1;
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    interval.tv_sec = interval_ms / 1000;
+    interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    if (seconds > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += seconds;
+    }
+
+    while (!stop) {
+        if (remote != NULL) {
+            if (sample_remote(remote, pid, &prof) != 0)
+                break;                  /* the process is gone */
+        } else {
+            backtrace_shm_drain(shm, merge_sample, &prof);
+        }
+        if (seconds > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > deadline.tv_sec ||
+                (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+                break;
+        }
+        nanosleep(&interval, NULL);
+    }
+    if (shm != NULL)
+        backtrace_shm_drain(shm, merge_sample, &prof);
+    if (backtrace_profile_writer_free(prof.store) != 0)
+        fprintf(stderr, "execinfo-collect: %s: %s\n", store, strerror(errno));
+
+    /* Pack and sort the stacks; number modules by first use */
+    stacks = malloc((prof.used ? prof.used : 1) * sizeof(*stacks));
+    if (stacks == NULL)
+        return 1;
+    for (i = 0, n = 0; prof.slots != NULL && i <= prof.mask; i++) {
+        if (prof.slots[i].id != 0) {
+            frames += (size_t)prof.slots[i].depth;
+            stacks[n++] = prof.slots[i];
+        }
+    }
+    qsort(stacks, n, sizeof(*stacks), stack_cmp);
+    ids = malloc((frames ? frames : 1) * sizeof(*ids));
+    if (ids == NULL)
+        return 1;
+    for (i = 0, id = ids; i < n; i++) {
+        for (j = 0; j < stacks[i].depth; j++, id++) {
+            *id = stacks[i].frames[j].module == NULL ? -1 :
+                  module_ref(&refs, &nrefs, stacks[i].frames[j].module);
+        }
+    }
+
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "execinfo-collect: %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+    if (folded)
+        write_folded(out, stacks, n, refs, ids);
+    else
+        write_dump(out, stacks, n, refs, nrefs, ids);
+    if (out != stdout)
+        fclose(out);
+
+    fprintf(stderr, "execinfo-collect: %llu samples, %zu stacks, %lu dropped\n",
+            (unsigned long long)prof.samples, n,
+            shm != NULL ? backtrace_shm_dropped(shm) : 0UL);
+
+    for (i = 0; i < n; i++)
+        free(stacks[i].frames);
+    for (j = 0; j < nrefs; j++)
+        backtrace_elf_close(refs[j].elf);
+    free(refs);
+    free(ids);
+    free(stacks);
+    free(prof.slots);
+    /* Modules of the samples belong to these handles */
+    backtrace_shm_destroy(shm);
+    backtrace_remote_detach(remote);
+    return 0;
+}
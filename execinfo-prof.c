@@ -0,0 +1,629 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+#define DEFAULT_TOP 20
+#define NAME_MAX_LEN 512
+
+/*
+ * execinfo-prof: merge and compare stack-count dumps written by
+ * execinfo-collect.
+ *
+ * Dumps list their stacks sorted by ID, so both commands walk their
+ * inputs in lockstep and hold one stack per input at a time.  Module
+ * numbers differ between dumps; every input's modules are folded into
+ * one module table up front and frames are renumbered on the way
+ * through.  Symbols are only looked up for what is printed: the
+ * reported stacks and the functions of the per-function summary.
+ */
+
+struct frame {
+    int module;                      /* global module number, -1 = none */
+    uint64_t offset;
+};
+
+struct dump {
+    const char *name;
+    FILE *fp;
+    char *line;
+    size_t cap;
+    int *modules;                    /* file module number -> global */
+    int nmodules;
+    int lineno;
+    int pending;                     /* line holds an unconsumed record */
+    /* Current stack */
+    int valid;
+    uint64_t id;
+    uint64_t count;
+    struct frame *frames;
+    int depth;
+    int frames_cap;
+};
+
+struct module_syms {
+    backtrace_elf_t *elf;
+    int tried;
+};
+
+static backtrace_modtab_t *modules;
+static struct module_syms *syms;
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: execinfo-prof merge [-o file] dump...\n"
+            "       execinfo-prof diff [-n top] before after\n");
+    exit(2);
+}
+
+static void
+die(const struct dump *d, const char *msg)
+{
+    fprintf(stderr, "execinfo-prof: %s:%d: %s\n", d->name, d->lineno, msg);
+    exit(1);
+}
+
+static int
+parse_hex(const char *s, unsigned char *out, int max)
+{
+    int n = 0;
+    unsigned v;
+
+    if (strcmp(s, "-") == 0)
+        return 0;
+    while (s[0] != '\0' && s[1] != '\0' && n < max) {
+        if (sscanf(s, "%2x", &v) != 1)
+            return -1;
+        out[n++] = (unsigned char)v;
+        s += 2;
+    }
+    return s[0] == '\0' ? n : -1;
+}
+
+static int
+read_line(struct dump *d)
+{
+    ssize_t len;
+
+    len = getline(&d->line, &d->cap, d->fp);
+    if (len < 0)
+        return 0;
+    d->lineno++;
+    if (len > 0 && d->line[len - 1] == '\n')
+        d->line[len - 1] = '\0';
+    return 1;
+}
+
+/* Parse "<n>+0x<off>" or "?+0x<addr>" frames of a stack line */
+static void
+parse_frames(struct dump *d, char *p)
+{
+    struct frame *f;
+    char *tok, *save, *end;
+    long n;
+
+    d->depth = 0;
+    for (tok = strtok_r(p, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save)) {
+        if (d->depth == d->frames_cap) {
+            d->frames_cap = d->frames_cap ? d->frames_cap * 2 : 64;
+            f = realloc(d->frames, (size_t)d->frames_cap * sizeof(*f));
+            if (f == NULL)
+                die(d, strerror(errno));
+            d->frames = f;
+        }
+        f = &d->frames[d->depth++];
+        if (tok[0] == '?') {
+            f->module = -1;
+            end = tok + 1;
+        } else {
+            n = strtol(tok, &end, 10);
+            if (end == tok || n < 0 || n >= d->nmodules)
+                die(d, "bad module number");
+            f->module = d->modules[n];
+        }
+        if (strncmp(end, "+0x", 3) != 0)
+            die(d, "bad frame");
+        f->offset = strtoull(end + 3, &end, 16);
+        if (*end != '\0')
+            die(d, "bad frame");
+    }
+}
+
+/* Advance D to its next stack; d->valid is 0 at the end */
+static void
+next_stack(struct dump *d)
+{
+    unsigned long long id, count;
+    uint64_t prev = d->id;
+    int pos;
+
+    d->valid = 0;
+    while (d->pending || read_line(d)) {
+        d->pending = 0;
+        if (d->line[0] == '#' || d->line[0] == '\0')
+            continue;
+        if (sscanf(d->line, "stack %llx %llu %n", &id, &count, &pos) != 2)
+            die(d, "expected a stack line");
+        if (prev != 0 && id <= prev)
+            die(d, "stacks not sorted by ID");
+        d->id = id;
+        d->count = count;
+        parse_frames(d, d->line + pos);
+        d->valid = 1;
+        return;
+    }
+}
+
+/* Open a dump, add its modules to the global table, load its first stack */
+static void
+open_dump(struct dump *d, const char *name)
+{
+    struct backtrace_module mod;
+    char buildid[2 * BACKTRACE_BUILD_ID_MAX + 2];
+    unsigned long long key;
+    int n, pos, *map;
+
+    memset(d, 0, sizeof(*d));
+    d->name = name;
+    d->fp = strcmp(name, "-") == 0 ? stdin : fopen(name, "r");
+    if (d->fp == NULL) {
+        fprintf(stderr, "execinfo-prof: %s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+    if (!read_line(d) || strcmp(d->line, "# execinfo stack-count 1") != 0)
+        die(d, "not a stack-count dump");
+
+    /* Module lines come first; the first stack line ends them */
+    while (read_line(d)) {
+        if (strncmp(d->line, "module ", 7) != 0) {
+            d->pending = 1;
+            break;
+        }
+        memset(&mod, 0, sizeof(mod));
+        if (sscanf(d->line, "module %d %llx %65s %n", &n, &key, buildid, &pos) != 3 ||
+            n != d->nmodules)
+            die(d, "bad module line");
+        mod.key = key;
+        mod.path = d->line + pos;
+        mod.build_id_len = parse_hex(buildid, mod.build_id, BACKTRACE_BUILD_ID_MAX);
+        if (mod.build_id_len < 0)
+            die(d, "bad build-id");
+        map = realloc(d->modules, (size_t)(n + 1) * sizeof(*map));
+        if (map == NULL || (map[n] = backtrace_modtab_add(modules, &mod)) < 0)
+            die(d, strerror(errno));
+        d->modules = map;
+        d->nmodules++;
+    }
+
+    next_stack(d);
+}
+
+static void
+close_dump(struct dump *d)
+{
+    if (d->fp != stdin)
+        fclose(d->fp);
+    free(d->line);
+    free(d->modules);
+    free(d->frames);
+}
+
+static void
+write_header(FILE *out)
+{
+    const struct backtrace_module *mod;
+    int i, k;
+
+    fprintf(out, "# execinfo stack-count 1\n");
+    for (i = 0; i < backtrace_modtab_count(modules); i++) {
+        mod = backtrace_modtab_get(modules, i);
+        fprintf(out, "module %d %016llx ", i, (unsigned long long)mod->key);
+        for (k = 0; k < mod->build_id_len; k++)
+            fprintf(out, "%02x", mod->build_id[k]);
+        fprintf(out, "%s %s\n", mod->build_id_len ? "" : "-", mod->path);
+    }
+}
+
+static void
+write_stack(FILE *out, uint64_t id, uint64_t count, const struct frame *frames,
+            int depth)
+{
+    int i;
+
+    fprintf(out, "stack %016llx %llu", (unsigned long long)id,
+            (unsigned long long)count);
+    for (i = 0; i < depth; i++) {
+        if (frames[i].module < 0)
+            fprintf(out, " ?+0x%llx", (unsigned long long)frames[i].offset);
+        else
+            fprintf(out, " %d+0x%llx", frames[i].module,
+                    (unsigned long long)frames[i].offset);
+    }
+    fputc('\n', out);
+}
+
+static int
+cmd_merge(int argc, char **argv)
+{
+    struct dump *dumps, *first;
+    const char *output = NULL;
+    uint64_t id, count;
+    FILE *out = stdout;
+    int i, n, opt;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o': output = optarg; break;
+        default: usage();
+        }
+    }
+    n = argc - optind;
+    if (n < 1)
+        usage();
+
+    dumps = calloc((size_t)n, sizeof(*dumps));
+    if (dumps == NULL)
+        return 1;
+    for (i = 0; i < n; i++)
+        open_dump(&dumps[i], argv[optind + i]);
+
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "execinfo-prof: %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+    write_header(out);
+
+    /* k-way merge on the smallest current ID */
+    for (;;) {
+        first = NULL;
+        for (i = 0; i < n; i++) {
+            if (dumps[i].valid && (first == NULL || dumps[i].id < first->id))
+                first = &dumps[i];
+        }
+        if (first == NULL)
+            break;
+        id = first->id;
+        count = 0;
+        for (i = 0; i < n; i++) {
+            if (dumps[i].valid && dumps[i].id == id && &dumps[i] != first)
+                count += dumps[i].count;
+        }
+        write_stack(out, id, count + first->count, first->frames, first->depth);
+        for (i = 0; i < n; i++) {
+            if (dumps[i].valid && dumps[i].id == id)
+                next_stack(&dumps[i]);
+        }
+    }
+
+    if (out != stdout)
+        fclose(out);
+    for (i = 0; i < n; i++)
+        close_dump(&dumps[i]);
+    free(dumps);
+    return 0;
+}
+
+/* Symbol containing FRAME, with *START set to the symbol's offset */
+static const char *
+frame_symbol(const struct frame *f, uint64_t *start)
+{
+    const struct backtrace_module *mod;
+    struct module_syms *s;
+    const unsigned char *id;
+    const char *name = NULL;
+    uint64_t off = 0;
+
+    *start = f->offset;
+    if (f->module < 0)
+        return NULL;
+    s = &syms[f->module];
+    if (!s->tried) {
+        s->tried = 1;
+        mod = backtrace_modtab_get(modules, f->module);
+        s->elf = backtrace_elf_open(mod->path);
+        /* A rebuilt file on disk would give wrong names */
+        if (s->elf != NULL && mod->build_id_len > 0 &&
+            (backtrace_elf_build_id(s->elf, &id) != mod->build_id_len ||
+             memcmp(id, mod->build_id, (size_t)mod->build_id_len) != 0)) {
+            backtrace_elf_close(s->elf);
+            s->elf = NULL;
+        }
+    }
+    if (s->elf != NULL && (name = backtrace_elf_lookup(s->elf, f->offset, &off)) != NULL)
+        *start = f->offset - off;
+    return name;
+}
+
+static void
+frame_label(const struct frame *f, char *buf, size_t len)
+{
+    const struct backtrace_module *mod;
+    const char *sym, *base;
+    uint64_t start;
+
+    sym = frame_symbol(f, &start);
+    if (sym != NULL) {
+        snprintf(buf, len, "%s", sym);
+    } else if (f->module >= 0) {
+        mod = backtrace_modtab_get(modules, f->module);
+        base = strrchr(mod->path, '/');
+        snprintf(buf, len, "%s+0x%llx", base ? base + 1 : mod->path,
+                 (unsigned long long)f->offset);
+    } else {
+        snprintf(buf, len, "0x%llx", (unsigned long long)f->offset);
+    }
+}
+
+/* Per-stack delta kept for the report */
+struct delta {
+    uint64_t id;
+    int64_t delta;
+    uint64_t before;
+    uint64_t after;
+    struct frame *frames;
+    int depth;
+};
+
+/* Per-function totals, keyed by module and symbol start */
+struct function {
+    int module;                      /* -2 = empty slot */
+    uint64_t start;
+    int64_t self;
+    int64_t total;
+};
+
+struct functions {
+    struct function *slots;
+    size_t mask;
+    size_t used;
+};
+
+static struct function *
+function_get(struct functions *t, int module, uint64_t start)
+{
+    struct function *slots, *f;
+    size_t i, j, h;
+
+    if ((t->used + 1) * 2 > t->mask + 1) {
+        size_t mask = t->mask ? t->mask * 2 + 1 : 255;
+        slots = malloc((mask + 1) * sizeof(*slots));
+        if (slots == NULL)
+            return NULL;
+        for (i = 0; i <= mask; i++)
+            slots[i].module = -2;
+        for (i = 0; t->slots != NULL && i <= t->mask; i++) {
+            if (t->slots[i].module == -2)
+                continue;
+            h = (size_t)((t->slots[i].start ^ ((uint64_t)t->slots[i].module << 40)) *
+                         0x9e3779b97f4a7c15ULL >> 20);
+            for (j = h & mask; slots[j].module != -2; j = (j + 1) & mask)
+                ;
+            slots[j] = t->slots[i];
+        }
+        free(t->slots);
+        t->slots = slots;
+        t->mask = mask;
+    }
+    h = (size_t)((start ^ ((uint64_t)module << 40)) * 0x9e3779b97f4a7c15ULL >> 20);
+    for (i = h & t->mask; t->slots[i].module != -2; i = (i + 1) & t->mask) {
+        f = &t->slots[i];
+        if (f->module == module && f->start == start)
+            return f;
+    }
+    f = &t->slots[i];
+    f->module = module;
+    f->start = start;
+    f->self = 0;
+    f->total = 0;
+    t->used++;
+    return f;
+}
+
+static void
+account_functions(struct functions *t, const struct frame *frames, int depth,
+                  int64_t delta)
+{
+    struct function *seen[EXECINFO_MAX_FRAMES], *f;
+    uint64_t start;
+    int i, j, nseen = 0;
+
+    for (i = 0; i < depth; i++) {
+        frame_symbol(&frames[i], &start);
+        f = function_get(t, frames[i].module, start);
+        if (f == NULL)
+            return;
+        if (i == 0)
+            f->self += delta;
+        /* Recursion counts a function once per stack */
+        for (j = 0; j < nseen && seen[j] != f; j++)
+            ;
+        if (j == nseen) {
+            f->total += delta;
+            if (nseen < EXECINFO_MAX_FRAMES)
+                seen[nseen++] = f;
+        }
+    }
+}
+
+static int64_t
+abs64(int64_t v)
+{
+    return v < 0 ? -v : v;
+}
+
+static int
+delta_cmp(const void *a, const void *b)
+{
+    const struct delta *x = a, *y = b;
+    int64_t ax = abs64(x->delta), ay = abs64(y->delta);
+
+    if (ax != ay)
+        return ax < ay ? 1 : -1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int
+function_cmp(const void *a, const void *b)
+{
+    const struct function *x = a, *y = b;
+    int64_t ax = abs64(x->total), ay = abs64(y->total);
+
+    if (ax != ay)
+        return ax < ay ? 1 : -1;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Keep D among the TOP largest deltas in TOPS, sorted */
+static void
+keep_top(struct delta *tops, int *ntops, int top, const struct delta *d)
+{
+    struct delta *slot;
+
+    if (*ntops == top) {
+        slot = &tops[top - 1];
+        if (delta_cmp(d, slot) >= 0)
+            return;
+        free(slot->frames);
+    } else {
+        slot = &tops[(*ntops)++];
+    }
+    *slot = *d;
+    slot->frames = malloc((size_t)d->depth * sizeof(*d->frames) + 1);
+    if (slot->frames == NULL) {
+        slot->depth = 0;
+    } else {
+        memcpy(slot->frames, d->frames, (size_t)d->depth * sizeof(*d->frames));
+    }
+    qsort(tops, (size_t)*ntops, sizeof(*tops), delta_cmp);
+}
+
+static int
+cmd_diff(int argc, char **argv)
+{
+    struct dump before, after, *src;
+    struct functions funcs = { NULL, 0, 0 };
+    struct delta *tops, d;
+    struct function *fl;
+    char name[NAME_MAX_LEN];
+    uint64_t total_before = 0, total_after = 0;
+    size_t i, nf = 0;
+    int top = DEFAULT_TOP, ntops = 0, opt, j, in_before, in_after;
+    struct frame fr;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': top = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 2 || top <= 0)
+        usage();
+
+    open_dump(&before, argv[optind]);
+    open_dump(&after, argv[optind + 1]);
+    syms = calloc((size_t)backtrace_modtab_count(modules) + 1, sizeof(*syms));
+    tops = calloc((size_t)top, sizeof(*tops));
+    if (syms == NULL || tops == NULL)
+        return 1;
+
+    /* Merge-join on stack ID */
+    while (before.valid || after.valid) {
+        memset(&d, 0, sizeof(d));
+        in_before = before.valid && (!after.valid || before.id <= after.id);
+        in_after = after.valid && (!before.valid || after.id <= before.id);
+        src = in_after ? &after : &before;
+        if (in_before)
+            d.before = before.count;
+        if (in_after)
+            d.after = after.count;
+        d.id = src->id;
+        d.delta = (int64_t)d.after - (int64_t)d.before;
+        d.frames = src->frames;
+        d.depth = src->depth;
+        total_before += d.before;
+        total_after += d.after;
+        if (d.delta != 0) {
+            keep_top(tops, &ntops, top, &d);
+            account_functions(&funcs, d.frames, d.depth, d.delta);
+        }
+        if (in_before)
+            next_stack(&before);
+        if (in_after)
+            next_stack(&after);
+    }
+
+    printf("# samples: before %llu, after %llu, delta %+lld\n",
+           (unsigned long long)total_before, (unsigned long long)total_after,
+           (long long)total_after - (long long)total_before);
+    printf("# stacks by |delta|, outermost frame first\n");
+    for (j = 0; j < ntops; j++) {
+        printf("%+10lld %10llu %10llu ", (long long)tops[j].delta,
+               (unsigned long long)tops[j].before, (unsigned long long)tops[j].after);
+        for (i = (size_t)tops[j].depth; i-- > 0;) {
+            frame_label(&tops[j].frames[i], name, sizeof(name));
+            printf("%s%s", name, i ? ";" : "\n");
+        }
+        if (tops[j].depth == 0)
+            putchar('\n');
+    }
+
+    /* Compact the function table and report the largest movers */
+    for (i = 0; funcs.slots != NULL && i <= funcs.mask; i++) {
+        if (funcs.slots[i].module != -2 && funcs.slots[i].total != 0)
+            funcs.slots[nf++] = funcs.slots[i];
+    }
+    fl = funcs.slots;
+    if (fl != NULL)
+        qsort(fl, nf, sizeof(*fl), function_cmp);
+    printf("# functions by |total delta|: self total name\n");
+    for (i = 0; i < nf && i < (size_t)top; i++) {
+        fr.module = fl[i].module;
+        fr.offset = fl[i].start;
+        frame_label(&fr, name, sizeof(name));
+        printf("%+10lld %+10lld %s\n", (long long)fl[i].self,
+               (long long)fl[i].total, name);
+    }
+
+    for (j = 0; j < ntops; j++)
+        free(tops[j].frames);
+    for (j = 0; j < backtrace_modtab_count(modules); j++)
+        backtrace_elf_close(syms[j].elf);
+    free(tops);
+    free(syms);
+    free(funcs.slots);
+    close_dump(&before);
+    close_dump(&after);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int rc;
+
+    if (argc < 2)
+        usage();
+    modules = backtrace_modtab_new();
+    if (modules == NULL)
+        return 1;
+
+    /* Subcommand options start after the subcommand */
+    if (strcmp(argv[1], "merge") == 0)
+        rc = cmd_merge(argc - 1, argv + 1);
+    else if (strcmp(argv[1], "diff") == 0)
+        rc = cmd_diff(argc - 1, argv + 1);
+    else
+        usage();
+
+    backtrace_modtab_free(modules);
+    return rc;
+}
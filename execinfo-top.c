@@ -0,0 +1,485 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+#define DEFAULT_RINGS 64
+#define DEFAULT_RING_SIZE (256 * 1024)
+#define DEFAULT_LINES 20
+#define DEFAULT_HZ 99
+#define DRAIN_MS 100
+#define NAME_MAX_LEN 512
+
+/*
+ * execinfo-top: live view of the functions that take the most samples.
+ *
+ * Samples come either from processes attached to a shared-memory
+ * segment, which execinfo-top creates and drains like execinfo-collect,
+ * or from a process's control socket, asked for a one-second CPU
+ * profile per refresh.  Every refresh shows each function's self and
+ * total share of the last interval's samples and its running totals.
+ *
+ * Symbolization is incremental: in shared-memory mode every distinct
+ * (module, offset) is looked up in the module's ELF index once and then
+ * served from a cache; the socket's folded stacks arrive named already.
+ */
+
+struct function {
+    char *name;
+    uint64_t self;                   /* this interval */
+    uint64_t total;
+    uint64_t self_all;
+    uint64_t total_all;
+    uint64_t stamp;                  /* last stack counted in total */
+};
+
+struct address {
+    const struct backtrace_module *module; /* NULL + used = no module */
+    uint64_t offset;
+    size_t function;                 /* index into the function array */
+    int used;
+};
+
+struct module_syms {
+    const struct backtrace_module *module;
+    backtrace_elf_t *elf;
+};
+
+struct top {
+    struct function *funcs;          /* in order of first sight */
+    size_t nfuncs;
+    size_t funcs_cap;
+    size_t *funcs_index;             /* open-addressed, function + 1 */
+    size_t funcs_mask;
+    struct address *addrs;
+    size_t addrs_mask;
+    size_t addrs_used;
+    struct module_syms *mods;
+    int nmods;
+    uint64_t stamp;
+    uint64_t samples;                /* this interval */
+    uint64_t samples_all;
+    uint64_t lookups;                /* symbol lookups done */
+};
+
+static volatile sig_atomic_t stop;
+static int sort_total;
+
+static void
+on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: execinfo-top [-d seconds] [-n iterations] [-l lines] [-t]\n"
+            "                    (-s shm_name [-r rings] | -c socket [-z hz])\n");
+    exit(2);
+}
+
+static uint64_t
+hash_str(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*s != '\0') {
+        h ^= (unsigned char)*s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t
+hash_addr(const struct backtrace_module *module, uint64_t offset)
+{
+    return ((uint64_t)(uintptr_t)module ^ offset) * 0x9e3779b97f4a7c15ULL;
+}
+
+static int
+funcs_grow(struct top *t)
+{
+    size_t mask = t->funcs_mask ? t->funcs_mask * 2 + 1 : 1023, i, j;
+    size_t *index;
+
+    index = calloc(mask + 1, sizeof(*index));
+    if (index == NULL)
+        return -1;
+    for (i = 0; i < t->nfuncs; i++) {
+        for (j = hash_str(t->funcs[i].name) & mask; index[j] != 0; j = (j + 1) & mask)
+            ;
+        index[j] = i + 1;
+    }
+    free(t->funcs_index);
+    t->funcs_index = index;
+    t->funcs_mask = mask;
+    return 0;
+}
+
+/* Index of function NAME, added on first sight; SIZE_MAX on error */
+static size_t
+function_index(struct top *t, const char *name)
+{
+    struct function *f;
+    size_t i;
+
+    if ((t->nfuncs + 1) * 2 > t->funcs_mask + 1 && funcs_grow(t) != 0)
+        return SIZE_MAX;
+    for (i = hash_str(name) & t->funcs_mask; t->funcs_index[i] != 0;
+         i = (i + 1) & t->funcs_mask) {
+        if (strcmp(t->funcs[t->funcs_index[i] - 1].name, name) == 0)
+            return t->funcs_index[i] - 1;
+    }
+    if (t->nfuncs == t->funcs_cap) {
+        f = realloc(t->funcs, (t->funcs_cap ? t->funcs_cap * 2 : 256) * sizeof(*f));
+        if (f == NULL)
+            return SIZE_MAX;
+        t->funcs = f;
+        t->funcs_cap = t->funcs_cap ? t->funcs_cap * 2 : 256;
+    }
+    f = &t->funcs[t->nfuncs];
+    memset(f, 0, sizeof(*f));
+    f->name = strdup(name);
+    if (f->name == NULL)
+        return SIZE_MAX;
+    t->funcs_index[i] = ++t->nfuncs;
+    return t->nfuncs - 1;
+}
+
+static void
+count_frame(struct top *t, size_t slot, int self, uint64_t count)
+{
+    struct function *f = &t->funcs[slot];
+
+    if (self) {
+        f->self += count;
+        f->self_all += count;
+    }
+    /* Recursion counts a function once per stack */
+    if (f->stamp != t->stamp) {
+        f->stamp = t->stamp;
+        f->total += count;
+        f->total_all += count;
+    }
+}
+
+static backtrace_elf_t *
+module_elf(struct top *t, const struct backtrace_module *module)
+{
+    struct module_syms *m;
+    const unsigned char *id;
+    int i;
+
+    for (i = 0; i < t->nmods; i++) {
+        if (t->mods[i].module == module)
+            return t->mods[i].elf;
+    }
+    m = realloc(t->mods, (size_t)(t->nmods + 1) * sizeof(*m));
+    if (m == NULL)
+        return NULL;
+    t->mods = m;
+    m = &t->mods[t->nmods++];
+    m->module = module;
+    m->elf = backtrace_elf_open(module->path);
+    /* A file rebuilt since the process loaded it would give wrong names */
+    if (m->elf != NULL && module->build_id_len > 0 &&
+        (backtrace_elf_build_id(m->elf, &id) != module->build_id_len ||
+         memcmp(id, module->build_id, (size_t)module->build_id_len) != 0)) {
+        backtrace_elf_close(m->elf);
+        m->elf = NULL;
+    }
+    return m->elf;
+}
+
+/* Function index of a module-relative frame, symbolized on first sight */
+static size_t
+frame_function(struct top *t, const struct backtrace_shm_frame *frame)
+{
+    char name[NAME_MAX_LEN];
+    const char *sym = NULL, *base;
+    backtrace_elf_t *elf;
+    struct address *a, *addrs;
+    size_t i, j, mask, slot;
+
+    for (i = hash_addr(frame->module, frame->offset) & t->addrs_mask;
+         t->addrs != NULL && t->addrs[i].used; i = (i + 1) & t->addrs_mask) {
+        a = &t->addrs[i];
+        if (a->module == frame->module && a->offset == frame->offset)
+            return a->function;
+    }
+
+    t->lookups++;
+    if (frame->module != NULL) {
+        if ((elf = module_elf(t, frame->module)) != NULL)
+            sym = backtrace_elf_lookup(elf, frame->offset, NULL);
+        base = strrchr(frame->module->path, '/');
+        base = base ? base + 1 : frame->module->path;
+        if (sym != NULL)
+            snprintf(name, sizeof(name), "%s", sym);
+        else
+            snprintf(name, sizeof(name), "%s+0x%llx", base,
+                     (unsigned long long)frame->offset);
+    } else {
+        snprintf(name, sizeof(name), "0x%llx", (unsigned long long)frame->offset);
+    }
+    if ((slot = function_index(t, name)) == SIZE_MAX)
+        return SIZE_MAX;
+
+    if ((t->addrs_used + 1) * 2 > t->addrs_mask + 1) {
+        mask = t->addrs_mask ? t->addrs_mask * 2 + 1 : 4095;
+        addrs = calloc(mask + 1, sizeof(*addrs));
+        if (addrs == NULL)
+            return slot;
+        for (i = 0; t->addrs != NULL && i <= t->addrs_mask; i++) {
+            if (!t->addrs[i].used)
+                continue;
+            for (j = hash_addr(t->addrs[i].module, t->addrs[i].offset) & mask;
+                 addrs[j].used; j = (j + 1) & mask)
+                ;
+            addrs[j] = t->addrs[i];
+        }
+        free(t->addrs);
+        t->addrs = addrs;
+        t->addrs_mask = mask;
+    }
+    for (i = hash_addr(frame->module, frame->offset) & t->addrs_mask;
+         t->addrs[i].used; i = (i + 1) & t->addrs_mask)
+        ;
+    t->addrs[i].module = frame->module;
+    t->addrs[i].offset = frame->offset;
+    t->addrs[i].function = slot;
+    t->addrs[i].used = 1;
+    t->addrs_used++;
+    return slot;
+}
+
+static int
+add_shm_sample(const struct backtrace_shm_sample *sample, void *ctx)
+{
+    struct top *t = ctx;
+    size_t slot;
+    int i;
+
+    t->stamp++;
+    t->samples += sample->count;
+    t->samples_all += sample->count;
+    for (i = 0; i < sample->depth; i++) {
+        if ((slot = frame_function(t, &sample->frames[i])) != SIZE_MAX)
+            count_frame(t, slot, i == 0, sample->count);
+    }
+    return 0;
+}
+
+/* Add one folded stack line, "outer;...;inner count" */
+static void
+add_folded(struct top *t, char *line)
+{
+    char *space, *name, *save;
+    uint64_t count;
+    size_t slot, last = SIZE_MAX;
+
+    space = strrchr(line, ' ');
+    if (space == NULL)
+        return;
+    *space = '\0';
+    count = strtoull(space + 1, NULL, 10);
+    if (count == 0)
+        return;
+
+    t->stamp++;
+    t->samples += count;
+    t->samples_all += count;
+    for (name = strtok_r(line, ";", &save); name != NULL; name = strtok_r(NULL, ";", &save)) {
+        if ((slot = function_index(t, name)) == SIZE_MAX)
+            continue;
+        count_frame(t, slot, 0, count);
+        last = slot;
+    }
+    if (last != SIZE_MAX) {
+        t->funcs[last].self += count;
+        t->funcs[last].self_all += count;
+    }
+}
+
+/* Ask the control socket for a profile of SECONDS and add it */
+static int
+poll_socket(struct top *t, const char *path, long seconds, long hz)
+{
+    struct sockaddr_un addr;
+    char *line = NULL;
+    size_t cap = 0;
+    FILE *fp;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (path[0] == '@')
+        addr.sun_path[0] = '\0';
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 ||
+        connect(fd, (struct sockaddr *)&addr,
+                (socklen_t)(offsetof(struct sockaddr_un, sun_path) + strlen(path))) != 0 ||
+        dprintf(fd, "cpu-profile %ld %ld\n", seconds, hz) < 0 ||
+        (fp = fdopen(fd, "r")) == NULL) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    while (getline(&line, &cap, fp) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "error:", 6) == 0) {
+            fprintf(stderr, "execinfo-top: %s: %s\n", path, line);
+            free(line);
+            fclose(fp);
+            errno = EPROTO;
+            return -1;
+        }
+        add_folded(t, line);
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+static int
+function_cmp(const void *a, const void *b)
+{
+    const struct function *x = *(const struct function *const *)a;
+    const struct function *y = *(const struct function *const *)b;
+    uint64_t kx = sort_total ? x->total : x->self;
+    uint64_t ky = sort_total ? y->total : y->self;
+
+    if (kx != ky)
+        return kx < ky ? 1 : -1;
+    if (x->total_all != y->total_all)
+        return x->total_all < y->total_all ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+static void
+show(struct top *t, int lines, int clear, const char *source)
+{
+    struct function **list, *f;
+    double scale = t->samples ? 100.0 / (double)t->samples : 0.0;
+    size_t i, n = 0;
+
+    list = malloc((t->nfuncs + 1) * sizeof(*list));
+    if (list == NULL)
+        return;
+    for (i = 0; i < t->nfuncs; i++)
+        list[n++] = &t->funcs[i];
+    qsort(list, n, sizeof(*list), function_cmp);
+
+    if (clear)
+        printf("\033[H\033[2J");
+    printf("execinfo-top - %s: %llu samples, %llu total, %zu functions, %llu lookups\n\n",
+           source, (unsigned long long)t->samples, (unsigned long long)t->samples_all,
+           t->nfuncs, (unsigned long long)t->lookups);
+    printf("%7s %7s %10s %10s  %s\n", "SELF%", "TOTAL%", "SELF", "TOTAL", "FUNCTION");
+    for (i = 0; i < n && i < (size_t)lines; i++) {
+        f = list[i];
+        printf("%6.1f%% %6.1f%% %10llu %10llu  %s\n", (double)f->self * scale,
+               (double)f->total * scale, (unsigned long long)f->self_all,
+               (unsigned long long)f->total_all, f->name);
+    }
+    if (!clear)
+        putchar('\n');
+    fflush(stdout);
+    free(list);
+
+    /* Start the next interval */
+    for (i = 0; i < t->nfuncs; i++) {
+        t->funcs[i].self = 0;
+        t->funcs[i].total = 0;
+    }
+    t->samples = 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct timespec drain = { 0, DRAIN_MS * 1000000L }, next, now;
+    struct top top;
+    const char *shm_name = NULL, *socket_path = NULL;
+    backtrace_shm_t *shm = NULL;
+    struct sigaction sa;
+    long delay = 1, iterations = 0, hz = DEFAULT_HZ, done = 0;
+    int lines = DEFAULT_LINES, rings = DEFAULT_RINGS, opt, clear;
+    size_t i;
+
+    while ((opt = getopt(argc, argv, "d:n:l:ts:r:c:z:")) != -1) {
+        switch (opt) {
+        case 'd': delay = atol(optarg); break;
+        case 'n': iterations = atol(optarg); break;
+        case 'l': lines = atoi(optarg); break;
+        case 't': sort_total = 1; break;
+        case 's': shm_name = optarg; break;
+        case 'r': rings = atoi(optarg); break;
+        case 'c': socket_path = optarg; break;
+        case 'z': hz = atol(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind != argc || delay <= 0 || lines <= 0 ||
+        (shm_name == NULL) == (socket_path == NULL))
+        usage();
+
+    memset(&top, 0, sizeof(top));
+    if (shm_name != NULL &&
+        (shm = backtrace_shm_create(shm_name, rings, DEFAULT_RING_SIZE)) == NULL) {
+        fprintf(stderr, "execinfo-top: %s: %s\n", shm_name, strerror(errno));
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    clear = isatty(STDOUT_FILENO);
+
+    while (!stop && (iterations == 0 || done < iterations)) {
+        if (shm != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &next);
+            next.tv_sec += delay;
+            do {
+                nanosleep(&drain, NULL);
+                backtrace_shm_drain(shm, add_shm_sample, &top);
+                clock_gettime(CLOCK_MONOTONIC, &now);
+            } while (!stop && (now.tv_sec < next.tv_sec ||
+                               (now.tv_sec == next.tv_sec && now.tv_nsec < next.tv_nsec)));
+        } else if (poll_socket(&top, socket_path, delay, hz) != 0) {
+            if (errno != EPROTO)
+                fprintf(stderr, "execinfo-top: %s: %s\n", socket_path, strerror(errno));
+            return 1;
+        }
+        show(&top, lines, clear, shm_name ? shm_name : socket_path);
+        done++;
+    }
+
+    if (shm != NULL)
+        backtrace_shm_destroy(shm);
+    for (i = 0; i < top.nfuncs; i++)
+        free(top.funcs[i].name);
+    for (i = 0; i < (size_t)top.nmods; i++)
+        backtrace_elf_close(top.mods[i].elf);
+    free(top.funcs);
+    free(top.funcs_index);
+    free(top.addrs);
+    free(top.mods);
+    return 0;
+}
@@ -1,23 +1,43 @@
 #define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/syscall.h>
 #include <dlfcn.h>
-#include <math.h>
+#include <link.h>
+#include <pthread.h>
+#include <sched.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <errno.h>
 
 #include "execinfo.h"
 #include "stacktraverse.h"
+#include "modmap.h"
+#include "shadow.h"
+
+#if defined(__x86_64__) && defined(__GLIBC__) && defined(__has_include)
+# if __has_include(<sys/rseq.h>)
+#  include <sys/rseq.h>
+#  define HAVE_RSEQ 1
+# endif
+#endif
 
-#define D10(x) ceil(log10(((x) == 0) ? 2 : ((x) + 1)))
 #define MAX_STACK_BUFFER 4096
+#define SYMBOL_LEN_HINT 128  /* initial per-frame guess for backtrace_symbols() */
+#define LAZY_ARENA_HINT 64   /* inline string space per frame for lazy handles */
+#define LAZY_CHUNK_SIZE 1024 /* minimum overflow chunk for lazy handles */
+#define RESOLVE_MODULE_SLOTS 32 /* modules tracked without rescanning frames */
+#define SYMCACHE_SLOTS 4096     /* memoized stacks, a power of two */
+#define SYMCACHE_PROBES 16      /* slots tried per stack */
 
-inline static void * __attribute__((unused))
+inline static void *
 realloc_safe(void *ptr, size_t size)
 {
     void *nptr;
@@ -33,130 +53,1522 @@ realloc_safe(void *ptr, size_t size)
     return nptr;
 }
 
+/*
+ * Fill F from a dladdr() lookup of PC, leaving the module index unset.
+ * Returns non-zero if PC lies in a loaded module.
+ */
+static int
+resolve_record(void *pc, struct backtrace_frame *f)
+{
+    Dl_info info;
+
+    memset(f, 0, sizeof(*f));
+    f->pc = pc;
+    f->module = -1;
+    if (pc == NULL || dladdr(pc, &info) == 0)
+        return 0;
+
+    f->module_base = info.dli_fbase;
+    f->module_name = info.dli_fname;
+    f->symbol = info.dli_sname;
+    f->symbol_start = info.dli_saddr;
+    f->offset = (char *)pc - (char *)(info.dli_saddr ? info.dli_saddr :
+                                      info.dli_fbase);
+    return 1;
+}
+
+/*
+ * Dense per-trace module numbering.  The first RESOLVE_MODULE_SLOTS
+ * distinct modules get index == slot; once the table is full, -1 is
+ * returned for modules not already in it.
+ */
+struct module_ids {
+    void *bases[RESOLVE_MODULE_SLOTS];
+    int count;
+};
+
+static int
+module_id(struct module_ids *ids, void *base)
+{
+    int j;
+
+    for (j = 0; j < ids->count && ids->bases[j] != base; j++)
+        ;
+    if (j < ids->count)
+        return j;
+    if (ids->count == RESOLVE_MODULE_SLOTS)
+        return -1;
+    ids->bases[ids->count] = base;
+    return ids->count++;
+}
+
+/*
+ * Frame walker.
+ *
+ * On targets where every frame built with frame pointers starts with a
+ * two-word record {saved frame pointer, return address}, the stack is
+ * walked by following that chain, one constant-cost step per frame.
+ * The chain is only followed towards higher addresses and in bounded
+ * steps, so a garbage frame pointer left by code built without frame
+ * pointers (such as the C start-up code below main()) ends the walk
+ * instead of faulting.
+ *
+ * Elsewhere the generated getreturnaddr()/getframeaddr() switches are
+ * used.  Both helpers are always inlined so that level 0 refers to the
+ * caller of the public function that embeds them.
+ */
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define HAVE_FRAME_RECORDS 1
+#endif
+
+#define FRAME_MAX_SPAN ((uintptr_t)64 << 20) /* largest plausible frame */
+
+struct frame_walk {
+    void **fp;    /* frame record read by the next step */
+    void *pc;     /* return address of the current frame */
+    void *sp;     /* stack pointer of the current frame */
+    int level;
+};
+
+static inline __attribute__((always_inline)) void
+walk_init(struct frame_walk *w)
+{
+    w->fp = __builtin_frame_address(0);
+    w->pc = NULL;
+    w->sp = NULL;
+    w->level = 0;
+}
+
+static inline __attribute__((always_inline)) int
+walk_step(struct frame_walk *w)
+{
+#ifdef HAVE_FRAME_RECORDS
+    void **fp = w->fp, **next;
+
+    if (fp == NULL)
+        return 0;
+    next = (void **)fp[0];
+    w->pc = fp[1];
+    w->sp = fp + 2;
+    if ((uintptr_t)next <= (uintptr_t)fp ||
+        (uintptr_t)next - (uintptr_t)fp > FRAME_MAX_SPAN ||
+        ((uintptr_t)next & (sizeof(void *) - 1)) != 0)
+        next = NULL;
+    w->fp = next;
+#else
+    w->pc = getreturnaddr(w->level);
+    w->fp = getframeaddr(w->level);
+    w->sp = NULL;
+#endif
+    if (w->pc == NULL)
+        return 0;
+    w->level++;
+    return 1;
+}
+
 int
 backtrace(void **buffer, int size)
 {
+    struct frame_walk w;
     int i;
+
     if (size <= 0)
         return 0;
 
-    for (i = 0; i < size; i++) {
-        void *addr = getreturnaddr(i);
-        if (addr == NULL)
-            break;
-        buffer[i] = addr;
+    /* Shadow mode: our caller, then the instrumented calls above it */
+    if (__atomic_load_n(&shadow_enabled, __ATOMIC_RELAXED) &&
+        (i = shadow_capture(buffer + 1, size - 1)) > 0) {
+        buffer[0] = __builtin_return_address(0);
+        return i + 1;
     }
+
+    walk_init(&w);
+    for (i = 0; i < size && walk_step(&w); i++)
+        buffer[i] = w.pc;
     return i;
 }
 
-char **
-backtrace_symbols(void *const *buffer, int size)
+uint64_t
+backtrace_hash(void *const *buffer, int size)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t)(size > 0 ? size : 0);
+    int i;
+
+    /* One multiply-xorshift round per frame */
+    for (i = 0; i < size; i++) {
+        h ^= (uint64_t)(uintptr_t)buffer[i];
+        h *= 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    return h ? h : 1;
+}
+
+struct filter_range {
+    uintptr_t start;
+    uintptr_t end;
+};
+
+struct backtrace_filter {
+    int skip;
+    int count;
+    int cap;
+    struct filter_range *ranges;  /* sorted by start */
+};
+
+backtrace_filter_t *
+backtrace_filter_new(int skip)
+{
+    backtrace_filter_t *filter;
+
+    if (skip < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    filter = calloc(1, sizeof(*filter));
+    if (filter == NULL)
+        return NULL;
+    filter->skip = skip;
+    return filter;
+}
+
+static int
+filter_add(backtrace_filter_t *filter, uintptr_t start, uintptr_t end)
+{
+    int i, j;
+
+    if (filter->count == filter->cap) {
+        filter->cap = filter->cap ? filter->cap * 2 : 8;
+        filter->ranges = realloc_safe(filter->ranges,
+                                      filter->cap * sizeof(*filter->ranges));
+        if (filter->ranges == NULL) {
+            filter->count = filter->cap = 0;
+            return -1;
+        }
+    }
+    /* Keep the ranges sorted and disjoint so a lookup is one search */
+    for (i = filter->count; i > 0 && filter->ranges[i - 1].start > start; i--)
+        filter->ranges[i] = filter->ranges[i - 1];
+    filter->ranges[i].start = start;
+    filter->ranges[i].end = end;
+    filter->count++;
+
+    for (i = 0, j = 1; j < filter->count; j++) {
+        if (filter->ranges[j].start <= filter->ranges[i].end) {
+            if (filter->ranges[j].end > filter->ranges[i].end)
+                filter->ranges[i].end = filter->ranges[j].end;
+        } else {
+            filter->ranges[++i] = filter->ranges[j];
+        }
+    }
+    filter->count = i + 1;
+    return 0;
+}
+
+int
+backtrace_filter_exclude_range(backtrace_filter_t *filter, const void *start,
+                               const void *end)
+{
+    if ((uintptr_t)end <= (uintptr_t)start) {
+        errno = EINVAL;
+        return -1;
+    }
+    return filter_add(filter, (uintptr_t)start, (uintptr_t)end);
+}
+
+struct module_match {
+    backtrace_filter_t *filter;
+    const char *name;
+    int matched;
+    int failed;
+};
+
+static int
+module_name_matches(const char *path, const char *name)
+{
+    const char *base = strrchr(path, '/');
+    size_t len = strlen(name);
+
+    base = base ? base + 1 : path;
+    if (strcmp(path, name) == 0 || strcmp(base, name) == 0)
+        return 1;
+    return strncmp(base, name, len) == 0 && base[len] == '.';
+}
+
+static int
+exclude_module_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct module_match *m = data;
+    uintptr_t start;
+    int i;
+
+    (void)size;
+    /* The main program comes first and has an empty name */
+    if (m->name == NULL ? info->dlpi_name[0] != '\0' || m->matched :
+        info->dlpi_name[0] == '\0' ||
+        !module_name_matches(info->dlpi_name, m->name))
+        return 0;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X))
+            continue;
+        start = info->dlpi_addr + ph->p_vaddr;
+        if (filter_add(m->filter, start, start + ph->p_memsz) != 0) {
+            m->failed = 1;
+            return 1;
+        }
+    }
+    m->matched++;
+    return 0;
+}
+
+int
+backtrace_filter_exclude_module(backtrace_filter_t *filter, const char *name)
+{
+    struct module_match m = { filter, name, 0, 0 };
+
+    dl_iterate_phdr(exclude_module_cb, &m);
+    if (m.failed) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (m.matched == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    return m.matched;
+}
+
+void
+backtrace_filter_free(backtrace_filter_t *filter)
+{
+    if (filter == NULL)
+        return;
+    free(filter->ranges);
+    free(filter);
+}
+
+static int
+filter_excludes(const backtrace_filter_t *filter, void *pc)
+{
+    /* Match the call instruction, not the return address after it */
+    uintptr_t site = (uintptr_t)pc - 1;
+    int lo = 0, hi = filter->count, mid;
+
+    /* Find the last range starting at or below SITE */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (filter->ranges[mid].start <= site)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 && site < filter->ranges[lo - 1].end;
+}
+
+int
+backtrace_ex(void **buffer, int size, const backtrace_filter_t *filter)
 {
+    struct frame_walk w;
+    int n = 0;
+
     if (size <= 0)
+        return 0;
+
+    walk_init(&w);
+    while (n < size && walk_step(&w)) {
+        if (filter != NULL) {
+            if (w.level <= filter->skip)
+                continue;
+            if (filter->count > 0 && filter_excludes(filter, w.pc))
+                continue;
+        }
+        buffer[n++] = w.pc;
+    }
+    return n;
+}
+
+/*
+ * Capture metadata.  gettid() is a system call, so the ID is cached per
+ * thread; a forked child starts with the forking thread's cache, which
+ * the atfork handler clears.
+ */
+static __thread uint32_t meta_tid;
+static pthread_once_t meta_once = PTHREAD_ONCE_INIT;
+
+static void
+meta_fork_child(void)
+{
+    meta_tid = 0;
+}
+
+static void
+meta_init(void)
+{
+    pthread_atfork(NULL, NULL, meta_fork_child);
+}
+
+static inline uint32_t
+meta_thread(void)
+{
+    if (meta_tid == 0) {
+        pthread_once(&meta_once, meta_init);
+        meta_tid = (uint32_t)syscall(SYS_gettid);
+    }
+    return meta_tid;
+}
+
+static inline int
+meta_cpu(void)
+{
+#ifdef HAVE_RSEQ
+    if (__rseq_size >= 20) {
+        const struct rseq *rs = (const struct rseq *)
+            ((char *)__builtin_thread_pointer() + __rseq_offset);
+        int32_t cpu = (int32_t)__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+
+        if (cpu >= 0)
+            return cpu;
+    }
+#endif
+    return sched_getcpu();
+}
+
+/* Cycle counter, or 0 where there is none */
+static inline uint64_t
+meta_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+#else
+    return 0;
+#endif
+}
+
+int
+backtrace_meta(void **buffer, int size, struct backtrace_meta *meta, int flags)
+{
+    struct frame_walk w;
+    struct timespec ts;
+    uint64_t cycles = 0;
+    int n = 0, cpu;
+
+    if ((flags & BACKTRACE_META_TSC) && (cycles = meta_cycles()) != 0) {
+        meta->timestamp = cycles;
+        meta->flags = BACKTRACE_META_TSC;
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        meta->timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        meta->flags = 0;
+    }
+    meta->tid = meta_thread();
+    cpu = meta_cpu();
+    meta->cpu = (int16_t)(cpu >= 0 && cpu <= INT16_MAX ? cpu : -1);
+
+    if (size > EXECINFO_MAX_FRAMES)
+        size = EXECINFO_MAX_FRAMES;
+    walk_init(&w);
+    while (n < size && walk_step(&w))
+        buffer[n++] = w.pc;
+    meta->depth = (uint8_t)n;
+    return n;
+}
+
+int
+backtrace_cursor_init(backtrace_cursor_t *cursor)
+{
+#ifdef HAVE_FRAME_RECORDS
+    struct frame_walk w;
+
+    /* Stepping out of our own frame lands in the caller's */
+    walk_init(&w);
+    if (!walk_step(&w)) {
+        memset(cursor, 0, sizeof(*cursor));
+        return 0;
+    }
+    cursor->pc = w.pc;
+    cursor->fp = w.fp;
+    cursor->sp = w.sp;
+    return 0;
+#else
+    memset(cursor, 0, sizeof(*cursor));
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int
+backtrace_cursor_step(backtrace_cursor_t *cursor)
+{
+#ifdef HAVE_FRAME_RECORDS
+    struct frame_walk w;
+
+    w.fp = cursor->fp;
+    w.level = 0;
+    if (!walk_step(&w))
+        return 0;
+    cursor->pc = w.pc;
+    cursor->fp = w.fp;
+    cursor->sp = w.sp;
+    return 1;
+#else
+    (void)cursor;
+    return 0;
+#endif
+}
+
+void *
+backtrace_cursor_pc(const backtrace_cursor_t *cursor)
+{
+    return cursor->pc;
+}
+
+void *
+backtrace_cursor_fp(const backtrace_cursor_t *cursor)
+{
+    return cursor->fp;
+}
+
+void *
+backtrace_cursor_sp(const backtrace_cursor_t *cursor)
+{
+    return cursor->sp;
+}
+
+int
+backtrace_foreach(backtrace_callback_t callback, void *ctx, int flags)
+{
+    struct backtrace_frame frame;
+    struct module_ids ids;
+    struct frame_walk w;
+    int rc;
+
+    ids.count = 0;
+    walk_init(&w);
+    while (walk_step(&w)) {
+        if (flags & BACKTRACE_FOREACH_RESOLVE) {
+            if (resolve_record(w.pc, &frame))
+                frame.module = module_id(&ids, frame.module_base);
+        } else {
+            memset(&frame, 0, sizeof(frame));
+            frame.pc = w.pc;
+            frame.module = -1;
+        }
+        rc = callback(&frame, w.level - 1, ctx);
+        if (rc != 0)
+            return rc;
+    }
+    return 0;
+}
+
+/*
+ * Resolve ADDR with dladdr() and fill in the defaults shared by every
+ * formatter.  Returns non-zero if symbol information is available.
+ */
+static int
+resolve_frame(void *addr, Dl_info *info)
+{
+    if (addr == NULL || dladdr(addr, info) == 0)
+        return 0;
+    if (info->dli_sname == NULL)
+        info->dli_sname = "???";
+    if (info->dli_saddr == NULL)
+        info->dli_saddr = addr;
+    return 1;
+}
+
+/*
+ * Format one frame into BUF, writing at most LEN bytes including the
+ * terminating NUL.  Returns the length of the complete string, as
+ * snprintf() does, so callers can detect truncation.
+ */
+static int
+format_frame(char *buf, size_t len, void *addr, const Dl_info *info,
+    int resolved)
+{
+    if (!resolved)
+        return snprintf(buf, len, "%p", addr);
+    return snprintf(buf, len, "%p <%s+%td> at %s", addr, info->dli_sname,
+                    (char *)addr - (char *)info->dli_saddr, info->dli_fname);
+}
+
+/*
+ * Compiled output templates.
+ *
+ * A template is parsed once into a sequence of ops: literal runs, which
+ * point into the unescaped template text, and frame fields.  The whole
+ * format is one allocation.  Rendering walks the ops and copies; no
+ * template text is looked at again.
+ */
+enum format_field {
+    FORMAT_LITERAL,
+    FORMAT_PC,
+    FORMAT_SYM,
+    FORMAT_OFF,
+    FORMAT_MODULE,
+    FORMAT_FILE,
+    FORMAT_LINE
+};
+
+struct format_op {
+    enum format_field field;
+    uint32_t start;             /* FORMAT_LITERAL: run in text */
+    uint32_t len;
+};
+
+struct backtrace_format {
+    int count;
+    char *text;                 /* literal runs, unescaped */
+    struct format_op ops[];
+};
+
+static const struct {
+    const char *name;
+    enum format_field field;
+} format_fields[] = {
+    { "pc", FORMAT_PC },
+    { "sym", FORMAT_SYM },
+    { "off", FORMAT_OFF },
+    { "module", FORMAT_MODULE },
+    { "file", FORMAT_FILE },
+    { "line", FORMAT_LINE },
+};
+
+backtrace_format_t *
+backtrace_format_compile(const char *tmpl)
+{
+    backtrace_format_t *fmt;
+    struct format_op *op;
+    const char *p, *end;
+    size_t n = strlen(tmpl), i, name;
+    uint32_t used = 0;
+
+    if (n >= UINT32_MAX) {
+        errno = EINVAL;
         return NULL;
+    }
+    /* At most one op per template byte, plus the text itself */
+    fmt = malloc(sizeof(*fmt) + (n + 1) * sizeof(*op) + n + 1);
+    if (fmt == NULL)
+        return NULL;
+    fmt->count = 0;
+    fmt->text = (char *)&fmt->ops[n + 1];
 
-    size_t total_len = 0;
-    char temp[512];
-    Dl_info info;
-    ptrdiff_t offset = 0;
+    for (p = tmpl; *p != '\0'; p++) {
+        if (*p == '{' && p[1] != '{') {
+            end = strchr(p, '}');
+            if (end == NULL)
+                goto invalid;
+            name = (size_t)(end - p - 1);
+            for (i = 0; i < sizeof(format_fields) / sizeof(format_fields[0]); i++) {
+                if (strlen(format_fields[i].name) == name &&
+                    memcmp(format_fields[i].name, p + 1, name) == 0)
+                    break;
+            }
+            if (i == sizeof(format_fields) / sizeof(format_fields[0]))
+                goto invalid;
+            op = &fmt->ops[fmt->count++];
+            op->field = format_fields[i].field;
+            op->start = op->len = 0;
+            p = end;
+            continue;
+        }
+        if (*p == '}' && p[1] != '}')
+            goto invalid;
+        /* A literal byte; doubled braces stand for one */
+        if (*p == '{' || *p == '}')
+            p++;
+        op = fmt->count > 0 ? &fmt->ops[fmt->count - 1] : NULL;
+        if (op == NULL || op->field != FORMAT_LITERAL) {
+            op = &fmt->ops[fmt->count++];
+            op->field = FORMAT_LITERAL;
+            op->start = used;
+            op->len = 0;
+        }
+        fmt->text[used++] = *p;
+        op->len++;
+    }
+    fmt->text[used] = '\0';
+    return fmt;
+
+invalid:
+    free(fmt);
+    errno = EINVAL;
+    return NULL;
+}
+
+void
+backtrace_format_free(backtrace_format_t *fmt)
+{
+    free(fmt);
+}
+
+/* Append LEN bytes of S to BUF as far as they fit, counting all of them */
+static inline void
+format_put(char *buf, size_t cap, size_t *used, const char *s, size_t len)
+{
+    if (*used < cap)
+        memcpy(buf + *used, s, *used + len < cap ? len : cap - *used);
+    *used += len;
+}
+
+/* Format V in base 10 or 16 at the end of TMP; returns the start */
+static inline char *
+format_number(char *end, uintmax_t v, int hex)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    do {
+        *--end = digits[hex ? v & 15 : v % 10];
+        v = hex ? v >> 4 : v / 10;
+    } while (v != 0);
+    return end;
+}
+
+/*
+ * Render frame ADDR with FMT into BUF like format_frame(): at most LEN
+ * bytes including the NUL, returning the untruncated length.  Unknown
+ * fields render as "???", and source positions, for which there is no
+ * debug line information, as "??" and 0.
+ */
+static int
+format_render(const backtrace_format_t *fmt, char *buf, size_t len,
+              void *addr, const Dl_info *info, int resolved)
+{
+    const struct format_op *op;
+    char tmp[24], *end = tmp + sizeof(tmp), *p;
+    const char *s;
+    ptrdiff_t off;
+    size_t used = 0;
     int i;
+
+    for (i = 0; i < fmt->count; i++) {
+        op = &fmt->ops[i];
+        switch (op->field) {
+        case FORMAT_LITERAL:
+            format_put(buf, len, &used, fmt->text + op->start, op->len);
+            break;
+        case FORMAT_PC:
+            p = format_number(end, (uintptr_t)addr, 1);
+            *--p = 'x';
+            *--p = '0';
+            format_put(buf, len, &used, p, (size_t)(end - p));
+            break;
+        case FORMAT_SYM:
+        case FORMAT_MODULE:
+            s = !resolved ? "???" : op->field == FORMAT_SYM ? info->dli_sname :
+                info->dli_fname;
+            format_put(buf, len, &used, s, strlen(s));
+            break;
+        case FORMAT_OFF:
+            off = resolved ? (char *)addr - (char *)info->dli_saddr : 0;
+            p = format_number(end, (uintmax_t)(off < 0 ? -off : off), 0);
+            if (off < 0)
+                *--p = '-';
+            format_put(buf, len, &used, p, (size_t)(end - p));
+            break;
+        case FORMAT_FILE:
+            format_put(buf, len, &used, "??", 2);
+            break;
+        case FORMAT_LINE:
+            format_put(buf, len, &used, "0", 1);
+            break;
+        }
+    }
+    if (len > 0)
+        buf[used < len ? used : len - 1] = '\0';
+    return used > INT_MAX ? -1 : (int)used;
+}
+
+/* Format with FMT, or in the default backtrace_symbols() format */
+static inline int
+frame_string(const backtrace_format_t *fmt, char *buf, size_t len,
+             void *addr, const Dl_info *info, int resolved)
+{
+    if (fmt != NULL)
+        return format_render(fmt, buf, len, addr, info, resolved);
+    return format_frame(buf, len, addr, info, resolved);
+}
+
+static char **
+symbols_format(void *const *buffer, int size, const backtrace_format_t *fmt)
+{
+    size_t ptrs_size, used, cap;
+    char **rval;
+    Dl_info info;
+    int i, len, resolved;
+
+    if (size <= 0)
+        return NULL;
+
+    /*
+     * Single pass: every frame is resolved and formatted exactly once,
+     * straight into the result block.  The pointer slots temporarily
+     * hold offsets so the block can be grown with realloc().
+     */
+    ptrs_size = (size_t)size * sizeof(char *);
+    cap = ptrs_size + (size_t)size * SYMBOL_LEN_HINT;
+    rval = malloc(cap);
+    if (rval == NULL)
+        return NULL;
+    used = ptrs_size;
+
     for (i = 0; i < size; i++) {
-        if (!buffer[i]) {
-            snprintf(temp, sizeof(temp), "%p", buffer[i]);
-        } else if (dladdr(buffer[i], &info) != 0) {
-            if (!info.dli_sname) info.dli_sname = "???";
-            if (!info.dli_saddr) info.dli_saddr = buffer[i];
-            offset = (char *)buffer[i] - (char *)info.dli_saddr;
-            snprintf(temp, sizeof(temp), "%p <%s+%td> at %s",
-                     buffer[i], info.dli_sname, offset, info.dli_fname);
-        } else {
-            snprintf(temp, sizeof(temp), "%p", buffer[i]);
+        resolved = resolve_frame(buffer[i], &info);
+        len = frame_string(fmt, (char *)rval + used, cap - used, buffer[i],
+                           &info, resolved);
+        if (len < 0) {
+            free(rval);
+            return NULL;
+        }
+        if ((size_t)len >= cap - used) {
+            cap = (cap * 2 > used + len + 1) ? cap * 2 : used + len + 1;
+            rval = realloc_safe(rval, cap);
+            if (rval == NULL)
+                return NULL;
+            frame_string(fmt, (char *)rval + used, cap - used, buffer[i],
+                         &info, resolved);
         }
-        total_len += strlen(temp) + 1; // for '\0'
+        rval[i] = (char *)(uintptr_t)used;
+        used += (size_t)len + 1;
     }
 
-    size_t ptrs_size = size * sizeof(char *);
-    char **rval = malloc(ptrs_size + total_len);
-    if (!rval) return NULL;
+    for (i = 0; i < size; i++)
+        rval[i] = (char *)rval + (uintptr_t)rval[i];
+    return rval;
+}
+
+char **
+backtrace_symbols(void *const *buffer, int size)
+{
+    return symbols_format(buffer, size, NULL);
+}
+
+char **
+backtrace_symbols_format(void *const *buffer, int size, const backtrace_format_t *fmt)
+{
+    return symbols_format(buffer, size, fmt);
+}
+
+char **
+backtrace_symbols_r(void *const *buffer, int size, void *mem, size_t *len)
+{
+    size_t pad, used, cap;
+    char **rval;
+    char *strings;
+    Dl_info info;
+    int i, n, resolved;
+
+    if (size <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* Align the pointer array; strings follow it directly */
+    pad = (-(uintptr_t)mem) & (sizeof(char *) - 1);
+    cap = (mem == NULL) ? 0 : *len;
+    used = pad + (size_t)size * sizeof(char *);
+    rval = (char **)((char *)mem + pad);
+    strings = (char *)mem;
 
-    char *strings = (char *)(rval + size);
-    char *cur = strings;
     for (i = 0; i < size; i++) {
-        if (!buffer[i]) {
-            snprintf(temp, sizeof(temp), "%p", buffer[i]);
-        } else if (dladdr(buffer[i], &info) != 0) {
-            if (!info.dli_sname) info.dli_sname = "???";
-            if (!info.dli_saddr) info.dli_saddr = buffer[i];
-            offset = (char *)buffer[i] - (char *)info.dli_saddr;
-            snprintf(temp, sizeof(temp), "%p <%s+%td> at %s",
-                     buffer[i], info.dli_sname, offset, info.dli_fname);
-        } else {
-            snprintf(temp, sizeof(temp), "%p", buffer[i]);
+        resolved = resolve_frame(buffer[i], &info);
+        /* Once out of space keep going with a zero length to size it */
+        if (used < cap)
+            n = format_frame(strings + used, cap - used, buffer[i], &info,
+                             resolved);
+        else
+            n = format_frame(NULL, 0, buffer[i], &info, resolved);
+        if (n < 0) {
+            errno = EINVAL;
+            return NULL;
         }
-        size_t len = strlen(temp) + 1;
-        memcpy(cur, temp, len);
-        rval[i] = cur;
-        cur += len;
+        if (used + (size_t)n < cap)
+            rval[i] = strings + used;
+        used += (size_t)n + 1;
+    }
+
+    *len = used;
+    if (used > cap) {
+        errno = ERANGE;
+        return NULL;
     }
     return rval;
 }
 
-void
-backtrace_symbols_fd(void *const *buffer, int size, int fd)
+static void
+symbols_fd_format(void *const *buffer, int size, int fd, const backtrace_format_t *fmt)
 {
-    int i, len;
-    char *buf;
     char static_buf[MAX_STACK_BUFFER];
+    char *buf;
     Dl_info info;
-    ptrdiff_t offset;
     ssize_t written;
+    int i, len, resolved;
 
     if (size <= 0 || fd < 0)
         return;
 
     for (i = 0; i < size; i++) {
-        if (!buffer[i]) {
-            len = 2 + (sizeof(void *) * 2) + 2;
-            if (len <= MAX_STACK_BUFFER) {
-                buf = static_buf;
-            } else {
-                buf = malloc(len);
-                if (buf == NULL)
-                    return;
-            }
-            snprintf(buf, len, "%p\n", buffer[i]);
-        } else if (dladdr(buffer[i], &info) != 0) {
-            if (info.dli_sname == NULL)
-                info.dli_sname = "???";
-            if (info.dli_saddr == NULL)
-                info.dli_saddr = buffer[i];
-            offset = (char *)buffer[i] - (char *)info.dli_saddr;
-            len = 2 + (sizeof(void *) * 2) + 2 + strlen(info.dli_sname) + 1 +
-                  D10(offset) + 5 + strlen(info.dli_fname) + 2;
-            if (len <= MAX_STACK_BUFFER) {
-                buf = static_buf;
+        resolved = resolve_frame(buffer[i], &info);
+        buf = static_buf;
+        len = frame_string(fmt, buf, sizeof(static_buf), buffer[i], &info,
+                           resolved);
+        if (len < 0)
+            return;
+        if ((size_t)len + 1 >= sizeof(static_buf)) {
+            buf = malloc((size_t)len + 2);
+            if (buf == NULL)
+                return;
+            frame_string(fmt, buf, (size_t)len + 1, buffer[i], &info, resolved);
+        }
+        buf[len++] = '\n';
+
+        written = write(fd, buf, len);
+        (void)written;
+        if (buf != static_buf)
+            free(buf);
+    }
+}
+
+void
+backtrace_symbols_fd(void *const *buffer, int size, int fd)
+{
+    symbols_fd_format(buffer, size, fd, NULL);
+}
+
+void
+backtrace_symbols_fd_format(void *const *buffer, int size, int fd,
+                            const backtrace_format_t *fmt)
+{
+    symbols_fd_format(buffer, size, fd, fmt);
+}
+
+/*
+ * JSON output.
+ *
+ * Frames are streamed through a small writer: in buffer mode it copies
+ * what fits and counts the rest, as snprintf() does; in fd mode it
+ * fills a stack buffer and writes it out whenever it is full.  Strings
+ * are copied in runs of bytes that need no escaping.  Bytes that are not
+ * valid UTF-8 become U+FFFD so the output always parses.
+ */
+struct json_out {
+    char *buf;
+    size_t cap;
+    size_t used;                /* bytes in BUF (fd) or produced (buffer) */
+    int fd;                     /* -1 in buffer mode */
+    int error;
+};
+
+/* Append a string literal */
+#define json_lit(out, s) json_put((out), (s), sizeof(s) - 1)
+
+static void
+json_flush(struct json_out *out)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < out->used && !out->error) {
+        n = write(out->fd, out->buf + off, out->used - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            out->error = 1;
+        else
+            off += (size_t)n;
+    }
+    out->used = 0;
+}
+
+static void
+json_put(struct json_out *out, const char *s, size_t len)
+{
+    size_t n;
+
+    if (out->fd < 0) {
+        format_put(out->buf, out->cap, &out->used, s, len);
+        return;
+    }
+    while (len > 0) {
+        if (out->used == out->cap)
+            json_flush(out);
+        n = out->cap - out->used < len ? out->cap - out->used : len;
+        memcpy(out->buf + out->used, s, n);
+        out->used += n;
+        s += n;
+        len -= n;
+    }
+}
+
+/* Length of the valid UTF-8 sequence at S (first byte >= 0x80), or 0 */
+static size_t
+json_utf8(const unsigned char *s)
+{
+    size_t len, i;
+    uint32_t c;
+
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        len = 2;
+        c = s[0] & 0x1f;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        len = 3;
+        c = s[0] & 0x0f;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        len = 4;
+        c = s[0] & 0x07;
+    } else {
+        return 0;
+    }
+    for (i = 1; i < len; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+        c = c << 6 | (s[i] & 0x3f);
+    }
+    /* Overlong forms, surrogates and code points past U+10FFFF */
+    if ((len == 3 && c < 0x800) || (len == 4 && (c < 0x10000 || c > 0x10ffff)) ||
+        (c >= 0xd800 && c <= 0xdfff))
+        return 0;
+    return len;
+}
+
+static void
+json_string(struct json_out *out, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *s = (const unsigned char *)str, *run;
+    char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+    size_t n;
+
+    json_lit(out, "\"");
+    for (run = s; *s != '\0';) {
+        if (*s >= 0x20 && *s < 0x80 && *s != '"' && *s != '\\') {
+            s++;
+            continue;
+        }
+        if (*s >= 0x80 && (n = json_utf8(s)) != 0) {
+            s += n;
+            continue;
+        }
+        json_put(out, (const char *)run, (size_t)(s - run));
+        switch (*s) {
+        case '"':  json_lit(out, "\\\""); break;
+        case '\\': json_lit(out, "\\\\"); break;
+        case '\n': json_lit(out, "\\n"); break;
+        case '\r': json_lit(out, "\\r"); break;
+        case '\t': json_lit(out, "\\t"); break;
+        default:
+            if (*s >= 0x80) {
+                json_lit(out, "\\ufffd");
             } else {
-                buf = malloc(len);
-                if (buf == NULL)
-                    return;
+                esc[4] = hex[*s >> 4];
+                esc[5] = hex[*s & 15];
+                json_put(out, esc, 6);
             }
-            snprintf(buf, len, "%p <%s+%td> at %s\n",
-                buffer[i], info.dli_sname, offset, info.dli_fname);
+        }
+        run = ++s;
+    }
+    json_put(out, (const char *)run, (size_t)(s - run));
+    json_lit(out, "\"");
+}
+
+static void
+json_number(struct json_out *out, uintmax_t v, int hex)
+{
+    char tmp[24], *end = tmp + sizeof(tmp), *p;
+
+    p = format_number(end, v, hex);
+    if (hex) {
+        *--p = 'x';
+        *--p = '0';
+        *--p = '"';
+        json_put(out, p, (size_t)(end - p));
+        json_lit(out, "\"");
+    } else {
+        json_put(out, p, (size_t)(end - p));
+    }
+}
+
+static void
+json_frames(struct json_out *out, void *const *buffer, int size, int flags)
+{
+    Dl_info info;
+    int i, resolved;
+
+    if (!(flags & BACKTRACE_JSON_NDJSON))
+        json_lit(out, "[");
+    for (i = 0; i < size; i++) {
+        resolved = buffer[i] != NULL && dladdr(buffer[i], &info) != 0;
+        if (i > 0 && !(flags & BACKTRACE_JSON_NDJSON))
+            json_lit(out, ",");
+        json_lit(out, "{\"frame\":");
+        json_number(out, (uintmax_t)i, 0);
+        json_lit(out, ",\"pc\":");
+        json_number(out, (uintptr_t)buffer[i], 1);
+        json_lit(out, ",\"symbol\":");
+        if (resolved && info.dli_sname != NULL)
+            json_string(out, info.dli_sname);
+        else
+            json_lit(out, "null");
+        json_lit(out, ",\"offset\":");
+        if (resolved && info.dli_sname != NULL && info.dli_saddr != NULL)
+            json_number(out, (uintmax_t)((char *)buffer[i] - (char *)info.dli_saddr), 0);
+        else
+            json_lit(out, "null");
+        json_lit(out, ",\"module\":");
+        if (resolved && info.dli_fname != NULL) {
+            json_string(out, info.dli_fname);
+            json_lit(out, ",\"module_offset\":");
+            json_number(out, (uintmax_t)((char *)buffer[i] - (char *)info.dli_fbase), 0);
         } else {
-            len = 2 + (sizeof(void *) * 2) + 2;
-            if (len <= MAX_STACK_BUFFER) {
-                buf = static_buf;
+            json_lit(out, "null,\"module_offset\":null");
+        }
+        json_lit(out, "}");
+        if (flags & BACKTRACE_JSON_NDJSON)
+            json_lit(out, "\n");
+    }
+    if (!(flags & BACKTRACE_JSON_NDJSON))
+        json_lit(out, "]\n");
+}
+
+int
+backtrace_symbols_json(void *const *buffer, int size, char *buf, size_t len,
+                       int flags)
+{
+    struct json_out out = { buf, len, 0, -1, 0 };
+
+    if (size < 0 || (buf == NULL && len > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    json_frames(&out, buffer, size, flags);
+    if (len > 0)
+        buf[out.used < len ? out.used : len - 1] = '\0';
+    if (out.used > INT_MAX) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    return (int)out.used;
+}
+
+int
+backtrace_symbols_json_fd(void *const *buffer, int size, int fd, int flags)
+{
+    char static_buf[MAX_STACK_BUFFER];
+    struct json_out out = { static_buf, sizeof(static_buf), 0, fd, 0 };
+
+    if (size < 0 || fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    json_frames(&out, buffer, size, flags);
+    json_flush(&out);
+    return out.error ? -1 : 0;
+}
+
+struct lazy_chunk {
+    struct lazy_chunk *next;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+
+struct backtrace_lazy {
+    int size;
+    void **addrs;
+    char **strs;
+    char *arena;                /* inline arena, part of the handle block */
+    size_t arena_used;
+    size_t arena_cap;
+    struct lazy_chunk *chunks;  /* overflow chunks, newest first */
+};
+
+backtrace_lazy_t *
+backtrace_symbols_lazy(void *const *buffer, int size)
+{
+    backtrace_lazy_t *lazy;
+    size_t arena_cap;
+
+    if (size <= 0)
+        return NULL;
+
+    /* Header, addresses, string slots and the inline arena in one block */
+    arena_cap = (size_t)size * LAZY_ARENA_HINT;
+    lazy = calloc(1, sizeof(*lazy) + (size_t)size * 2 * sizeof(void *) +
+                  arena_cap);
+    if (lazy == NULL)
+        return NULL;
+
+    lazy->size = size;
+    lazy->addrs = (void **)(lazy + 1);
+    lazy->strs = (char **)(lazy->addrs + size);
+    lazy->arena = (char *)(lazy->strs + size);
+    lazy->arena_cap = arena_cap;
+    memcpy(lazy->addrs, buffer, (size_t)size * sizeof(void *));
+    return lazy;
+}
+
+/*
+ * Reserve LEN bytes for a cached string, preferring the inline arena
+ * and falling back to overflow chunks.
+ */
+static char *
+lazy_reserve(backtrace_lazy_t *lazy, size_t len)
+{
+    struct lazy_chunk *chunk;
+    size_t cap;
+    char *p;
+
+    if (len <= lazy->arena_cap - lazy->arena_used) {
+        p = lazy->arena + lazy->arena_used;
+        lazy->arena_used += len;
+        return p;
+    }
+
+    chunk = lazy->chunks;
+    if (chunk == NULL || len > chunk->cap - chunk->used) {
+        cap = (len > LAZY_CHUNK_SIZE) ? len : LAZY_CHUNK_SIZE;
+        chunk = malloc(sizeof(*chunk) + cap);
+        if (chunk == NULL)
+            return NULL;
+        chunk->next = lazy->chunks;
+        chunk->used = 0;
+        chunk->cap = cap;
+        lazy->chunks = chunk;
+    }
+    p = chunk->data + chunk->used;
+    chunk->used += len;
+    return p;
+}
+
+const char *
+backtrace_lazy_symbol(backtrace_lazy_t *lazy, int index)
+{
+    char temp[MAX_STACK_BUFFER];
+    Dl_info info;
+    char *str;
+    int len, resolved;
+
+    if (index < 0 || index >= lazy->size)
+        return NULL;
+    if (lazy->strs[index] != NULL)
+        return lazy->strs[index];
+
+    resolved = resolve_frame(lazy->addrs[index], &info);
+    len = format_frame(temp, sizeof(temp), lazy->addrs[index], &info,
+                       resolved);
+    if (len < 0)
+        return NULL;
+
+    str = lazy_reserve(lazy, (size_t)len + 1);
+    if (str == NULL)
+        return NULL;
+    if ((size_t)len < sizeof(temp))
+        memcpy(str, temp, (size_t)len + 1);
+    else
+        format_frame(str, (size_t)len + 1, lazy->addrs[index], &info,
+                     resolved);
+
+    lazy->strs[index] = str;
+    return str;
+}
+
+int
+backtrace_lazy_size(const backtrace_lazy_t *lazy)
+{
+    return lazy->size;
+}
+
+void
+backtrace_lazy_free(backtrace_lazy_t *lazy)
+{
+    struct lazy_chunk *chunk, *next;
+
+    if (lazy == NULL)
+        return;
+    for (chunk = lazy->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    free(lazy);
+}
+
+/*
+ * Memoized symbol arrays.
+ *
+ * An entry is one allocation: a header, the array handed to callers and
+ * its strings, laid out as backtrace_symbols() lays them out, then the
+ * frames it was made for.  Entries are published into a fixed
+ * open-addressed table with compare-and-swap; the table's own reference
+ * keeps the count above zero while an entry is in it.
+ *
+ * The names are only right while the same modules cover the frames, so
+ * an entry records the module map snapshot it was checked against and a
+ * hash of the module, by key and load bias, under each frame.  A lookup
+ * under a newer snapshot rehashes the modules: if they are the same the
+ * entry is stamped with the new snapshot, otherwise it is formatted
+ * again and the new entry replaces the old one in its slot.  Readers
+ * find entries inside a module map read-side section, and a replaced
+ * entry's last release frees it through modmap_defer_free(), so a
+ * lookup takes no lock and the entry it finds cannot go away.  Arrays
+ * made once the probe range is full are never published, and their
+ * last release frees them at once.
+ */
+struct symcache_entry {
+    struct modmap_deferred retire;      /* first: the allocation's start */
+    _Atomic unsigned long refs;
+    _Atomic uint64_t gen;       /* snapshot the modules were last checked in */
+    uint64_t modules;           /* hash of the modules under the frames */
+    uint64_t id;                /* backtrace_hash() of the frames */
+    int size;
+    int published;              /* ever visible in the table */
+    void **frames;
+    char *symbols[];
+};
+
+static struct symcache_entry *_Atomic symcache[SYMCACHE_SLOTS];
+
+static int
+symcache_match(const struct symcache_entry *e, uint64_t id,
+               void *const *buffer, int size)
+{
+    return e->id == id && e->size == size &&
+           memcmp(e->frames, buffer, (size_t)size * sizeof(void *)) == 0;
+}
+
+/* Hash of the module covering each frame in MAP, by key and load bias */
+static uint64_t
+symcache_modules(const struct modmap *map, void *const *buffer, int size)
+{
+    uint64_t h = modmap_id_init(size);
+    int i, m;
+
+    for (i = 0; i < size; i++) {
+        m = map != NULL ? modmap_find(map, (uintptr_t)buffer[i]) : -1;
+        if (m < 0)
+            h = modmap_id_step(h, 0, 0);
+        else
+            h = modmap_id_step(h, map->entries[m].mod.key, map->entries[m].bias);
+    }
+    return h;
+}
+
+/* Whether E's names still hold under MAP; stamps E with MAP if so */
+static int
+symcache_valid(struct symcache_entry *e, const struct modmap *map,
+               void *const *buffer, int size)
+{
+    uint64_t gen = map != NULL ? map->gen : 0;
+
+    if (atomic_load_explicit(&e->gen, memory_order_relaxed) == gen)
+        return 1;
+    if (symcache_modules(map, buffer, size) != e->modules)
+        return 0;
+    atomic_store_explicit(&e->gen, gen, memory_order_relaxed);
+    return 1;
+}
+
+/* Take a reference unless the last one is already gone */
+static int
+symcache_get(struct symcache_entry *e)
+{
+    unsigned long n = atomic_load_explicit(&e->refs, memory_order_relaxed);
+
+    do {
+        if (n == 0)
+            return 0;
+    } while (!atomic_compare_exchange_weak_explicit(&e->refs, &n, n + 1,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed));
+    return 1;
+}
+
+static void
+symcache_put(struct symcache_entry *e)
+{
+    if (atomic_fetch_sub_explicit(&e->refs, 1, memory_order_acq_rel) != 1)
+        return;
+    if (e->published)
+        modmap_defer_free(&e->retire);
+    else
+        free(e);
+}
+
+/* Copy a backtrace_symbols() block into a new entry holding REFS */
+static struct symcache_entry *
+symcache_new(void *const *buffer, int size, uint64_t id, unsigned long refs,
+             const struct modmap *map)
+{
+    struct symcache_entry *e;
+    char **strings, *p;
+    size_t bytes = 0, len, off;
+    uint64_t modules;
+    int i;
+
+    /* Before formatting: a module change meanwhile then fails the check */
+    modules = symcache_modules(map, buffer, size);
+    strings = backtrace_symbols(buffer, size);
+    if (strings == NULL)
+        return NULL;
+    for (i = 0; i < size; i++)
+        bytes += strlen(strings[i]) + 1;
+    off = offsetof(struct symcache_entry, symbols) + (size_t)size * sizeof(char *) + bytes;
+    off = (off + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    e = malloc(off + (size_t)size * sizeof(void *));
+    if (e == NULL) {
+        free(strings);
+        return NULL;
+    }
+    atomic_init(&e->refs, refs);
+    atomic_init(&e->gen, map != NULL ? map->gen : 0);
+    e->modules = modules;
+    e->id = id;
+    e->size = size;
+    e->published = 0;
+    e->frames = (void **)((char *)e + off);
+    memcpy(e->frames, buffer, (size_t)size * sizeof(void *));
+    p = (char *)&e->symbols[size];
+    for (i = 0; i < size; i++) {
+        len = strlen(strings[i]) + 1;
+        memcpy(p, strings[i], len);
+        e->symbols[i] = p;
+        p += len;
+    }
+    free(strings);
+    return e;
+}
+
+const char *const *
+backtrace_symbols_cached(void *const *buffer, int size)
+{
+    struct symcache_entry *_Atomic *slotp;
+    struct symcache_entry *e = NULL, *cur, *expected;
+    const struct modmap *map;
+    uint64_t id;
+    unsigned slot;
+    int i, token;
+
+    if (size <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    id = backtrace_hash(buffer, size);
+    slot = (unsigned)id & (SYMCACHE_SLOTS - 1);
+    token = modmap_enter();
+    map = modmap_sync();
+    for (i = 0; i < SYMCACHE_PROBES; i++) {
+        slotp = &symcache[(slot + i) & (SYMCACHE_SLOTS - 1)];
+        cur = atomic_load_explicit(slotp, memory_order_acquire);
+        if (cur == NULL)
+            break;
+        if (!symcache_match(cur, id, buffer, size))
+            continue;
+        if (!symcache_get(cur)) {
+            /* Replaced and released meanwhile: read the slot again */
+            i--;
+            continue;
+        }
+        if (symcache_valid(cur, map, buffer, size)) {
+            modmap_exit(token);
+            return (const char *const *)cur->symbols;
+        }
+
+        /* Other modules cover the frames now: format again and replace */
+        e = symcache_new(buffer, size, id, 2, map);
+        expected = cur;
+        if (e != NULL) {
+            e->published = 1;
+            if (atomic_compare_exchange_strong_explicit(slotp, &expected, e,
+                                                        memory_order_release,
+                                                        memory_order_acquire)) {
+                symcache_put(cur);      /* the table's reference */
             } else {
-                buf = malloc(len);
-                if (buf == NULL)
-                    return;
+                e->published = 0;
+                atomic_store_explicit(&e->refs, 1, memory_order_relaxed);
+            }
+        }
+        symcache_put(cur);
+        modmap_exit(token);
+        return e != NULL ? (const char *const *)e->symbols : NULL;
+    }
+
+    /* Miss: one reference for the table, one for the caller */
+    e = symcache_new(buffer, size, id, 2, map);
+    if (e == NULL) {
+        modmap_exit(token);
+        return NULL;
+    }
+    e->published = 1;
+    for (; i < SYMCACHE_PROBES; i++) {
+        expected = NULL;
+        if (atomic_compare_exchange_strong_explicit(
+                &symcache[(slot + i) & (SYMCACHE_SLOTS - 1)], &expected, e,
+                memory_order_release, memory_order_acquire)) {
+            modmap_exit(token);
+            return (const char *const *)e->symbols;
+        }
+        if (symcache_match(expected, id, buffer, size)) {
+            /* Another thread published the same stack first */
+            if (symcache_get(expected)) {
+                if (symcache_valid(expected, map, buffer, size)) {
+                    free(e);
+                    modmap_exit(token);
+                    return (const char *const *)expected->symbols;
+                }
+                symcache_put(expected);
             }
-            snprintf(buf, len, "%p\n", buffer[i]);
+            break;
         }
+    }
+    e->published = 0;
+    atomic_store_explicit(&e->refs, 1, memory_order_relaxed);
+    modmap_exit(token);
+    return (const char *const *)e->symbols;
+}
 
-        written = write(fd, buf, strlen(buf));
-        (void)written;
-        if (buf != static_buf)
-            free(buf);
+void
+backtrace_symbols_release(const char *const *symbols)
+{
+    if (symbols == NULL)
+        return;
+    symcache_put((struct symcache_entry *)((char *)symbols -
+                                           offsetof(struct symcache_entry, symbols)));
+}
+
+int
+backtrace_resolve(void *const *buffer, int size, struct backtrace_frame *frames)
+{
+    struct module_ids ids;
+    struct backtrace_frame *f;
+    int i, j, last = -1, nmodules = RESOLVE_MODULE_SLOTS;
+
+    if (size <= 0)
+        return 0;
+
+    ids.count = 0;
+    for (i = 0; i < size; i++) {
+        f = &frames[i];
+        if (!resolve_record(buffer[i], f))
+            continue;
+
+        /* Consecutive frames usually share a module */
+        if (last >= 0 && frames[last].module_base == f->module_base) {
+            f->module = frames[last].module;
+        } else if ((f->module = module_id(&ids, f->module_base)) < 0) {
+            /* More modules than slots: fall back to a linear scan */
+            for (j = 0; j < i; j++) {
+                if (frames[j].module >= RESOLVE_MODULE_SLOTS &&
+                    frames[j].module_base == f->module_base)
+                    break;
+            }
+            f->module = (j < i) ? frames[j].module : nmodules++;
+        }
+        last = i;
     }
+    return size;
 }
@@ -3,6 +3,8 @@
 
 /* Include required system headers */
 #include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint64_t */
+#include <sys/types.h>  /* for pid_t */
 
 #ifdef __cplusplus
 extern "C" {
@@ -150,6 +152,1463 @@ char **backtrace_symbols(void *const *buffer, int size) __THROW __nonnull((1)) _
  */
 void backtrace_symbols_fd(void *const *buffer, int size, int fd) __THROW __nonnull((1));
 
+/**
+ * Opaque compiled output template, see backtrace_format_compile().
+ */
+typedef struct backtrace_format backtrace_format_t;
+
+/**
+ * Compile a line template for backtrace_symbols_format() and
+ * backtrace_symbols_fd_format().
+ *
+ * The template is text with fields in braces:
+ *
+ *   - {pc}      the address, as 0x-prefixed hex
+ *   - {sym}     the nearest symbol, "???" if unknown
+ *   - {off}     decimal offset of the address from {sym}
+ *   - {module}  path of the containing module, "???" if unknown
+ *   - {file}    source file; always "??", as there is no debug line reader
+ *   - {line}    source line; always 0
+ *
+ * and "{{" and "}}" for literal braces.  It is parsed once here; the
+ * result is immutable and may be shared by any number of threads.
+ *
+ * @return New format, or NULL on error (EINVAL for an unknown field or
+ *         an unmatched brace)
+ *
+ * Example:
+ * @code
+ * backtrace_format_t *fmt = backtrace_format_compile("{module}\t{sym}\t{off}");
+ * backtrace_symbols_fd_format(buffer, count, STDERR_FILENO, fmt);
+ * @endcode
+ */
+backtrace_format_t *backtrace_format_compile(const char *tmpl) __THROW __nonnull((1)) __wur;
+
+/**
+ * Free a format from backtrace_format_compile().
+ */
+void backtrace_format_free(backtrace_format_t *fmt) __THROW;
+
+/**
+ * backtrace_symbols() with every line rendered by FMT; NULL gives the
+ * default format.  Free the result with free().
+ */
+char **backtrace_symbols_format(void *const *buffer, int size,
+                                const backtrace_format_t *fmt) __THROW __nonnull((1)) __wur;
+
+/**
+ * backtrace_symbols_fd() with every line rendered by FMT; NULL gives the
+ * default format.
+ */
+void backtrace_symbols_fd_format(void *const *buffer, int size, int fd,
+                                 const backtrace_format_t *fmt) __THROW __nonnull((1));
+
+/**
+ * Flag for the JSON writers: write one frame object per line (NDJSON)
+ * instead of one array per trace.
+ */
+#define BACKTRACE_JSON_NDJSON 0x1
+
+/**
+ * Write the frames in BUFFER as JSON into BUF, as snprintf() would.
+ *
+ * The trace is an array of frame objects followed by a newline, or with
+ * BACKTRACE_JSON_NDJSON one object per line:
+ *
+ *   {"frame":0,"pc":"0x55d0c1a4","symbol":"main","offset":36,
+ *    "module":"/usr/bin/app","module_offset":4516}
+ *
+ * "symbol" and "offset" are null when no symbol covers the address, and
+ * "module" and "module_offset" when no module does.  Strings are
+ * escaped, and bytes that are not UTF-8 are replaced by U+FFFD.  Frames
+ * are streamed as they are resolved; nothing is built in memory.
+ *
+ * @param buf Output buffer; NULL with LEN 0 only measures
+ * @param len Size of BUF; the output is truncated to LEN - 1 bytes
+ * @param flags 0 or BACKTRACE_JSON_NDJSON
+ * @return Length of the complete output, excluding the NUL, or -1
+ */
+int backtrace_symbols_json(void *const *buffer, int size, char *buf, size_t len,
+                           int flags) __THROW __nonnull((1));
+
+/**
+ * Write the frames in BUFFER as JSON to FD, in the format of
+ * backtrace_symbols_json(), through a fixed stack buffer.
+ *
+ * @return 0 on success, -1 on a write error
+ */
+int backtrace_symbols_json_fd(void *const *buffer, int size, int fd, int flags) __THROW __nonnull((1));
+
+/**
+ * Reentrant, allocation-free variant of backtrace_symbols().
+ *
+ * The pointer array and the strings are written into the caller's
+ * buffer MEM, laid out exactly as backtrace_symbols() lays out its
+ * allocation.  Nothing is allocated, so the function can be used from
+ * allocator hooks and real-time threads.  It is not async-signal-safe:
+ * frames are resolved with dladdr(), which takes the dynamic loader's
+ * lock, and formatted with snprintf().
+ *
+ * @param buffer Array of return addresses from backtrace()
+ * @param size Number of addresses in the array
+ * @param mem Caller-provided storage
+ * @param len On input, the size of MEM in bytes; on return, the number
+ *            of bytes used, or the number required if MEM was too small
+ * @return Array of string pointers inside MEM, or NULL with errno set to
+ *         ERANGE if MEM is too small, or EINVAL if SIZE <= 0
+ *
+ * @note Each frame is resolved once even when MEM is too small, so the
+ *       required size is always reported in a single call.
+ *
+ * Example:
+ * @code
+ * static char mem[8192];
+ * size_t len = sizeof(mem);
+ * char **strings = backtrace_symbols_r(buffer, count, mem, &len);
+ * if (strings == NULL && errno == ERANGE)
+ *     fprintf(stderr, "need %zu bytes\n", len);
+ * @endcode
+ */
+char **backtrace_symbols_r(void *const *buffer, int size, void *mem,
+                           size_t *len) __THROW __nonnull((1, 4)) __wur;
+
+/**
+ * Opaque handle returned by backtrace_symbols_lazy().
+ */
+typedef struct backtrace_lazy backtrace_lazy_t;
+
+/**
+ * Create a lazily symbolized view of the addresses in ARRAY.
+ *
+ * Unlike backtrace_symbols(), nothing is resolved up front: each frame
+ * is looked up with dladdr() and formatted the first time it is
+ * requested with backtrace_lazy_symbol(), and the string is cached in
+ * the handle for later calls.  Frames that are never requested cost
+ * nothing beyond copying their address.
+ *
+ * @param buffer Array of return addresses from backtrace()
+ * @param size Number of addresses in the array
+ * @return New handle, or NULL on error
+ *
+ * @note The handle is not thread-safe.  Release it, together with every
+ *       string it has handed out, with backtrace_lazy_free().
+ *
+ * Example:
+ * @code
+ * void *buffer[64];
+ * int count = backtrace(buffer, 64);
+ * backtrace_lazy_t *bt = backtrace_symbols_lazy(buffer, count);
+ * if (bt) {
+ *     for (int i = 0; i < count && i < 3; i++)
+ *         printf("%s\n", backtrace_lazy_symbol(bt, i));
+ *     backtrace_lazy_free(bt);
+ * }
+ * @endcode
+ */
+backtrace_lazy_t *backtrace_symbols_lazy(void *const *buffer, int size) __THROW __nonnull((1)) __wur;
+
+/**
+ * Return the formatted string for frame INDEX of a lazy handle.
+ *
+ * The string has the same format as the entries of backtrace_symbols()
+ * and stays valid until the handle is freed.
+ *
+ * @param lazy Handle from backtrace_symbols_lazy()
+ * @param index Frame index, 0 <= index < backtrace_lazy_size()
+ * @return Formatted frame, or NULL if INDEX is out of range or memory
+ *         could not be allocated
+ */
+const char *backtrace_lazy_symbol(backtrace_lazy_t *lazy, int index) __THROW __nonnull((1));
+
+/**
+ * Return the number of frames held by a lazy handle.
+ */
+int backtrace_lazy_size(const backtrace_lazy_t *lazy) __THROW __nonnull((1)) __pure;
+
+/**
+ * Release a lazy handle and all strings it has cached.
+ *
+ * @param lazy Handle from backtrace_symbols_lazy(), or NULL
+ */
+void backtrace_lazy_free(backtrace_lazy_t *lazy) __THROW;
+
+/**
+ * Memoized backtrace_symbols().
+ *
+ * Results are cached process-wide by stack: a repeated call for the same
+ * addresses costs a backtrace_hash() of BUFFER, a comparison with the
+ * cached addresses, a check of the loader's load and unload counters and
+ * an atomic reference count increment, with no symbol lookup and no
+ * allocation.  The result is shared and immutable; hand it back with
+ * backtrace_symbols_release() instead of free().  Safe to call from any
+ * number of threads.
+ *
+ * The cache keeps up to a few thousand stacks for the life of the
+ * process; once it is full, new stacks are formatted afresh on every
+ * call.  After modules are loaded or unloaded, a cached stack is
+ * formatted again if other modules now cover its addresses, so a library
+ * mapped where an unloaded one was never inherits its names.  Arrays
+ * handed out earlier keep the names they had.
+ *
+ * @param buffer Array of return addresses from backtrace()
+ * @param size Number of addresses in the array
+ * @return Array of SIZE formatted frames, or NULL on error
+ *
+ * Example:
+ * @code
+ * const char *const *strings = backtrace_symbols_cached(buffer, count);
+ * if (strings) {
+ *     log_error(strings, count);
+ *     backtrace_symbols_release(strings);
+ * }
+ * @endcode
+ */
+const char *const *backtrace_symbols_cached(void *const *buffer, int size) __THROW __nonnull((1)) __wur;
+
+/**
+ * Drop a reference from backtrace_symbols_cached().
+ *
+ * @param symbols Array from backtrace_symbols_cached(), or NULL
+ */
+void backtrace_symbols_release(const char *const *symbols) __THROW;
+
+/**
+ * Structured description of one frame, filled in by backtrace_resolve().
+ *
+ * String members point into tables owned by the dynamic loader (the
+ * module's dynamic string table and its link map entry); they are never
+ * copied and must not be freed.  They stay valid until the module that
+ * contains the frame is unloaded with dlclose().
+ */
+struct backtrace_frame {
+    void *pc;                 /* return address from backtrace() */
+    int module;               /* dense module index within the trace, -1 if unknown */
+    void *module_base;        /* load address of the module, NULL if unknown */
+    const char *module_name;  /* path of the module, NULL if unknown */
+    const char *symbol;       /* nearest exported symbol, NULL if unknown */
+    void *symbol_start;       /* address of SYMBOL, NULL if unknown */
+    ptrdiff_t offset;         /* pc - symbol_start, or pc - module_base */
+    const char *file;         /* source file, NULL if no line info */
+    int line;                 /* source line, 0 if no line info */
+};
+
+/**
+ * Resolve the addresses in ARRAY into structured frame records.
+ *
+ * This performs the same dladdr() lookup as backtrace_symbols() but
+ * skips string formatting entirely, which suits callers that emit JSON
+ * or metric labels.  Frames from the same module share a module index,
+ * assigned densely in order of first appearance, so the index can be
+ * used to build a per-trace module table.
+ *
+ * @param buffer Array of return addresses from backtrace()
+ * @param size Number of addresses in the array
+ * @param frames Array of at least SIZE records to fill
+ * @return Number of records filled (SIZE), or 0 if SIZE <= 0
+ *
+ * @note Source file and line are not available from dladdr(); FILE is
+ *       always NULL and LINE always 0 in this implementation.
+ *
+ * Example:
+ * @code
+ * void *buffer[32];
+ * struct backtrace_frame frames[32];
+ * int count = backtrace(buffer, 32);
+ * count = backtrace_resolve(buffer, count, frames);
+ * for (int i = 0; i < count; i++)
+ *     printf("%s+%td\n", frames[i].symbol ? frames[i].symbol : "??",
+ *            frames[i].offset);
+ * @endcode
+ */
+int backtrace_resolve(void *const *buffer, int size,
+                      struct backtrace_frame *frames) __THROW __nonnull((1, 3));
+
+/* Flags for backtrace_foreach() */
+#define BACKTRACE_FOREACH_RESOLVE 0x1  /* fill in symbol and module fields */
+
+/**
+ * Callback invoked by backtrace_foreach() for every frame.
+ *
+ * @param frame Frame record, valid only for the duration of the call
+ * @param index Frame index, 0 being the caller of backtrace_foreach()
+ * @param ctx Context pointer passed to backtrace_foreach()
+ * @return 0 to continue the walk, non-zero to stop it
+ */
+typedef int (*backtrace_callback_t)(const struct backtrace_frame *frame,
+                                    int index, void *ctx);
+
+/**
+ * Walk the current call stack, calling CALLBACK once per frame.
+ *
+ * Frames are produced one at a time as the stack is walked; no address
+ * array is built and the walk stops as soon as CALLBACK returns a
+ * non-zero value, so frames above the one of interest are never
+ * visited.
+ *
+ * Without flags only the pc member of the record is set and the module
+ * index is -1.  With BACKTRACE_FOREACH_RESOLVE each frame is resolved
+ * as by backtrace_resolve() just before the callback sees it; module
+ * indexes are dense over the walk for up to 32 distinct modules and -1
+ * beyond that.
+ *
+ * @param callback Function called for each frame
+ * @param ctx Context pointer handed to CALLBACK
+ * @param flags Bitwise OR of BACKTRACE_FOREACH_* flags
+ * @return The non-zero value that stopped the walk, or 0 if every frame
+ *         was visited
+ *
+ * Example:
+ * @code
+ * static int find_first_foreign(const struct backtrace_frame *f, int i,
+ *                               void *ctx) {
+ *     (void)i;
+ *     if (f->module_base == ctx)
+ *         return 0;
+ *     printf("first foreign frame: %s\n", f->symbol ? f->symbol : "??");
+ *     return 1;
+ * }
+ * backtrace_foreach(find_first_foreign, my_base, BACKTRACE_FOREACH_RESOLVE);
+ * @endcode
+ */
+int backtrace_foreach(backtrace_callback_t callback, void *ctx,
+                      int flags) __nonnull((1));
+
+/**
+ * Compute a 64-bit identifier for the stack in ARRAY.
+ *
+ * Equal address arrays always give the same value, so the result can
+ * be used as a stack ID for aggregation tables and caches.  The value
+ * is never 0, leaving 0 free to mark empty slots.
+ *
+ * @param buffer Array of return addresses from backtrace()
+ * @param size Number of addresses in the array
+ * @return Non-zero hash of the addresses and their count
+ */
+uint64_t backtrace_hash(void *const *buffer, int size) __THROW __nonnull((1)) __pure;
+
+/**
+ * Opaque, precompiled capture filter for backtrace_ex().
+ */
+typedef struct backtrace_filter backtrace_filter_t;
+
+/**
+ * Create an empty capture filter.
+ *
+ * @param skip Number of innermost frames to drop unconditionally, for
+ *             example logging wrappers that always sit on top of the stack
+ * @return New filter, or NULL on error
+ */
+backtrace_filter_t *backtrace_filter_new(int skip) __THROW __wur;
+
+/**
+ * Exclude frames whose call site lies in [START, END).
+ *
+ * @return 0 on success, -1 on error (errno set to EINVAL or ENOMEM)
+ */
+int backtrace_filter_exclude_range(backtrace_filter_t *filter,
+                                   const void *start, const void *end) __THROW __nonnull((1));
+
+/**
+ * Exclude frames from every executable segment of a loaded module.
+ *
+ * NAME matches a module whose path equals NAME, whose file name equals
+ * NAME, or whose file name starts with NAME followed by a dot, so
+ * "libc" and "libc.so" both select "/lib/libc.so.6".  A NULL name
+ * selects the main program.
+ *
+ * The module's address ranges are looked up once, here; capturing with
+ * the filter never consults the loader.  Modules loaded later are not
+ * covered.
+ *
+ * @return Number of modules matched, or -1 with errno set to ENOENT if
+ *         none is loaded, or ENOMEM
+ */
+int backtrace_filter_exclude_module(backtrace_filter_t *filter,
+                                    const char *name) __THROW __nonnull((1));
+
+/**
+ * Release a filter created by backtrace_filter_new().
+ */
+void backtrace_filter_free(backtrace_filter_t *filter) __THROW;
+
+/**
+ * Capture a backtrace, applying FILTER while walking the stack.
+ *
+ * Skipped and excluded frames are never stored, so BUFFER holds up to
+ * SIZE frames that passed the filter and needs no post-processing
+ * before symbolization.  A filter may be shared by any number of
+ * threads once it has been built.
+ *
+ * @param buffer Array to store the return addresses
+ * @param size Maximum number of addresses to store
+ * @param filter Filter to apply, or NULL to behave like backtrace()
+ * @return Number of addresses stored
+ *
+ * Example:
+ * @code
+ * static backtrace_filter_t *log_filter;
+ * log_filter = backtrace_filter_new(3);
+ * backtrace_filter_exclude_module(log_filter, "libc");
+ * ...
+ * int count = backtrace_ex(buffer, 64, log_filter);
+ * @endcode
+ */
+int backtrace_ex(void **buffer, int size,
+                 const backtrace_filter_t *filter) __THROW __nonnull((1)) __wur;
+
+/**
+ * Flag for backtrace_meta(): take the timestamp from the CPU's cycle
+ * counter (TSC on x86_64, CNTVCT on aarch64) instead of CLOCK_MONOTONIC.
+ */
+#define BACKTRACE_META_TSC 0x1
+
+/**
+ * When, where and by which thread a stack was captured, see
+ * backtrace_meta().  Packed into 16 bytes so it can be stored directly
+ * in front of the frames.
+ */
+struct backtrace_meta {
+    uint64_t timestamp;   /**< CLOCK_MONOTONIC ns, or cycles with BACKTRACE_META_TSC */
+    uint32_t tid;         /**< Kernel thread ID */
+    int16_t cpu;          /**< CPU the capture ran on, -1 if unknown */
+    uint8_t flags;        /**< BACKTRACE_META_TSC if timestamp is in cycles */
+    uint8_t depth;        /**< Number of frames captured */
+} __attribute__((packed));
+
+/**
+ * Capture a backtrace like backtrace() and describe it in META.
+ *
+ * No system call is made: the thread ID is cached per thread (and
+ * refreshed in a forked child), the clock is read through the vDSO or
+ * the cycle counter, and the CPU number comes from the thread's rseq
+ * area, or the vDSO getcpu() where rseq is not registered.
+ *
+ * @param buffer Array to store the return addresses
+ * @param size Maximum number of addresses to store, at most EXECINFO_MAX_FRAMES
+ * @param meta Receives the header; meta->depth is the return value
+ * @param flags 0 or BACKTRACE_META_TSC; the flag is ignored where
+ *              there is no cycle counter, and cleared in meta->flags
+ * @return Number of addresses stored
+ */
+int backtrace_meta(void **buffer, int size, struct backtrace_meta *meta,
+                   int flags) __THROW __nonnull((1, 3));
+
+/**
+ * Incremental stack cursor, see backtrace_cursor_init().
+ *
+ * The members are exposed only so that cursors can live on the stack;
+ * read them through the backtrace_cursor_*() accessors.
+ */
+typedef struct backtrace_cursor {
+    void *pc;   /* resume address of the current frame */
+    void *fp;   /* frame pointer of the current frame */
+    void *sp;   /* stack pointer of the current frame at its call site */
+} backtrace_cursor_t;
+
+/**
+ * Initialize CURSOR to describe the frame of the calling function.
+ *
+ * The cursor is then moved towards main() one frame at a time with
+ * backtrace_cursor_step(); every step costs a constant amount of work,
+ * so callers can skip frames cheaply, stop anywhere and resume later.
+ * The difference between the stack pointers of two consecutive frames
+ * is the size of the inner frame.
+ *
+ * The cursor stays valid only while the function that initialized it
+ * has not returned.
+ *
+ * @param cursor Cursor to initialize
+ * @return 0 on success, -1 with errno set to ENOSYS on targets without
+ *         frame records (only x86, x86_64 and aarch64 are supported)
+ *
+ * @note Stack pointers are exact on x86 and x86_64.  On aarch64 the
+ *       frame record may sit below a frame's locals, in which case SP
+ *       is the address just above that record.
+ *
+ * Example:
+ * @code
+ * backtrace_cursor_t c;
+ * if (backtrace_cursor_init(&c) == 0) {
+ *     do {
+ *         printf("pc=%p sp=%p\n", backtrace_cursor_pc(&c),
+ *                backtrace_cursor_sp(&c));
+ *     } while (backtrace_cursor_step(&c) > 0);
+ * }
+ * @endcode
+ */
+int backtrace_cursor_init(backtrace_cursor_t *cursor) __THROW __nonnull((1));
+
+/**
+ * Move CURSOR to the caller of its current frame.
+ *
+ * @param cursor Cursor from backtrace_cursor_init()
+ * @return 1 if the cursor moved, 0 if the outermost frame was reached
+ */
+int backtrace_cursor_step(backtrace_cursor_t *cursor) __THROW __nonnull((1));
+
+/**
+ * Return the resume address (return address) of the cursor's frame.
+ */
+void *backtrace_cursor_pc(const backtrace_cursor_t *cursor) __THROW __nonnull((1)) __pure;
+
+/**
+ * Return the frame pointer of the cursor's frame, or NULL if the frame
+ * chain cannot be followed past it.
+ */
+void *backtrace_cursor_fp(const backtrace_cursor_t *cursor) __THROW __nonnull((1)) __pure;
+
+/**
+ * Return the stack pointer of the cursor's frame at its call site.
+ */
+void *backtrace_cursor_sp(const backtrace_cursor_t *cursor) __THROW __nonnull((1)) __pure;
+
+/**
+ * Stack usage at one point of execution, see backtrace_stack_usage().
+ */
+struct backtrace_stack_usage {
+    uint64_t id;       /* backtrace_hash() of the measured frames */
+    size_t used;       /* bytes between the stack top and the caller's sp */
+    size_t headroom;   /* bytes left before the thread's stack limit */
+    int depth;         /* number of frames measured */
+};
+
+/**
+ * Measure the calling thread's stack usage at the point of the call.
+ *
+ * The caller's frames are walked with the cursor API; the size of each
+ * frame is the distance between its stack pointer and its caller's.
+ * Usage and headroom are measured against the thread's stack bounds,
+ * which are queried once per thread.
+ *
+ * @param usage Receives the totals for the current stack
+ * @param frame_sizes Receives the size in bytes of each frame, innermost
+ *                    (the caller of this function) first; may be NULL
+ * @param size Capacity of FRAME_SIZES, at most EXECINFO_MAX_FRAMES
+ *             are measured; without FRAME_SIZES, 0 measures that many
+ * @return Number of frames measured, or -1 on error (EINVAL if
+ *         FRAME_SIZES is given with SIZE <= 0, ENOSYS on targets
+ *         without frame records)
+ *
+ * @note The outermost frame measured is charged everything up to the
+ *       top of the stack, including the process arguments and
+ *       environment on the main thread.
+ */
+int backtrace_stack_usage(struct backtrace_stack_usage *usage,
+                          size_t *frame_sizes, int size) __THROW __nonnull((1));
+
+/**
+ * Enable the sampling stack usage profiler.
+ *
+ * Once enabled, every PERIOD-th call to backtrace_stackprof_sample() in
+ * each thread measures the stack and folds the result into a fixed-size
+ * table keyed by stack ID that keeps, per distinct stack, the highest
+ * usage and lowest headroom seen, the sample count and the frame sizes.
+ *
+ * @param period Sample one call in PERIOD; 0 disables sampling
+ * @return 0 on success, -1 if the table could not be allocated
+ */
+int backtrace_stackprof_set_period(unsigned period) __THROW;
+
+/**
+ * Sample point for the stack usage profiler.
+ *
+ * Place calls where deep stacks are expected, such as request handlers
+ * or recursion.  When sampling is disabled, or the per-thread countdown
+ * has not expired, the call only reads a counter.  Updates are
+ * lock-free; stacks that do not fit in the table are counted as
+ * dropped.
+ */
+void backtrace_stackprof_sample(void) __THROW;
+
+/**
+ * Write the stack usage table to FD as text.
+ *
+ * Each stack is printed as a header line with its ID, high-water usage,
+ * minimum headroom, sample count and depth, followed by one line per
+ * frame with the frame size in bytes and the symbolized frame.
+ *
+ * @return Number of stacks written, or -1 on error
+ */
+int backtrace_stackprof_dump(int fd) __THROW;
+
+/**
+ * Clear the stack usage table.  Must not race with sampling threads.
+ */
+void backtrace_stackprof_reset(void) __THROW;
+
+/**
+ * Opaque calling-context tree, see backtrace_cct_new().
+ */
+typedef struct backtrace_cct backtrace_cct_t;
+
+/**
+ * Create an empty calling-context tree (CCT).
+ *
+ * A CCT aggregates sampled stacks by shared prefix: each distinct call
+ * path is stored once, as a chain of nodes from the outermost frame
+ * inwards, and every node keeps a self count (samples that ended there)
+ * and a total count (samples that passed through it).  Memory grows
+ * with the number of distinct call paths rather than with the number
+ * of samples.
+ *
+ * @return New tree, or NULL on error
+ *
+ * @note A tree is not thread-safe; serialize inserts or keep one tree
+ *       per thread.
+ */
+backtrace_cct_t *backtrace_cct_new(void) __THROW __wur;
+
+/**
+ * Add COUNT samples of the stack in ARRAY to the tree.
+ *
+ * @param cct Tree from backtrace_cct_new()
+ * @param buffer Array of return addresses from backtrace(), innermost
+ *               frame first
+ * @param size Number of addresses in the array
+ * @param count Weight of the sample, e.g. 1 or a byte count
+ * @return 0 on success, -1 on error; the tree is unchanged on error
+ */
+int backtrace_cct_insert(backtrace_cct_t *cct, void *const *buffer, int size,
+                         uint64_t count) __THROW __nonnull((1, 2));
+
+/**
+ * Return the number of nodes (distinct call path prefixes) in the tree.
+ */
+size_t backtrace_cct_nodes(const backtrace_cct_t *cct) __THROW __nonnull((1)) __pure;
+
+/**
+ * Return the sum of the counts of all inserted samples.
+ */
+uint64_t backtrace_cct_total(const backtrace_cct_t *cct) __THROW __nonnull((1)) __pure;
+
+/**
+ * Write the tree to FD in folded stack format.
+ *
+ * One line is written per node with a non-zero self count: the frame
+ * names from the outermost frame inwards separated by ';', a space and
+ * the count.  This is the input format of flamegraph.pl and most other
+ * flame graph tools.  Frames are named by symbol when dladdr() finds
+ * one, otherwise as module+0xoffset.  Every node is symbolized once,
+ * however many paths it appears in.
+ *
+ * @return 0 on success, -1 on error
+ */
+int backtrace_cct_write_folded(const backtrace_cct_t *cct, int fd) __THROW __nonnull((1));
+
+/**
+ * Release a tree created by backtrace_cct_new().
+ */
+void backtrace_cct_free(backtrace_cct_t *cct) __THROW;
+
+/**
+ * Deepest stack kept by a top-K tracker
+ */
+#define BACKTRACE_TOPK_MAX_DEPTH 64
+
+/**
+ * Opaque heavy-hitter tracker, see backtrace_topk_new().
+ */
+typedef struct backtrace_topk backtrace_topk_t;
+
+/**
+ * One tracked stack returned by backtrace_topk_get().
+ */
+struct backtrace_topk_entry {
+    uint64_t id;                /**< Stack ID, as from backtrace_hash() */
+    uint64_t count;             /**< Estimated count, never an underestimate */
+    uint64_t error;             /**< Maximum overestimate in count */
+    int depth;                  /**< Number of valid frames */
+    void *frames[BACKTRACE_TOPK_MAX_DEPTH]; /**< Innermost frame first */
+};
+
+/**
+ * Create a tracker of the most frequent stacks in bounded memory.
+ *
+ * The tracker uses the Space-Saving algorithm: it keeps CAPACITY
+ * counters, and a stack that is not tracked takes over the smallest
+ * counter.  A stack whose count exceeds roughly total/CAPACITY is
+ * guaranteed to be tracked, and each count carries its maximum error.  Tracking
+ * a few times more stacks than are reported keeps the top of the list
+ * exact in practice.  All memory is allocated here.
+ *
+ * @param capacity Number of stacks tracked
+ * @param max_depth Frames kept per stack, at most BACKTRACE_TOPK_MAX_DEPTH
+ * @return New tracker, or NULL on error (errno EINVAL for bad arguments)
+ *
+ * @note Updates and queries may run concurrently from any thread.
+ */
+backtrace_topk_t *backtrace_topk_new(int capacity, int max_depth) __THROW __wur;
+
+/**
+ * Add COUNT occurrences of the stack in BUFFER.
+ *
+ * Stacks deeper than the tracker's max_depth are truncated before they
+ * are hashed, so they are tracked by their innermost frames.
+ *
+ * @return 0 on success, -1 on error
+ */
+int backtrace_topk_add(backtrace_topk_t *topk, void *const *buffer, int size,
+                       uint64_t count) __THROW __nonnull((1, 2));
+
+/**
+ * Copy up to N of the most frequent stacks into ENTRIES, highest count
+ * first.
+ *
+ * @return Number of entries stored, or -1 on error
+ */
+int backtrace_topk_get(backtrace_topk_t *topk,
+                       struct backtrace_topk_entry *entries, int n)
+    __THROW __nonnull((1, 2));
+
+/**
+ * Release a tracker created by backtrace_topk_new().
+ */
+void backtrace_topk_free(backtrace_topk_t *topk) __THROW;
+
+/**
+ * Longest build-id kept for a module
+ */
+#define BACKTRACE_BUILD_ID_MAX 32
+
+/**
+ * A loaded module, identified independently of where it is mapped.
+ */
+struct backtrace_module {
+    uint64_t key;               /**< Hash of the build-id, or of the path */
+    const char *path;           /**< File name of the module */
+    unsigned char build_id[BACKTRACE_BUILD_ID_MAX]; /**< GNU build-id */
+    int build_id_len;           /**< Bytes of build_id, 0 if none */
+};
+
+/**
+ * Module number of a converted frame that lies outside every module
+ */
+#define BACKTRACE_MODREL_NONE UINT32_MAX
+
+/**
+ * A frame as (module, offset), meaningful outside the capturing process.
+ */
+struct backtrace_modrel {
+    uint32_t module;            /**< Index in the module table, or
+                                     BACKTRACE_MODREL_NONE */
+    uint64_t offset;            /**< Relative to the module's load bias;
+                                     the raw address without a module */
+};
+
+/**
+ * Opaque compact module table, see backtrace_modtab_new().
+ */
+typedef struct backtrace_modtab backtrace_modtab_t;
+
+/**
+ * Create an empty module table.
+ *
+ * A table numbers modules densely in order of first use and holds each
+ * module once, identified by its key (a hash of its build-id), so the
+ * frames of many stacks or processes can refer to modules by a small
+ * index.  Tables are not thread-safe.
+ *
+ * @return New table, or NULL on error
+ */
+backtrace_modtab_t *backtrace_modtab_new(void) __THROW __wur;
+
+/**
+ * Convert return addresses to module-relative frames.
+ *
+ * Every address in BUFFER is looked up in the cached module map and
+ * stored in FRAMES as its module's index in TABLE, which is added on
+ * first use, and its offset from the module's load bias.  The result is
+ * independent of address space layout randomization, so stacks from
+ * different processes and hosts can be merged without symbolizing them.
+ *
+ * @return SIZE on success, -1 on error
+ */
+int backtrace_modrel(void *const *buffer, int size, struct backtrace_modrel *frames,
+                     backtrace_modtab_t *table) __THROW __nonnull((1, 3, 4));
+
+/**
+ * Hash converted frames into a stack ID that is equal for the same
+ * stack in any process, whatever its module numbering.  It matches the
+ * IDs of backtrace_shm_record().
+ */
+uint64_t backtrace_modrel_hash(const struct backtrace_modrel *frames, int size,
+                               const backtrace_modtab_t *table) __THROW __nonnull((1, 3)) __pure;
+
+/**
+ * Add MODULE to TABLE, e.g. when merging another process's table.
+ *
+ * @return Its index in TABLE, existing or new, or -1 on error
+ */
+int backtrace_modtab_add(backtrace_modtab_t *table,
+                         const struct backtrace_module *module) __THROW __nonnull((1, 2));
+
+/**
+ * Return the number of modules in TABLE.
+ */
+int backtrace_modtab_count(const backtrace_modtab_t *table) __THROW __nonnull((1)) __pure;
+
+/**
+ * Return module INDEX of TABLE, or NULL if out of range.  The entry
+ * stays valid until the table is freed.
+ */
+const struct backtrace_module *backtrace_modtab_get(const backtrace_modtab_t *table,
+                                                    int index) __THROW __nonnull((1));
+
+/**
+ * Release a table created by backtrace_modtab_new().
+ */
+void backtrace_modtab_free(backtrace_modtab_t *table) __THROW;
+
+/**
+ * Opaque ELF symbol index, see backtrace_elf_open().
+ */
+typedef struct backtrace_elf backtrace_elf_t;
+
+/**
+ * Index the function symbols of an ELF file for offline symbolization.
+ *
+ * The file is mapped read-only; its symbol table, or the dynamic symbol
+ * table if it is stripped, is sorted once so that lookups are a binary
+ * search.  Use it to name module-relative addresses in a process other
+ * than the one that captured them.
+ *
+ * @param path ELF file of the host's class
+ * @return New index, or NULL on error (errno ENOEXEC if not ELF)
+ */
+backtrace_elf_t *backtrace_elf_open(const char *path) __THROW __nonnull((1)) __wur;
+
+/**
+ * Find the function containing VADDR, an address relative to the
+ * module's load bias.
+ *
+ * @param offset If not NULL, receives VADDR minus the symbol's address
+ * @return Symbol name inside the index, or NULL if none covers VADDR
+ */
+const char *backtrace_elf_lookup(const backtrace_elf_t *elf, uint64_t vaddr,
+                                 uint64_t *offset) __THROW __nonnull((1));
+
+/**
+ * Point *BUILD_ID at the file's GNU build-id and return its length, 0
+ * if it has none.
+ */
+int backtrace_elf_build_id(const backtrace_elf_t *elf,
+                           const unsigned char **build_id) __THROW __nonnull((1, 2));
+
+/**
+ * Release an index created by backtrace_elf_open().
+ */
+void backtrace_elf_close(backtrace_elf_t *elf) __THROW;
+
+/**
+ * Opaque batch symbolizer, see backtrace_symbolizer_new().
+ */
+typedef struct backtrace_symbolizer backtrace_symbolizer_t;
+
+/**
+ * A symbolized address, as resolved by backtrace_symbolize().
+ */
+struct backtrace_symbol {
+    const char *symbol;         /**< Function name, NULL if unknown */
+    uint64_t offset;            /**< Address minus the function's start */
+    const char *module;         /**< File of the containing module, or NULL */
+    uint64_t module_offset;     /**< Relative to the module's load bias;
+                                     the raw address without a module */
+};
+
+/**
+ * Create a symbolizer for large batches of addresses of this process.
+ *
+ * Batches are grouped by module and resolved from ELF symbol indexes, as
+ * backtrace_elf_open(), rather than dladdr(), so symbolization never
+ * takes the dynamic loader's lock.  The indexes of the modules of a
+ * batch are built in parallel and kept for later batches; the lookups
+ * are split into chunks spread over THREADS workers, the caller being
+ * one of them, and idle workers steal chunks from busy ones.  One
+ * symbolizer serves one batch at a time.
+ *
+ * @param threads Workers, including the caller; 0 for one per online CPU
+ * @return New symbolizer, or NULL on error
+ */
+backtrace_symbolizer_t *backtrace_symbolizer_new(int threads) __THROW __wur;
+
+/**
+ * Return the number of workers of S, including the caller.
+ */
+int backtrace_symbolizer_threads(const backtrace_symbolizer_t *s) __THROW __nonnull((1)) __pure;
+
+/**
+ * Symbolize COUNT addresses from BUFFER into OUT.
+ *
+ * Names and module paths point into S and stay valid until it is freed.
+ * Frames in a module without symbols, or outside every module, have a
+ * NULL symbol.
+ *
+ * @return 0 on success, -1 on error
+ */
+int backtrace_symbolize(backtrace_symbolizer_t *s, void *const *buffer, size_t count,
+                        struct backtrace_symbol *out) __THROW __nonnull((1));
+
+/**
+ * Stop the workers of S and release it with its indexes.
+ */
+void backtrace_symbolizer_free(backtrace_symbolizer_t *s) __THROW;
+
+/**
+ * Attach this process to the shared-memory collector segment NAME.
+ *
+ * The process claims a ring of its own in the segment created by
+ * backtrace_shm_create(), usually in the execinfo-collect tool, and
+ * backtrace_shm_record() then writes samples into it.  A forked child
+ * claims a new ring on its first record.
+ *
+ * @return 0 on success, -1 on error (ENOENT if no collector runs,
+ *         ENOSPC if every ring is taken, EBUSY if already attached)
+ */
+int backtrace_shm_attach(const char *name) __THROW __nonnull((1));
+
+/**
+ * Write COUNT samples of the stack in BUFFER to this process's ring.
+ *
+ * Frames are converted to (module, offset) pairs and the stack ID is
+ * hashed from those, so it agrees across processes.  The call never
+ * waits for a lock: when the ring is full, or another thread of the
+ * process is writing to it, the sample is dropped and counted.  Frames
+ * outside the cached module map, such as JIT code, are sent as raw
+ * addresses; for them the map is rebuilt at most every 10 ms, and only
+ * when no other thread is rebuilding it.
+ *
+ * @return 0 on success, -1 on error (EAGAIN for a dropped sample,
+ *         ENOTCONN if not attached)
+ *
+ * @note Not async-signal-safe: a new module may require an allocation.
+ */
+int backtrace_shm_record(void *const *buffer, int size, uint64_t count) __THROW __nonnull((1));
+
+/**
+ * Release this process's ring; the collector drains what is left.
+ */
+void backtrace_shm_detach(void) __THROW;
+
+/**
+ * Opaque collector side of a shared-memory segment.
+ */
+typedef struct backtrace_shm backtrace_shm_t;
+
+/**
+ * One frame of a sample read from shared memory.
+ */
+struct backtrace_shm_frame {
+    const struct backtrace_module *module; /**< NULL if outside any module */
+    uint64_t offset;            /**< Relative to the module's load bias,
+                                     or the raw address without a module */
+};
+
+/**
+ * One sample read from shared memory.
+ */
+struct backtrace_shm_sample {
+    int pid;                    /**< Producing process */
+    uint64_t id;                /**< Stack ID, equal across processes */
+    uint64_t count;
+    int depth;
+    const struct backtrace_shm_frame *frames; /**< Innermost frame first */
+};
+
+/**
+ * Callback for backtrace_shm_drain(); return non-zero to stop.
+ */
+typedef int (*backtrace_shm_callback_t)(const struct backtrace_shm_sample *sample,
+                                        void *ctx);
+
+/**
+ * Create the shared-memory segment NAME with RINGS producer rings.
+ *
+ * A stale segment of the same name is replaced.  The segment is removed
+ * again by backtrace_shm_destroy().
+ *
+ * @param rings Number of processes that can attach at once
+ * @param ring_size Bytes per ring, a power of two of at least 4096
+ * @return New collector handle, or NULL on error
+ */
+backtrace_shm_t *backtrace_shm_create(const char *name, int rings,
+                                      size_t ring_size) __THROW __nonnull((1)) __wur;
+
+/**
+ * Consume every record currently in the segment's rings.
+ *
+ * CALLBACK is called for each sample in ring order; the sample and its
+ * frames are valid only during the call, the modules until the handle
+ * is destroyed.  Rings of detached or dead processes are freed once
+ * empty.  A single thread must drain a segment.
+ *
+ * @return Number of samples delivered
+ */
+int backtrace_shm_drain(backtrace_shm_t *shm, backtrace_shm_callback_t callback,
+                        void *ctx) __THROW __nonnull((1, 2));
+
+/**
+ * Return the number of samples producers have dropped so far.
+ */
+unsigned long backtrace_shm_dropped(const backtrace_shm_t *shm) __THROW __nonnull((1));
+
+/**
+ * Unmap and remove a segment created by backtrace_shm_create().
+ */
+void backtrace_shm_destroy(backtrace_shm_t *shm) __THROW;
+
+/**
+ * Flag for backtrace_samples_init(): use per-thread rings even where
+ * per-CPU rings are available
+ */
+#define BACKTRACE_SAMPLES_PER_THREAD 0x1
+
+/**
+ * One sample read back by backtrace_samples_drain().
+ */
+struct backtrace_sample {
+    int cpu;                    /**< CPU it was written on, -1 if per-thread */
+    int depth;
+    uint64_t value;             /**< Weight given to backtrace_samples_record() */
+    void *const *frames;        /**< Innermost frame first */
+};
+
+/**
+ * Callback for backtrace_samples_drain(); return non-zero to stop.
+ */
+typedef int (*backtrace_sample_callback_t)(const struct backtrace_sample *sample,
+                                           void *ctx);
+
+/**
+ * Set up the process-wide sample buffers.
+ *
+ * On Linux x86_64 with a C library that registers restartable sequences
+ * (rseq), every CPU gets a ring and backtrace_samples_record() commits
+ * into the ring of the CPU it runs on without locks or atomic
+ * instructions, so writers on different cores never share cache lines.
+ * Elsewhere, or with BACKTRACE_SAMPLES_PER_THREAD, every thread gets a
+ * ring of its own instead.
+ *
+ * @param capacity Samples per ring, rounded up to a power of two
+ * @param max_depth Frames kept per sample, at most EXECINFO_MAX_FRAMES
+ * @param flags 0 or BACKTRACE_SAMPLES_PER_THREAD
+ * @return 0 on success, -1 on error (EBUSY if already set up)
+ */
+int backtrace_samples_init(int capacity, int max_depth, int flags) __THROW;
+
+/**
+ * Return 1 if the sample buffers are per-CPU, 0 if per-thread.
+ */
+int backtrace_samples_percpu(void) __THROW;
+
+/**
+ * Write a sample of the stack in BUFFER with weight VALUE.
+ *
+ * Never blocks; a sample that finds its ring full is dropped and
+ * counted.  Stacks deeper than max_depth keep their innermost frames.
+ *
+ * @return 0 on success, -1 on error (EAGAIN if dropped, ENOTCONN if the
+ *         buffers are not set up)
+ *
+ * @note A thread's first sample in per-thread mode allocates its ring.
+ */
+int backtrace_samples_record(void *const *buffer, int size, uint64_t value) __THROW __nonnull((1));
+
+/**
+ * Consume every sample currently buffered, calling CALLBACK for each.
+ * The sample is valid only during the call.  Drains are serialized.
+ *
+ * @return Number of samples delivered, or -1 if not set up
+ */
+int backtrace_samples_drain(backtrace_sample_callback_t callback, void *ctx) __THROW __nonnull((1));
+
+/**
+ * Return the number of samples dropped because a ring was full.
+ */
+unsigned long backtrace_samples_dropped(void) __THROW;
+
+/**
+ * Free the sample buffers.  Must not race with writers or drains.
+ */
+void backtrace_samples_shutdown(void) __THROW;
+
+/**
+ * Opaque writer of rotated profile segments, see
+ * backtrace_profile_writer_new().
+ */
+typedef struct backtrace_profile_writer backtrace_profile_writer_t;
+
+/**
+ * Opaque read-only mapping of one profile segment.
+ */
+typedef struct backtrace_profile backtrace_profile_t;
+
+/**
+ * One sample read from a profile segment.
+ */
+struct backtrace_profile_sample {
+    uint64_t timestamp;         /**< Nanoseconds, as recorded */
+    uint64_t id;                /**< Stack ID, as backtrace_modrel_hash() */
+    uint64_t value;
+    int depth;
+    const struct backtrace_modrel *frames; /**< Innermost frame first,
+                                                inside the mapping */
+    const backtrace_profile_t *profile; /**< Segment, for
+                                             backtrace_profile_module() */
+};
+
+/**
+ * Callback for profile queries; return non-zero to stop.
+ */
+typedef int (*backtrace_profile_callback_t)(const struct backtrace_profile_sample *sample,
+                                            void *ctx);
+
+/**
+ * Create a writer of columnar profile segments in directory DIR.
+ *
+ * Each segment file covers one window of SEGMENT_NS nanoseconds and
+ * holds a module table, a table of distinct stacks and the timestamp,
+ * stack and value of every sample as separate sorted columns.  The
+ * samples of the current window are buffered and the segment is written
+ * when a sample of another window arrives, on backtrace_profile_flush()
+ * or when the writer is freed.  A writer is not thread-safe.
+ *
+ * @param dir Directory for the segments, created if missing
+ * @param segment_ns Length of a segment's time window
+ * @return New writer, or NULL on error (EINVAL if SEGMENT_NS is 0)
+ */
+backtrace_profile_writer_t *backtrace_profile_writer_new(const char *dir,
+                                                         uint64_t segment_ns) __THROW __nonnull((1)) __wur;
+
+/**
+ * Add a sample of the stack in BUFFER, captured in this process, with
+ * weight VALUE at TIMESTAMP nanoseconds, or now (CLOCK_REALTIME) if 0.
+ *
+ * @return 0 on success, -1 on error (a completed segment could not be
+ *         written, the sample is not added)
+ */
+int backtrace_profile_record(backtrace_profile_writer_t *w, uint64_t timestamp,
+                             void *const *buffer, int size, uint64_t value) __THROW __nonnull((1, 3));
+
+/**
+ * Add a sample of module-relative FRAMES, e.g. from
+ * backtrace_shm_drain(), as backtrace_profile_record() does.
+ */
+int backtrace_profile_record_frames(backtrace_profile_writer_t *w, uint64_t timestamp,
+                                    const struct backtrace_shm_frame *frames,
+                                    int depth, uint64_t value) __THROW __nonnull((1, 3));
+
+/**
+ * Write out the buffered samples as a segment now.
+ *
+ * @return 0 on success, -1 on error (the samples stay buffered)
+ */
+int backtrace_profile_flush(backtrace_profile_writer_t *w) __THROW __nonnull((1));
+
+/**
+ * Flush and free a writer.
+ *
+ * @return Result of the final flush
+ */
+int backtrace_profile_writer_free(backtrace_profile_writer_t *w) __THROW;
+
+/**
+ * Map the segment file PATH read-only.
+ *
+ * Only the header and the module and stack tables are checked; columns
+ * are paged in as queries touch them.
+ *
+ * @return New mapping, or NULL on error (EINVAL if not a valid segment)
+ */
+backtrace_profile_t *backtrace_profile_map(const char *path) __THROW __nonnull((1)) __wur;
+
+/**
+ * Call CALLBACK for the samples of PROFILE with START <= timestamp <
+ * END, in time order.  A sparse time index locates the first row, so
+ * only the rows of the window are read.  The sample points into the
+ * mapping and is valid until it is unmapped.
+ *
+ * @return Number of samples delivered, or -1 on a corrupt row
+ */
+int backtrace_profile_window(const backtrace_profile_t *profile, uint64_t start,
+                             uint64_t end, backtrace_profile_callback_t callback,
+                             void *ctx) __THROW __nonnull((1, 4));
+
+/**
+ * Return module INDEX of PROFILE's module table, or NULL if out of range.
+ */
+const struct backtrace_module *backtrace_profile_module(const backtrace_profile_t *profile,
+                                                        uint32_t index) __THROW __nonnull((1));
+
+/**
+ * Release a mapping created by backtrace_profile_map().
+ */
+void backtrace_profile_unmap(backtrace_profile_t *profile) __THROW;
+
+/**
+ * Query the time window [START, END) across the segments in DIR.
+ *
+ * Segments are visited in time order and those outside the window are
+ * skipped after reading their header; files that are not valid segments
+ * are ignored.  The sample is valid only during the call.
+ *
+ * @return Number of samples delivered, or -1 on error
+ */
+int backtrace_profile_query(const char *dir, uint64_t start, uint64_t end,
+                            backtrace_profile_callback_t callback,
+                            void *ctx) __THROW __nonnull((1, 4));
+
+/**
+ * Opaque encoder of binary trace streams, see backtrace_wire_writer_new().
+ */
+typedef struct backtrace_wire_writer backtrace_wire_writer_t;
+
+/**
+ * Opaque streaming decoder, see backtrace_wire_reader_new().
+ */
+typedef struct backtrace_wire_reader backtrace_wire_reader_t;
+
+/**
+ * Flag for backtrace_wire_writer_new(): send symbol names, each once
+ */
+#define BACKTRACE_WIRE_SYMBOLS 0x1
+
+/**
+ * One frame decoded from a trace stream.
+ */
+struct backtrace_wire_frame {
+    uint32_t module;            /**< Index for backtrace_wire_module(), or
+                                     BACKTRACE_MODREL_NONE */
+    uint64_t offset;            /**< As in struct backtrace_modrel */
+    const char *symbol;         /**< NULL if unknown or not sent */
+    uint64_t symbol_offset;     /**< Offset into the symbol */
+};
+
+/**
+ * One trace decoded from a stream.
+ */
+struct backtrace_wire_trace {
+    uint64_t timestamp;         /**< Nanoseconds, as recorded */
+    uint64_t id;                /**< Stack ID, as backtrace_modrel_hash() */
+    int depth;
+    const struct backtrace_wire_frame *frames; /**< Innermost frame first */
+    const backtrace_wire_reader_t *reader; /**< For backtrace_wire_module() */
+};
+
+/**
+ * Callback for decoded traces; return non-zero to stop.
+ */
+typedef int (*backtrace_wire_callback_t)(const struct backtrace_wire_trace *trace,
+                                         void *ctx);
+
+/**
+ * Create an encoder of compact binary trace streams.
+ *
+ * A stream starts with a versioned header and holds length-prefixed
+ * module, symbol and trace records.  Modules are sent once, before the
+ * first trace that uses them, and frames are varint module numbers and
+ * module-relative offsets, so a trace takes a few bytes per frame
+ * instead of a symbolized line.  With BACKTRACE_WIRE_SYMBOLS, names
+ * from dladdr() are interned and sent once as well.  A stream can only
+ * be decoded from its start.  A writer is not thread-safe.
+ *
+ * @param fd Descriptor the stream is written to in 64 KiB batches, or
+ *           -1 to keep it for backtrace_wire_take()
+ * @param flags 0 or BACKTRACE_WIRE_SYMBOLS
+ * @return New writer, or NULL on error (EINVAL for unknown flags)
+ */
+backtrace_wire_writer_t *backtrace_wire_writer_new(int fd, int flags) __THROW __wur;
+
+/**
+ * Append the stack in BUFFER, captured in this process, at TIMESTAMP
+ * nanoseconds, or now (CLOCK_REALTIME) if 0.
+ *
+ * @return 0 on success, -1 on error (the trace is not added)
+ */
+int backtrace_wire_record(backtrace_wire_writer_t *w, uint64_t timestamp,
+                          void *const *buffer, int size) __THROW __nonnull((1, 3));
+
+/**
+ * Move up to LEN bytes of pending stream into BUF.
+ *
+ * @return Bytes copied, 0 once nothing is pending
+ */
+size_t backtrace_wire_take(backtrace_wire_writer_t *w, void *buf,
+                           size_t len) __THROW __nonnull((1));
+
+/**
+ * Write the pending stream to the writer's descriptor now.
+ *
+ * @return 0 on success or without a descriptor, -1 on error (the
+ *         unwritten bytes stay pending)
+ */
+int backtrace_wire_flush(backtrace_wire_writer_t *w) __THROW __nonnull((1));
+
+/**
+ * Flush and free a writer.
+ *
+ * @return Result of the final flush
+ */
+int backtrace_wire_writer_free(backtrace_wire_writer_t *w) __THROW;
+
+/**
+ * Create a decoder that calls CALLBACK for every trace of a stream.
+ *
+ * @return New reader, or NULL on error
+ */
+backtrace_wire_reader_t *backtrace_wire_reader_new(backtrace_wire_callback_t callback,
+                                                   void *ctx) __THROW __nonnull((1)) __wur;
+
+/**
+ * Decode the next LEN bytes of the stream.
+ *
+ * DATA may end anywhere, even inside a record; incomplete records are
+ * kept until the rest arrives.  Records of unknown types are skipped.
+ * When the callback stops, the rest stays buffered and a later call,
+ * possibly with LEN 0, resumes after the trace it stopped at.  The trace
+ * and its strings are valid only during the callback.
+ *
+ * @return Number of traces delivered, or -1 on error (EINVAL for a
+ *         corrupt stream, after which the reader stays failed)
+ */
+int backtrace_wire_feed(backtrace_wire_reader_t *r, const void *data,
+                        size_t len) __THROW __nonnull((1));
+
+/**
+ * Return module INDEX of the stream read so far, or NULL if out of range.
+ */
+const struct backtrace_module *backtrace_wire_module(const backtrace_wire_reader_t *r,
+                                                     uint32_t index) __THROW __nonnull((1));
+
+/**
+ * Release a reader created by backtrace_wire_reader_new().
+ */
+void backtrace_wire_reader_free(backtrace_wire_reader_t *r) __THROW;
+
+/**
+ * Start a background thread serving live profiling commands on the
+ * local socket PATH.
+ *
+ * Each connection sends one command line and reads the response until
+ * the connection is closed:
+ *
+ * - "cpu-profile [seconds [hz]]": sample running threads on a process
+ *   CPU-time timer (default 10 s at 99 Hz) and reply with folded stacks,
+ *   as backtrace_cct_write_folded()
+ * - "threads": the symbolized stack of every other thread
+ * - "heap": the allocator's state, as glibc malloc_info() XML
+ * - "stats": "name value" counter lines
+ *
+ * Samples are taken by a SIGPROF handler that is installed only while
+ * a command runs.  Request threads are interrupted for one frame walk
+ * and never wait for the control thread.  PATH is created with mode
+ * 0600 and only peers of the same user, or root, are served.  A PATH
+ * starting with '@' names a Linux abstract socket instead.
+ *
+ * @return 0 on success, -1 on error (EBUSY if already started)
+ *
+ * @note A program with its own SIGPROF handler gets it back after each
+ *       command, and may see a stray signal.
+ */
+int backtrace_control_start(const char *path) __THROW __nonnull((1));
+
+/**
+ * Stop the control thread, waiting for a running command to finish, and
+ * remove its socket.
+ */
+void backtrace_control_stop(void) __THROW;
+
+/**
+ * Opaque ptrace sampler of another process, see backtrace_remote_attach().
+ */
+typedef struct backtrace_remote backtrace_remote_t;
+
+/**
+ * Attach to every thread of process PID for stack sampling.
+ *
+ * Threads are seized with ptrace but keep running; the target does not
+ * need to link this library.  Executable mappings are read from
+ * /proc/PID/maps and their files indexed for symbols.  All calls on the
+ * handle must come from the thread that attached, as ptrace requires.
+ *
+ * @return New handle, or NULL on error (EPERM without ptrace rights)
+ */
+backtrace_remote_t *backtrace_remote_attach(pid_t pid) __THROW __wur;
+
+/**
+ * Attach to threads started since the last call and store up to SIZE
+ * thread IDs in TIDS, which may be NULL.
+ *
+ * @return Number of attached threads, which may exceed SIZE, or -1 if
+ *         the process is gone
+ */
+int backtrace_remote_threads(backtrace_remote_t *r, pid_t *tids, int size) __THROW __nonnull((1));
+
+/**
+ * Sample the stack of thread TID into FRAMES, innermost first.
+ *
+ * The thread is interrupted just long enough to read its registers and
+ * walk the frame-pointer chain through a copy of its stack, read in
+ * batches with process_vm_readv(); symbolization happens after it
+ * resumes.  Frames point at modules
+ * owned by R, with offsets relative to the load bias as in
+ * backtrace_shm_drain().
+ *
+ * @param id If not NULL, receives the stack ID, equal to the one the
+ *           target's own samplers give the same stack
+ * @return Number of frames, or -1 on error (ESRCH if the thread exited)
+ */
+int backtrace_remote_sample(backtrace_remote_t *r, pid_t tid,
+                            struct backtrace_shm_frame *frames, int size,
+                            uint64_t *id) __THROW __nonnull((1, 3));
+
+/**
+ * Name the function containing FRAME, a frame from
+ * backtrace_remote_sample(), as backtrace_elf_lookup() does.
+ */
+const char *backtrace_remote_symbol(const backtrace_remote_t *r,
+                                    const struct backtrace_shm_frame *frame,
+                                    uint64_t *offset) __THROW __nonnull((1, 2));
+
+/**
+ * Detach from the process and free the handle.
+ */
+void backtrace_remote_detach(backtrace_remote_t *r) __THROW;
+
+/**
+ * Copy the return addresses of the calling thread's active instrumented
+ * calls into BUFFER, innermost first, in constant time.
+ *
+ * Code built with -finstrument-functions calls hooks in this library on
+ * every function entry and exit, which keep a per-thread shadow stack
+ * of up to EXECINFO_MAX_FRAMES return addresses.  Uninstrumented frames
+ * do not appear.
+ *
+ * @return Number of addresses, or 0 if no instrumented call is active
+ *         or the shadow stack overflowed
+ */
+int backtrace_shadow(void **buffer, int size) __THROW __nonnull((1));
+
+/**
+ * Make backtrace() read the shadow stack whenever backtrace_shadow()
+ * would return addresses, instead of walking frames.  Frame 0 is still
+ * the caller of backtrace(), so a trace taken directly from
+ * instrumented code is the same either way.
+ *
+ * @return Previous setting
+ */
+int backtrace_shadow_mode(int enable) __THROW;
+
+/**
+ * Number of active instrumented calls of the calling thread.
+ */
+int backtrace_shadow_depth(void) __THROW __wur;
+
+/**
+ * Drop shadow stack entries above DEPTH, a value saved earlier with
+ * backtrace_shadow_depth(), after a longjmp() out of instrumented calls.
+ */
+void backtrace_shadow_reset(int depth) __THROW;
+
 /* Convenience macros for common usage patterns */
 
 /**
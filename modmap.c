@@ -0,0 +1,475 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+#include "modmap.h"
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+#define MODMAP_PATH_MAX 4096
+#define MODMAP_SHARDS 16             /* reader counter cache lines */
+#define MODMAP_RETRY_NS 10000000ULL  /* between non-blocking refreshes */
+
+/*
+ * Module map snapshots.
+ *
+ * A snapshot is one allocation: the entry array followed by the path
+ * strings.  It is published through an atomic pointer and never changed
+ * afterwards, so readers need no lock.  Rebuilds are serialized by a
+ * mutex; a replaced snapshot goes on the retired chain until no reader
+ * can still hold it.
+ *
+ * Reclamation is epoch based.  A reader counts itself into the current
+ * epoch, in one of two counters chosen by the epoch's parity, and
+ * checks that the epoch did not move meanwhile; readers are therefore
+ * always in the current epoch or the one before.  A replaced snapshot
+ * is stamped with the epoch current after it was unpublished, and only
+ * readers of that epoch or earlier can have loaded it.  The rebuilder
+ * advances the epoch when the counter of the previous one drops to
+ * zero, and frees snapshots two epochs older than the current one.
+ * Readers never wait for the rebuilder, nor it for them: a reader that
+ * stays in its section just postpones the frees.  The counters are
+ * spread over cache lines by thread so that readers on different cores
+ * do not share one.  Other caches read inside sections retire their
+ * objects through the same epochs with modmap_defer_free().
+ */
+
+static struct modmap *_Atomic modmap_cur;
+static pthread_mutex_t modmap_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct modmap *modmap_retired;   /* under modmap_lock */
+static struct modmap_deferred *modmap_deferred; /* under modmap_lock */
+static uint64_t modmap_gen;             /* under modmap_lock */
+static _Atomic uint64_t modmap_epoch;
+static _Atomic uint64_t modmap_retry_at; /* next non-blocking refresh */
+static struct {
+    _Alignas(64) _Atomic unsigned long readers[2];
+} modmap_shards[MODMAP_SHARDS];
+static __thread char modmap_shard_tag;  /* its address picks the shard */
+
+struct modmap_build {
+    struct modmap_entry *entries;
+    int count;
+    int cap;
+    size_t paths;                    /* bytes of path strings */
+    unsigned long long adds, subs;
+};
+
+int
+modmap_enter(void)
+{
+    uint32_t shard = ((uint32_t)((uintptr_t)&modmap_shard_tag >> 6) *
+                      2654435761U) >> 28;
+    uint64_t e;
+
+    for (;;) {
+        e = atomic_load(&modmap_epoch);
+        atomic_fetch_add(&modmap_shards[shard].readers[e & 1], 1);
+        if (atomic_load(&modmap_epoch) == e)
+            return (int)(shard << 1 | (e & 1));
+        /* Advanced meanwhile; count into the new epoch instead */
+        atomic_fetch_sub(&modmap_shards[shard].readers[e & 1], 1);
+    }
+}
+
+void
+modmap_exit(int token)
+{
+    atomic_fetch_sub_explicit(&modmap_shards[token >> 1].readers[token & 1], 1,
+                              memory_order_release);
+}
+
+static int
+modmap_quiet(unsigned parity)
+{
+    int i;
+
+    for (i = 0; i < MODMAP_SHARDS; i++) {
+        if (atomic_load(&modmap_shards[i].readers[parity]) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/* Advance the epoch as far as readers allow and free what is safe */
+static void
+modmap_reclaim(void)
+{
+    struct modmap **pp, *map;
+    struct modmap_deferred **dp, *d;
+    uint64_t e;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        e = atomic_load(&modmap_epoch);
+        /* The epoch before E has the parity of E + 1 */
+        if (!modmap_quiet((unsigned)(e + 1) & 1))
+            break;
+        atomic_store(&modmap_epoch, e + 1);
+    }
+    e = atomic_load(&modmap_epoch);
+    for (pp = &modmap_retired; (map = *pp) != NULL;) {
+        if (map->epoch + 2 <= e) {
+            *pp = map->retired;
+            free(map);
+        } else {
+            pp = &map->retired;
+        }
+    }
+    for (dp = &modmap_deferred; (d = *dp) != NULL;) {
+        if (d->epoch + 2 <= e) {
+            *dp = d->next;
+            free(d);
+        } else {
+            dp = &d->next;
+        }
+    }
+}
+
+void
+modmap_defer_free(struct modmap_deferred *obj)
+{
+    pthread_mutex_lock(&modmap_lock);
+    obj->epoch = atomic_load(&modmap_epoch);
+    obj->next = modmap_deferred;
+    modmap_deferred = obj;
+    modmap_reclaim();
+    pthread_mutex_unlock(&modmap_lock);
+}
+
+uint64_t
+modmap_key(const unsigned char *build_id, int build_id_len, const char *path)
+{
+    const unsigned char *p = build_id;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i, n = (size_t)build_id_len;
+
+    if (build_id_len <= 0) {
+        p = (const unsigned char *)(path ? path : "");
+        n = strlen((const char *)p);
+    }
+    for (i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+/* Copy the GNU build-id note of a loaded module into MOD */
+static void
+read_build_id(const struct dl_phdr_info *info, struct backtrace_module *mod)
+{
+    const ElfW(Nhdr) *note;
+    const char *p, *end;
+    size_t align;
+    int i;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_NOTE)
+            continue;
+        align = ph->p_align == 8 ? 8 : 4;
+        p = (const char *)(info->dlpi_addr + ph->p_vaddr);
+        end = p + ph->p_memsz;
+        while (p + sizeof(*note) <= end) {
+            note = (const ElfW(Nhdr) *)p;
+            p += sizeof(*note);
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                memcmp(p, "GNU", 4) == 0) {
+                p += (note->n_namesz + align - 1) & ~(align - 1);
+                if (note->n_descsz > BACKTRACE_BUILD_ID_MAX ||
+                    p + note->n_descsz > end)
+                    return;
+                memcpy(mod->build_id, p, note->n_descsz);
+                mod->build_id_len = (int)note->n_descsz;
+                return;
+            }
+            p += (note->n_namesz + align - 1) & ~(align - 1);
+            p += (note->n_descsz + align - 1) & ~(align - 1);
+        }
+    }
+}
+
+static int
+build_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct modmap_build *b = data;
+    struct modmap_entry *e;
+    char exe[MODMAP_PATH_MAX];
+    const char *path = info->dlpi_name;
+    uintptr_t start = UINTPTR_MAX, end = 0, s;
+    ssize_t n;
+    int i;
+
+    if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+        b->adds = info->dlpi_adds;
+        b->subs = info->dlpi_subs;
+    }
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X))
+            continue;
+        s = info->dlpi_addr + ph->p_vaddr;
+        if (s < start)
+            start = s;
+        if (s + ph->p_memsz > end)
+            end = s + ph->p_memsz;
+    }
+    if (start >= end)
+        return 0;
+
+    if (b->count == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 32;
+        e = realloc(b->entries, (size_t)b->cap * sizeof(*e));
+        if (e == NULL)
+            return 1;
+        b->entries = e;
+    }
+    e = &b->entries[b->count++];
+    memset(e, 0, sizeof(*e));
+    e->start = start;
+    e->end = end;
+    e->bias = info->dlpi_addr;
+
+    /* The main program has an empty name; ask the kernel for its path */
+    if (path == NULL || path[0] == '\0') {
+        n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        exe[n > 0 ? n : 0] = '\0';
+        path = exe;
+    }
+    read_build_id(info, &e->mod);
+    e->mod.path = strdup(path);
+    if (e->mod.path == NULL) {
+        b->count--;
+        return 1;
+    }
+    b->paths += strlen(path) + 1;
+    e->mod.key = modmap_key(e->mod.build_id, e->mod.build_id_len, path);
+    return 0;
+}
+
+static int
+entry_cmp(const void *a, const void *b)
+{
+    const struct modmap_entry *x = a, *y = b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Build a snapshot; paths are repacked behind the entry array */
+static struct modmap *
+modmap_build(void)
+{
+    struct modmap_build b;
+    struct modmap *map = NULL;
+    char *strings;
+    size_t len;
+    int i;
+
+    memset(&b, 0, sizeof(b));
+    if (dl_iterate_phdr(build_cb, &b) != 0)
+        goto out;
+    qsort(b.entries, (size_t)b.count, sizeof(*b.entries), entry_cmp);
+
+    map = malloc(sizeof(*map) + (size_t)b.count * sizeof(*b.entries) + b.paths);
+    if (map == NULL)
+        goto out;
+    map->adds = b.adds;
+    map->subs = b.subs;
+    map->gen = ++modmap_gen;
+    map->epoch = 0;
+    map->count = b.count;
+    map->entries = (struct modmap_entry *)(map + 1);
+    map->retired = NULL;
+    memcpy(map->entries, b.entries, (size_t)b.count * sizeof(*b.entries));
+    strings = (char *)(map->entries + b.count);
+    for (i = 0; i < b.count; i++) {
+        len = strlen(map->entries[i].mod.path) + 1;
+        memcpy(strings, map->entries[i].mod.path, len);
+        map->entries[i].mod.path = strings;
+        strings += len;
+    }
+
+out:
+    for (i = 0; i < b.count; i++)
+        free((char *)b.entries[i].mod.path);
+    free(b.entries);
+    return map;
+}
+
+static int
+counters_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    unsigned long long *c = data;
+
+    if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+        c[0] = info->dlpi_adds;
+        c[1] = info->dlpi_subs;
+    }
+    return 1;
+}
+
+/* As modmap_refresh(), with modmap_lock held */
+static struct modmap *
+modmap_refresh_locked(struct modmap *old)
+{
+    unsigned long long c[2] = { 0, 0 };
+    struct modmap *map;
+
+    map = atomic_load(&modmap_cur);
+    if (map != old && map != NULL) {
+        /* Somebody else refreshed meanwhile */
+        return map;
+    }
+    if (map != NULL) {
+        dl_iterate_phdr(counters_cb, c);
+        if (c[0] == map->adds && c[1] == map->subs) {
+            if (modmap_retired != NULL)
+                modmap_reclaim();
+            return map;
+        }
+    }
+
+    old = map;
+    map = modmap_build();
+    if (map != NULL) {
+        atomic_store(&modmap_cur, map);
+        if (old != NULL) {
+            /* Unpublished first: later readers cannot find it */
+            old->epoch = atomic_load(&modmap_epoch);
+            old->retired = modmap_retired;
+            modmap_retired = old;
+        }
+        modmap_reclaim();
+    } else {
+        map = old;
+    }
+    return map;
+}
+
+/* Replace the snapshot if the loader state differs from OLD's */
+static struct modmap *
+modmap_refresh(struct modmap *old)
+{
+    struct modmap *map;
+
+    pthread_mutex_lock(&modmap_lock);
+    map = modmap_refresh_locked(old);
+    pthread_mutex_unlock(&modmap_lock);
+    return map;
+}
+
+/*
+ * modmap_refresh() for callers that must not wait: one caller per
+ * MODMAP_RETRY_NS gets to try, and only if no rebuild is running.
+ * Addresses that no module covers therefore cost a loader walk at most
+ * every few milliseconds instead of on every lookup.
+ */
+static struct modmap *
+modmap_try_refresh(struct modmap *old)
+{
+    struct timespec ts;
+    uint64_t now, at;
+    struct modmap *map;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    at = atomic_load_explicit(&modmap_retry_at, memory_order_relaxed);
+    if (now < at ||
+        !atomic_compare_exchange_strong(&modmap_retry_at, &at, now + MODMAP_RETRY_NS) ||
+        pthread_mutex_trylock(&modmap_lock) != 0)
+        return old;
+    map = modmap_refresh_locked(old);
+    pthread_mutex_unlock(&modmap_lock);
+    return map;
+}
+
+const struct modmap *
+modmap_current(void)
+{
+    struct modmap *map;
+
+    map = atomic_load(&modmap_cur);
+    return map != NULL ? map : modmap_refresh(NULL);
+}
+
+int
+modmap_find(const struct modmap *map, uintptr_t pc)
+{
+    int lo = 0, hi = map->count - 1, mid;
+
+    while (lo <= hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pc < map->entries[mid].start)
+            hi = mid - 1;
+        else if (pc >= map->entries[mid].end)
+            lo = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+const struct modmap *
+modmap_sync(void)
+{
+    unsigned long long c[2] = { 0, 0 };
+    struct modmap *map;
+
+    map = atomic_load(&modmap_cur);
+    if (map == NULL)
+        return modmap_refresh(NULL);
+    dl_iterate_phdr(counters_cb, c);
+    if (c[0] == map->adds && c[1] == map->subs)
+        return map;
+    return modmap_refresh(map);
+}
+
+int
+modmap_lookup(uintptr_t pc, const struct modmap **mapp)
+{
+    struct modmap *map;
+    int i;
+
+    map = atomic_load(&modmap_cur);
+    if (map == NULL)
+        map = modmap_refresh(NULL);
+    if (map == NULL) {
+        *mapp = NULL;
+        return -1;
+    }
+    if ((i = modmap_find(map, pc)) < 0) {
+        map = modmap_refresh(map);
+        i = modmap_find(map, pc);
+    }
+    *mapp = map;
+    return i;
+}
+
+int
+modmap_lookup_nowait(uintptr_t pc, const struct modmap **mapp)
+{
+    struct modmap *map;
+    int i = -1;
+
+    map = atomic_load(&modmap_cur);
+    if (map == NULL || (i = modmap_find(map, pc)) < 0) {
+        map = modmap_try_refresh(map);
+        if (map != NULL)
+            i = modmap_find(map, pc);
+    }
+    *mapp = map;
+    return i;
+}
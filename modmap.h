@@ -0,0 +1,139 @@
+#ifndef _MODMAP_H_
+#define _MODMAP_H_
+
+/*
+ * Internal interface to the cached module map.  Not installed.
+ *
+ * A module map is an immutable snapshot of the loaded modules, each with
+ * its executable address range, load bias, path and build-id.  Readers
+ * take the current snapshot without locking; a lookup that misses
+ * rebuilds the snapshot if the loader's add/remove counters moved.
+ *
+ * Replaced snapshots are freed once no reader can still hold them, so
+ * every use of a snapshot, and of the module data in it, must lie
+ * between modmap_enter() and modmap_exit():
+ *
+ *     int token = modmap_enter();
+ *     i = modmap_lookup(pc, &map);
+ *     ... use map->entries[i] ...
+ *     modmap_exit(token);
+ *
+ * Sections may nest and may be entered from signal handlers; they never
+ * block.  Pointers and indices into a snapshot are dead after the exit;
+ * compare snapshots across sections by their generation instead.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "execinfo.h"
+
+struct modmap_entry {
+    uintptr_t start;                 /* executable range [start, end) */
+    uintptr_t end;
+    uintptr_t bias;                  /* load bias, pc - bias = ELF vaddr */
+    struct backtrace_module mod;     /* path, build-id, key */
+};
+
+struct modmap {
+    unsigned long long adds;         /* dl_iterate_phdr counters at build */
+    unsigned long long subs;
+    uint64_t gen;                    /* never reused, unlike the address */
+    uint64_t epoch;                  /* reclamation epoch it was replaced in */
+    int count;
+    struct modmap_entry *entries;    /* sorted by start */
+    struct modmap *retired;          /* next replaced snapshot awaiting free */
+};
+
+/*
+ * Enter a read-side section; pass the result to modmap_exit().
+ */
+int modmap_enter(void);
+void modmap_exit(int token);
+
+/*
+ * Return the current snapshot, building the first one on demand, or
+ * NULL if it cannot be built.  Call inside a read-side section.
+ */
+const struct modmap *modmap_current(void);
+
+/*
+ * Find the module containing PC.  *MAP is set to the snapshot the index
+ * refers to, which is refreshed first when PC is not covered and the
+ * loader state changed.  Returns the entry index or -1.  Call inside a
+ * read-side section.
+ */
+int modmap_lookup(uintptr_t pc, const struct modmap **map);
+
+/*
+ * As modmap_lookup(), but never waits for the module map lock: a miss
+ * refreshes the snapshot only if no rebuild is running and none was
+ * tried in the last few milliseconds.  *MAP may be NULL before the first
+ * snapshot exists.
+ */
+int modmap_lookup_nowait(uintptr_t pc, const struct modmap **map);
+
+/*
+ * Return the current snapshot, rebuilt first if the loader's add/remove
+ * counters moved since it was built, so that a module unloaded and
+ * replaced at the same addresses is never reported as the old one.
+ * Costs a dl_iterate_phdr() call.  Call inside a read-side section.
+ */
+const struct modmap *modmap_sync(void);
+
+/*
+ * Find the module of MAP containing PC, without refreshing.  Returns
+ * the entry index or -1.
+ */
+int modmap_find(const struct modmap *map, uintptr_t pc);
+
+/*
+ * Header of an object that readers may still hold after it was
+ * unpublished, placed at the start of its allocation.
+ */
+struct modmap_deferred {
+    struct modmap_deferred *next;
+    uint64_t epoch;
+};
+
+/*
+ * Free OBJ, already unpublished, once no read-side section that could
+ * have found it remains.  Readers must therefore look such objects up
+ * inside a section.
+ */
+void modmap_defer_free(struct modmap_deferred *obj);
+
+/*
+ * Stable 64-bit key of a module: hash of its build-id, or of its path
+ * when it has none.  Never 0.
+ */
+uint64_t modmap_key(const unsigned char *build_id, int build_id_len,
+                    const char *path);
+
+/*
+ * Process-independent stack ID over (module key, offset) frames: start
+ * with modmap_id_init(), fold every frame in with modmap_id_step() and
+ * finish with modmap_id_final().  Frames outside any module use key 0
+ * and their raw address.
+ */
+static inline uint64_t
+modmap_id_init(int frames)
+{
+    return 0xcbf29ce484222325ULL ^ (uint64_t)frames;
+}
+
+static inline uint64_t
+modmap_id_step(uint64_t h, uint64_t key, uint64_t offset)
+{
+    h ^= key ^ (offset * 0x9e3779b97f4a7c15ULL);
+    h *= 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+static inline uint64_t
+modmap_id_final(uint64_t h)
+{
+    return h ? h : 1;
+}
+
+#endif /* _MODMAP_H_ */
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "execinfo.h"
+#include "modmap.h"
+
+/*
+ * Compact module tables.
+ *
+ * A table numbers modules densely in order of first use and dedupes
+ * them by key, so a converted frame is a small module number plus an
+ * offset.  Entries own a copy of their path and never move once added;
+ * an open-addressed index maps keys to numbers.
+ */
+
+struct backtrace_modtab {
+    struct backtrace_module *modules;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *index;                 /* module number + 1, 0 = empty */
+    uint32_t mask;
+};
+
+backtrace_modtab_t *
+backtrace_modtab_new(void)
+{
+    return calloc(1, sizeof(backtrace_modtab_t));
+}
+
+void
+backtrace_modtab_free(backtrace_modtab_t *table)
+{
+    uint32_t i;
+
+    if (table == NULL)
+        return;
+    for (i = 0; i < table->count; i++)
+        free((char *)table->modules[i].path);
+    free(table->modules);
+    free(table->index);
+    free(table);
+}
+
+static uint32_t
+modtab_slot(const backtrace_modtab_t *table, uint64_t key)
+{
+    uint32_t s = (uint32_t)(key >> 32) & table->mask;
+
+    while (table->index[s] != 0 &&
+           table->modules[table->index[s] - 1].key != key)
+        s = (s + 1) & table->mask;
+    return s;
+}
+
+static int
+modtab_grow(backtrace_modtab_t *table)
+{
+    struct backtrace_module *modules;
+    uint32_t *index, *old = table->index;
+    uint32_t cap = table->cap ? table->cap * 2 : 16, i;
+
+    modules = realloc(table->modules, cap * sizeof(*modules));
+    if (modules == NULL)
+        return -1;
+    table->modules = modules;
+    index = calloc((size_t)cap * 2, sizeof(*index));
+    if (index == NULL)
+        return -1;
+    table->index = index;
+    table->mask = cap * 2 - 1;
+    table->cap = cap;
+    for (i = 0; i < table->count; i++)
+        index[modtab_slot(table, modules[i].key)] = i + 1;
+    free(old);
+    return 0;
+}
+
+int
+backtrace_modtab_add(backtrace_modtab_t *table,
+                     const struct backtrace_module *module)
+{
+    struct backtrace_module *m;
+    uint32_t s;
+
+    if (table->count == table->cap && modtab_grow(table) != 0)
+        return -1;
+    s = modtab_slot(table, module->key);
+    if (table->index[s] != 0)
+        return (int)table->index[s] - 1;
+
+    m = &table->modules[table->count];
+    *m = *module;
+    m->path = strdup(module->path ? module->path : "");
+    if (m->path == NULL)
+        return -1;
+    table->index[s] = ++table->count;
+    return (int)table->count - 1;
+}
+
+int
+backtrace_modtab_count(const backtrace_modtab_t *table)
+{
+    return (int)table->count;
+}
+
+const struct backtrace_module *
+backtrace_modtab_get(const backtrace_modtab_t *table, int index)
+{
+    if (index < 0 || (uint32_t)index >= table->count)
+        return NULL;
+    return &table->modules[index];
+}
+
+int
+backtrace_modrel(void *const *buffer, int size, struct backtrace_modrel *frames,
+                 backtrace_modtab_t *table)
+{
+    const struct modmap *map, *last_map = NULL;
+    const struct modmap_entry *e;
+    int i, m, idx, last_m = -1, last_idx = -1, token;
+    uintptr_t pc;
+
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    token = modmap_enter();
+    for (i = 0; i < size; i++) {
+        pc = (uintptr_t)buffer[i];
+        m = modmap_lookup(pc, &map);
+        if (m < 0) {
+            frames[i].module = BACKTRACE_MODREL_NONE;
+            frames[i].offset = pc;
+            continue;
+        }
+        e = &map->entries[m];
+        /* Neighbouring frames are usually in the same module */
+        if (map == last_map && m == last_m) {
+            idx = last_idx;
+        } else if ((idx = backtrace_modtab_add(table, &e->mod)) < 0) {
+            modmap_exit(token);
+            return -1;
+        }
+        last_map = map;
+        last_m = m;
+        last_idx = idx;
+        frames[i].module = (uint32_t)idx;
+        frames[i].offset = pc - e->bias;
+    }
+    modmap_exit(token);
+    return size;
+}
+
+uint64_t
+backtrace_modrel_hash(const struct backtrace_modrel *frames, int size,
+                      const backtrace_modtab_t *table)
+{
+    uint64_t h = modmap_id_init(size), key;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        key = frames[i].module < table->count ?
+              table->modules[frames[i].module].key : 0;
+        h = modmap_id_step(h, key, frames[i].offset);
+    }
+    return modmap_id_final(h);
+}
@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/sysinfo.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+#if defined(__x86_64__) && defined(__GLIBC__) && defined(__has_include)
+# if __has_include(<sys/rseq.h>)
+#  include <sys/rseq.h>
+#  define HAVE_RSEQ 1
+# endif
+#endif
+
+#define SAMPLES_MAX_CAPACITY (1 << 20) /* slots per ring */
+
+/*
+ * Sample buffers.
+ *
+ * Every CPU has its own ring of fixed-size slots.  A producer on CPU n
+ * writes into ring n inside a restartable sequence: it copies the
+ * sample into the slot at head and commits by storing head + 1, and the
+ * kernel restarts the sequence if the thread is preempted or migrated
+ * before the commit.  Nothing is locked and no atomic instruction is
+ * executed, and the ring's cache lines stay on the CPU that writes
+ * them.  The drain thread is the only consumer; it reads slots up to
+ * head and releases them by advancing tail.
+ *
+ * Without rseq (other architectures, older C libraries, or a thread
+ * whose rseq area is not registered) each thread gets a ring of its own
+ * instead, written with a release store of head.  Rings of exited
+ * threads are handed to new threads.
+ */
+
+struct sample_ring {
+    _Alignas(64) _Atomic uint64_t head;  /* written by producers */
+    _Alignas(64) _Atomic uint64_t tail;  /* written by the consumer */
+    _Atomic unsigned long dropped;
+    _Atomic int owner;                   /* thread rings: 1 while in use */
+    struct sample_ring *next;            /* thread ring list */
+    unsigned char *slots;
+};
+
+/* Slot layout: header, then max_depth frames */
+struct sample_slot {
+    uint32_t depth;
+    int32_t cpu;
+    uint64_t value;
+    void *frames[];
+};
+
+static struct {
+    int ready;
+    int percpu;
+    int ncpus;
+    int max_depth;
+    uint64_t mask;
+    size_t stride;
+    unsigned generation;
+    struct sample_ring *cpus;
+    struct sample_ring *_Atomic threads;
+    pthread_mutex_t lock;                /* init, shutdown and drain */
+} samples = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static __thread struct sample_ring *thread_ring;
+static __thread unsigned thread_generation;
+
+static void
+thread_ring_release(void *ring)
+{
+    /* Rings of an earlier init are gone already */
+    if (ring == thread_ring && thread_generation == samples.generation)
+        atomic_store_explicit(&((struct sample_ring *)ring)->owner, 0,
+                              memory_order_release);
+}
+
+static void
+thread_key_create(void)
+{
+    pthread_key_create(&thread_key, thread_ring_release);
+}
+
+static int
+ring_init(struct sample_ring *ring, uint64_t slots)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = calloc(slots, samples.stride);
+    return ring->slots == NULL ? -1 : 0;
+}
+
+static inline struct sample_slot *
+ring_slot(const struct sample_ring *ring, uint64_t pos)
+{
+    return (struct sample_slot *)(ring->slots +
+                                  (size_t)(pos & samples.mask) * samples.stride);
+}
+
+int
+backtrace_samples_init(int capacity, int max_depth, int flags)
+{
+    uint64_t slots;
+    int i;
+
+    if (capacity <= 0 || capacity > SAMPLES_MAX_CAPACITY || max_depth <= 0 ||
+        max_depth > EXECINFO_MAX_FRAMES ||
+        (flags & ~BACKTRACE_SAMPLES_PER_THREAD) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_once(&thread_key_once, thread_key_create);
+
+    pthread_mutex_lock(&samples.lock);
+    if (samples.ready) {
+        pthread_mutex_unlock(&samples.lock);
+        errno = EBUSY;
+        return -1;
+    }
+    for (slots = 1; slots < (uint64_t)capacity; slots <<= 1)
+        ;
+    samples.mask = slots - 1;
+    samples.max_depth = max_depth;
+    samples.stride = sizeof(struct sample_slot) + (size_t)max_depth * sizeof(void *);
+    samples.percpu = 0;
+    samples.ncpus = 0;
+    samples.cpus = NULL;
+    atomic_store(&samples.threads, NULL);
+
+#ifdef HAVE_RSEQ
+    if (!(flags & BACKTRACE_SAMPLES_PER_THREAD) && __rseq_size >= 20) {
+        samples.ncpus = get_nprocs_conf();
+        samples.cpus = aligned_alloc(64, (size_t)samples.ncpus * sizeof(*samples.cpus));
+        if (samples.cpus == NULL)
+            goto fail;
+        for (i = 0; i < samples.ncpus; i++) {
+            if (ring_init(&samples.cpus[i], slots) != 0) {
+                while (i-- > 0)
+                    free(samples.cpus[i].slots);
+                free(samples.cpus);
+                goto fail;
+            }
+        }
+        samples.percpu = 1;
+    }
+#else
+    (void)i;
+#endif
+
+    samples.generation++;
+    samples.ready = 1;
+    pthread_mutex_unlock(&samples.lock);
+    return 0;
+
+#ifdef HAVE_RSEQ
+fail:
+    pthread_mutex_unlock(&samples.lock);
+    return -1;
+#endif
+}
+
+int
+backtrace_samples_percpu(void)
+{
+    return samples.ready && samples.percpu;
+}
+
+void
+backtrace_samples_shutdown(void)
+{
+    struct sample_ring *r, *next;
+    int i;
+
+    pthread_mutex_lock(&samples.lock);
+    if (samples.ready) {
+        for (i = 0; i < samples.ncpus; i++)
+            free(samples.cpus[i].slots);
+        free(samples.cpus);
+        for (r = atomic_load(&samples.threads); r != NULL; r = next) {
+            next = r->next;
+            free(r->slots);
+            free(r);
+        }
+        atomic_store(&samples.threads, NULL);
+        samples.cpus = NULL;
+        samples.ncpus = 0;
+        samples.ready = 0;
+    }
+    pthread_mutex_unlock(&samples.lock);
+}
+
+/* This thread's ring, reusing one left by an exited thread if possible */
+static struct sample_ring *
+thread_ring_get(void)
+{
+    struct sample_ring *r, *head;
+    int expected;
+
+    if (thread_ring != NULL && thread_generation == samples.generation)
+        return thread_ring;
+
+    for (r = atomic_load_explicit(&samples.threads, memory_order_acquire);
+         r != NULL; r = r->next) {
+        expected = 0;
+        if (atomic_compare_exchange_strong(&r->owner, &expected, 1))
+            goto found;
+    }
+
+    r = aligned_alloc(64, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    if (ring_init(r, samples.mask + 1) != 0) {
+        free(r);
+        return NULL;
+    }
+    atomic_init(&r->owner, 1);
+    head = atomic_load_explicit(&samples.threads, memory_order_relaxed);
+    do {
+        r->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&samples.threads, &head, r,
+                 memory_order_release, memory_order_relaxed));
+
+found:
+    thread_ring = r;
+    thread_generation = samples.generation;
+    pthread_setspecific(thread_key, r);
+    return r;
+}
+
+#ifdef HAVE_RSEQ
+/*
+ * Copy WORDS 8-byte words from SRC to DST and store HEAD + 1 to *HEADP,
+ * as one restartable sequence on CPU.  Returns 0 when committed, or -1
+ * if the thread was moved or preempted, or *HEADP was no longer HEAD.
+ */
+static inline int
+rseq_copy_commit(struct rseq *rs, uint32_t cpu, _Atomic uint64_t *headp,
+                 uint64_t head, void *dst, const void *src, size_t words)
+{
+    __asm__ __volatile__ goto (
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0x0, 0x0\n\t"
+        ".quad 1f, (2f - 1f), 4f\n\t"
+        ".popsection\n\t"
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %[rseq_cs]\n\t"
+        "1:\n\t"
+        "cmpl %[cpu], %[cpu_id]\n\t"
+        "jnz 4f\n\t"
+        "cmpq %[head], %[v]\n\t"
+        "jnz %l[abort]\n\t"
+        "movq %[src], %%rsi\n\t"
+        "movq %[dst], %%rdi\n\t"
+        "movq %[words], %%rcx\n\t"
+        "5:\n\t"
+        "movq (%%rsi), %%rax\n\t"
+        "movq %%rax, (%%rdi)\n\t"
+        "addq $8, %%rsi\n\t"
+        "addq $8, %%rdi\n\t"
+        "decq %%rcx\n\t"
+        "jnz 5b\n\t"
+        "movq %[next], %[v]\n\t"
+        "2:\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        /* The abort handler must follow the signature */
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "jmp %l[abort]\n\t"
+        ".popsection\n\t"
+        :
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id),
+          [rseq_cs] "m" (rs->rseq_cs), [v] "m" (*headp),
+          [head] "r" (head), [next] "r" (head + 1),
+          [src] "r" (src), [dst] "r" (dst), [words] "r" (words)
+        : "memory", "cc", "rax", "rcx", "rsi", "rdi"
+        : abort);
+    return 0;
+abort:
+    return -1;
+}
+
+static inline struct rseq *
+rseq_area(void)
+{
+    return (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+}
+
+#define RSEQ_RETRIES 8
+
+/* Returns 1 if written, 0 if the ring is full, -1 if rseq is unusable */
+static int
+percpu_write(struct sample_slot *slot, size_t words)
+{
+    struct sample_ring *ring;
+    struct rseq *rs = rseq_area();
+    uint64_t head, tail;
+    uint32_t cpu;
+    int i;
+
+    for (i = 0; i < RSEQ_RETRIES; i++) {
+        cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+        if ((int32_t)__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED) < 0 ||
+            cpu >= (uint32_t)samples.ncpus)
+            return -1;
+        ring = &samples.cpus[cpu];
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - tail > samples.mask) {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return 0;
+        }
+        slot->cpu = (int32_t)cpu;
+        if (rseq_copy_commit(rs, cpu, &ring->head, head, ring_slot(ring, head),
+                             slot, words) == 0)
+            return 1;
+    }
+    return -1;
+}
+#endif
+
+int
+backtrace_samples_record(void *const *buffer, int size, uint64_t value)
+{
+    union {
+        struct sample_slot slot;
+        unsigned char bytes[sizeof(struct sample_slot) +
+                            EXECINFO_MAX_FRAMES * sizeof(void *)];
+    } u;
+    struct sample_ring *ring;
+    uint64_t head, tail;
+    size_t bytes;
+
+    if (!samples.ready || size < 0) {
+        errno = samples.ready ? EINVAL : ENOTCONN;
+        return -1;
+    }
+    if (size > samples.max_depth)
+        size = samples.max_depth;
+
+    u.slot.depth = (uint32_t)size;
+    u.slot.cpu = -1;
+    u.slot.value = value;
+    memcpy(u.slot.frames, buffer, (size_t)size * sizeof(void *));
+    bytes = sizeof(u.slot) + (size_t)size * sizeof(void *);
+
+#ifdef HAVE_RSEQ
+    if (samples.percpu) {
+        switch (percpu_write(&u.slot, bytes / 8)) {
+        case 1:
+            return 0;
+        case 0:
+            errno = EAGAIN;
+            return -1;
+        }
+        /* rseq unusable for this thread: fall through to its own ring */
+    }
+#endif
+
+    ring = thread_ring_get();
+    if (ring == NULL)
+        return -1;
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail > samples.mask) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        errno = EAGAIN;
+        return -1;
+    }
+    memcpy(ring_slot(ring, head), &u.slot, bytes);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+static int
+ring_drain(struct sample_ring *ring, backtrace_sample_callback_t callback,
+           void *ctx, int *stop)
+{
+    const struct sample_slot *slot;
+    struct backtrace_sample sample;
+    uint64_t head, tail;
+    int n = 0;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    while (tail < head && !*stop) {
+        slot = ring_slot(ring, tail);
+        sample.cpu = slot->cpu;
+        sample.depth = (int)slot->depth;
+        sample.value = slot->value;
+        sample.frames = slot->frames;
+        n++;
+        *stop = callback(&sample, ctx);
+        tail++;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    return n;
+}
+
+int
+backtrace_samples_drain(backtrace_sample_callback_t callback, void *ctx)
+{
+    struct sample_ring *r;
+    int i, n = 0, stop = 0;
+
+    pthread_mutex_lock(&samples.lock);
+    if (!samples.ready) {
+        pthread_mutex_unlock(&samples.lock);
+        errno = ENOTCONN;
+        return -1;
+    }
+    for (i = 0; i < samples.ncpus && !stop; i++)
+        n += ring_drain(&samples.cpus[i], callback, ctx, &stop);
+    for (r = atomic_load_explicit(&samples.threads, memory_order_acquire);
+         r != NULL && !stop; r = r->next)
+        n += ring_drain(r, callback, ctx, &stop);
+    pthread_mutex_unlock(&samples.lock);
+    return n;
+}
+
+unsigned long
+backtrace_samples_dropped(void)
+{
+    struct sample_ring *r;
+    unsigned long dropped = 0;
+    int i;
+
+    pthread_mutex_lock(&samples.lock);
+    for (i = 0; i < samples.ncpus; i++)
+        dropped += atomic_load(&samples.cpus[i].dropped);
+    for (r = atomic_load(&samples.threads); r != NULL; r = r->next)
+        dropped += atomic_load(&r->dropped);
+    pthread_mutex_unlock(&samples.lock);
+    return dropped;
+}
@@ -0,0 +1,729 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+/*
+ * Columnar profile segments.
+ *
+ * A segment file holds the samples of one time window:
+ *
+ *   header    magic, version, time span and the section table below
+ *   strings   NUL-terminated module paths
+ *   modules   key, build-id and path offset of every module
+ *   stacks    stack ID plus a range of the frames array
+ *   frames    struct backtrace_modrel, innermost first
+ *   columns   timestamp, stack number and value of every sample, each
+ *             column contiguous and sorted by timestamp
+ *   index     the timestamp of every PROFILE_BLOCK-th sample
+ *
+ * Every section is 8-byte aligned and in host layout, so a reader maps
+ * the file and uses the sections in place.  A window query searches the
+ * small index and then reads only the rows inside the window; the page
+ * cache brings in just those pages.
+ *
+ * The writer buffers one segment in memory and writes it out, under a
+ * temporary name renamed into place, when a sample falls into the next
+ * window or on flush.
+ */
+
+#define PROFILE_MAGIC "EXECPRF"
+#define PROFILE_VERSION 1
+#define PROFILE_BLOCK 256
+#define PROFILE_SUFFIX ".prof"
+
+struct profile_section {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct profile_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t block;                  /* rows per index entry */
+    uint64_t window;                 /* start of the segment's window */
+    uint64_t first;                  /* first and last timestamp */
+    uint64_t last;
+    struct profile_section strings;  /* bytes */
+    struct profile_section modules;
+    struct profile_section stacks;
+    struct profile_section frames;
+    struct profile_section timestamps;
+    struct profile_section stack_col;
+    struct profile_section values;
+    struct profile_section index;
+};
+
+struct profile_module {
+    uint64_t key;
+    uint32_t path;                   /* offset into strings */
+    uint32_t build_id_len;
+    unsigned char build_id[BACKTRACE_BUILD_ID_MAX];
+};
+
+struct profile_stack {
+    uint64_t id;
+    uint32_t frame;                  /* first entry in frames */
+    uint32_t depth;
+};
+
+struct profile_row {
+    uint64_t timestamp;
+    uint64_t value;
+    uint32_t stack;
+};
+
+struct backtrace_profile_writer {
+    char *dir;
+    uint64_t segment_ns;
+    uint64_t window;                 /* window of the buffered rows */
+    backtrace_modtab_t *modules;
+    struct profile_stack *stacks;
+    uint32_t nstacks;
+    uint32_t stacks_cap;
+    uint32_t *stack_index;           /* stack number + 1 by ID, 0 = empty */
+    uint32_t stack_mask;
+    struct backtrace_modrel *frames;
+    size_t nframes;
+    size_t frames_cap;
+    struct profile_row *rows;
+    size_t nrows;
+    size_t rows_cap;
+    unsigned seq;                    /* distinguishes segments of one window */
+};
+
+struct backtrace_profile {
+    const unsigned char *map;
+    size_t len;
+    const struct profile_header *hdr;
+    struct backtrace_module *modules;
+    const struct profile_stack *stacks;
+    const struct backtrace_modrel *frames;
+    const uint64_t *timestamps;
+    const uint32_t *stack_col;
+    const uint64_t *values;
+    const uint64_t *index;
+};
+
+static uint64_t
+profile_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void *
+profile_grow(void *array, size_t *cap, size_t need, size_t size)
+{
+    size_t n = *cap ? *cap : 64;
+    void *p;
+
+    if (need <= *cap)
+        return array;
+    while (n < need)
+        n *= 2;
+    p = realloc(array, n * size);
+    if (p != NULL)
+        *cap = n;
+    return p;
+}
+
+backtrace_profile_writer_t *
+backtrace_profile_writer_new(const char *dir, uint64_t segment_ns)
+{
+    backtrace_profile_writer_t *w;
+
+    if (segment_ns == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        return NULL;
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return NULL;
+    w->segment_ns = segment_ns;
+    w->dir = strdup(dir);
+    w->modules = backtrace_modtab_new();
+    if (w->dir == NULL || w->modules == NULL) {
+        backtrace_modtab_free(w->modules);
+        free(w->dir);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+/* Forget the buffered segment, keeping the allocations */
+static int
+profile_reset(backtrace_profile_writer_t *w)
+{
+    backtrace_modtab_free(w->modules);
+    w->modules = backtrace_modtab_new();
+    if (w->modules == NULL)
+        return -1;
+    if (w->stack_index != NULL)
+        memset(w->stack_index, 0, ((size_t)w->stack_mask + 1) * sizeof(*w->stack_index));
+    w->nstacks = 0;
+    w->nframes = 0;
+    w->nrows = 0;
+    return 0;
+}
+
+static int
+profile_row_cmp(const void *a, const void *b)
+{
+    const struct profile_row *x = a, *y = b;
+
+    return (x->timestamp > y->timestamp) - (x->timestamp < y->timestamp);
+}
+
+static int
+profile_put(FILE *fp, const void *data, size_t len, uint64_t *offset)
+{
+    static const char zero[8];
+    size_t pad = (size_t)(-len & 7);
+
+    if ((len && fwrite(data, 1, len, fp) != len) ||
+        (pad && fwrite(zero, 1, pad, fp) != pad))
+        return -1;
+    *offset += len + pad;
+    return 0;
+}
+
+int
+backtrace_profile_flush(backtrace_profile_writer_t *w)
+{
+    struct profile_header hdr;
+    struct profile_module *mods = NULL;
+    const struct backtrace_module *m;
+    uint64_t *col64 = NULL, off;
+    uint32_t *col32 = NULL;
+    size_t i, nblocks, strings = 0, len;
+    char *path = NULL, *tmp = NULL, *strtab = NULL;
+    int nmods, fd, rc = -1;
+    FILE *fp = NULL;
+
+    if (w->nrows == 0)
+        return 0;
+
+    for (i = 1; i < w->nrows && w->rows[i - 1].timestamp <= w->rows[i].timestamp; i++)
+        ;
+    if (i < w->nrows)
+        qsort(w->rows, w->nrows, sizeof(*w->rows), profile_row_cmp);
+
+    /* Module records and their string table */
+    nmods = backtrace_modtab_count(w->modules);
+    for (i = 0; i < (size_t)nmods; i++)
+        strings += strlen(backtrace_modtab_get(w->modules, (int)i)->path) + 1;
+    mods = calloc((size_t)nmods + 1, sizeof(*mods));
+    strtab = malloc(strings + 1);
+    nblocks = (w->nrows + PROFILE_BLOCK - 1) / PROFILE_BLOCK;
+    col64 = malloc((w->nrows > nblocks ? w->nrows : nblocks) * sizeof(*col64));
+    col32 = malloc(w->nrows * sizeof(*col32));
+    if (mods == NULL || strtab == NULL || col64 == NULL || col32 == NULL)
+        goto out;
+    for (i = 0, strings = 0; i < (size_t)nmods; i++) {
+        m = backtrace_modtab_get(w->modules, (int)i);
+        len = strlen(m->path) + 1;
+        memcpy(strtab + strings, m->path, len);
+        mods[i].key = m->key;
+        mods[i].path = (uint32_t)strings;
+        mods[i].build_id_len = (uint32_t)m->build_id_len;
+        memcpy(mods[i].build_id, m->build_id, sizeof(mods[i].build_id));
+        strings += len;
+    }
+
+    if (asprintf(&path, "%s/%016" PRIx64 "-%u" PROFILE_SUFFIX, w->dir, w->window,
+                 w->seq) < 0 ||
+        asprintf(&tmp, "%s/.%016" PRIx64 "-%u.tmp", w->dir, w->window, w->seq) < 0) {
+        path = tmp = NULL;
+        goto out;
+    }
+    /* Never replace a segment an earlier writer left for this window */
+    while (access(path, F_OK) == 0) {
+        free(path);
+        if (asprintf(&path, "%s/%016" PRIx64 "-%u" PROFILE_SUFFIX, w->dir,
+                     w->window, ++w->seq) < 0) {
+            path = NULL;
+            goto out;
+        }
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+        if (fd >= 0)
+            close(fd);
+        goto out;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PROFILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = PROFILE_VERSION;
+    hdr.block = PROFILE_BLOCK;
+    hdr.window = w->window;
+    hdr.first = w->rows[0].timestamp;
+    hdr.last = w->rows[w->nrows - 1].timestamp;
+
+    /* Sections follow the header in the order of the section table */
+    off = sizeof(hdr);
+    if (fseek(fp, (long)off, SEEK_SET) != 0)
+        goto out;
+    hdr.strings.offset = off;
+    hdr.strings.count = strings;
+    if (profile_put(fp, strtab, strings, &off) != 0)
+        goto out;
+    hdr.modules.offset = off;
+    hdr.modules.count = (uint64_t)nmods;
+    if (profile_put(fp, mods, (size_t)nmods * sizeof(*mods), &off) != 0)
+        goto out;
+    hdr.stacks.offset = off;
+    hdr.stacks.count = w->nstacks;
+    if (profile_put(fp, w->stacks, w->nstacks * sizeof(*w->stacks), &off) != 0)
+        goto out;
+    hdr.frames.offset = off;
+    hdr.frames.count = w->nframes;
+    if (profile_put(fp, w->frames, w->nframes * sizeof(*w->frames), &off) != 0)
+        goto out;
+
+    for (i = 0; i < w->nrows; i++)
+        col64[i] = w->rows[i].timestamp;
+    hdr.timestamps.offset = off;
+    hdr.timestamps.count = w->nrows;
+    if (profile_put(fp, col64, w->nrows * sizeof(*col64), &off) != 0)
+        goto out;
+    for (i = 0; i < w->nrows; i++)
+        col32[i] = w->rows[i].stack;
+    hdr.stack_col.offset = off;
+    hdr.stack_col.count = w->nrows;
+    if (profile_put(fp, col32, w->nrows * sizeof(*col32), &off) != 0)
+        goto out;
+    for (i = 0; i < w->nrows; i++)
+        col64[i] = w->rows[i].value;
+    hdr.values.offset = off;
+    hdr.values.count = w->nrows;
+    if (profile_put(fp, col64, w->nrows * sizeof(*col64), &off) != 0)
+        goto out;
+    for (i = 0; i < nblocks; i++)
+        col64[i] = w->rows[i * PROFILE_BLOCK].timestamp;
+    hdr.index.offset = off;
+    hdr.index.count = nblocks;
+    if (profile_put(fp, col64, nblocks * sizeof(*col64), &off) != 0)
+        goto out;
+
+    /* The header goes in last so that a torn file never validates */
+    if (fseek(fp, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fflush(fp) != 0 || fdatasync(fileno(fp)) != 0)
+        goto out;
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        goto out;
+    }
+    fp = NULL;
+    if (rename(tmp, path) != 0)
+        goto out;
+    w->seq++;
+    rc = profile_reset(w);
+
+out:
+    if (fp != NULL) {
+        fclose(fp);
+        unlink(tmp);
+    } else if (rc != 0 && tmp != NULL) {
+        unlink(tmp);
+    }
+    free(path);
+    free(tmp);
+    free(strtab);
+    free(mods);
+    free(col64);
+    free(col32);
+    return rc;
+}
+
+static int
+profile_index_grow(backtrace_profile_writer_t *w)
+{
+    uint32_t mask = w->stack_mask ? w->stack_mask * 2 + 1 : 1023, i, s;
+    uint32_t *index;
+
+    index = calloc((size_t)mask + 1, sizeof(*index));
+    if (index == NULL)
+        return -1;
+    for (i = 0; i < w->nstacks; i++) {
+        for (s = (uint32_t)w->stacks[i].id & mask; index[s] != 0; s = (s + 1) & mask)
+            ;
+        index[s] = i + 1;
+    }
+    free(w->stack_index);
+    w->stack_index = index;
+    w->stack_mask = mask;
+    return 0;
+}
+
+/*
+ * Write out the buffered segment if *TIMESTAMP falls into another window.
+ * Frames must be converted afterwards, as the module table starts over.
+ */
+static int
+profile_rotate(backtrace_profile_writer_t *w, uint64_t *timestamp)
+{
+    uint64_t window;
+
+    if (*timestamp == 0)
+        *timestamp = profile_now();
+    window = *timestamp - *timestamp % w->segment_ns;
+    if (w->nrows > 0 && window != w->window && backtrace_profile_flush(w) != 0)
+        return -1;
+    if (w->nrows == 0 && window != w->window) {
+        w->window = window;
+        w->seq = 0;
+    }
+    return 0;
+}
+
+/* Append a sample of the converted stack in FRAMES */
+static int
+profile_append(backtrace_profile_writer_t *w, uint64_t timestamp,
+               const struct backtrace_modrel *frames, int depth, uint64_t value)
+{
+    struct profile_stack *st;
+    struct profile_row *row;
+    uint64_t id;
+    size_t cap;
+    uint32_t s;
+    void *p;
+
+    id = backtrace_modrel_hash(frames, depth, w->modules);
+    if ((w->nstacks + 1) * 2 > w->stack_mask + 1 && profile_index_grow(w) != 0)
+        return -1;
+    for (s = (uint32_t)id & w->stack_mask; w->stack_index[s] != 0; s = (s + 1) & w->stack_mask) {
+        if (w->stacks[w->stack_index[s] - 1].id == id)
+            break;
+    }
+    if (w->stack_index[s] == 0) {
+        cap = w->stacks_cap;
+        if ((p = profile_grow(w->stacks, &cap, w->nstacks + 1, sizeof(*st))) == NULL)
+            return -1;
+        w->stacks = p;
+        w->stacks_cap = (uint32_t)cap;
+        if ((p = profile_grow(w->frames, &w->frames_cap, w->nframes + (size_t)depth,
+                              sizeof(*frames))) == NULL)
+            return -1;
+        w->frames = p;
+        /* Zero the padding of every frame, it is written out as is */
+        memset(w->frames + w->nframes, 0, (size_t)depth * sizeof(*frames));
+        for (s = 0; s < (uint32_t)depth; s++) {
+            w->frames[w->nframes + s].module = frames[s].module;
+            w->frames[w->nframes + s].offset = frames[s].offset;
+        }
+        st = &w->stacks[w->nstacks];
+        st->id = id;
+        st->frame = (uint32_t)w->nframes;
+        st->depth = (uint32_t)depth;
+        w->nframes += (size_t)depth;
+        for (s = (uint32_t)id & w->stack_mask; w->stack_index[s] != 0;
+             s = (s + 1) & w->stack_mask)
+            ;
+        w->stack_index[s] = ++w->nstacks;
+    }
+
+    if ((p = profile_grow(w->rows, &w->rows_cap, w->nrows + 1, sizeof(*row))) == NULL)
+        return -1;
+    w->rows = p;
+    row = &w->rows[w->nrows++];
+    row->timestamp = timestamp;
+    row->value = value;
+    row->stack = w->stack_index[s] - 1;
+    return 0;
+}
+
+int
+backtrace_profile_record(backtrace_profile_writer_t *w, uint64_t timestamp,
+                         void *const *buffer, int size, uint64_t value)
+{
+    struct backtrace_modrel frames[EXECINFO_MAX_FRAMES];
+
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size > EXECINFO_MAX_FRAMES)
+        size = EXECINFO_MAX_FRAMES;
+    if (profile_rotate(w, &timestamp) != 0 ||
+        backtrace_modrel(buffer, size, frames, w->modules) < 0)
+        return -1;
+    return profile_append(w, timestamp, frames, size, value);
+}
+
+int
+backtrace_profile_record_frames(backtrace_profile_writer_t *w, uint64_t timestamp,
+                                const struct backtrace_shm_frame *frames,
+                                int depth, uint64_t value)
+{
+    struct backtrace_modrel rel[EXECINFO_MAX_FRAMES];
+    int i, idx;
+
+    if (depth < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (depth > EXECINFO_MAX_FRAMES)
+        depth = EXECINFO_MAX_FRAMES;
+    if (profile_rotate(w, &timestamp) != 0)
+        return -1;
+    for (i = 0; i < depth; i++) {
+        rel[i].offset = frames[i].offset;
+        rel[i].module = BACKTRACE_MODREL_NONE;
+        if (frames[i].module != NULL) {
+            if ((idx = backtrace_modtab_add(w->modules, frames[i].module)) < 0)
+                return -1;
+            rel[i].module = (uint32_t)idx;
+        }
+    }
+    return profile_append(w, timestamp, rel, depth, value);
+}
+
+int
+backtrace_profile_writer_free(backtrace_profile_writer_t *w)
+{
+    int rc;
+
+    if (w == NULL)
+        return 0;
+    rc = backtrace_profile_flush(w);
+    backtrace_modtab_free(w->modules);
+    free(w->stacks);
+    free(w->stack_index);
+    free(w->frames);
+    free(w->rows);
+    free(w->dir);
+    free(w);
+    return rc;
+}
+
+/* Check that section S of COUNT elements of SIZE bytes lies in the file */
+static const void *
+profile_section(const backtrace_profile_t *p, const struct profile_section *s,
+                size_t size)
+{
+    if ((s->offset & 7) != 0 || s->offset > p->len ||
+        s->count > (p->len - s->offset) / size)
+        return NULL;
+    return p->map + s->offset;
+}
+
+backtrace_profile_t *
+backtrace_profile_map(const char *path)
+{
+    const struct profile_header *hdr;
+    const struct profile_module *mods;
+    backtrace_profile_t *p;
+    struct stat st;
+    uint64_t i;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        close(fd);
+        return NULL;
+    }
+    p->len = (size_t)st.st_size;
+    p->map = mmap(NULL, p->len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p->map == MAP_FAILED) {
+        free(p);
+        return NULL;
+    }
+
+    hdr = p->hdr = (const struct profile_header *)p->map;
+    mods = profile_section(p, &hdr->modules, sizeof(*mods));
+    p->stacks = profile_section(p, &hdr->stacks, sizeof(*p->stacks));
+    p->frames = profile_section(p, &hdr->frames, sizeof(*p->frames));
+    p->timestamps = profile_section(p, &hdr->timestamps, sizeof(*p->timestamps));
+    p->stack_col = profile_section(p, &hdr->stack_col, sizeof(*p->stack_col));
+    p->values = profile_section(p, &hdr->values, sizeof(*p->values));
+    p->index = profile_section(p, &hdr->index, sizeof(*p->index));
+    if (memcmp(hdr->magic, PROFILE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != PROFILE_VERSION || hdr->block == 0 ||
+        profile_section(p, &hdr->strings, 1) == NULL || mods == NULL ||
+        p->stacks == NULL || p->frames == NULL || p->timestamps == NULL ||
+        p->stack_col == NULL || p->values == NULL || p->index == NULL ||
+        hdr->stack_col.count != hdr->timestamps.count ||
+        hdr->values.count != hdr->timestamps.count ||
+        hdr->index.count != (hdr->timestamps.count + hdr->block - 1) / hdr->block)
+        goto invalid;
+
+    /* Modules are few; give them the public layout up front */
+    p->modules = calloc(hdr->modules.count + 1, sizeof(*p->modules));
+    if (p->modules == NULL) {
+        backtrace_profile_unmap(p);
+        return NULL;
+    }
+    for (i = 0; i < hdr->modules.count; i++) {
+        if (mods[i].path >= hdr->strings.count ||
+            memchr(p->map + hdr->strings.offset + mods[i].path, '\0',
+                   hdr->strings.count - mods[i].path) == NULL ||
+            mods[i].build_id_len > BACKTRACE_BUILD_ID_MAX)
+            goto invalid;
+        p->modules[i].key = mods[i].key;
+        p->modules[i].path = (const char *)p->map + hdr->strings.offset + mods[i].path;
+        p->modules[i].build_id_len = (int)mods[i].build_id_len;
+        memcpy(p->modules[i].build_id, mods[i].build_id, sizeof(mods[i].build_id));
+    }
+    for (i = 0; i < hdr->stacks.count; i++) {
+        if (p->stacks[i].frame > hdr->frames.count ||
+            p->stacks[i].depth > hdr->frames.count - p->stacks[i].frame)
+            goto invalid;
+    }
+    return p;
+
+invalid:
+    backtrace_profile_unmap(p);
+    errno = EINVAL;
+    return NULL;
+}
+
+const struct backtrace_module *
+backtrace_profile_module(const backtrace_profile_t *profile, uint32_t index)
+{
+    if (index >= profile->hdr->modules.count)
+        return NULL;
+    return &profile->modules[index];
+}
+
+static int
+profile_window(const backtrace_profile_t *profile, uint64_t start, uint64_t end,
+               backtrace_profile_callback_t callback, void *ctx, int *stopped)
+{
+    const struct profile_header *hdr = profile->hdr;
+    const struct profile_stack *st;
+    struct backtrace_profile_sample sample;
+    uint64_t lo = 0, hi = hdr->index.count, mid, row, rows = hdr->timestamps.count;
+    int n = 0;
+
+    if (rows == 0 || start >= end || hdr->first >= end || hdr->last < start)
+        return 0;
+
+    /* Last block starting before START; ties may spill into it */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (profile->index[mid] < start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    row = lo > 0 ? (lo - 1) * hdr->block : 0;
+
+    sample.profile = profile;
+    for (; row < rows && profile->timestamps[row] < end; row++) {
+        if (profile->timestamps[row] < start)
+            continue;
+        if (profile->stack_col[row] >= hdr->stacks.count) {
+            errno = EINVAL;
+            return -1;
+        }
+        st = &profile->stacks[profile->stack_col[row]];
+        sample.timestamp = profile->timestamps[row];
+        sample.id = st->id;
+        sample.value = profile->values[row];
+        sample.depth = (int)st->depth;
+        sample.frames = profile->frames + st->frame;
+        n++;
+        if (callback(&sample, ctx) != 0) {
+            *stopped = 1;
+            break;
+        }
+    }
+    return n;
+}
+
+int
+backtrace_profile_window(const backtrace_profile_t *profile, uint64_t start,
+                         uint64_t end, backtrace_profile_callback_t callback,
+                         void *ctx)
+{
+    int stopped = 0;
+
+    return profile_window(profile, start, end, callback, ctx, &stopped);
+}
+
+void
+backtrace_profile_unmap(backtrace_profile_t *profile)
+{
+    if (profile == NULL)
+        return;
+    munmap((void *)profile->map, profile->len);
+    free(profile->modules);
+    free(profile);
+}
+
+static int
+profile_filter(const struct dirent *d)
+{
+    size_t len = strlen(d->d_name), suffix = sizeof(PROFILE_SUFFIX) - 1;
+
+    return d->d_name[0] != '.' && len > suffix &&
+           strcmp(d->d_name + len - suffix, PROFILE_SUFFIX) == 0;
+}
+
+int
+backtrace_profile_query(const char *dir, uint64_t start, uint64_t end,
+                        backtrace_profile_callback_t callback, void *ctx)
+{
+    struct dirent **names;
+    backtrace_profile_t *p;
+    unsigned long long window;
+    char *path;
+    int i, n, rc, total = 0, stopped = 0;
+
+    n = scandir(dir, &names, profile_filter, alphasort);
+    if (n < 0)
+        return -1;
+
+    /* Names sort by window; skip files that start after the query */
+    for (i = 0; i < n; i++) {
+        if (stopped || sscanf(names[i]->d_name, "%16llx", &window) != 1 ||
+            window >= end || asprintf(&path, "%s/%s", dir, names[i]->d_name) < 0) {
+            free(names[i]);
+            continue;
+        }
+        p = backtrace_profile_map(path);
+        free(path);
+        free(names[i]);
+        if (p == NULL)
+            continue;
+        rc = profile_window(p, start, end, callback, ctx, &stopped);
+        backtrace_profile_unmap(p);
+        if (rc < 0) {
+            stopped = 1;
+            total = -1;
+        } else if (total >= 0) {
+            total += rc;
+        }
+    }
+    free(names);
+    return total;
+}
@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+#include "modmap.h"
+
+#if defined(__aarch64__)
+#include <asm/ptrace.h>
+#endif
+
+/*
+ * Sampling another process with ptrace.
+ *
+ * Threads are attached with PTRACE_SEIZE, which leaves them running.  A
+ * sample interrupts one thread, reads its registers and copies the top
+ * of its stack with one process_vm_readv() of page-sized pieces, then
+ * resumes it; the frame chain is walked in the copy afterwards.  Only if
+ * the chain leaves the copy is more stack read, still in one call per
+ * piece, before the thread goes on.
+ *
+ * Executable mappings come from /proc/<pid>/maps.  Each file gets one
+ * module whose key matches what the target's own modmap would compute,
+ * so frames and stack IDs agree with the in-process samplers.
+ */
+
+#define REMOTE_WINDOW (16 * 1024)    /* stack copied per stop */
+#define REMOTE_MAX_STACK (1024 * 1024)
+#define REMOTE_PAGE 4096
+#define FRAME_MAX_SPAN ((uint64_t)64 << 20)
+
+struct remote_module {
+    struct backtrace_module mod;
+    backtrace_elf_t *elf;
+    struct remote_module *next;
+};
+
+struct remote_map {
+    uint64_t start;
+    uint64_t end;
+    uint64_t bias;                   /* pc - bias = ELF vaddr */
+    struct remote_module *module;
+};
+
+struct backtrace_remote {
+    pid_t pid;
+    pid_t *threads;                  /* seized threads */
+    int nthreads;
+    struct remote_map *maps;         /* sorted by start */
+    int nmaps;
+    struct remote_module *modules;   /* never freed before detach */
+    unsigned char *stack;            /* copy of the sampled stack */
+};
+
+struct remote_regs {
+    uint64_t pc;
+    uint64_t sp;
+    uint64_t fp;
+};
+
+static int
+remote_getregs(pid_t tid, struct remote_regs *regs)
+{
+#if defined(__x86_64__)
+    struct user_regs_struct r;
+
+    if (ptrace(PTRACE_GETREGS, tid, NULL, &r) != 0)
+        return -1;
+    regs->pc = r.rip;
+    regs->sp = r.rsp;
+    regs->fp = r.rbp;
+    return 0;
+#elif defined(__aarch64__)
+    struct user_pt_regs r;
+    struct iovec iov = { &r, sizeof(r) };
+
+    if (ptrace(PTRACE_GETREGSET, tid, (void *)NT_PRSTATUS, &iov) != 0)
+        return -1;
+    regs->pc = r.pc;
+    regs->sp = r.sp;
+    regs->fp = r.regs[29];
+    return 0;
+#else
+    (void)tid;
+    (void)regs;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * Load bias of a mapping of PATH at START from file offset OFFSET: the
+ * load segment holding OFFSET tells which vaddr the mapping starts at.
+ */
+static int
+remote_bias(const char *path, uint64_t start, uint64_t offset, uint64_t *bias)
+{
+    ElfW(Ehdr) eh;
+    ElfW(Phdr) ph;
+    int fd, i, rc = -1;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (pread(fd, &eh, sizeof(eh), 0) == (ssize_t)sizeof(eh) &&
+        memcmp(eh.e_ident, ELFMAG, SELFMAG) == 0 &&
+        eh.e_phentsize == sizeof(ph)) {
+        for (i = 0; i < eh.e_phnum; i++) {
+            if (pread(fd, &ph, sizeof(ph), (off_t)(eh.e_phoff + (uint64_t)i * sizeof(ph))) !=
+                (ssize_t)sizeof(ph))
+                break;
+            if (ph.p_type == PT_LOAD && offset >= (ph.p_offset & ~(uint64_t)(REMOTE_PAGE - 1)) &&
+                offset < ph.p_offset + ph.p_filesz) {
+                *bias = start - offset + ph.p_offset - ph.p_vaddr;
+                rc = 0;
+                break;
+            }
+        }
+    }
+    close(fd);
+    return rc;
+}
+
+static struct remote_module *
+remote_module(backtrace_remote_t *r, const char *path)
+{
+    struct remote_module *m;
+    const unsigned char *id;
+    int len;
+
+    for (m = r->modules; m != NULL; m = m->next) {
+        if (strcmp(m->mod.path, path) == 0)
+            return m;
+    }
+    m = calloc(1, sizeof(*m));
+    if (m == NULL || (m->mod.path = strdup(path)) == NULL) {
+        free(m);
+        return NULL;
+    }
+    /* The index serves both the build-id and later symbol lookups */
+    m->elf = backtrace_elf_open(path);
+    if (m->elf != NULL && (len = backtrace_elf_build_id(m->elf, &id)) > 0 &&
+        len <= BACKTRACE_BUILD_ID_MAX) {
+        memcpy(m->mod.build_id, id, (size_t)len);
+        m->mod.build_id_len = len;
+    }
+    m->mod.key = modmap_key(m->mod.build_id, m->mod.build_id_len, path);
+    m->next = r->modules;
+    r->modules = m;
+    return m;
+}
+
+static int
+remote_map_cmp(const void *a, const void *b)
+{
+    const struct remote_map *x = a, *y = b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Reread the executable mappings of the target */
+static int
+remote_load_maps(backtrace_remote_t *r)
+{
+    unsigned long long start, end, offset;
+    struct remote_map *maps = NULL, *m;
+    char file[64], perms[8], *line = NULL, *path;
+    size_t cap = 0;
+    int n = 0, alloc = 0, pos;
+    uint64_t bias;
+    FILE *fp;
+
+    snprintf(file, sizeof(file), "/proc/%d/maps", (int)r->pid);
+    fp = fopen(file, "re");
+    if (fp == NULL)
+        return -1;
+    while (getline(&line, &cap, fp) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n", &start, &end, perms,
+                   &offset, &pos) != 4 || perms[2] != 'x')
+            continue;
+        path = line + pos;
+        if (path[0] != '/' || remote_bias(path, start, offset, &bias) != 0)
+            continue;
+        if (n == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            m = realloc(maps, (size_t)alloc * sizeof(*m));
+            if (m == NULL)
+                break;
+            maps = m;
+        }
+        m = &maps[n];
+        m->start = start;
+        m->end = end;
+        m->bias = bias;
+        if ((m->module = remote_module(r, path)) != NULL)
+            n++;
+    }
+    free(line);
+    fclose(fp);
+    qsort(maps, (size_t)n, sizeof(*maps), remote_map_cmp);
+    free(r->maps);
+    r->maps = maps;
+    r->nmaps = n;
+    return 0;
+}
+
+static const struct remote_map *
+remote_find(const backtrace_remote_t *r, uint64_t pc)
+{
+    int lo = 0, hi = r->nmaps - 1, mid;
+
+    while (lo <= hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pc < r->maps[mid].start)
+            hi = mid - 1;
+        else if (pc >= r->maps[mid].end)
+            lo = mid + 1;
+        else
+            return &r->maps[mid];
+    }
+    return NULL;
+}
+
+static int
+remote_seize(backtrace_remote_t *r, pid_t tid)
+{
+    pid_t *t;
+    int i;
+
+    for (i = 0; i < r->nthreads; i++) {
+        if (r->threads[i] == tid)
+            return 0;
+    }
+    if (ptrace(PTRACE_SEIZE, tid, NULL, NULL) != 0)
+        return -1;
+    t = realloc(r->threads, (size_t)(r->nthreads + 1) * sizeof(*t));
+    if (t == NULL) {
+        ptrace(PTRACE_DETACH, tid, NULL, NULL);
+        return -1;
+    }
+    r->threads = t;
+    r->threads[r->nthreads++] = tid;
+    return 0;
+}
+
+static void
+remote_forget(backtrace_remote_t *r, pid_t tid)
+{
+    int i;
+
+    for (i = 0; i < r->nthreads; i++) {
+        if (r->threads[i] == tid) {
+            r->threads[i] = r->threads[--r->nthreads];
+            return;
+        }
+    }
+}
+
+backtrace_remote_t *
+backtrace_remote_attach(pid_t pid)
+{
+    backtrace_remote_t *r;
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    r->pid = pid;
+    r->stack = malloc(REMOTE_MAX_STACK);
+    if (r->stack == NULL || remote_load_maps(r) != 0 ||
+        backtrace_remote_threads(r, NULL, 0) <= 0) {
+        backtrace_remote_detach(r);
+        return NULL;
+    }
+    return r;
+}
+
+int
+backtrace_remote_threads(backtrace_remote_t *r, pid_t *tids, int size)
+{
+    struct dirent *d;
+    char dir[64];
+    pid_t tid;
+    DIR *dp;
+    int i, err = 0;
+
+    snprintf(dir, sizeof(dir), "/proc/%d/task", (int)r->pid);
+    dp = opendir(dir);
+    if (dp == NULL)
+        return -1;
+    while ((d = readdir(dp)) != NULL) {
+        tid = (pid_t)atoi(d->d_name);
+        if (tid > 0 && remote_seize(r, tid) != 0 && errno != ESRCH)
+            err = errno;
+    }
+    closedir(dp);
+    if (r->nthreads == 0) {
+        errno = err ? err : ESRCH;
+        return -1;
+    }
+    for (i = 0; tids != NULL && i < r->nthreads && i < size; i++)
+        tids[i] = r->threads[i];
+    return r->nthreads;
+}
+
+/*
+ * Stop TID, passing on any signal that arrives first; 0 when stopped.
+ * *GROUP is set if the stop is a job-control group-stop rather than our
+ * interrupt, so that remote_resume() leaves the thread stopped.
+ */
+static int
+remote_stop(backtrace_remote_t *r, pid_t tid, int *group)
+{
+    int status;
+
+    *group = 0;
+    if (ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) != 0)
+        return -1;
+    for (;;) {
+        if (waitpid(tid, &status, __WALL) != tid)
+            return -1;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            remote_forget(r, tid);
+            errno = ESRCH;
+            return -1;
+        }
+        if (!WIFSTOPPED(status))
+            continue;
+        /* Our interrupt traps with SIGTRAP, a group-stop with its signal */
+        if ((status >> 16) == PTRACE_EVENT_STOP) {
+            *group = WSTOPSIG(status) != SIGTRAP;
+            return 0;
+        }
+        /* A signal for the thread got in first: deliver it, stop again */
+        if (ptrace(PTRACE_CONT, tid, NULL,
+                   (void *)(uintptr_t)((status >> 16) == 0 ? WSTOPSIG(status) : 0)) != 0 ||
+            ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) != 0)
+            return -1;
+    }
+}
+
+/* Let TID go on after remote_stop(); a group-stopped thread stays stopped */
+static void
+remote_resume(pid_t tid, int group)
+{
+    ptrace(group ? PTRACE_LISTEN : PTRACE_CONT, tid, NULL, NULL);
+}
+
+/* Copy [ADDR, ADDR + LEN) of the target into BUF, page by page */
+static size_t
+remote_read(pid_t pid, void *buf, uint64_t addr, size_t len)
+{
+    struct iovec local, remote[REMOTE_WINDOW / REMOTE_PAGE];
+    size_t done = 0, chunk;
+    ssize_t n;
+    int i;
+
+    /* One call reads up to a window; it stops at the first bad page */
+    while (done < len) {
+        chunk = len - done < REMOTE_WINDOW ? len - done : REMOTE_WINDOW;
+        for (i = 0; (size_t)i * REMOTE_PAGE < chunk; i++) {
+            remote[i].iov_base = (void *)(uintptr_t)(addr + done + (uint64_t)i * REMOTE_PAGE);
+            remote[i].iov_len = chunk - (size_t)i * REMOTE_PAGE < REMOTE_PAGE ?
+                                chunk - (size_t)i * REMOTE_PAGE : REMOTE_PAGE;
+        }
+        local.iov_base = (char *)buf + done;
+        local.iov_len = chunk;
+        n = process_vm_readv(pid, &local, 1, remote, (unsigned long)i, 0);
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+        if ((size_t)n < chunk)
+            break;
+    }
+    return done;
+}
+
+int
+backtrace_remote_sample(backtrace_remote_t *r, pid_t tid,
+                        struct backtrace_shm_frame *frames, int size, uint64_t *id)
+{
+    struct remote_regs regs;
+    const struct remote_map *map;
+    uint64_t base, fp, next, ret, h, pcs[EXECINFO_MAX_FRAMES];
+    size_t have, want;
+    int depth = 0, i, refreshed = 0, group;
+
+    if (size <= 0)
+        return 0;
+    if (size > EXECINFO_MAX_FRAMES)
+        size = EXECINFO_MAX_FRAMES;
+    if (remote_stop(r, tid, &group) != 0)
+        return -1;
+
+    /*
+     * Stopped: registers, then the top of the stack, more only if the
+     * frame chain runs past it.  Frame records are two words: the
+     * caller's frame pointer and the return address.
+     */
+    if (remote_getregs(tid, &regs) != 0) {
+        remote_resume(tid, group);
+        return -1;
+    }
+    base = regs.sp;
+    have = remote_read(r->pid, r->stack, base, REMOTE_WINDOW);
+    pcs[depth++] = regs.pc;
+    /* Bounds are offsets from BASE: a wild FP must not wrap around */
+    for (fp = regs.fp; depth < size && fp >= base && (fp & 7) == 0;) {
+        if (fp - base > REMOTE_MAX_STACK - 16)
+            break;
+        if (have < 16 || fp - base > have - 16) {
+            want = (size_t)(fp - base) + 16;
+            want = (want + REMOTE_WINDOW - 1) & ~(size_t)(REMOTE_WINDOW - 1);
+            if (have < want && want <= REMOTE_MAX_STACK && have % REMOTE_WINDOW == 0)
+                have += remote_read(r->pid, r->stack + have, base + have, want - have);
+            if (have < 16 || fp - base > have - 16)
+                break;
+        }
+        memcpy(&next, r->stack + (fp - base), sizeof(next));
+        memcpy(&ret, r->stack + (fp - base) + 8, sizeof(ret));
+        if (ret == 0)
+            break;
+        pcs[depth++] = ret;
+        if (next <= fp || next - fp > FRAME_MAX_SPAN)
+            break;
+        fp = next;
+    }
+    remote_resume(tid, group);
+
+    /* Resumed: convert to module-relative frames */
+    h = modmap_id_init(depth);
+    for (i = 0; i < depth; i++) {
+        map = remote_find(r, pcs[i]);
+        if (map == NULL && !refreshed) {
+            /* A library loaded since the last look */
+            refreshed = 1;
+            remote_load_maps(r);
+            map = remote_find(r, pcs[i]);
+        }
+        frames[i].module = map != NULL ? &map->module->mod : NULL;
+        frames[i].offset = map != NULL ? pcs[i] - map->bias : pcs[i];
+        h = modmap_id_step(h, map != NULL ? map->module->mod.key : 0, frames[i].offset);
+    }
+    if (id != NULL)
+        *id = modmap_id_final(h);
+    return depth;
+}
+
+const char *
+backtrace_remote_symbol(const backtrace_remote_t *r,
+                        const struct backtrace_shm_frame *frame, uint64_t *offset)
+{
+    const struct remote_module *m;
+
+    /* Frames point at the mod member, first in struct remote_module */
+    for (m = r->modules; m != NULL; m = m->next) {
+        if (&m->mod == frame->module)
+            return m->elf != NULL ?
+                   backtrace_elf_lookup(m->elf, frame->offset, offset) : NULL;
+    }
+    return NULL;
+}
+
+void
+backtrace_remote_detach(backtrace_remote_t *r)
+{
+    struct remote_module *m, *next;
+    pid_t tid;
+    int group;
+
+    if (r == NULL)
+        return;
+    /* Detaching needs a stopped thread; exited ones drop out */
+    while (r->nthreads > 0) {
+        tid = r->threads[r->nthreads - 1];
+        if (remote_stop(r, tid, &group) == 0)
+            ptrace(PTRACE_DETACH, tid, NULL, NULL);
+        remote_forget(r, tid);
+    }
+    for (m = r->modules; m != NULL; m = next) {
+        next = m->next;
+        backtrace_elf_close(m->elf);
+        free((char *)m->mod.path);
+        free(m);
+    }
+    free(r->threads);
+    free(r->maps);
+    free(r->stack);
+    free(r);
+}
@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "execinfo.h"
+#include "shadow.h"
+
+/*
+ * Shadow call stack.
+ *
+ * The hooks run on every call and return of instrumented code, so they
+ * only bump a thread-local counter and store one word.  The counter is
+ * raised before the store: a signal handler that is itself instrumented
+ * pushes above the slot being written and pops back to it, so the
+ * stack stays balanced.  Calls deeper than SHADOW_DEPTH are counted
+ * but not stored.
+ *
+ * Leaving instrumented frames with longjmp() skips their exit hooks and
+ * leaves stale entries behind; backtrace_shadow_reset() drops them.
+ */
+
+__thread struct shadow_stack shadow_stack
+    __attribute__((tls_model("initial-exec")));
+int shadow_enabled;
+
+/* Weak, so a program with hooks of its own keeps them */
+void __cyg_profile_func_enter(void *fn, void *site)
+    __attribute__((weak, no_instrument_function));
+void __cyg_profile_func_exit(void *fn, void *site)
+    __attribute__((weak, no_instrument_function));
+
+void
+__cyg_profile_func_enter(void *fn, void *site)
+{
+    unsigned depth = shadow_stack.depth;
+
+    (void)fn;
+    shadow_stack.depth = depth + 1;
+    atomic_signal_fence(memory_order_seq_cst);
+    if (depth < SHADOW_DEPTH)
+        shadow_stack.ret[SHADOW_DEPTH - 1 - depth] = site;
+}
+
+void
+__cyg_profile_func_exit(void *fn, void *site)
+{
+    (void)fn;
+    (void)site;
+    if (shadow_stack.depth > 0)
+        shadow_stack.depth--;
+}
+
+int
+backtrace_shadow(void **buffer, int size)
+{
+    return shadow_capture(buffer, size);
+}
+
+int
+backtrace_shadow_depth(void)
+{
+    return (int)shadow_stack.depth;
+}
+
+void
+backtrace_shadow_reset(int depth)
+{
+    if (depth >= 0 && (unsigned)depth < shadow_stack.depth)
+        shadow_stack.depth = (unsigned)depth;
+}
+
+int
+backtrace_shadow_mode(int enable)
+{
+    int old = __atomic_exchange_n(&shadow_enabled, enable != 0, __ATOMIC_RELAXED);
+
+    return old;
+}
@@ -0,0 +1,54 @@
+#ifndef _SHADOW_H_
+#define _SHADOW_H_
+
+/*
+ * Internal interface to the shadow call stack.  Not installed.
+ *
+ * Code built with -finstrument-functions calls
+ * __cyg_profile_func_enter() and __cyg_profile_func_exit() around every
+ * function body.  The hooks in shadow.c keep, per thread, the return
+ * address of every instrumented call still active.  The array grows
+ * downwards, so the innermost entries are always contiguous and
+ * innermost first: a capture is one bounded memcpy, whatever the depth.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "execinfo.h"
+
+#define SHADOW_DEPTH EXECINFO_MAX_FRAMES
+
+struct shadow_stack {
+    unsigned depth;                  /* active calls, may exceed SHADOW_DEPTH */
+    void *ret[SHADOW_DEPTH];         /* entry n at ret[SHADOW_DEPTH - 1 - n] */
+};
+
+/* Initial-exec keeps the hooks free of __tls_get_addr() calls */
+extern __thread struct shadow_stack shadow_stack
+    __attribute__((visibility("hidden"), tls_model("initial-exec")));
+
+/* Set by backtrace_shadow_mode(): backtrace() reads the shadow stack */
+extern int shadow_enabled __attribute__((visibility("hidden")));
+
+/*
+ * Copy up to SIZE return addresses of the calling thread's active
+ * instrumented calls into BUFFER, innermost first.  Returns 0 when
+ * there are none or when the stack outgrew SHADOW_DEPTH, in which case
+ * the innermost calls were not recorded.
+ */
+static inline int
+shadow_capture(void **buffer, int size)
+{
+    unsigned depth = shadow_stack.depth;
+
+    if (depth == 0 || depth > SHADOW_DEPTH || size <= 0)
+        return 0;
+    if ((unsigned)size > depth)
+        size = (int)depth;
+    memcpy(buffer, &shadow_stack.ret[SHADOW_DEPTH - depth],
+           (size_t)size * sizeof(void *));
+    return size;
+}
+
+#endif /* _SHADOW_H_ */
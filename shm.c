@@ -0,0 +1,688 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+#include "modmap.h"
+
+#define SHM_MAGIC "EXECSHM"
+#define SHM_VERSION 1
+#define SHM_HEADER_SIZE 64
+#define SHM_MIN_RING 4096
+#define SHM_MAX_RING ((size_t)1 << 30)
+#define SHM_NAME_MAX 255
+
+/*
+ * Shared-memory sample transport.
+ *
+ * A collector creates one segment holding a number of rings; every
+ * producing process claims a ring of its own by writing its pid into
+ * the ring's owner word, so each ring has exactly one producer and one
+ * consumer and needs nothing but acquire/release on head and tail.
+ * Records are variable length and 8-byte aligned; one that does not fit
+ * before the end of the ring is preceded by a pad record and starts
+ * again at offset 0.  A producer that finds its ring full drops the
+ * sample and counts it instead of waiting.
+ *
+ * Frames travel as (module, offset) with offsets relative to the
+ * module's load bias, so they mean the same thing in every process.
+ * A producer describes each module once per ring with a module record
+ * before the first stack that uses it; stack IDs are hashed from the
+ * module keys and offsets and agree across processes.
+ */
+
+enum {
+    SHM_REC_PAD = 0,
+    SHM_REC_MODULE = 1,
+    SHM_REC_STACK = 2
+};
+
+struct shm_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t rings;
+    uint32_t ring_size;
+    uint32_t reserved;
+};
+
+struct shm_ring {
+    _Atomic int32_t owner;           /* pid; 0 = free; -pid = detached */
+    uint32_t reserved;
+    _Atomic uint64_t dropped;
+    _Alignas(64) _Atomic uint64_t head;  /* written by the producer */
+    _Alignas(64) _Atomic uint64_t tail;  /* written by the consumer */
+    _Alignas(64) unsigned char data[];
+};
+
+struct shm_rec {
+    uint32_t len;                    /* whole record, multiple of 8 */
+    uint16_t type;
+    uint16_t n;                      /* frames, or build-id length */
+};
+
+struct shm_rec_module {
+    struct shm_rec h;
+    uint32_t index;                  /* producer's module number */
+    uint32_t reserved;
+    uint64_t key;
+    unsigned char build_id[BACKTRACE_BUILD_ID_MAX];
+    char path[];
+};
+
+/* Followed by n uint64_t offsets, then n uint32_t module numbers */
+struct shm_rec_stack {
+    struct shm_rec h;
+    uint64_t id;
+    uint64_t count;
+};
+
+#define SHM_NO_MODULE UINT32_MAX
+
+static inline size_t
+ring_stride(uint32_t ring_size)
+{
+    return sizeof(struct shm_ring) + ring_size;
+}
+
+static inline struct shm_ring *
+ring_at(void *base, uint32_t ring_size, uint32_t i)
+{
+    return (struct shm_ring *)((char *)base + SHM_HEADER_SIZE +
+                               (size_t)i * ring_stride(ring_size));
+}
+
+static inline uint32_t
+rec_align(size_t len)
+{
+    return (uint32_t)((len + 7) & ~(size_t)7);
+}
+
+static int
+shm_path(const char *name, char *path)
+{
+    if (name == NULL || name[0] == '\0' || strchr(name + 1, '/') != NULL ||
+        strlen(name) >= SHM_NAME_MAX - 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    snprintf(path, SHM_NAME_MAX, "%s%s", name[0] == '/' ? "" : "/", name);
+    return 0;
+}
+
+static uint64_t
+shm_stack_id(const uint64_t *keys, const uint64_t *offsets, int n)
+{
+    uint64_t h = modmap_id_init(n);
+    int i;
+
+    for (i = 0; i < n; i++)
+        h = modmap_id_step(h, keys[i], offsets[i]);
+    return modmap_id_final(h);
+}
+
+/* Producer side */
+
+static struct {
+    atomic_flag busy;                /* held while a record is written */
+    pthread_mutex_t lock;            /* serializes attach and detach */
+    void *base;
+    size_t len;
+    struct shm_ring *ring;
+    uint32_t ring_size;
+    uint32_t rings;
+    pid_t pid;
+    uint64_t gen;                    /* generation of the snapshot SENT refers to */
+    unsigned char *sent;             /* module described in this ring */
+} producer = { ATOMIC_FLAG_INIT, PTHREAD_MUTEX_INITIALIZER, NULL, 0, NULL,
+               0, 0, 0, 0, NULL };
+
+/* Samples dropped because another thread held the ring */
+static _Atomic uint64_t producer_contended;
+
+static int
+producer_claim(void)
+{
+    struct shm_ring *ring;
+    int32_t expected;
+    uint32_t i;
+
+    producer.pid = getpid();
+    producer.ring = NULL;
+    producer.gen = 0;
+    for (i = 0; i < producer.rings; i++) {
+        ring = ring_at(producer.base, producer.ring_size, i);
+        expected = 0;
+        if (atomic_compare_exchange_strong(&ring->owner, &expected,
+                                           (int32_t)producer.pid)) {
+            producer.ring = ring;
+            return 0;
+        }
+    }
+    errno = ENOSPC;
+    return -1;
+}
+
+int
+backtrace_shm_attach(const char *name)
+{
+    char path[SHM_NAME_MAX];
+    struct shm_header *hdr;
+    struct stat st;
+    void *base;
+    int fd, token;
+
+    if (shm_path(name, path) != 0)
+        return -1;
+
+    pthread_mutex_lock(&producer.lock);
+    if (producer.base != NULL) {
+        pthread_mutex_unlock(&producer.lock);
+        errno = EBUSY;
+        return -1;
+    }
+    fd = shm_open(path, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+        goto fail;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHM_HEADER_SIZE) {
+        close(fd);
+        errno = EPROTO;
+        goto fail;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        goto fail;
+
+    hdr = base;
+    if (memcmp(hdr->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 ||
+        hdr->version != SHM_VERSION ||
+        SHM_HEADER_SIZE + (size_t)hdr->rings * ring_stride(hdr->ring_size) >
+        (size_t)st.st_size) {
+        munmap(base, (size_t)st.st_size);
+        errno = EPROTO;
+        goto fail;
+    }
+
+    producer.base = base;
+    producer.len = (size_t)st.st_size;
+    producer.ring_size = hdr->ring_size;
+    producer.rings = hdr->rings;
+    if (producer_claim() != 0) {
+        munmap(base, producer.len);
+        producer.base = NULL;
+        goto fail;
+    }
+    pthread_mutex_unlock(&producer.lock);
+    /* Build the module map here, where waiting is fine, not on a record */
+    token = modmap_enter();
+    modmap_current();
+    modmap_exit(token);
+    return 0;
+
+fail:
+    pthread_mutex_unlock(&producer.lock);
+    return -1;
+}
+
+void
+backtrace_shm_detach(void)
+{
+    pthread_mutex_lock(&producer.lock);
+    while (atomic_flag_test_and_set_explicit(&producer.busy,
+                                             memory_order_acquire))
+        ;
+    if (producer.ring != NULL && producer.pid == getpid())
+        atomic_store(&producer.ring->owner, -(int32_t)producer.pid);
+    if (producer.base != NULL)
+        munmap(producer.base, producer.len);
+    free(producer.sent);
+    producer.base = NULL;
+    producer.ring = NULL;
+    producer.gen = 0;
+    producer.sent = NULL;
+    atomic_flag_clear_explicit(&producer.busy, memory_order_release);
+    pthread_mutex_unlock(&producer.lock);
+}
+
+/*
+ * Reserve LEN bytes at *HEAD, padding to the ring start if needed.  The
+ * record is published by storing the returned position + LEN as head.
+ */
+static void *
+ring_reserve(struct shm_ring *ring, uint32_t size, uint64_t *head,
+             uint32_t len)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t off = (uint32_t)(*head & (size - 1));
+    struct shm_rec *pad;
+
+    if (off + len > size) {
+        if (*head + (size - off) + len - tail > size)
+            return NULL;
+        pad = (struct shm_rec *)&ring->data[off];
+        pad->len = size - off;
+        pad->type = SHM_REC_PAD;
+        pad->n = 0;
+        *head += size - off;
+        off = 0;
+    } else if (*head + len - tail > size) {
+        return NULL;
+    }
+    return &ring->data[off];
+}
+
+static int
+producer_send_module(uint64_t *head, const struct modmap *map, int index)
+{
+    const struct backtrace_module *mod = &map->entries[index].mod;
+    struct shm_rec_module *rec;
+    size_t plen = strlen(mod->path) + 1;
+    uint32_t len = rec_align(sizeof(*rec) + plen);
+
+    if (len > producer.ring_size / 2)
+        return -1;
+    rec = ring_reserve(producer.ring, producer.ring_size, head, len);
+    if (rec == NULL)
+        return -1;
+    rec->h.len = len;
+    rec->h.type = SHM_REC_MODULE;
+    rec->h.n = (uint16_t)mod->build_id_len;
+    rec->index = (uint32_t)index;
+    rec->reserved = 0;
+    rec->key = mod->key;
+    memcpy(rec->build_id, mod->build_id, sizeof(rec->build_id));
+    memcpy(rec->path, mod->path, plen);
+    *head += len;
+    return 0;
+}
+
+int
+backtrace_shm_record(void *const *buffer, int size, uint64_t count)
+{
+    uint64_t keys[EXECINFO_MAX_FRAMES], offsets[EXECINFO_MAX_FRAMES];
+    uint32_t modules[EXECINFO_MAX_FRAMES];
+    const struct modmap *map, *cur;
+    struct shm_rec_stack *rec;
+    struct shm_ring *ring;
+    unsigned char *sent;
+    uint64_t head;
+    uint32_t len;
+    uintptr_t pc;
+    int i, m, tries, stale = 0, rc = -1, token = -1;
+
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size > EXECINFO_MAX_FRAMES)
+        size = EXECINFO_MAX_FRAMES;
+
+    /* Producers never wait: a busy ring means this sample is dropped */
+    if (atomic_flag_test_and_set_explicit(&producer.busy,
+                                          memory_order_acquire)) {
+        atomic_fetch_add_explicit(&producer_contended, 1,
+                                  memory_order_relaxed);
+        errno = EAGAIN;
+        return -1;
+    }
+    if (producer.base == NULL) {
+        errno = ENOTCONN;
+        goto out;
+    }
+    /* A forked child must not share its parent's ring */
+    if (producer.pid != getpid() && producer_claim() != 0)
+        goto out;
+    ring = producer.ring;
+    atomic_fetch_add_explicit(&ring->dropped,
+                              atomic_exchange(&producer_contended, 0),
+                              memory_order_relaxed);
+
+    /* Module numbers are only meaningful within one map snapshot */
+    token = modmap_enter();
+    map = NULL;
+    for (tries = 0; tries < 2; tries++) {
+        stale = 0;
+        for (i = 0; i < size; i++) {
+            pc = (uintptr_t)buffer[i];
+            m = modmap_lookup_nowait(pc, &cur);
+            if (i > 0 && cur != map)
+                stale = 1;
+            map = cur;
+            if (m < 0) {
+                modules[i] = SHM_NO_MODULE;
+                keys[i] = 0;
+                offsets[i] = pc;
+            } else {
+                modules[i] = (uint32_t)m;
+                keys[i] = map->entries[m].mod.key;
+                offsets[i] = pc - map->entries[m].bias;
+            }
+        }
+        if (!stale)
+            break;
+    }
+    if (stale) {
+        errno = EAGAIN;
+        goto drop;
+    }
+
+    if (map != NULL && map->gen != producer.gen) {
+        sent = calloc((size_t)map->count, 1);
+        if (sent == NULL)
+            goto drop;
+        free(producer.sent);
+        producer.sent = sent;
+        producer.gen = map->gen;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (i = 0; i < size; i++) {
+        if (modules[i] == SHM_NO_MODULE || producer.sent[modules[i]])
+            continue;
+        if (producer_send_module(&head, map, (int)modules[i]) != 0) {
+            errno = EAGAIN;
+            goto drop;
+        }
+        producer.sent[modules[i]] = 1;
+        /* Publish now so the module survives a dropped stack record */
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+
+    len = rec_align(sizeof(*rec) + (size_t)size * (sizeof(uint64_t) +
+                                                   sizeof(uint32_t)));
+    if (len > producer.ring_size / 2 ||
+        (rec = ring_reserve(ring, producer.ring_size, &head, len)) == NULL) {
+        errno = EAGAIN;
+        goto drop;
+    }
+    rec->h.len = len;
+    rec->h.type = SHM_REC_STACK;
+    rec->h.n = (uint16_t)size;
+    rec->id = shm_stack_id(keys, offsets, size);
+    rec->count = count;
+    memcpy(rec + 1, offsets, (size_t)size * sizeof(uint64_t));
+    memcpy((uint64_t *)(rec + 1) + size, modules,
+           (size_t)size * sizeof(uint32_t));
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+    rc = 0;
+    goto out;
+
+drop:
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+out:
+    if (token >= 0)
+        modmap_exit(token);
+    atomic_flag_clear_explicit(&producer.busy, memory_order_release);
+    return rc;
+}
+
+/* Consumer side */
+
+struct shm_module {
+    struct backtrace_module mod;
+    struct shm_module *next;
+    char path[];
+};
+
+struct shm_local {
+    struct shm_module **modules;     /* by the producer's module number */
+    uint32_t cap;
+};
+
+struct backtrace_shm {
+    char path[SHM_NAME_MAX];
+    void *base;
+    size_t len;
+    uint32_t rings;
+    uint32_t ring_size;
+    struct shm_local *local;
+    struct shm_module *modules;      /* every module seen, by key */
+    struct backtrace_shm_frame frames[EXECINFO_MAX_FRAMES];
+};
+
+backtrace_shm_t *
+backtrace_shm_create(const char *name, int rings, size_t ring_size)
+{
+    struct shm_header *hdr;
+    backtrace_shm_t *shm;
+    size_t size;
+    int fd;
+
+    if (rings <= 0 || ring_size < SHM_MIN_RING || ring_size > SHM_MAX_RING ||
+        (ring_size & (ring_size - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    shm = calloc(1, sizeof(*shm));
+    if (shm == NULL)
+        return NULL;
+    if (shm_path(name, shm->path) != 0)
+        goto fail;
+    shm->rings = (uint32_t)rings;
+    shm->ring_size = (uint32_t)ring_size;
+    shm->local = calloc((size_t)rings, sizeof(*shm->local));
+    if (shm->local == NULL)
+        goto fail;
+
+    /* A segment left behind by a dead collector is replaced */
+    fd = shm_open(shm->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        shm_unlink(shm->path);
+        fd = shm_open(shm->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+    if (fd < 0)
+        goto fail;
+    size = SHM_HEADER_SIZE + (size_t)rings * ring_stride(shm->ring_size);
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(shm->path);
+        goto fail;
+    }
+    shm->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm->base == MAP_FAILED) {
+        shm->base = NULL;
+        shm_unlink(shm->path);
+        goto fail;
+    }
+    shm->len = size;
+
+    /* The new file is zeroed, so every ring starts free and empty */
+    hdr = shm->base;
+    hdr->version = SHM_VERSION;
+    hdr->rings = shm->rings;
+    hdr->ring_size = shm->ring_size;
+    atomic_thread_fence(memory_order_release);
+    memcpy(hdr->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    return shm;
+
+fail:
+    free(shm->local);
+    free(shm);
+    return NULL;
+}
+
+static struct shm_module *
+consumer_module(backtrace_shm_t *shm, const struct shm_rec_module *rec)
+{
+    struct shm_module *m;
+    size_t plen;
+
+    for (m = shm->modules; m != NULL; m = m->next) {
+        if (m->mod.key == rec->key)
+            return m;
+    }
+    plen = strnlen(rec->path, rec->h.len - sizeof(*rec));
+    m = calloc(1, sizeof(*m) + plen + 1);
+    if (m == NULL)
+        return NULL;
+    memcpy(m->path, rec->path, plen);
+    m->mod.key = rec->key;
+    m->mod.path = m->path;
+    m->mod.build_id_len = rec->h.n <= BACKTRACE_BUILD_ID_MAX ? rec->h.n : 0;
+    memcpy(m->mod.build_id, rec->build_id, (size_t)m->mod.build_id_len);
+    m->next = shm->modules;
+    shm->modules = m;
+    return m;
+}
+
+static int
+consumer_bind(struct shm_local *local, uint32_t index, struct shm_module *m)
+{
+    struct shm_module **mods;
+    uint32_t cap;
+
+    if (index >= local->cap) {
+        cap = local->cap ? local->cap : 64;
+        while (cap <= index)
+            cap *= 2;
+        mods = realloc(local->modules, cap * sizeof(*mods));
+        if (mods == NULL)
+            return -1;
+        memset(mods + local->cap, 0, (cap - local->cap) * sizeof(*mods));
+        local->modules = mods;
+        local->cap = cap;
+    }
+    local->modules[index] = m;
+    return 0;
+}
+
+static int
+consumer_stack(backtrace_shm_t *shm, struct shm_local *local, int32_t pid,
+               const struct shm_rec_stack *rec, backtrace_shm_callback_t cb,
+               void *ctx)
+{
+    struct backtrace_shm_sample sample;
+    const uint64_t *offsets = (const uint64_t *)(rec + 1);
+    const uint32_t *modules = (const uint32_t *)(offsets + rec->h.n);
+    int i, n = rec->h.n;
+
+    if (n > EXECINFO_MAX_FRAMES ||
+        sizeof(*rec) + (size_t)n * (sizeof(*offsets) + sizeof(*modules)) >
+        rec->h.len)
+        return 0;
+    for (i = 0; i < n; i++) {
+        shm->frames[i].offset = offsets[i];
+        shm->frames[i].module = (modules[i] < local->cap &&
+                                 local->modules[modules[i]] != NULL) ?
+                                &local->modules[modules[i]]->mod : NULL;
+    }
+    sample.pid = pid;
+    sample.id = rec->id;
+    sample.count = rec->count;
+    sample.depth = n;
+    sample.frames = shm->frames;
+    return cb(&sample, ctx);
+}
+
+int
+backtrace_shm_drain(backtrace_shm_t *shm, backtrace_shm_callback_t callback,
+                    void *ctx)
+{
+    const struct shm_rec *rec;
+    struct shm_module *m;
+    struct shm_ring *ring;
+    struct shm_local *local;
+    uint64_t head, tail;
+    uint32_t r, off, mask = shm->ring_size - 1;
+    int32_t owner;
+    int samples = 0;
+
+    for (r = 0; r < shm->rings; r++) {
+        ring = ring_at(shm->base, shm->ring_size, r);
+        local = &shm->local[r];
+        owner = atomic_load_explicit(&ring->owner, memory_order_acquire);
+        if (owner == 0)
+            continue;
+
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while (tail < head) {
+            off = (uint32_t)(tail & mask);
+            rec = (const struct shm_rec *)&ring->data[off];
+            if (rec->len < sizeof(*rec) || (rec->len & 7) != 0 ||
+                off + rec->len > shm->ring_size) {
+                /* Corrupt ring: discard what is there */
+                tail = head;
+                break;
+            }
+            tail += rec->len;
+            if (rec->type == SHM_REC_MODULE &&
+                rec->len >= sizeof(struct shm_rec_module)) {
+                const struct shm_rec_module *mr = (const void *)rec;
+                if ((m = consumer_module(shm, mr)) != NULL)
+                    consumer_bind(local, mr->index, m);
+            } else if (rec->type == SHM_REC_STACK &&
+                       rec->len >= sizeof(struct shm_rec_stack)) {
+                samples++;
+                if (consumer_stack(shm, local, owner < 0 ? -owner : owner,
+                                   (const void *)rec, callback, ctx) != 0) {
+                    atomic_store_explicit(&ring->tail, tail,
+                                          memory_order_release);
+                    return samples;
+                }
+            }
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        /* Free the rings of detached and dead producers once drained */
+        if ((owner < 0 || (kill(owner, 0) != 0 && errno == ESRCH)) &&
+            tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+            atomic_store(&ring->head, 0);
+            atomic_store(&ring->tail, 0);
+            free(local->modules);
+            local->modules = NULL;
+            local->cap = 0;
+            atomic_store_explicit(&ring->owner, 0, memory_order_release);
+        }
+    }
+    return samples;
+}
+
+unsigned long
+backtrace_shm_dropped(const backtrace_shm_t *shm)
+{
+    unsigned long dropped = 0;
+    uint32_t r;
+
+    for (r = 0; r < shm->rings; r++)
+        dropped += (unsigned long)atomic_load(
+            &ring_at(shm->base, shm->ring_size, r)->dropped);
+    return dropped;
+}
+
+void
+backtrace_shm_destroy(backtrace_shm_t *shm)
+{
+    struct shm_module *m, *next;
+    uint32_t r;
+
+    if (shm == NULL)
+        return;
+    if (shm->base != NULL) {
+        munmap(shm->base, shm->len);
+        shm_unlink(shm->path);
+    }
+    for (r = 0; r < shm->rings; r++)
+        free(shm->local[r].modules);
+    for (m = shm->modules; m != NULL; m = next) {
+        next = m->next;
+        free(m);
+    }
+    free(shm->local);
+    free(shm);
+}
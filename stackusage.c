@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+#define STACKPROF_SLOTS 512      /* distinct stacks tracked, power of two */
+#define STACKPROF_MAX_DEPTH 32   /* frames kept per tracked stack */
+#define STACKPROF_PROBES 16      /* open-addressing probe limit */
+
+/*
+ * Stack usage profiler.
+ *
+ * A measurement walks the caller's frames with the cursor API, so each
+ * frame costs one step, and takes the size of every frame from the
+ * difference between consecutive stack pointers.  Usage and headroom
+ * are relative to the thread's stack bounds, which are looked up once
+ * per thread.
+ *
+ * Sampled measurements are folded into a fixed table keyed by the stack
+ * hash that keeps the high-water mark for every distinct stack.  Slots
+ * are claimed with a compare-and-swap on the hash and updated with
+ * atomic max/min loops, so sampling threads never block each other.
+ */
+
+struct stackprof_entry {
+    _Atomic uint64_t id;             /* 0 while the slot is free */
+    _Atomic int ready;               /* frames below are published */
+    _Atomic size_t max_used;
+    _Atomic size_t min_headroom;
+    _Atomic unsigned long samples;
+    int depth;
+    void *pcs[STACKPROF_MAX_DEPTH];
+    size_t sizes[STACKPROF_MAX_DEPTH];
+};
+
+static struct stackprof_entry *_Atomic stackprof_table;
+static _Atomic unsigned stackprof_period;
+static _Atomic unsigned long stackprof_dropped;
+
+static __thread uintptr_t stack_lo, stack_hi;
+static __thread unsigned stackprof_tick;
+
+static int
+thread_stack_bounds(uintptr_t *lo, uintptr_t *hi)
+{
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+
+    if (stack_hi == 0) {
+        if (pthread_getattr_np(pthread_self(), &attr) != 0)
+            return -1;
+        if (pthread_attr_getstack(&attr, &addr, &size) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+        pthread_attr_destroy(&attr);
+        stack_lo = (uintptr_t)addr;
+        stack_hi = (uintptr_t)addr + size;
+    }
+    *lo = stack_lo;
+    *hi = stack_hi;
+    return 0;
+}
+
+/*
+ * Measure from the frame CURSOR points at.  PCS and SIZES receive up to
+ * MAX entries; the return value is the number of frames recorded.
+ */
+static int
+measure(backtrace_cursor_t *cursor, struct backtrace_stack_usage *usage,
+        void **pcs, size_t *sizes, int max)
+{
+    uintptr_t lo, hi, sp, next_sp;
+    int depth = 0;
+
+    memset(usage, 0, sizeof(*usage));
+    if (thread_stack_bounds(&lo, &hi) != 0)
+        return -1;
+
+    sp = (uintptr_t)backtrace_cursor_sp(cursor);
+    if (sp < lo || sp > hi) {
+        errno = ERANGE;
+        return -1;
+    }
+    usage->used = hi - sp;
+    usage->headroom = sp - lo;
+
+    while (depth < max) {
+        pcs[depth] = backtrace_cursor_pc(cursor);
+        next_sp = (backtrace_cursor_step(cursor) > 0) ?
+                  (uintptr_t)backtrace_cursor_sp(cursor) : hi;
+        /* The outermost frame owns everything up to the stack top */
+        if (next_sp <= sp || next_sp > hi)
+            next_sp = hi;
+        if (sizes != NULL)
+            sizes[depth] = next_sp - sp;
+        depth++;
+        if (next_sp == hi)
+            break;
+        sp = next_sp;
+    }
+
+    usage->depth = depth;
+    usage->id = backtrace_hash(pcs, depth);
+    return depth;
+}
+
+int
+backtrace_stack_usage(struct backtrace_stack_usage *usage, size_t *frame_sizes,
+                      int size)
+{
+    void *pcs[EXECINFO_MAX_FRAMES];
+    backtrace_cursor_t cursor;
+
+    if (frame_sizes != NULL && size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size <= 0 || size > EXECINFO_MAX_FRAMES)
+        size = EXECINFO_MAX_FRAMES;
+    if (backtrace_cursor_init(&cursor) != 0)
+        return -1;
+    /* Step out of our own frame into the caller's */
+    if (backtrace_cursor_step(&cursor) <= 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    return measure(&cursor, usage, pcs, frame_sizes, size);
+}
+
+static void
+atomic_max(_Atomic size_t *p, size_t v)
+{
+    size_t cur = atomic_load_explicit(p, memory_order_relaxed);
+
+    while (cur < v && !atomic_compare_exchange_weak_explicit(p, &cur, v,
+               memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+static void
+atomic_min(_Atomic size_t *p, size_t v)
+{
+    size_t cur = atomic_load_explicit(p, memory_order_relaxed);
+
+    while (cur > v && !atomic_compare_exchange_weak_explicit(p, &cur, v,
+               memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+static void
+stackprof_record(struct stackprof_entry *table,
+                 const struct backtrace_stack_usage *usage,
+                 void *const *pcs, const size_t *sizes)
+{
+    struct stackprof_entry *e;
+    uint64_t expected;
+    unsigned i, slot;
+
+    for (i = 0; i < STACKPROF_PROBES; i++) {
+        slot = (unsigned)(usage->id + i) & (STACKPROF_SLOTS - 1);
+        e = &table[slot];
+        expected = atomic_load_explicit(&e->id, memory_order_acquire);
+        if (expected == 0) {
+            if (atomic_compare_exchange_strong(&e->id, &expected, usage->id)) {
+                /* We own the slot: publish frames before marking ready */
+                e->depth = usage->depth < STACKPROF_MAX_DEPTH ?
+                           usage->depth : STACKPROF_MAX_DEPTH;
+                memcpy(e->pcs, pcs, (size_t)e->depth * sizeof(void *));
+                memcpy(e->sizes, sizes, (size_t)e->depth * sizeof(size_t));
+                atomic_store_explicit(&e->ready, 1, memory_order_release);
+                expected = usage->id;
+            }
+        }
+        if (expected != usage->id)
+            continue;
+
+        atomic_max(&e->max_used, usage->used);
+        atomic_min(&e->min_headroom, usage->headroom);
+        atomic_fetch_add_explicit(&e->samples, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&stackprof_dropped, 1, memory_order_relaxed);
+}
+
+static void
+stackprof_clear(struct stackprof_entry *table)
+{
+    int i;
+
+    memset(table, 0, STACKPROF_SLOTS * sizeof(*table));
+    for (i = 0; i < STACKPROF_SLOTS; i++)
+        atomic_init(&table[i].min_headroom, SIZE_MAX);
+}
+
+int
+backtrace_stackprof_set_period(unsigned period)
+{
+    struct stackprof_entry *table, *expected = NULL;
+
+    if (period != 0 && atomic_load(&stackprof_table) == NULL) {
+        table = malloc(STACKPROF_SLOTS * sizeof(*table));
+        if (table == NULL)
+            return -1;
+        stackprof_clear(table);
+        if (!atomic_compare_exchange_strong(&stackprof_table, &expected,
+                                            table))
+            free(table);
+    }
+    atomic_store(&stackprof_period, period);
+    return 0;
+}
+
+void
+backtrace_stackprof_sample(void)
+{
+    struct backtrace_stack_usage usage;
+    struct stackprof_entry *table;
+    size_t sizes[STACKPROF_MAX_DEPTH];
+    void *pcs[STACKPROF_MAX_DEPTH];
+    backtrace_cursor_t cursor;
+    unsigned period;
+
+    period = atomic_load_explicit(&stackprof_period, memory_order_relaxed);
+    if (period == 0 || ++stackprof_tick < period)
+        return;
+    stackprof_tick = 0;
+
+    table = atomic_load_explicit(&stackprof_table, memory_order_acquire);
+    if (table == NULL || backtrace_cursor_init(&cursor) != 0 ||
+        backtrace_cursor_step(&cursor) <= 0)
+        return;
+    if (measure(&cursor, &usage, pcs, sizes, STACKPROF_MAX_DEPTH) > 0)
+        stackprof_record(table, &usage, pcs, sizes);
+}
+
+void
+backtrace_stackprof_reset(void)
+{
+    struct stackprof_entry *table;
+
+    table = atomic_load(&stackprof_table);
+    if (table != NULL)
+        stackprof_clear(table);
+    atomic_store(&stackprof_dropped, 0);
+}
+
+int
+backtrace_stackprof_dump(int fd)
+{
+    struct stackprof_entry *table, *e;
+    char line[256];
+    char **strings;
+    int i, j, len, stacks = 0;
+    ssize_t written;
+
+    table = atomic_load_explicit(&stackprof_table, memory_order_acquire);
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    len = snprintf(line, sizeof(line),
+                   "# stack usage: %lu samples dropped\n",
+                   atomic_load(&stackprof_dropped));
+    written = write(fd, line, (size_t)len);
+    (void)written;
+    if (table == NULL)
+        return 0;
+
+    for (i = 0; i < STACKPROF_SLOTS; i++) {
+        e = &table[i];
+        if (!atomic_load_explicit(&e->ready, memory_order_acquire))
+            continue;
+
+        len = snprintf(line, sizeof(line),
+                       "stack 0x%016llx max_used=%zu min_headroom=%zu "
+                       "samples=%lu depth=%d\n",
+                       (unsigned long long)atomic_load(&e->id),
+                       atomic_load(&e->max_used),
+                       atomic_load(&e->min_headroom),
+                       atomic_load(&e->samples), e->depth);
+        written = write(fd, line, (size_t)len);
+        (void)written;
+
+        /* Frame size in bytes, then the symbolized frame */
+        strings = backtrace_symbols(e->pcs, e->depth);
+        for (j = 0; j < e->depth; j++) {
+            len = snprintf(line, sizeof(line), "  %8zu %s\n", e->sizes[j],
+                           strings ? strings[j] : "?");
+            if (len >= (int)sizeof(line))
+                len = sizeof(line) - 1;
+            written = write(fd, line, (size_t)len);
+            (void)written;
+        }
+        free(strings);
+        stacks++;
+    }
+    return stacks;
+}
@@ -0,0 +1,440 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+#include "modmap.h"
+
+/*
+ * Parallel batch symbolization.
+ *
+ * A batch is grouped by module against the module map, then symbolized
+ * from the ELF index of each module (elfsym.c) instead of dladdr(), so
+ * no loader lock is taken.  Work runs on a fixed pool in two phases,
+ * each a set of independent tasks:
+ *
+ *   index     open the index of every module not seen before
+ *   lookup    resolve a chunk of one module's addresses
+ *
+ * Every worker owns a range of the task array and takes tasks from its
+ * front; an idle worker steals the back half of the fullest range it
+ * finds.  A range is one 64-bit word (next << 32 | end) updated by CAS,
+ * so neither taking nor stealing locks.  Tasks write disjoint slots of
+ * the index cache or of the output, so results need no locks either.
+ * The pool's mutex only starts and joins phases.
+ */
+
+#define SYMBOLIZE_CHUNK 1024         /* addresses per lookup task */
+#define SYMBOLIZE_MAX_THREADS 256
+
+struct symbolize_task {
+    uint32_t module;
+    uint32_t start;                  /* range of the order array */
+    uint32_t end;
+};
+
+struct symbolize_worker {
+    _Alignas(64) _Atomic uint64_t range;
+    backtrace_symbolizer_t *owner;
+    int self;
+    pthread_t thread;
+};
+
+struct backtrace_symbolizer {
+    int nthreads;
+    struct symbolize_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;             /* under lock */
+    int running;                     /* pool threads in the phase, under lock */
+    int shutdown;                    /* under lock */
+
+    /* The current phase */
+    void (*run)(backtrace_symbolizer_t *s, const struct symbolize_task *task);
+    const struct symbolize_task *tasks;
+    const uint32_t *order;           /* batch positions grouped by module */
+    struct backtrace_symbol *out;
+
+    /* Index cache, by module number in MODULES */
+    backtrace_modtab_t *modules;
+    backtrace_elf_t **elfs;          /* NULL if the file has no index */
+    unsigned char *tried;
+    uint32_t elfs_cap;
+};
+
+/* Take the next task of W's own range; -1 if it is empty */
+static int64_t
+symbolize_pop(struct symbolize_worker *w)
+{
+    uint64_t r = atomic_load_explicit(&w->range, memory_order_acquire);
+    uint32_t next, end;
+
+    do {
+        next = (uint32_t)(r >> 32);
+        end = (uint32_t)r;
+        if (next >= end)
+            return -1;
+    } while (!atomic_compare_exchange_weak_explicit(&w->range, &r,
+                                                    ((uint64_t)(next + 1) << 32) | end,
+                                                    memory_order_acq_rel,
+                                                    memory_order_acquire));
+    return next;
+}
+
+/* Move the back half of the fullest other range to SELF; 0 if none is left */
+static int
+symbolize_steal(backtrace_symbolizer_t *s, int self)
+{
+    struct symbolize_worker *victim;
+    uint64_t r, best_r = 0;
+    uint32_t next, end, take;
+    int i, best;
+
+    for (;;) {
+        best = -1;
+        for (i = 1; i < s->nthreads; i++) {
+            victim = &s->workers[(self + i) % s->nthreads];
+            r = atomic_load_explicit(&victim->range, memory_order_acquire);
+            next = (uint32_t)(r >> 32);
+            end = (uint32_t)r;
+            if (next < end &&
+                (best < 0 || end - next > (uint32_t)best_r - (uint32_t)(best_r >> 32))) {
+                best = (self + i) % s->nthreads;
+                best_r = r;
+            }
+        }
+        if (best < 0)
+            return 0;
+        next = (uint32_t)(best_r >> 32);
+        end = (uint32_t)best_r;
+        take = (end - next + 1) / 2;
+        if (atomic_compare_exchange_strong_explicit(&s->workers[best].range, &best_r,
+                                                    ((uint64_t)next << 32) | (end - take),
+                                                    memory_order_acq_rel,
+                                                    memory_order_acquire)) {
+            /* Our range is empty, and thieves leave empty ranges alone */
+            atomic_store_explicit(&s->workers[self].range,
+                                  ((uint64_t)(end - take) << 32) | end,
+                                  memory_order_release);
+            return 1;
+        }
+    }
+}
+
+static void
+symbolize_work(backtrace_symbolizer_t *s, int self)
+{
+    int64_t t;
+
+    do {
+        while ((t = symbolize_pop(&s->workers[self])) >= 0)
+            s->run(s, &s->tasks[t]);
+    } while (s->nthreads > 1 && symbolize_steal(s, self));
+}
+
+static void *
+symbolize_main(void *arg)
+{
+    struct symbolize_worker *w = arg;
+    backtrace_symbolizer_t *s = w->owner;
+    uint64_t seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (s->generation == seen && !s->shutdown)
+            pthread_cond_wait(&s->start, &s->lock);
+        if (s->shutdown) {
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+        seen = s->generation;
+        pthread_mutex_unlock(&s->lock);
+
+        symbolize_work(s, w->self);
+
+        pthread_mutex_lock(&s->lock);
+        if (--s->running == 0)
+            pthread_cond_signal(&s->done);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/* Run COUNT tasks with RUN on the pool and the calling thread */
+static void
+symbolize_phase(backtrace_symbolizer_t *s,
+                void (*run)(backtrace_symbolizer_t *, const struct symbolize_task *),
+                const struct symbolize_task *tasks, uint32_t count)
+{
+    uint64_t lo, hi;
+    int i;
+
+    if (count == 0)
+        return;
+    s->run = run;
+    s->tasks = tasks;
+    if (s->nthreads == 1 || count == 1) {
+        /* Not worth waking anybody; nothing is left to steal either */
+        for (i = 0; i < s->nthreads; i++)
+            atomic_store_explicit(&s->workers[i].range, i == 0 ? count : 0,
+                                  memory_order_relaxed);
+        symbolize_work(s, 0);
+        return;
+    }
+    for (i = 0; i < s->nthreads; i++) {
+        lo = (uint64_t)count * (uint64_t)i / (uint64_t)s->nthreads;
+        hi = (uint64_t)count * (uint64_t)(i + 1) / (uint64_t)s->nthreads;
+        atomic_store_explicit(&s->workers[i].range, (lo << 32) | hi,
+                              memory_order_relaxed);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->generation++;
+    s->running = s->nthreads - 1;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+
+    symbolize_work(s, 0);
+
+    pthread_mutex_lock(&s->lock);
+    while (s->running > 0)
+        pthread_cond_wait(&s->done, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void
+symbolize_index(backtrace_symbolizer_t *s, const struct symbolize_task *task)
+{
+    const struct backtrace_module *m = backtrace_modtab_get(s->modules, (int)task->module);
+
+    s->elfs[task->module] = m != NULL ? backtrace_elf_open(m->path) : NULL;
+}
+
+static void
+symbolize_lookup(backtrace_symbolizer_t *s, const struct symbolize_task *task)
+{
+    const backtrace_elf_t *elf = s->elfs[task->module];
+    struct backtrace_symbol *out;
+    uint32_t k;
+
+    for (k = task->start; k < task->end; k++) {
+        out = &s->out[s->order[k]];
+        out->symbol = elf != NULL ?
+                      backtrace_elf_lookup(elf, out->module_offset, &out->offset) : NULL;
+        if (out->symbol == NULL)
+            out->offset = 0;
+    }
+}
+
+backtrace_symbolizer_t *
+backtrace_symbolizer_new(int threads)
+{
+    backtrace_symbolizer_t *s;
+    sigset_t all, old;
+    long cpus;
+    int i;
+
+    if (threads <= 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > SYMBOLIZE_MAX_THREADS)
+        threads = SYMBOLIZE_MAX_THREADS;
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+    s->workers = calloc((size_t)threads, sizeof(*s->workers));
+    s->modules = backtrace_modtab_new();
+    if (s->workers == NULL || s->modules == NULL) {
+        backtrace_modtab_free(s->modules);
+        free(s->workers);
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->done, NULL);
+
+    /* Worker 0 is the calling thread; the others take no signals */
+    s->workers[0].owner = s;
+    s->nthreads = 1;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 1; i < threads; i++) {
+        s->workers[i].owner = s;
+        s->workers[i].self = i;
+        if (pthread_create(&s->workers[i].thread, NULL, symbolize_main,
+                           &s->workers[i]) != 0)
+            break;
+        s->nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return s;
+}
+
+int
+backtrace_symbolizer_threads(const backtrace_symbolizer_t *s)
+{
+    return s->nthreads;
+}
+
+/* Make room in the index cache for every module of the table */
+static int
+symbolize_grow(backtrace_symbolizer_t *s)
+{
+    uint32_t n = (uint32_t)backtrace_modtab_count(s->modules), cap;
+    backtrace_elf_t **elfs;
+    unsigned char *tried;
+
+    if (n <= s->elfs_cap)
+        return 0;
+    for (cap = s->elfs_cap ? s->elfs_cap : 16; cap < n; cap *= 2)
+        ;
+    elfs = realloc(s->elfs, cap * sizeof(*elfs));
+    if (elfs == NULL)
+        return -1;
+    s->elfs = elfs;
+    tried = realloc(s->tried, cap);
+    if (tried == NULL)
+        return -1;
+    s->tried = tried;
+    memset(s->elfs + s->elfs_cap, 0, (cap - s->elfs_cap) * sizeof(*elfs));
+    memset(s->tried + s->elfs_cap, 0, cap - s->elfs_cap);
+    s->elfs_cap = cap;
+    return 0;
+}
+
+int
+backtrace_symbolize(backtrace_symbolizer_t *s, void *const *buffer, size_t count,
+                    struct backtrace_symbol *out)
+{
+    const struct modmap *map, *last_map = NULL;
+    const struct modmap_entry *e;
+    struct symbolize_task *tasks = NULL;
+    uint32_t *modules = NULL, *order = NULL, *first = NULL, nmods, ntasks, i, m, k;
+    int j, idx, last_j = -1, last_idx = -1, token, rc = -1;
+    uintptr_t pc;
+
+    if (count > UINT32_MAX / 2) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (count == 0)
+        return 0;
+    modules = malloc(count * sizeof(*modules));
+    order = malloc(count * sizeof(*order));
+    if (modules == NULL || order == NULL)
+        goto out;
+
+    /* Group by module; the offsets are what the indexes are keyed by */
+    token = modmap_enter();
+    for (i = 0; i < count; i++) {
+        pc = (uintptr_t)buffer[i];
+        out[i].symbol = NULL;
+        out[i].offset = 0;
+        out[i].module = NULL;
+        out[i].module_offset = pc;
+        modules[i] = BACKTRACE_MODREL_NONE;
+        if ((j = modmap_lookup(pc, &map)) < 0)
+            continue;
+        e = &map->entries[j];
+        if (map == last_map && j == last_j) {
+            idx = last_idx;
+        } else if ((idx = backtrace_modtab_add(s->modules, &e->mod)) < 0) {
+            modmap_exit(token);
+            goto out;
+        }
+        last_map = map;
+        last_j = j;
+        last_idx = idx;
+        modules[i] = (uint32_t)idx;
+        out[i].module = backtrace_modtab_get(s->modules, idx)->path;
+        out[i].module_offset = pc - e->bias;
+    }
+    modmap_exit(token);
+
+    /* Counting sort of the positions by module */
+    nmods = (uint32_t)backtrace_modtab_count(s->modules);
+    if (symbolize_grow(s) != 0 || (first = calloc((size_t)nmods + 1, sizeof(*first))) == NULL ||
+        (tasks = malloc(((size_t)nmods + count / SYMBOLIZE_CHUNK + 1) * sizeof(*tasks))) == NULL)
+        goto out;
+    for (i = 0; i < count; i++) {
+        if (modules[i] != BACKTRACE_MODREL_NONE)
+            first[modules[i] + 1]++;
+    }
+    for (m = 0; m < nmods; m++)
+        first[m + 1] += first[m];
+
+    /* Index phase: every module of the batch seen for the first time */
+    for (m = 0, ntasks = 0; m < nmods; m++) {
+        if (first[m + 1] > first[m] && !s->tried[m]) {
+            s->tried[m] = 1;
+            tasks[ntasks].module = m;
+            tasks[ntasks].start = tasks[ntasks].end = 0;
+            ntasks++;
+        }
+    }
+    symbolize_phase(s, symbolize_index, tasks, ntasks);
+
+    /* Lookup phase: chunks, so that one big module still spreads out */
+    for (i = 0; i < count; i++) {
+        if (modules[i] != BACKTRACE_MODREL_NONE)
+            order[first[modules[i]]++] = i;
+    }
+    for (m = 0, ntasks = 0, k = 0; m < nmods; m++) {
+        /* FIRST[m] now holds the end of module m's run */
+        for (; k < first[m]; k += SYMBOLIZE_CHUNK) {
+            tasks[ntasks].module = m;
+            tasks[ntasks].start = k;
+            tasks[ntasks].end = first[m] - k > SYMBOLIZE_CHUNK ? k + SYMBOLIZE_CHUNK : first[m];
+            ntasks++;
+        }
+        k = first[m];
+    }
+    s->order = order;
+    s->out = out;
+    symbolize_phase(s, symbolize_lookup, tasks, ntasks);
+    rc = 0;
+
+out:
+    free(tasks);
+    free(first);
+    free(order);
+    free(modules);
+    return rc;
+}
+
+void
+backtrace_symbolizer_free(backtrace_symbolizer_t *s)
+{
+    uint32_t i;
+    int t;
+
+    if (s == NULL)
+        return;
+    pthread_mutex_lock(&s->lock);
+    s->shutdown = 1;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+    for (t = 1; t < s->nthreads; t++)
+        pthread_join(s->workers[t].thread, NULL);
+    for (i = 0; i < s->elfs_cap; i++)
+        backtrace_elf_close(s->elfs[i]);
+    free(s->elfs);
+    free(s->tried);
+    backtrace_modtab_free(s->modules);
+    pthread_cond_destroy(&s->start);
+    pthread_cond_destroy(&s->done);
+    pthread_mutex_destroy(&s->lock);
+    free(s->workers);
+    free(s);
+}
@@ -4,11 +4,21 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <errno.h>
 #include <assert.h>
 #include <signal.h>
 #include <setjmp.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #include "execinfo.h"
 
@@ -35,6 +45,29 @@ static void test_basic_functionality(test_result_t *result);
 static void test_edge_cases(test_result_t *result);
 static void test_performance(test_result_t *result);
 static void test_symbols_fd(test_result_t *result);
+static void test_symbols_lazy(test_result_t *result);
+static void test_resolve(test_result_t *result);
+static void test_symbols_r(test_result_t *result);
+static void test_foreach(test_result_t *result);
+static void test_cursor(test_result_t *result);
+static void test_filter(test_result_t *result);
+static void test_stack_usage(test_result_t *result);
+static void test_cct(test_result_t *result);
+static void test_topk(test_result_t *result);
+static void test_shm(test_result_t *result);
+static void test_samples(test_result_t *result);
+static void test_modrel(test_result_t *result);
+static void test_profile(test_result_t *result);
+static void test_control(test_result_t *result);
+static void test_remote(test_result_t *result);
+static void test_shadow(test_result_t *result);
+static void test_meta(test_result_t *result);
+static void test_unload(test_result_t *result);
+static void test_symbolize(test_result_t *result);
+static void test_symbols_cached(test_result_t *result);
+static void test_format(test_result_t *result);
+static void test_json(test_result_t *result);
+static void test_wire(test_result_t *result);
 static double get_time_ms(void);
 static void recursive_function(int depth, int max_depth);
 static void setup_signal_handlers(void);
@@ -427,6 +460,2524 @@ test_symbols_fd(test_result_t *result)
     result->duration_ms = get_time_ms() - start_time;
 }
 
+/**
+ * Test lazy symbolization against the eager backtrace_symbols() output
+ */
+static void
+test_symbols_lazy(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    char **strings;
+    backtrace_lazy_t *lazy;
+    const char *str;
+    int i, size, mismatches;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_symbols_lazy()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("lazy symbols test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    memset(array, 0, sizeof(array));
+    size = backtrace(array, MAX_FRAMES);
+    lazy = backtrace_symbols_lazy(array, size);
+    strings = backtrace_symbols(array, size);
+    if (lazy == NULL || strings == NULL || backtrace_lazy_size(lazy) != size) {
+        result->failed++;
+        safe_printf("✗ backtrace_symbols_lazy() failed (size=%d)\n", size);
+        backtrace_lazy_free(lazy);
+        free_bt_symbols(strings, size);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Access frames out of order; repeated lookups must hit the cache */
+    for (i = size - 1, mismatches = 0; i >= 0; i -= 2) {
+        str = backtrace_lazy_symbol(lazy, i);
+        if (str == NULL || strcmp(str, strings[i]) != 0 ||
+            backtrace_lazy_symbol(lazy, i) != str)
+            mismatches++;
+    }
+    for (i = 0; i < size; i++) {
+        str = backtrace_lazy_symbol(lazy, i);
+        if (str == NULL || strcmp(str, strings[i]) != 0)
+            mismatches++;
+    }
+
+    if (mismatches == 0) {
+        result->passed++;
+        safe_printf("✓ lazy frames match backtrace_symbols() (%d frames)\n", size);
+    } else {
+        result->failed++;
+        safe_printf("✗ %d lazy frames differ from backtrace_symbols()\n", mismatches);
+    }
+
+    if (backtrace_lazy_symbol(lazy, -1) == NULL &&
+        backtrace_lazy_symbol(lazy, size) == NULL &&
+        backtrace_symbols_lazy(array, 0) == NULL) {
+        result->passed++;
+        safe_printf("✓ out-of-range lazy lookups rejected\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ out-of-range lazy lookup accepted\n");
+    }
+
+    backtrace_lazy_free(lazy);
+    free_bt_symbols(strings, size);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Test structured frame records from backtrace_resolve()
+ */
+static void
+test_resolve(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    struct backtrace_frame frames[MAX_FRAMES];
+    char expect[512];
+    char **strings;
+    int i, j, size, bad, next_module;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_resolve()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("resolve test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    memset(array, 0, sizeof(array));
+    size = backtrace(array, MAX_FRAMES);
+    strings = backtrace_symbols(array, size);
+    if (strings == NULL || backtrace_resolve(array, size, frames) != size) {
+        result->failed++;
+        safe_printf("✗ backtrace_resolve() failed (size=%d)\n", size);
+        free_bt_symbols(strings, size);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    bad = next_module = 0;
+    for (i = 0; i < size; i++) {
+        if (frames[i].pc != array[i])
+            bad++;
+        if (frames[i].module < 0)
+            continue;
+
+        /* Records must carry the same data as the formatted string */
+        snprintf(expect, sizeof(expect), "%p <%s+%td> at %s", frames[i].pc,
+                 frames[i].symbol ? frames[i].symbol : "???",
+                 frames[i].symbol ? frames[i].offset : (ptrdiff_t)0,
+                 frames[i].module_name);
+        if (strcmp(expect, strings[i]) != 0)
+            bad++;
+
+        /* Module indexes are dense and assigned in order of appearance */
+        if (frames[i].module > next_module)
+            bad++;
+        else if (frames[i].module == next_module)
+            next_module++;
+        for (j = 0; j < i; j++) {
+            if (frames[j].module >= 0 &&
+                (frames[j].module_base == frames[i].module_base) !=
+                (frames[j].module == frames[i].module))
+                bad++;
+        }
+    }
+
+    if (bad == 0) {
+        result->passed++;
+        safe_printf("✓ %d records over %d modules match backtrace_symbols()\n",
+                    size, next_module);
+    } else {
+        result->failed++;
+        safe_printf("✗ %d inconsistencies in resolved records\n", bad);
+    }
+
+    free_bt_symbols(strings, size);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Test the allocation-free backtrace_symbols_r() variant
+ */
+static void
+test_symbols_r(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    static char mem[16384];
+    char small[16];
+    char **strings, **rstrings;
+    size_t len;
+    int i, size, mismatches;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_symbols_r()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("symbols_r test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    memset(array, 0, sizeof(array));
+    size = backtrace(array, MAX_FRAMES);
+
+    /* Too small: must fail with ERANGE and report the required size */
+    len = sizeof(small);
+    errno = 0;
+    rstrings = backtrace_symbols_r(array, size, small, &len);
+    if (rstrings == NULL && errno == ERANGE && len > sizeof(small) &&
+        len <= sizeof(mem)) {
+        result->passed++;
+        safe_printf("✓ overflow reported, %zu bytes required\n", len);
+    } else {
+        result->failed++;
+        safe_printf("✗ overflow not reported correctly (len=%zu)\n", len);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Exactly the reported size must be enough */
+    rstrings = backtrace_symbols_r(array, size, mem, &len);
+    strings = backtrace_symbols(array, size);
+    if (rstrings == NULL || strings == NULL) {
+        result->failed++;
+        safe_printf("✗ backtrace_symbols_r() failed with %zu bytes\n", len);
+        free_bt_symbols(strings, size);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+    for (i = 0, mismatches = 0; i < size; i++) {
+        if ((char *)rstrings[i] < mem || (char *)rstrings[i] >= mem + len ||
+            strcmp(rstrings[i], strings[i]) != 0)
+            mismatches++;
+    }
+    if (mismatches == 0) {
+        result->passed++;
+        safe_printf("✓ caller-buffer output matches backtrace_symbols()\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ %d frames differ from backtrace_symbols()\n", mismatches);
+    }
+
+    free_bt_symbols(strings, size);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * backtrace_foreach() callback: count frames, stop at ctx->stop_at
+ */
+typedef struct {
+    int visited;
+    int stop_at;
+    int resolved;
+} foreach_state_t;
+
+static int
+foreach_callback(const struct backtrace_frame *frame, int index, void *ctx)
+{
+    foreach_state_t *state = ctx;
+
+    if (frame->pc == NULL || index != state->visited)
+        return -1;
+    state->visited++;
+    if (frame->module_name != NULL)
+        state->resolved++;
+    return (index == state->stop_at) ? 42 : 0;
+}
+
+/**
+ * Test streaming frame iteration and early stop
+ */
+static void
+test_foreach(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    foreach_state_t state;
+    int size, rc;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_foreach()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("foreach test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /*
+     * A full walk sees as many frames as a capture from the same depth.
+     * The reference uses backtrace_ex() because sanitizers intercept
+     * backtrace() and add a frame of their own.
+     */
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    memset(&state, 0, sizeof(state));
+    state.stop_at = -1;
+    rc = backtrace_foreach(foreach_callback, &state, 0);
+    if (rc == 0 && state.visited == size && state.resolved == 0) {
+        result->passed++;
+        safe_printf("✓ full walk visited %d frames\n", state.visited);
+    } else {
+        result->failed++;
+        safe_printf("✗ full walk: rc=%d visited=%d expected=%d\n",
+                    rc, state.visited, size);
+    }
+
+    /* Stop on the first frame and resolve it */
+    memset(&state, 0, sizeof(state));
+    state.stop_at = 0;
+    rc = backtrace_foreach(foreach_callback, &state, BACKTRACE_FOREACH_RESOLVE);
+    if (rc == 42 && state.visited == 1 && state.resolved == 1) {
+        result->passed++;
+        safe_printf("✓ walk stopped after the first resolved frame\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ early stop: rc=%d visited=%d resolved=%d\n",
+                    rc, state.visited, state.resolved);
+    }
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Test the incremental cursor against backtrace()
+ */
+static void
+test_cursor(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    backtrace_cursor_t cursor;
+    char *prev_sp;
+    int i, size, bad;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_cursor_*()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("cursor test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    if (backtrace_cursor_init(&cursor) != 0) {
+        /* Targets without frame records report ENOSYS */
+        if (errno == ENOSYS) {
+            result->passed++;
+            safe_printf("✓ cursor unsupported on this target\n");
+        } else {
+            result->failed++;
+            safe_printf("✗ backtrace_cursor_init() failed\n");
+        }
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /*
+     * The first frame is our own, as is array[0]; both were taken at
+     * different call sites, so only the frames above it must match.
+     */
+    prev_sp = backtrace_cursor_sp(&cursor);
+    for (i = 1, bad = 0; i < size && backtrace_cursor_step(&cursor) > 0; i++) {
+        if (backtrace_cursor_pc(&cursor) != array[i] ||
+            (char *)backtrace_cursor_sp(&cursor) <= prev_sp)
+            bad++;
+        prev_sp = backtrace_cursor_sp(&cursor);
+    }
+
+    if (bad == 0 && i == size && backtrace_cursor_step(&cursor) == 0) {
+        result->passed++;
+        safe_printf("✓ cursor walked %d frames matching backtrace()\n", i);
+    } else {
+        result->failed++;
+        safe_printf("✗ cursor walked %d of %d frames, %d mismatches\n",
+                    i, size, bad);
+    }
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Test capture-time skipping and module filtering with backtrace_ex()
+ */
+static void
+test_filter(test_result_t *result)
+{
+    void *array[MAX_FRAMES], *filtered[MAX_FRAMES];
+    struct backtrace_frame frames[MAX_FRAMES];
+    backtrace_filter_t *filter;
+    int i, size, count, expected, bad = 0;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_ex() filters...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("filter test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Skipping one frame drops our own frame and nothing else */
+    filter = backtrace_filter_new(1);
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    count = backtrace_ex(filtered, MAX_FRAMES, filter);
+    for (i = 0; i < count; i++) {
+        if (filtered[i] != array[i + 1])
+            bad++;
+    }
+    if (filter != NULL && count == size - 1 && bad == 0) {
+        result->passed++;
+        safe_printf("✓ skip=1 captured %d of %d frames\n", count, size);
+    } else {
+        result->failed++;
+        safe_printf("✗ skip=1 captured %d of %d frames, %d mismatches\n",
+                    count, size, bad);
+    }
+    backtrace_filter_free(filter);
+
+    /* Excluding the main program leaves only library frames */
+    filter = backtrace_filter_new(0);
+    if (filter == NULL || backtrace_filter_exclude_module(filter, NULL) != 1 ||
+        backtrace_filter_exclude_module(filter, "no-such-module") != -1 ||
+        errno != ENOENT) {
+        result->failed++;
+        safe_printf("✗ backtrace_filter_exclude_module() failed\n");
+        backtrace_filter_free(filter);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+    count = backtrace_ex(filtered, MAX_FRAMES, filter);
+    bad = 0;
+
+    /* array[0] is our own frame, so it names the program's module */
+    backtrace_resolve(array, size, frames);
+    for (i = 0, expected = 0; i < size; i++) {
+        if (frames[i].module_base == frames[0].module_base)
+            continue;
+        if (expected >= count || filtered[expected] != array[i])
+            bad++;
+        expected++;
+    }
+    if (expected != count)
+        bad++;
+    if (bad == 0 && count < size) {
+        result->passed++;
+        safe_printf("✓ module filter dropped %d program frames\n", size - count);
+    } else {
+        result->failed++;
+        safe_printf("✗ module filter kept %d of %d frames (%d errors)\n",
+                    count, size, bad);
+    }
+    backtrace_filter_free(filter);
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Recurse DEPTH times, then sample and measure stack usage
+ */
+static size_t __attribute__((noinline))
+stack_usage_at_depth(int depth)
+{
+    volatile char pad[256];
+    struct backtrace_stack_usage usage;
+    size_t used;
+
+    pad[0] = (char)depth;
+    (void)pad;
+    if (depth > 0) {
+        /* Touching PAD after the call rules out tail-call elimination */
+        used = stack_usage_at_depth(depth - 1);
+        pad[1] = (char)used;
+        return used;
+    }
+
+    backtrace_stackprof_sample();
+    if (backtrace_stack_usage(&usage, NULL, 0) < 0)
+        return 0;
+    return usage.used;
+}
+
+/**
+ * Test stack usage measurement and the sampling high-water table
+ */
+static void
+test_stack_usage(test_result_t *result)
+{
+    struct backtrace_stack_usage usage;
+    size_t sizes[MAX_FRAMES], total, shallow, deep;
+    char report[8192];
+    FILE *out;
+    ssize_t len;
+    int i, depth, stacks;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_stack_usage()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("stack usage test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    depth = backtrace_stack_usage(&usage, sizes, MAX_FRAMES);
+    if (depth < 0 && errno == ENOSYS) {
+        result->passed++;
+        safe_printf("✓ stack usage unsupported on this target\n");
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+    for (i = 0, total = 0; i < depth; i++)
+        total += sizes[i];
+    if (depth > 0 && usage.used > 0 && usage.headroom > 0 &&
+        total == usage.used && usage.depth == depth) {
+        result->passed++;
+        safe_printf("✓ %d frames use %zu bytes, %zu bytes headroom\n",
+                    depth, usage.used, usage.headroom);
+    } else {
+        result->failed++;
+        safe_printf("✗ inconsistent usage: depth=%d used=%zu frames=%zu\n",
+                    depth, usage.used, total);
+    }
+
+    /* A zero capacity must not be taken as the maximum */
+    memset(sizes, 0xa5, sizeof(sizes));
+    errno = 0;
+    depth = backtrace_stack_usage(&usage, sizes, 0);
+    for (i = 0; i < MAX_FRAMES && sizes[i] == sizes[0]; i++)
+        ;
+    if (depth == -1 && errno == EINVAL && i == MAX_FRAMES) {
+        result->passed++;
+        safe_printf("✓ zero capacity rejected without writing\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ zero capacity returned %d\n", depth);
+    }
+
+    /* Deeper recursion must use more stack; sample both depths */
+    if (backtrace_stackprof_set_period(1) != 0) {
+        result->failed++;
+        safe_printf("✗ backtrace_stackprof_set_period() failed\n");
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+    shallow = stack_usage_at_depth(0);
+    deep = stack_usage_at_depth(4);
+    backtrace_stackprof_set_period(0);
+    if (deep >= shallow + 4 * 256) {
+        result->passed++;
+        safe_printf("✓ recursion grew usage from %zu to %zu bytes\n", shallow, deep);
+    } else {
+        result->failed++;
+        safe_printf("✗ recursion usage %zu -> %zu bytes\n", shallow, deep);
+    }
+
+    out = tmpfile();
+    stacks = out ? backtrace_stackprof_dump(fileno(out)) : -1;
+    len = 0;
+    if (out != NULL) {
+        rewind(out);
+        len = (ssize_t)fread(report, 1, sizeof(report) - 1, out);
+        fclose(out);
+    }
+    report[len > 0 ? len : 0] = '\0';
+    if (stacks >= 2 && strstr(report, "max_used=") != NULL) {
+        result->passed++;
+        safe_printf("✓ high-water table holds %d stacks\n", stacks);
+    } else {
+        result->failed++;
+        safe_printf("✗ stack usage dump returned %d\n", stacks);
+    }
+    backtrace_stackprof_reset();
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Test calling-context tree aggregation and folded export
+ */
+static void
+test_cct(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    void *stack_a[3] = { (void *)strlen, (void *)memcpy, (void *)printf };
+    void *stack_b[3] = { (void *)memset, (void *)memcpy, (void *)printf };
+    backtrace_cct_t *cct;
+    char report[4096], *line, *save;
+    FILE *out;
+    size_t len;
+    int size, lines, bad;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_cct_*()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("CCT test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    cct = backtrace_cct_new();
+    if (cct == NULL) {
+        result->failed++;
+        safe_printf("✗ backtrace_cct_new() failed\n");
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Two stacks sharing a two-frame prefix need four nodes */
+    backtrace_cct_insert(cct, stack_a, 3, 1);
+    backtrace_cct_insert(cct, stack_b, 3, 1);
+    backtrace_cct_insert(cct, stack_a, 3, 1);
+    if (backtrace_cct_nodes(cct) == 4 && backtrace_cct_total(cct) == 3) {
+        result->passed++;
+        safe_printf("✓ 3 samples share prefixes in 4 nodes\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ CCT has %zu nodes, total %llu\n", backtrace_cct_nodes(cct),
+                    (unsigned long long)backtrace_cct_total(cct));
+    }
+
+    /* Folded output: one line per leaf, root first, three frames each */
+    out = tmpfile();
+    len = 0;
+    if (out != NULL && backtrace_cct_write_folded(cct, fileno(out)) == 0) {
+        rewind(out);
+        len = fread(report, 1, sizeof(report) - 1, out);
+    }
+    if (out != NULL)
+        fclose(out);
+    report[len] = '\0';
+    lines = bad = 0;
+    for (line = strtok_r(report, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save)) {
+        char *count = strrchr(line, ' ');
+        char *first = strchr(line, ';');
+        lines++;
+        if (count == NULL || first == NULL || strchr(first + 1, ';') == NULL ||
+            (strcmp(count, " 2") != 0 && strcmp(count, " 1") != 0))
+            bad++;
+    }
+    if (lines == 2 && bad == 0) {
+        result->passed++;
+        safe_printf("✓ folded export wrote %d stacks\n", lines);
+    } else {
+        result->failed++;
+        safe_printf("✗ folded export: %d lines, %d malformed\n", lines, bad);
+    }
+
+    /* Real captures go in deeper and only add nodes */
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    if (backtrace_cct_insert(cct, array, size, 1) == 0 &&
+        backtrace_cct_nodes(cct) == 4 + (size_t)size) {
+        result->passed++;
+        safe_printf("✓ captured stack added %d nodes\n", size);
+    } else {
+        result->failed++;
+        safe_printf("✗ captured stack insert gave %zu nodes\n", backtrace_cct_nodes(cct));
+    }
+
+    backtrace_cct_free(cct);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Test heavy-hitter tracking in bounded memory
+ */
+static void
+test_topk(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    void *noise[2];
+    struct backtrace_topk_entry top[4];
+    backtrace_topk_t *topk;
+    int size, i, n;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_topk_*()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Top-K test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    topk = backtrace_topk_new(64, MAX_FRAMES);
+    if (topk == NULL) {
+        result->failed++;
+        safe_printf("✗ backtrace_topk_new() failed\n");
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* One hot stack among far more distinct stacks than counters */
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    for (i = 0; i < 10000; i++) {
+        noise[0] = (void *)(uintptr_t)(0x1000 + i * 16);
+        noise[1] = (void *)strlen;
+        backtrace_topk_add(topk, noise, 2, 1);
+        if (i % 4 == 0)
+            backtrace_topk_add(topk, array, size, 1);
+    }
+
+    n = backtrace_topk_get(topk, top, 4);
+    if (n == 4 && top[0].id == backtrace_hash(array, size) &&
+        top[0].count >= 2500 && top[0].count - top[0].error <= 2500 &&
+        top[0].count >= top[1].count) {
+        result->passed++;
+        safe_printf("✓ hot stack ranked first (count %llu, error %llu)\n",
+                    (unsigned long long)top[0].count,
+                    (unsigned long long)top[0].error);
+    } else {
+        result->failed++;
+        safe_printf("✗ top-K returned %d entries, first count %llu\n", n,
+                    n > 0 ? (unsigned long long)top[0].count : 0ULL);
+    }
+
+    if (n > 0 && top[0].depth == size &&
+        memcmp(top[0].frames, array, (size_t)size * sizeof(void *)) == 0) {
+        result->passed++;
+        safe_printf("✓ full %d-frame stack returned\n", size);
+    } else {
+        result->failed++;
+        safe_printf("✗ returned frames do not match the capture\n");
+    }
+
+    if (backtrace_topk_new(0, MAX_FRAMES) == NULL && errno == EINVAL) {
+        result->passed++;
+        safe_printf("✓ zero capacity rejected\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ zero capacity accepted\n");
+    }
+
+    backtrace_topk_free(topk);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+typedef struct {
+    int samples;
+    uint64_t count;
+    uint64_t id;
+    int mixed_ids;
+    struct backtrace_shm_frame first;
+} shm_state_t;
+
+static int
+shm_callback(const struct backtrace_shm_sample *sample, void *ctx)
+{
+    shm_state_t *state = ctx;
+
+    if (state->samples == 0) {
+        state->id = sample->id;
+        if (sample->depth > 0)
+            state->first = sample->frames[0];
+    } else if (sample->id != state->id) {
+        state->mixed_ids++;
+    }
+    state->samples++;
+    state->count += sample->count;
+    return 0;
+}
+
+/**
+ * Test the shared-memory producer and collector
+ */
+static void
+test_shm(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    char name[64];
+    shm_state_t state;
+    backtrace_shm_t *shm;
+    backtrace_elf_t *elf;
+    const char *sym = NULL;
+    int size, i, sent, failed;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_shm_*()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Shared memory test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    snprintf(name, sizeof(name), "execinfo-test-%d", (int)getpid());
+    shm = backtrace_shm_create(name, 4, 4096);
+    if (shm == NULL || backtrace_shm_attach(name) != 0) {
+        result->failed++;
+        safe_printf("✗ shared memory setup failed: %s\n", strerror(errno));
+        backtrace_shm_destroy(shm);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    for (i = 0; i < 3; i++)
+        backtrace_shm_record(array, size, 1);
+    backtrace_shm_record(array, size, 5);
+    backtrace_shm_detach();
+
+    memset(&state, 0, sizeof(state));
+    backtrace_shm_drain(shm, shm_callback, &state);
+    if (state.samples == 4 && state.count == 8 && state.mixed_ids == 0) {
+        result->passed++;
+        safe_printf("✓ collector drained 4 samples with one stack ID\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ collector drained %d samples, count %llu\n",
+                    state.samples, (unsigned long long)state.count);
+    }
+
+    /* Module-relative frames symbolize offline from the file itself */
+    if (state.first.module != NULL &&
+        (elf = backtrace_elf_open(state.first.module->path)) != NULL) {
+        sym = backtrace_elf_lookup(elf, state.first.offset, NULL);
+        if (sym != NULL && strcmp(sym, "test_shm") == 0) {
+            result->passed++;
+            safe_printf("✓ frame 0 symbolized offline as %s\n", sym);
+        } else {
+            result->failed++;
+            safe_printf("✗ frame 0 symbolized as %s\n", sym ? sym : "(null)");
+        }
+        backtrace_elf_close(elf);
+    } else {
+        result->failed++;
+        safe_printf("✗ frame 0 has no usable module\n");
+    }
+
+    /* A full ring drops samples instead of blocking */
+    sent = failed = 0;
+    if (backtrace_shm_attach(name) == 0) {
+        for (i = 0; i < 1000; i++) {
+            if (backtrace_shm_record(array, size, 1) == 0)
+                sent++;
+            else if (errno == EAGAIN)
+                failed++;
+        }
+        backtrace_shm_detach();
+    }
+    memset(&state, 0, sizeof(state));
+    backtrace_shm_drain(shm, shm_callback, &state);
+    if (failed > 0 && sent == state.samples &&
+        backtrace_shm_dropped(shm) == (unsigned long)failed) {
+        result->passed++;
+        safe_printf("✓ full ring dropped %d of 1000 samples\n", failed);
+    } else {
+        result->failed++;
+        safe_printf("✗ full ring: %d sent, %d drained, %d dropped\n", sent,
+                    state.samples, failed);
+    }
+
+    /* Frames outside every module go out raw, without a map rebuild each */
+    array[0] = (void *)0x10;
+    sent = 0;
+    if (backtrace_shm_attach(name) == 0) {
+        for (i = 0; i < 8; i++)
+            sent += backtrace_shm_record(array, size, 1) == 0;
+        backtrace_shm_detach();
+    }
+    memset(&state, 0, sizeof(state));
+    backtrace_shm_drain(shm, shm_callback, &state);
+    if (sent == 8 && state.samples == 8 && state.first.module == NULL &&
+        state.first.offset == 0x10) {
+        result->passed++;
+        safe_printf("✓ unknown frame recorded as a raw address\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ unknown frame: %d sent, %d drained\n", sent, state.samples);
+    }
+
+    backtrace_shm_destroy(shm);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+typedef struct {
+    int samples;
+    uint64_t value;
+    int mismatches;
+    int per_thread;
+    void *const *expect;
+    int depth;
+} samples_state_t;
+
+static int
+samples_callback(const struct backtrace_sample *sample, void *ctx)
+{
+    samples_state_t *state = ctx;
+
+    state->samples++;
+    state->value += sample->value;
+    if (sample->cpu < 0)
+        state->per_thread++;
+    if (sample->depth != state->depth ||
+        memcmp(sample->frames, state->expect,
+               (size_t)sample->depth * sizeof(void *)) != 0)
+        state->mismatches++;
+    return 0;
+}
+
+static void *
+samples_thread(void *arg)
+{
+    samples_state_t *state = arg;
+    int i;
+
+    for (i = 0; i < 3; i++)
+        backtrace_samples_record(state->expect, state->depth, 1);
+    return NULL;
+}
+
+/**
+ * Test per-CPU and per-thread sample buffers
+ */
+static void
+test_samples(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    samples_state_t state;
+    pthread_t thread;
+    int size, i, dropped;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_samples_*()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Samples test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    memset(&state, 0, sizeof(state));
+    state.expect = array;
+    state.depth = size;
+
+    /* Default mode: per-CPU where rseq is available */
+    dropped = 0;
+    if (backtrace_samples_init(64, MAX_FRAMES, 0) == 0) {
+        for (i = 0; i < 100; i++) {
+            if (backtrace_samples_record(array, size, 2) != 0 && errno == EAGAIN)
+                dropped++;
+        }
+        backtrace_samples_drain(samples_callback, &state);
+    }
+    if (state.samples == 100 - dropped && state.value == 2 * (uint64_t)state.samples &&
+        state.mismatches == 0 && dropped >= 36 &&
+        backtrace_samples_dropped() == (unsigned long)dropped) {
+        result->passed++;
+        safe_printf("✓ %s buffers kept %d samples, dropped %d\n",
+                    backtrace_samples_percpu() ? "per-CPU" : "per-thread",
+                    state.samples, dropped);
+    } else {
+        result->failed++;
+        safe_printf("✗ buffers kept %d samples (%d bad), dropped %d\n",
+                    state.samples, state.mismatches, dropped);
+    }
+    backtrace_samples_shutdown();
+
+    /* Forced per-thread mode, with a second writer thread */
+    memset(&state, 0, sizeof(state));
+    state.expect = array;
+    state.depth = size;
+    if (backtrace_samples_init(64, MAX_FRAMES, BACKTRACE_SAMPLES_PER_THREAD) == 0) {
+        for (i = 0; i < 5; i++)
+            backtrace_samples_record(array, size, 1);
+        if (pthread_create(&thread, NULL, samples_thread, &state) == 0)
+            pthread_join(thread, NULL);
+        backtrace_samples_drain(samples_callback, &state);
+    }
+    if (state.samples == 8 && state.per_thread == 8 && state.mismatches == 0 &&
+        !backtrace_samples_percpu()) {
+        result->passed++;
+        safe_printf("✓ per-thread buffers collected 8 samples from 2 threads\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ per-thread buffers collected %d samples\n", state.samples);
+    }
+    backtrace_samples_shutdown();
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Test module-relative conversion and module tables
+ */
+static void
+test_modrel(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    struct backtrace_modrel frames[MAX_FRAMES], other[MAX_FRAMES];
+    struct backtrace_frame resolved;
+    const struct backtrace_module *mod = NULL;
+    const char *name = NULL, *expect = NULL;
+    backtrace_modtab_t *table, *merged;
+    int size, count, last;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_modrel()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Modrel test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    table = backtrace_modtab_new();
+    merged = backtrace_modtab_new();
+    if (table == NULL || merged == NULL) {
+        result->failed++;
+        safe_printf("✗ backtrace_modtab_new() failed\n");
+        backtrace_modtab_free(table);
+        backtrace_modtab_free(merged);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Frame 0 is in the test program: module index 0, offset within it */
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    backtrace_resolve(array, 1, &resolved);
+    if (backtrace_modrel(array, size, frames, table) == size &&
+        (mod = backtrace_modtab_get(table, 0)) != NULL) {
+        name = strrchr(mod->path, '/') ? strrchr(mod->path, '/') + 1 : mod->path;
+        expect = resolved.module_name;
+        if (expect != NULL && strrchr(expect, '/') != NULL)
+            expect = strrchr(expect, '/') + 1;
+    }
+    if (mod != NULL && frames[0].module == 0 && expect != NULL &&
+        strcmp(name, expect) == 0 &&
+        frames[0].offset < (uint64_t)(uintptr_t)array[0]) {
+        result->passed++;
+        safe_printf("✓ %d frames over %d modules, frame 0 at %s+0x%llx\n",
+                    size, backtrace_modtab_count(table), name,
+                    (unsigned long long)frames[0].offset);
+    } else {
+        result->failed++;
+        safe_printf("✗ frame 0 not converted to the test program\n");
+    }
+
+    /* Another table numbered differently yields the same stack ID */
+    count = backtrace_modtab_count(table);
+    last = count - 1;
+    backtrace_modtab_add(merged, backtrace_modtab_get(table, last));
+    backtrace_modrel(array, size, other, merged);
+    if (backtrace_modtab_count(merged) == count &&
+        backtrace_modrel_hash(frames, size, table) ==
+        backtrace_modrel_hash(other, size, merged) &&
+        (count == 1 || frames[0].module != other[0].module)) {
+        result->passed++;
+        safe_printf("✓ stack ID independent of module numbering\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ stack IDs differ between module tables\n");
+    }
+
+    /* Converting again adds nothing to the table */
+    backtrace_modrel(array, size, frames, table);
+    if (backtrace_modtab_count(table) == count) {
+        result->passed++;
+        safe_printf("✓ modules stored once\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ table grew to %d modules\n", backtrace_modtab_count(table));
+    }
+
+    backtrace_modtab_free(table);
+    backtrace_modtab_free(merged);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+struct profile_check {
+    int samples;
+    uint64_t sum;
+    uint64_t last;
+    int unordered;
+    int limit;
+    char module[256];                /* the mapping goes away after the query */
+};
+
+static int
+profile_check_sample(const struct backtrace_profile_sample *sample, void *ctx)
+{
+    struct profile_check *check = ctx;
+    const struct backtrace_module *mod;
+
+    if (sample->timestamp < check->last)
+        check->unordered++;
+    check->last = sample->timestamp;
+    check->samples++;
+    check->sum += sample->value;
+    if (check->module[0] == '\0' && sample->depth > 0 &&
+        (mod = backtrace_profile_module(sample->profile, sample->frames[0].module)) != NULL)
+        snprintf(check->module, sizeof(check->module), "%s", mod->path);
+    return check->limit && check->samples >= check->limit;
+}
+
+/**
+ * Test the columnar profile segments
+ */
+static void
+test_profile(test_result_t *result)
+{
+    void *array[MAX_FRAMES];
+    char dir[] = "/tmp/execinfo-profile-XXXXXX", path[512];
+    struct profile_check check;
+    backtrace_profile_writer_t *w;
+    struct dirent *d;
+    DIR *dp;
+    int size, i, segments, rc;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_profile_writer_new()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Profile test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    if (mkdtemp(dir) == NULL || (w = backtrace_profile_writer_new(dir, 1000)) == NULL) {
+        result->failed++;
+        safe_printf("✗ backtrace_profile_writer_new() failed: %s\n", strerror(errno));
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Two stacks over 3000 ns: three 1000 ns segments of 1000 rows */
+    size = backtrace_ex(array, MAX_FRAMES, NULL);
+    for (i = 0, rc = 0; i < 3000 && rc == 0; i++)
+        rc = backtrace_profile_record(w, 1000 + (uint64_t)i, array + i % 2,
+                                      size - i % 2, (uint64_t)(i % 3));
+    if (backtrace_profile_writer_free(w) != 0)
+        rc = -1;
+    segments = 0;
+    if ((dp = opendir(dir)) != NULL) {
+        while ((d = readdir(dp)) != NULL)
+            segments += d->d_name[0] != '.';
+        closedir(dp);
+    }
+    if (rc == 0 && segments == 3) {
+        result->passed++;
+        safe_printf("✓ 3000 samples rotated into %d segments\n", segments);
+    } else {
+        result->failed++;
+        safe_printf("✗ writing failed (rc %d, %d segments)\n", rc, segments);
+    }
+
+    /* A window across two segments, starting mid-block */
+    memset(&check, 0, sizeof(check));
+    rc = backtrace_profile_query(dir, 1500, 2600, profile_check_sample, &check);
+    if (rc == 1100 && check.samples == 1100 && check.sum == 1100 &&
+        check.unordered == 0 && strstr(check.module, "test") != NULL) {
+        result->passed++;
+        safe_printf("✓ window [1500, 2600) gave %d samples, frame 0 in %s\n",
+                    check.samples, check.module);
+    } else {
+        result->failed++;
+        safe_printf("✗ window query gave %d samples, sum %llu\n",
+                    rc, (unsigned long long)check.sum);
+    }
+
+    /* The callback stops the query across segments */
+    memset(&check, 0, sizeof(check));
+    check.limit = 5;
+    rc = backtrace_profile_query(dir, 0, UINT64_MAX, profile_check_sample, &check);
+    if (rc == 5 && check.samples == 5) {
+        result->passed++;
+        safe_printf("✓ query stopped after %d samples\n", rc);
+    } else {
+        result->failed++;
+        safe_printf("✗ query went on to %d samples\n", rc);
+    }
+
+    if ((dp = opendir(dir)) != NULL) {
+        while ((d = readdir(dp)) != NULL) {
+            if (d->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+            unlink(path);
+        }
+        closedir(dp);
+    }
+    rmdir(dir);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+static volatile unsigned long control_spin_sink;
+
+/* Burn CPU until FD is readable; external so dladdr() can name it */
+void control_spin(int fd);
+
+__attribute__((noinline)) void
+control_spin(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    unsigned long i;
+
+    do {
+        for (i = 0; i < 1000000; i++)
+            control_spin_sink += i;
+    } while (poll(&pfd, 1, 0) == 0);
+}
+
+/* The hooks -finstrument-functions emits calls to */
+void __cyg_profile_func_enter(void *fn, void *site);
+void __cyg_profile_func_exit(void *fn, void *site);
+
+/* Send CMD to the control socket at PATH and read the whole reply */
+static int
+control_request(const char *path, const char *cmd, char *reply, size_t len, int spin)
+{
+    struct sockaddr_un addr;
+    size_t used = 0;
+    ssize_t n;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        write(fd, cmd, strlen(cmd)) != (ssize_t)strlen(cmd)) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (spin)
+        control_spin(fd);
+    while (used < len - 1) {
+        n = read(fd, reply + used, len - 1 - used);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        used += (size_t)n;
+    }
+    reply[used] = '\0';
+    close(fd);
+    return (int)used;
+}
+
+static void *
+control_idle_thread(void *arg)
+{
+    pthread_barrier_t *barrier = arg;
+
+    pthread_barrier_wait(barrier);
+    pthread_barrier_wait(barrier);
+    return NULL;
+}
+
+/**
+ * Test the live profiling control socket
+ */
+static void
+test_control(test_result_t *result)
+{
+    char path[64], expect[32], *reply, *p;
+    pthread_barrier_t barrier;
+    pthread_t thread;
+    int n, threads;
+    volatile double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_control_start()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Control test crashed with signal %d\n", test_result);
+        result->failed++;
+        backtrace_control_stop();
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    reply = malloc(1 << 20);
+    snprintf(path, sizeof(path), "/tmp/execinfo-control-%d.sock", (int)getpid());
+    if (reply == NULL || backtrace_control_start(path) != 0) {
+        result->failed++;
+        safe_printf("✗ backtrace_control_start() failed: %s\n", strerror(errno));
+        free(reply);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    snprintf(expect, sizeof(expect), "pid %d\n", (int)getpid());
+    n = control_request(path, "stats\n", reply, 1 << 20, 0);
+    if (n > 0 && strncmp(reply, expect, strlen(expect)) == 0 &&
+        backtrace_control_start(path) != 0 && errno == EBUSY) {
+        result->passed++;
+        safe_printf("✓ stats answered, second start refused\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ stats reply: %.80s\n", n > 0 ? reply : "(none)");
+    }
+
+    /* This thread spins while the control thread profiles it */
+    n = control_request(path, "cpu-profile 1 200\n", reply, 1 << 20, 1);
+    if (n > 0 && strstr(reply, "control_spin") != NULL) {
+        result->passed++;
+        safe_printf("✓ cpu-profile saw control_spin (%d bytes of folded stacks)\n", n);
+    } else {
+        result->failed++;
+        safe_printf("✗ cpu-profile reply: %.80s\n", n > 0 ? reply : "(none)");
+    }
+
+    /* Shadow mode must not change the stacks the profiler walks */
+    backtrace_shadow_mode(1);
+    __cyg_profile_func_enter((void *)test_control, __builtin_return_address(0));
+    n = control_request(path, "cpu-profile 1 200\n", reply, 1 << 20, 1);
+    __cyg_profile_func_exit((void *)test_control, __builtin_return_address(0));
+    backtrace_shadow_mode(0);
+    if (n > 0 && strstr(reply, ";control_spin") != NULL) {
+        result->passed++;
+        safe_printf("✓ cpu-profile stacks intact in shadow mode\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ shadow mode cpu-profile reply: %.80s\n", n > 0 ? reply : "(none)");
+    }
+
+    /* Every thread but the control thread answers a dump */
+    pthread_barrier_init(&barrier, NULL, 2);
+    pthread_create(&thread, NULL, control_idle_thread, &barrier);
+    pthread_barrier_wait(&barrier);
+    n = control_request(path, "threads\n", reply, 1 << 20, 0);
+    pthread_barrier_wait(&barrier);
+    pthread_join(thread, NULL);
+    pthread_barrier_destroy(&barrier);
+    for (p = reply, threads = 0; n > 0 && (p = strstr(p, "Thread ")) != NULL; p++)
+        threads++;
+    if (threads == 2) {
+        result->passed++;
+        safe_printf("✓ threads dumped %d stacks\n", threads);
+    } else {
+        result->failed++;
+        safe_printf("✗ threads dumped %d stacks\n", threads);
+    }
+
+    n = control_request(path, "bogus\n", reply, 1 << 20, 0);
+    backtrace_control_stop();
+    if (n > 0 && strncmp(reply, "error:", 6) == 0 && access(path, F_OK) != 0) {
+        result->passed++;
+        safe_printf("✓ unknown command rejected, socket removed on stop\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ unknown command or stop misbehaved\n");
+    }
+
+    free(reply);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+static volatile unsigned long remote_spin_sink;
+
+/* Spin forever in a forked child; external so the ELF index names it */
+void remote_spin(void);
+
+__attribute__((noinline)) void
+remote_spin(void)
+{
+    for (;;)
+        remote_spin_sink++;
+}
+
+/* CPU time of PID in clock ticks, from /proc/PID/stat, or -1 */
+static long
+remote_cpu_ticks(pid_t pid)
+{
+    char path[64], buf[512], *p;
+    unsigned long utime, stime;
+    FILE *fp;
+    size_t n;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+    n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+    /* Fields 14 and 15, counted after the parenthesized command name */
+    if ((p = strrchr(buf, ')')) == NULL ||
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &utime, &stime) != 2)
+        return -1;
+    return (long)(utime + stime);
+}
+
+/**
+ * Test ptrace sampling of another process
+ */
+static void
+test_remote(test_result_t *result)
+{
+    struct backtrace_shm_frame frames[EXECINFO_MAX_FRAMES];
+    backtrace_remote_t *r;
+    const char *name;
+    uint64_t id = 0, offset;
+    pid_t child, tid;
+    int i, n, depth, hits, samples;
+    long ticks;
+    double start_time = get_time_ms();
+    int test_result;
+
+    safe_printf("Testing backtrace_remote_attach()...\n");
+
+    child = fork();
+    if (child == 0)
+        remote_spin();
+    if (child < 0) {
+        result->failed++;
+        safe_printf("✗ fork failed: %s\n", strerror(errno));
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Remote test crashed with signal %d\n", test_result);
+        result->failed++;
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    r = backtrace_remote_attach(child);
+    if (r == NULL) {
+        /* Containers often forbid ptrace; nothing to test then */
+        safe_printf("- ptrace unavailable (%s), skipped\n", strerror(errno));
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    n = backtrace_remote_threads(r, &tid, 1);
+    for (i = 0, hits = samples = 0; n == 1 && i < 20; i++) {
+        depth = backtrace_remote_sample(r, tid, frames, EXECINFO_MAX_FRAMES, &id);
+        if (depth <= 0)
+            continue;
+        samples++;
+        name = backtrace_remote_symbol(r, &frames[0], &offset);
+        if (name != NULL && strcmp(name, "remote_spin") == 0 && id != 0)
+            hits++;
+        usleep(1000);
+    }
+    if (n == 1 && tid == child && hits > 0) {
+        result->passed++;
+        safe_printf("✓ %d of %d samples were in remote_spin\n", hits, samples);
+    } else {
+        result->failed++;
+        safe_printf("✗ %d threads, %d of %d samples in remote_spin\n", n, hits, samples);
+    }
+
+    /* A job-control stop is the user's: sampling must not resume it */
+    kill(child, SIGSTOP);
+    depth = backtrace_remote_sample(r, child, frames, EXECINFO_MAX_FRAMES, &id);
+    ticks = remote_cpu_ticks(child);
+    usleep(100000);
+    if (depth > 0 && ticks >= 0 && remote_cpu_ticks(child) == ticks) {
+        result->passed++;
+        safe_printf("✓ stopped child sampled and left stopped\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ stopped child: depth %d, ran after the sample\n", depth);
+    }
+    kill(child, SIGCONT);
+
+    /* The child keeps running untraced after detach */
+    backtrace_remote_detach(r);
+    if (kill(child, 0) == 0 && waitpid(child, NULL, WNOHANG) == 0) {
+        result->passed++;
+        safe_printf("✓ detached, child still running\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ child did not survive detach\n");
+    }
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+#define SHADOW_TEST_DEPTH 64
+#define SHADOW_ITERATIONS 100000
+
+struct shadow_traces {
+    void *walked[EXECINFO_MAX_FRAMES];
+    void *shadowed[EXECINFO_MAX_FRAMES];
+    int nwalked, nshadowed;
+    double walk_ns, shadow_ns;
+};
+
+/* Recurse as instrumented code would, then trace both ways at the bottom */
+static __attribute__((noinline)) void
+shadow_chain(int depth, struct shadow_traces *t)
+{
+    double start;
+    int i;
+
+    __cyg_profile_func_enter((void *)shadow_chain, __builtin_return_address(0));
+    if (depth > 0) {
+        shadow_chain(depth - 1, t);
+    } else {
+        backtrace_shadow_mode(0);
+        start = get_time_ms();
+        for (i = 0; i < SHADOW_ITERATIONS; i++)
+            t->nwalked = backtrace(t->walked, EXECINFO_MAX_FRAMES);
+        t->walk_ns = (get_time_ms() - start) * 1e6 / SHADOW_ITERATIONS;
+        backtrace_shadow_mode(1);
+        start = get_time_ms();
+        for (i = 0; i < SHADOW_ITERATIONS; i++)
+            t->nshadowed = backtrace(t->shadowed, EXECINFO_MAX_FRAMES);
+        t->shadow_ns = (get_time_ms() - start) * 1e6 / SHADOW_ITERATIONS;
+        backtrace_shadow_mode(0);
+    }
+    __cyg_profile_func_exit((void *)shadow_chain, __builtin_return_address(0));
+}
+
+/**
+ * Test the -finstrument-functions shadow stack
+ */
+static void
+test_shadow(test_result_t *result)
+{
+    struct shadow_traces *t;
+    void *frame;
+    volatile double start_time = get_time_ms();
+    double start, hook_ns;
+    int i, test_result;
+
+    safe_printf("Testing backtrace_shadow()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Shadow test crashed with signal %d\n", test_result);
+        result->failed++;
+        backtrace_shadow_mode(0);
+        backtrace_shadow_reset(0);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Nothing instrumented is active here */
+    if (backtrace_shadow(&frame, 1) == 0 && backtrace_shadow_depth() == 0) {
+        result->passed++;
+        safe_printf("✓ empty outside instrumented code\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ shadow stack not empty at depth %d\n", backtrace_shadow_depth());
+    }
+
+    /*
+     * Past frame 0, the two backtrace() call sites, the traces agree.
+     * An interposed backtrace(), as under ASan, adds a frame to the walk.
+     */
+    shadow_chain(SHADOW_TEST_DEPTH, t);
+    for (i = 0; i < t->nwalked && t->walked[i] != t->shadowed[1]; i++)
+        ;
+    if (t->nshadowed == SHADOW_TEST_DEPTH + 2 && t->nwalked - i >= t->nshadowed - 1 &&
+        memcmp(t->walked + i, t->shadowed + 1,
+               (size_t)(t->nshadowed - 1) * sizeof(void *)) == 0 &&
+        backtrace_shadow_depth() == 0) {
+        result->passed++;
+        safe_printf("✓ %d frames match the walk: %.0f ns walked, %.0f ns shadowed\n",
+                    t->nshadowed, t->walk_ns, t->shadow_ns);
+    } else {
+        result->failed++;
+        safe_printf("✗ shadow trace of %d frames, walk of %d\n", t->nshadowed, t->nwalked);
+    }
+
+    /* What instrumentation costs every call */
+    start = get_time_ms();
+    for (i = 0; i < SHADOW_ITERATIONS; i++) {
+        __cyg_profile_func_enter((void *)test_shadow, (void *)test_shadow);
+        __cyg_profile_func_exit((void *)test_shadow, (void *)test_shadow);
+    }
+    hook_ns = (get_time_ms() - start) * 1e6 / SHADOW_ITERATIONS;
+    safe_printf("  enter/exit hooks: %.1f ns per instrumented call\n", hook_ns);
+
+    /* Stale entries after a longjmp are dropped */
+    for (i = 0; i < 3; i++)
+        __cyg_profile_func_enter((void *)test_shadow, (void *)test_shadow);
+    backtrace_shadow_reset(0);
+    if (backtrace_shadow_depth() == 0 && backtrace_shadow(&frame, 1) == 0) {
+        result->passed++;
+        safe_printf("✓ reset dropped stale entries\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ reset left depth %d\n", backtrace_shadow_depth());
+    }
+
+    free(t);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+static void *
+meta_thread(void *arg)
+{
+    struct backtrace_meta *meta = arg;
+    void *frames[MAX_FRAMES];
+
+    backtrace_meta(frames, MAX_FRAMES, meta, 0);
+    return NULL;
+}
+
+/**
+ * Test backtrace_meta() headers
+ */
+static void
+test_meta(test_result_t *result)
+{
+    struct backtrace_meta meta, other, tsc;
+    struct timespec before, after;
+    void *frames[MAX_FRAMES], *walked[MAX_FRAMES];
+    uint64_t lo, hi;
+    pthread_t thread;
+    pid_t child;
+    double start_time = get_time_ms(), start;
+    int n, walk, i, status;
+    int test_result;
+
+    safe_printf("Testing backtrace_meta()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Metadata test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    n = backtrace_meta(frames, MAX_FRAMES, &meta, 0);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    walk = backtrace_ex(walked, MAX_FRAMES, NULL);
+    lo = (uint64_t)before.tv_sec * 1000000000ULL + (uint64_t)before.tv_nsec;
+    hi = (uint64_t)after.tv_sec * 1000000000ULL + (uint64_t)after.tv_nsec;
+    if (sizeof(meta) == 16 && n > 0 && meta.depth == n && walk == n &&
+        memcmp(frames + 1, walked + 1, (size_t)(n - 1) * sizeof(void *)) == 0 &&
+        meta.tid == (uint32_t)getpid() && meta.timestamp >= lo && meta.timestamp <= hi &&
+        meta.cpu >= 0 && meta.cpu < sysconf(_SC_NPROCESSORS_CONF) && meta.flags == 0) {
+        result->passed++;
+        safe_printf("✓ %d frames on tid %u, cpu %d, t=%llu\n", n, meta.tid, meta.cpu,
+                    (unsigned long long)meta.timestamp);
+    } else {
+        result->failed++;
+        safe_printf("✗ header: depth %d/%d tid %u cpu %d t=%llu not in [%llu, %llu]\n",
+                    meta.depth, n, meta.tid, meta.cpu, (unsigned long long)meta.timestamp,
+                    (unsigned long long)lo, (unsigned long long)hi);
+    }
+
+    /* Other threads and forked children get their own thread IDs */
+    memset(&other, 0, sizeof(other));
+    pthread_create(&thread, NULL, meta_thread, &other);
+    pthread_join(thread, NULL);
+    fflush(stdout);
+    child = fork();
+    if (child == 0) {
+        backtrace_meta(frames, MAX_FRAMES, &meta, 0);
+        _exit(meta.tid == (uint32_t)getpid() ? 0 : 1);
+    }
+    if (other.tid != 0 && other.tid != meta.tid && other.depth > 0 &&
+        child > 0 && waitpid(child, &status, 0) == child &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        result->passed++;
+        safe_printf("✓ thread and child thread IDs are their own\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ thread tid %u, child status %d\n", other.tid, child > 0 ? status : -1);
+    }
+
+    /* Cycle counter timestamps, where there is one, only go forwards */
+    backtrace_meta(frames, MAX_FRAMES, &meta, BACKTRACE_META_TSC);
+    backtrace_meta(frames, MAX_FRAMES, &tsc, BACKTRACE_META_TSC);
+    if (meta.flags != tsc.flags ||
+        (tsc.flags == BACKTRACE_META_TSC && tsc.timestamp < meta.timestamp)) {
+        result->failed++;
+        safe_printf("✗ cycle timestamps %llu then %llu\n",
+                    (unsigned long long)meta.timestamp, (unsigned long long)tsc.timestamp);
+    } else {
+        result->passed++;
+        safe_printf("✓ %s timestamps\n", tsc.flags ? "cycle counter" : "monotonic clock");
+    }
+
+    start = get_time_ms();
+    for (i = 0; i < TEST_ITERATIONS * 10; i++)
+        backtrace_meta(frames, MAX_FRAMES, &meta, 0);
+    safe_printf("  backtrace_meta(): %.0f ns/call\n",
+                (get_time_ms() - start) * 1e6 / (TEST_ITERATIONS * 10));
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+#define UNLOAD_READERS 4
+#define UNLOAD_CYCLES 200
+
+struct unload_shared {
+    void *_Atomic plugin_pc;         /* may be stale: never dereferenced */
+    _Atomic int stop;
+    _Atomic unsigned long conversions;
+    _Atomic unsigned long errors;
+};
+
+/* Convert stacks while modules come and go */
+static void *
+unload_reader(void *arg)
+{
+    struct unload_shared *sh = arg;
+    struct backtrace_modrel frames[3];
+    backtrace_modtab_t *table = backtrace_modtab_new();
+    void *buffer[3];
+    int heap;
+
+    while (table != NULL && !atomic_load(&sh->stop)) {
+        buffer[0] = (void *)unload_reader;
+        buffer[1] = atomic_load(&sh->plugin_pc);
+        buffer[2] = &heap;              /* in no module: forces a refresh check */
+        if (backtrace_modrel(buffer, 3, frames, table) != 3 ||
+            frames[0].module == BACKTRACE_MODREL_NONE)
+            atomic_fetch_add(&sh->errors, 1);
+        atomic_fetch_add(&sh->conversions, 1);
+    }
+    backtrace_modtab_free(table);
+    return NULL;
+}
+
+/**
+ * Test module map lookups racing with dlopen()/dlclose()
+ */
+static void
+test_unload(test_result_t *result)
+{
+    static const char *const plugins[][2] = {
+        { "libthread_db.so.1", "td_init" },
+        { "libresolv.so.2", "__res_query" },
+        { "libanl.so.1", "getaddrinfo_a" },
+    };
+    struct unload_shared sh;
+    pthread_t readers[UNLOAD_READERS];
+    void *handle = NULL;
+    size_t p;
+    double start_time = get_time_ms();
+    int i, started = 0, cycles = 0;
+    int test_result;
+
+    safe_printf("Testing module map reclamation under dlclose()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Unload test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* A library loaded already would never be unmapped */
+    for (p = 0; p < sizeof(plugins) / sizeof(plugins[0]); p++) {
+        if ((handle = dlopen(plugins[p][0], RTLD_NOW | RTLD_NOLOAD)) != NULL) {
+            dlclose(handle);
+            continue;
+        }
+        if ((handle = dlopen(plugins[p][0], RTLD_NOW | RTLD_LOCAL)) != NULL) {
+            dlclose(handle);
+            break;
+        }
+    }
+    if (p == sizeof(plugins) / sizeof(plugins[0])) {
+        safe_printf("- no unloadable library found, skipped\n");
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    memset(&sh, 0, sizeof(sh));
+    for (i = 0; i < UNLOAD_READERS; i++)
+        started += pthread_create(&readers[i], NULL, unload_reader, &sh) == 0;
+    for (cycles = 0; cycles < UNLOAD_CYCLES; cycles++) {
+        handle = dlopen(plugins[p][0], RTLD_NOW | RTLD_LOCAL);
+        if (handle == NULL)
+            break;
+        atomic_store(&sh.plugin_pc, dlsym(handle, plugins[p][1]));
+        usleep(100);
+        dlclose(handle);
+    }
+    atomic_store(&sh.stop, 1);
+    for (i = 0; i < started; i++)
+        pthread_join(readers[i], NULL);
+
+    if (started == UNLOAD_READERS && cycles == UNLOAD_CYCLES &&
+        atomic_load(&sh.errors) == 0 && atomic_load(&sh.conversions) > 0) {
+        result->passed++;
+        safe_printf("✓ %lu conversions across %d loads of %s\n",
+                    atomic_load(&sh.conversions), cycles, plugins[p][0]);
+    } else {
+        result->failed++;
+        safe_printf("✗ %d readers, %d cycles, %lu errors\n", started, cycles,
+                    atomic_load(&sh.errors));
+    }
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+#define SYMBOLIZE_BATCH 50000
+
+/* Symbolize PCS with a fresh symbolizer of THREADS workers */
+static struct backtrace_symbol *
+symbolize_batch(void **pcs, int threads, backtrace_symbolizer_t **sp, double *ms)
+{
+    struct backtrace_symbol *out = calloc(SYMBOLIZE_BATCH, sizeof(*out));
+    double start;
+
+    *sp = backtrace_symbolizer_new(threads);
+    start = get_time_ms();
+    if (out == NULL || *sp == NULL ||
+        backtrace_symbolize(*sp, (void *const *)pcs, SYMBOLIZE_BATCH, out) != 0) {
+        free(out);
+        return NULL;
+    }
+    *ms = get_time_ms() - start;
+    return out;
+}
+
+/**
+ * Test parallel batch symbolization against dladdr()
+ */
+static void
+test_symbolize(test_result_t *result)
+{
+    void *funcs[] = {
+        (void *)(uintptr_t)malloc, (void *)(uintptr_t)free, (void *)(uintptr_t)qsort,
+        (void *)(uintptr_t)getenv, (void *)(uintptr_t)fopen,
+        (void *)(uintptr_t)pthread_create, (void *)(uintptr_t)backtrace_ex,
+        (void *)(uintptr_t)backtrace_symbols, (void *)(uintptr_t)backtrace_modtab_new,
+        (void *)(uintptr_t)backtrace_elf_open, (void *)(uintptr_t)test_symbolize,
+        (void *)0x10
+    };
+    int nfuncs = (int)(sizeof(funcs) / sizeof(funcs[0]));
+    void **volatile pcs = NULL;
+    struct backtrace_symbol *volatile one = NULL, *volatile many = NULL;
+    backtrace_symbolizer_t *volatile s1 = NULL, *volatile s4 = NULL;
+    backtrace_symbolizer_t *s;
+    double t1 = 0.0, t4 = 0.0;
+    volatile double start_time = get_time_ms();
+    int i, checked, bad, differ, test_result;
+    Dl_info info;
+
+    safe_printf("Testing backtrace_symbolize()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Batch symbolizer test crashed with signal %d\n", test_result);
+        result->failed++;
+        backtrace_symbolizer_free(s1);
+        backtrace_symbolizer_free(s4);
+        free(one);
+        free(many);
+        free(pcs);
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Function entries and a few bytes into them, and an unmapped address */
+    pcs = malloc(SYMBOLIZE_BATCH * sizeof(*pcs));
+    for (i = 0; pcs != NULL && i < SYMBOLIZE_BATCH; i++)
+        pcs[i] = (char *)funcs[i % nfuncs] + (funcs[i % nfuncs] == (void *)0x10 ? 0 : i / nfuncs % 8);
+    one = pcs != NULL ? symbolize_batch(pcs, 1, &s, &t1) : NULL;
+    s1 = s;
+    many = pcs != NULL ? symbolize_batch(pcs, 4, &s, &t4) : NULL;
+    s4 = s;
+
+    /* Exported functions must agree with dladdr(), aliases aside */
+    checked = bad = 0;
+    for (i = 0; one != NULL && i < SYMBOLIZE_BATCH; i++) {
+        if (pcs[i] == (void *)0x10) {
+            if (one[i].symbol != NULL || one[i].module != NULL || one[i].module_offset != 0x10)
+                bad++;
+        } else if (dladdr(pcs[i], &info) != 0 && info.dli_sname != NULL) {
+            checked++;
+            if (one[i].symbol == NULL || one[i].module == NULL ||
+                one[i].offset != (uint64_t)((char *)pcs[i] - (char *)info.dli_saddr))
+                bad++;
+        }
+    }
+    if (one != NULL && checked > SYMBOLIZE_BATCH / 2 && bad == 0) {
+        result->passed++;
+        safe_printf("✓ %d addresses symbolized as dladdr() does\n", checked);
+    } else {
+        result->failed++;
+        safe_printf("✗ %d of %d addresses symbolized differently\n", bad, checked);
+    }
+
+    /* Any number of workers gives the same answer */
+    differ = one == NULL || many == NULL;
+    for (i = 0; !differ && i < SYMBOLIZE_BATCH; i++) {
+        if ((one[i].symbol == NULL) != (many[i].symbol == NULL) ||
+            (one[i].symbol != NULL && strcmp(one[i].symbol, many[i].symbol) != 0) ||
+            one[i].offset != many[i].offset || one[i].module_offset != many[i].module_offset)
+            differ = 1;
+    }
+    if (!differ && s4 != NULL && backtrace_symbolizer_threads(s4) == 4) {
+        result->passed++;
+        safe_printf("✓ 4 workers match 1 worker (%.2f ms vs %.2f ms)\n", t4, t1);
+    } else {
+        result->failed++;
+        safe_printf("✗ results depend on the number of workers\n");
+    }
+
+    /* Later batches reuse the indexes */
+    t1 = get_time_ms();
+    if (s4 != NULL && many != NULL &&
+        backtrace_symbolize(s4, (void *const *)pcs, SYMBOLIZE_BATCH, many) == 0 &&
+        backtrace_symbolize(s4, (void *const *)pcs, 0, many) == 0) {
+        result->passed++;
+        safe_printf("✓ second batch in %.2f ms\n", get_time_ms() - t1);
+    } else {
+        result->failed++;
+        safe_printf("✗ second batch failed\n");
+    }
+
+    backtrace_symbolizer_free(s1);
+    backtrace_symbolizer_free(s4);
+    free(one);
+    free(many);
+    free(pcs);
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+#define CACHED_THREADS 4
+#define CACHED_CALLS 10000
+
+struct cached_shared {
+    void **frames;
+    int size;
+    const char *const *expect;
+    _Atomic int mismatches;
+};
+
+static void *
+cached_thread(void *arg)
+{
+    struct cached_shared *sh = arg;
+    const char *const *strings;
+    int i;
+
+    for (i = 0; i < CACHED_CALLS; i++) {
+        strings = backtrace_symbols_cached(sh->frames, sh->size);
+        if (strings != sh->expect)
+            atomic_fetch_add(&sh->mismatches, 1);
+        backtrace_symbols_release(strings);
+    }
+    return NULL;
+}
+
+/* Cache a stack in one library, then swap it for another under it */
+static void
+cached_reload(test_result_t *result)
+{
+    static const char *const plugins[][2] = {
+        { "libthread_db.so.1", "td_init" },
+        { "libresolv.so.2", "__b64_ntop" },
+        { "libBrokenLocale.so.1", "__ctype_get_mb_cur_max" },
+    };
+    const char *const *before, *const *after;
+    const char *loaded[2], *name = NULL;
+    char old[512], **plain;
+    void *stack[1], *handle;
+    size_t p;
+    int found = 0;
+
+    /* Only libraries loaded by us alone are really unmapped */
+    for (p = 0; p < sizeof(plugins) / sizeof(plugins[0]) && found < 2; p++) {
+        if ((handle = dlopen(plugins[p][0], RTLD_NOW | RTLD_NOLOAD)) != NULL) {
+            dlclose(handle);
+            continue;
+        }
+        if ((handle = dlopen(plugins[p][0], RTLD_NOW | RTLD_LOCAL)) != NULL) {
+            dlclose(handle);
+            loaded[found++] = plugins[p][0];
+            if (found == 1)
+                name = plugins[p][1];
+        }
+    }
+    if (found < 2) {
+        safe_printf("- fewer than two unloadable libraries, reload skipped\n");
+        return;
+    }
+
+    handle = dlopen(loaded[0], RTLD_NOW | RTLD_LOCAL);
+    stack[0] = handle != NULL ? dlsym(handle, name) : NULL;
+    if (stack[0] == NULL) {
+        result->failed++;
+        safe_printf("✗ %s: %s not found\n", loaded[0], name);
+        if (handle != NULL)
+            dlclose(handle);
+        return;
+    }
+    stack[0] = (char *)stack[0] + 1;
+    before = backtrace_symbols_cached(stack, 1);
+    snprintf(old, sizeof(old), "%s", before != NULL ? before[0] : "");
+    backtrace_symbols_release(before);
+    dlclose(handle);
+
+    /* The address now lies in the other library, or in none */
+    handle = dlopen(loaded[1], RTLD_NOW | RTLD_LOCAL);
+    after = backtrace_symbols_cached(stack, 1);
+    plain = backtrace_symbols(stack, 1);
+    if (before != NULL && strstr(old, name) != NULL && after != NULL &&
+        plain != NULL && strcmp(after[0], plain[0]) == 0 && strcmp(after[0], old) != 0) {
+        result->passed++;
+        safe_printf("✓ %s replaced by %s: \"%s\"\n", loaded[0], loaded[1], after[0]);
+    } else {
+        result->failed++;
+        safe_printf("✗ after reload cached \"%s\", expected \"%s\"\n",
+                    after != NULL ? after[0] : "(null)", plain != NULL ? plain[0] : "(null)");
+    }
+    free(plain);
+    backtrace_symbols_release(after);
+    if (handle != NULL)
+        dlclose(handle);
+}
+
+/**
+ * Test memoized backtrace_symbols_cached()
+ */
+static void
+test_symbols_cached(test_result_t *result)
+{
+    void *frames[MAX_FRAMES], *other[MAX_FRAMES];
+    const char *const *first, *const *again, *const *diff;
+    struct cached_shared sh;
+    pthread_t threads[CACHED_THREADS];
+    char **plain;
+    double start_time = get_time_ms(), start, cached_ns, plain_ns;
+    int i, n, bad = 0, started = 0;
+    int test_result;
+
+    safe_printf("Testing backtrace_symbols_cached()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Cached symbols test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    n = backtrace(frames, MAX_FRAMES);
+    memcpy(other, frames, sizeof(other));
+    other[0] = (char *)other[0] + 1;
+    first = backtrace_symbols_cached(frames, n);
+    again = backtrace_symbols_cached(frames, n);
+    diff = backtrace_symbols_cached(other, n);
+    plain = backtrace_symbols(frames, n);
+    for (i = 0; first != NULL && plain != NULL && i < n; i++)
+        bad += strcmp(first[i], plain[i]) != 0;
+    if (first != NULL && plain != NULL && again == first && diff != NULL &&
+        diff != first && bad == 0) {
+        result->passed++;
+        safe_printf("✓ repeat call shared the %d-frame result\n", n);
+    } else {
+        result->failed++;
+        safe_printf("✗ cached %p/%p/%p, %d strings differ\n",
+                    (const void *)first, (const void *)again, (const void *)diff, bad);
+    }
+    free(plain);
+    backtrace_symbols_release(again);
+    backtrace_symbols_release(diff);
+
+    /* Every thread gets the same shared array */
+    sh.frames = frames;
+    sh.size = n;
+    sh.expect = first;
+    atomic_init(&sh.mismatches, 0);
+    for (i = 0; i < CACHED_THREADS; i++)
+        started += pthread_create(&threads[i], NULL, cached_thread, &sh) == 0;
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    if (started == CACHED_THREADS && atomic_load(&sh.mismatches) == 0) {
+        result->passed++;
+        safe_printf("✓ %d threads shared one result\n", started);
+    } else {
+        result->failed++;
+        safe_printf("✗ %d mismatched results\n", atomic_load(&sh.mismatches));
+    }
+
+    cached_reload(result);
+
+    start = get_time_ms();
+    for (i = 0; i < CACHED_CALLS; i++)
+        backtrace_symbols_release(backtrace_symbols_cached(frames, n));
+    cached_ns = (get_time_ms() - start) * 1e6 / CACHED_CALLS;
+    start = get_time_ms();
+    for (i = 0; i < CACHED_CALLS / 10; i++)
+        free(backtrace_symbols(frames, n));
+    plain_ns = (get_time_ms() - start) * 1e6 / (CACHED_CALLS / 10);
+    safe_printf("  cached %.0f ns/call, uncached %.0f ns/call\n", cached_ns, plain_ns);
+
+    backtrace_symbols_release(first);
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+/**
+ * Test compiled output templates
+ */
+static void
+test_format(test_result_t *result)
+{
+    static const char *const invalid[] = { "{bogus}", "{pc", "a}b", "{}" };
+    backtrace_format_t *fmt, *braces;
+    void *frames[MAX_FRAMES];
+    char **plain, **formatted, reply[4096];
+    ssize_t got;
+    size_t used;
+    double start_time = get_time_ms();
+    int fds[2], i, n, bad, lines;
+    int test_result;
+
+    safe_printf("Testing backtrace_format_compile()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Format test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* The default layout, spelled as a template, renders identically */
+    n = backtrace(frames, MAX_FRAMES);
+    fmt = backtrace_format_compile("{pc} <{sym}+{off}> at {module}");
+    plain = formatted = NULL;
+    if (fmt != NULL) {
+        plain = backtrace_symbols(frames, n);
+        formatted = backtrace_symbols_format(frames, n, fmt);
+    }
+    for (i = 0, bad = 0; plain != NULL && formatted != NULL && i < n; i++)
+        bad += strcmp(plain[i], formatted[i]) != 0;
+    if (plain != NULL && formatted != NULL && bad == 0) {
+        result->passed++;
+        safe_printf("✓ template matches backtrace_symbols(): %s\n", formatted[0]);
+    } else {
+        result->failed++;
+        safe_printf("✗ %d of %d lines differ\n", bad, n);
+    }
+    free(plain);
+    free(formatted);
+    backtrace_format_free(fmt);
+
+    /* Escapes, fields without data, and the fd writer */
+    braces = backtrace_format_compile("{{{sym}}} {file}:{line}");
+    used = 0;
+    if (braces != NULL && pipe(fds) == 0) {
+        backtrace_symbols_fd_format(frames, n, fds[1], braces);
+        close(fds[1]);
+        while (used < sizeof(reply) - 1 &&
+               (got = read(fds[0], reply + used, sizeof(reply) - 1 - used)) > 0)
+            used += (size_t)got;
+        close(fds[0]);
+    }
+    reply[used] = '\0';
+    for (i = 0, lines = 0; i < (int)used; i++)
+        lines += reply[i] == '\n';
+    if (braces != NULL && lines == n && reply[0] == '{' &&
+        strstr(reply, "} ??:0\n") != NULL) {
+        result->passed++;
+        safe_printf("✓ fd writer wrote %d lines like %.*s\n", lines,
+                    (int)(strchr(reply, '\n') - reply), reply);
+    } else {
+        result->failed++;
+        safe_printf("✗ fd writer output: %.80s\n", reply);
+    }
+    backtrace_format_free(braces);
+
+    for (i = 0, bad = 0; i < (int)(sizeof(invalid) / sizeof(invalid[0])); i++) {
+        errno = 0;
+        fmt = backtrace_format_compile(invalid[i]);
+        bad += fmt != NULL || errno != EINVAL;
+        backtrace_format_free(fmt);
+    }
+    if (bad == 0) {
+        result->passed++;
+        safe_printf("✓ malformed templates rejected\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ %d malformed templates accepted\n", bad);
+    }
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+#define JSON_ITERATIONS 2000
+
+/* Read everything written to the pipe FD until it closes */
+static size_t
+json_drain(int fd, char *buf, size_t len)
+{
+    size_t used = 0;
+    ssize_t n;
+
+    while (used < len - 1 && (n = read(fd, buf + used, len - 1 - used)) > 0)
+        used += (size_t)n;
+    buf[used] = '\0';
+    close(fd);
+    return used;
+}
+
+/*
+ * Load a copy of a system library from a directory whose name needs
+ * escaping and return the JSON of a frame inside it, or 0 if there is
+ * no such library.
+ */
+static int
+json_odd_module(char *json, size_t len)
+{
+    char dir[] = "/tmp/execinfo-json-\"\t\xff-XXXXXX", path[128], block[65536];
+    void *handle, *pc;
+    Dl_info info;
+    ssize_t n;
+    int in, out, rc = 0;
+
+    handle = dlopen("libresolv.so.2", RTLD_NOW | RTLD_LOCAL);
+    pc = handle != NULL ? dlsym(handle, "__b64_ntop") : NULL;
+    if (pc == NULL || dladdr(pc, &info) == 0 || mkdtemp(dir) == NULL) {
+        if (handle != NULL)
+            dlclose(handle);
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/libodd.so", dir);
+    in = open(info.dli_fname, O_RDONLY);
+    out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+    while (in >= 0 && out >= 0 && (n = read(in, block, sizeof(block))) > 0)
+        if (write(out, block, (size_t)n) != n)
+            break;
+    if (in >= 0)
+        close(in);
+    if (out >= 0)
+        close(out);
+    dlclose(handle);
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    pc = handle != NULL ? dlsym(handle, "__b64_ntop") : NULL;
+    if (pc != NULL)
+        rc = backtrace_symbols_json(&pc, 1, json, len, 0) > 0;
+    if (handle != NULL)
+        dlclose(handle);
+    unlink(path);
+    rmdir(dir);
+    return rc;
+}
+
+/**
+ * Test the JSON and NDJSON writers
+ */
+static void
+test_json(test_result_t *result)
+{
+    void *frames[MAX_FRAMES];
+    char *json, piped[16384], odd[1024];
+    const char *p;
+    double start_time = get_time_ms(), start, text_ns, json_ns;
+    int fds[2], i, n, len, objects, lines, devnull;
+    int test_result;
+
+    safe_printf("Testing backtrace_symbols_json()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("JSON test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    /* Measure, write, and compare with the fd writer */
+    n = backtrace(frames, MAX_FRAMES);
+    len = backtrace_symbols_json(frames, n, NULL, 0, 0);
+    json = NULL;
+    if (len > 0 && (json = malloc((size_t)len + 1)) != NULL &&
+        backtrace_symbols_json(frames, n, json, (size_t)len + 1, 0) == len &&
+        pipe(fds) == 0) {
+        backtrace_symbols_json_fd(frames, n, fds[1], 0);
+        close(fds[1]);
+        json_drain(fds[0], piped, sizeof(piped));
+    } else {
+        piped[0] = '\0';
+    }
+    objects = 0;
+    for (p = json; p != NULL && (p = strstr(p, "{\"frame\":")) != NULL; p++)
+        objects++;
+    if (json != NULL && strcmp(json, piped) == 0 && objects == n &&
+        strncmp(json, "[{\"frame\":0,\"pc\":\"0x", 20) == 0 &&
+        strcmp(json + len - 2, "]\n") == 0) {
+        result->passed++;
+        safe_printf("✓ %d frames in %d bytes, fd and buffer writers agree\n", n, len);
+    } else {
+        result->failed++;
+        safe_printf("✗ JSON output: %.100s\n", json != NULL ? json : "(none)");
+    }
+    free(json);
+
+    /* One object per line */
+    lines = 0;
+    if (pipe(fds) == 0) {
+        backtrace_symbols_json_fd(frames, n, fds[1], BACKTRACE_JSON_NDJSON);
+        close(fds[1]);
+        json_drain(fds[0], piped, sizeof(piped));
+        for (p = piped; (p = strchr(p, '\n')) != NULL; p++)
+            lines += p[-1] == '}';
+    }
+    if (lines == n && piped[0] == '{') {
+        result->passed++;
+        safe_printf("✓ NDJSON wrote %d lines\n", lines);
+    } else {
+        result->failed++;
+        safe_printf("✗ NDJSON output: %.100s\n", piped);
+    }
+
+    /* Quotes, control characters and stray bytes in a module path */
+    if (json_odd_module(odd, sizeof(odd))) {
+        if (strstr(odd, "execinfo-json-\\\"\\t\\ufffd-") != NULL &&
+            strstr(odd, "\"symbol\":\"__b64_ntop\"") != NULL) {
+            result->passed++;
+            safe_printf("✓ module path escaped\n");
+        } else {
+            result->failed++;
+            safe_printf("✗ unescaped module path: %.200s\n", odd);
+        }
+    }
+
+    devnull = open("/dev/null", O_WRONLY);
+    start = get_time_ms();
+    for (i = 0; i < JSON_ITERATIONS; i++)
+        backtrace_symbols_fd(frames, n, devnull);
+    text_ns = (get_time_ms() - start) * 1e6 / JSON_ITERATIONS;
+    start = get_time_ms();
+    for (i = 0; i < JSON_ITERATIONS; i++)
+        backtrace_symbols_json_fd(frames, n, devnull, 0);
+    json_ns = (get_time_ms() - start) * 1e6 / JSON_ITERATIONS;
+    if (devnull >= 0)
+        close(devnull);
+    safe_printf("  text %.0f ns/trace, JSON %.0f ns/trace\n", text_ns, json_ns);
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
+#define WIRE_TRACES 200
+
+/* Recurse DEPTH times, then capture a stack into FRAMES */
+static int __attribute__((noinline))
+wire_capture(int depth, void **frames)
+{
+    volatile int n;
+
+    if (depth > 0) {
+        /* Using N after the call rules out tail-call elimination */
+        n = wire_capture(depth - 1, frames);
+        return n;
+    }
+    n = backtrace_ex(frames, MAX_FRAMES, NULL);
+    return n;
+}
+
+struct wire_check {
+    void **frames;
+    int size;
+    backtrace_modtab_t *modules;     /* the sender's view of the frames */
+    int traces;
+    int mismatched;
+    int symbols;
+    int limit;
+};
+
+static int
+wire_check_trace(const struct backtrace_wire_trace *trace, void *ctx)
+{
+    struct wire_check *check = ctx;
+    struct backtrace_modrel rel[MAX_FRAMES];
+    const struct backtrace_module *sent, *got;
+    Dl_info info;
+    int i, depth = check->size - check->traces % 4;
+
+    /* Trace k was sent with the innermost k % 4 frames dropped */
+    backtrace_modrel(check->frames + check->traces % 4, depth, rel, check->modules);
+    if (trace->depth != depth ||
+        trace->id != backtrace_modrel_hash(rel, depth, check->modules) ||
+        trace->timestamp != 1000000000ULL + (uint64_t)check->traces * 1000)
+        check->mismatched++;
+    for (i = 0; i < trace->depth && i < depth; i++) {
+        sent = backtrace_modtab_get(check->modules, (int)rel[i].module);
+        got = backtrace_wire_module(trace->reader, trace->frames[i].module);
+        if (trace->frames[i].offset != rel[i].offset ||
+            (sent == NULL) != (got == NULL) ||
+            (sent != NULL && (sent->key != got->key || strcmp(sent->path, got->path) != 0)))
+            check->mismatched++;
+        if (trace->frames[i].symbol != NULL) {
+            check->symbols++;
+            if (dladdr(check->frames[check->traces % 4 + i], &info) == 0 ||
+                info.dli_sname == NULL || strcmp(info.dli_sname, trace->frames[i].symbol) != 0)
+                check->mismatched++;
+        }
+    }
+    check->traces++;
+    return check->limit && check->traces % check->limit == 0;
+}
+
+/**
+ * Test the binary trace stream encoder and decoder
+ */
+static void
+test_wire(test_result_t *result)
+{
+    void *frames[MAX_FRAMES];
+    unsigned char *stream, chunk[7];
+    char **lines;
+    struct wire_check check;
+    backtrace_wire_writer_t *w;
+    backtrace_wire_reader_t *r;
+    size_t len, text, off, n;
+    int fds[2], i, size, rc, delivered, test_result;
+    double start_time = get_time_ms();
+
+    safe_printf("Testing backtrace_wire_writer_new()...\n");
+
+    if ((test_result = setjmp(test_jmp_buf)) != 0) {
+        safe_printf("Wire format test crashed with signal %d\n", test_result);
+        result->failed++;
+        result->duration_ms = get_time_ms() - start_time;
+        return;
+    }
+
+    size = wire_capture(8, frames);
+    memset(&check, 0, sizeof(check));
+    check.frames = frames;
+    check.size = size;
+    check.modules = backtrace_modtab_new();
+
+    /* Encode into memory, with symbols */
+    stream = NULL;
+    len = text = 0;
+    w = backtrace_wire_writer_new(-1, BACKTRACE_WIRE_SYMBOLS);
+    for (i = 0, rc = 0; w != NULL && i < WIRE_TRACES && size > 4; i++) {
+        rc |= backtrace_wire_record(w, 1000000000ULL + (uint64_t)i * 1000,
+                                    frames + i % 4, size - i % 4);
+        if ((lines = backtrace_symbols(frames + i % 4, size - i % 4)) != NULL) {
+            for (n = 0; n < (size_t)(size - i % 4); n++)
+                text += strlen(lines[n]) + 1;
+            free(lines);
+        }
+    }
+    while (w != NULL && (stream = realloc(stream, len + 4096)) != NULL &&
+           (n = backtrace_wire_take(w, stream + len, 4096)) > 0)
+        len += n;
+    backtrace_wire_writer_free(w);
+
+    /* Decode in 7-byte pieces that split every kind of record */
+    r = backtrace_wire_reader_new(wire_check_trace, &check);
+    for (off = 0, delivered = 0; r != NULL && stream != NULL && off < len; off += n) {
+        n = len - off < sizeof(chunk) ? len - off : sizeof(chunk);
+        memcpy(chunk, stream + off, n);
+        if ((rc = backtrace_wire_feed(r, chunk, n)) < 0)
+            break;
+        delivered += rc;
+    }
+    backtrace_wire_reader_free(r);
+    if (w != NULL && rc >= 0 && delivered == WIRE_TRACES && check.traces == WIRE_TRACES &&
+        check.mismatched == 0 && check.symbols > 0 && len * 5 < text) {
+        result->passed++;
+        safe_printf("✓ %d traces in %zu bytes, %zu as text (%.1fx)\n",
+                    WIRE_TRACES, len, text, (double)text / (double)len);
+    } else {
+        result->failed++;
+        safe_printf("✗ decoded %d/%d traces, %d mismatched, %zu bytes vs %zu text\n",
+                    check.traces, WIRE_TRACES, check.mismatched, len, text);
+    }
+
+    /* A stopping callback resumes where it left off */
+    check.traces = check.mismatched = 0;
+    check.limit = 50;
+    r = backtrace_wire_reader_new(wire_check_trace, &check);
+    rc = r != NULL && stream != NULL ? backtrace_wire_feed(r, stream, len) : -1;
+    for (delivered = rc; rc > 0 && delivered < WIRE_TRACES; delivered += rc)
+        rc = backtrace_wire_feed(r, NULL, 0);
+    if (rc == check.limit && delivered == WIRE_TRACES && check.mismatched == 0 &&
+        backtrace_wire_feed(r, NULL, 0) == 0) {
+        result->passed++;
+        safe_printf("✓ stopped and resumed every %d traces\n", check.limit);
+    } else {
+        result->failed++;
+        safe_printf("✗ resumed decoding delivered %d traces\n", delivered);
+    }
+    backtrace_wire_reader_free(r);
+
+    /* Streams written to a descriptor, and corrupt input */
+    check.traces = check.mismatched = 0;
+    check.limit = 0;
+    delivered = -1;
+    if (pipe(fds) == 0) {
+        w = backtrace_wire_writer_new(fds[1], 0);
+        for (i = 0; w != NULL && i < 8; i++)
+            backtrace_wire_record(w, 1000000000ULL + (uint64_t)i * 1000,
+                                  frames + i % 4, size - i % 4);
+        backtrace_wire_writer_free(w);
+        close(fds[1]);
+        r = backtrace_wire_reader_new(wire_check_trace, &check);
+        for (delivered = 0; r != NULL && (n = (size_t)read(fds[0], chunk, sizeof(chunk))) > 0 &&
+             n <= sizeof(chunk); delivered += rc)
+            if ((rc = backtrace_wire_feed(r, chunk, n)) < 0)
+                break;
+        backtrace_wire_reader_free(r);
+        close(fds[0]);
+    }
+    r = backtrace_wire_reader_new(wire_check_trace, &check);
+    if (stream != NULL)
+        stream[0] ^= 0xff;
+    errno = 0;
+    rc = r != NULL && stream != NULL ? backtrace_wire_feed(r, stream, len) : 0;
+    if (delivered == 8 && check.mismatched == 0 && check.symbols > 0 &&
+        rc == -1 && errno == EINVAL && backtrace_wire_feed(r, NULL, 0) == -1) {
+        result->passed++;
+        safe_printf("✓ fd stream decoded, corrupt stream rejected\n");
+    } else {
+        result->failed++;
+        safe_printf("✗ fd stream delivered %d traces, corrupt stream gave %d\n",
+                    delivered, rc);
+    }
+    backtrace_wire_reader_free(r);
+    backtrace_modtab_free(check.modules);
+    free(stream);
+
+    result->duration_ms = get_time_ms() - start_time;
+}
+
 /**
  * Conservative recursive function
  */
@@ -487,7 +3038,30 @@ main(void)
         {"Basic Functionality", 0, 0, 0.0},
         {"Edge Cases", 0, 0, 0.0},
         {"Performance", 0, 0, 0.0},
-        {"Symbols FD", 0, 0, 0.0}
+        {"Symbols FD", 0, 0, 0.0},
+        {"Symbols Lazy", 0, 0, 0.0},
+        {"Resolve", 0, 0, 0.0},
+        {"Symbols Reentrant", 0, 0, 0.0},
+        {"Foreach", 0, 0, 0.0},
+        {"Cursor", 0, 0, 0.0},
+        {"Filter", 0, 0, 0.0},
+        {"Stack Usage", 0, 0, 0.0},
+        {"CCT", 0, 0, 0.0},
+        {"Top-K", 0, 0, 0.0},
+        {"Shared Memory", 0, 0, 0.0},
+        {"Samples", 0, 0, 0.0},
+        {"Module Relative", 0, 0, 0.0},
+        {"Profile Segments", 0, 0, 0.0},
+        {"Control Socket", 0, 0, 0.0},
+        {"Remote Sampling", 0, 0, 0.0},
+        {"Shadow Stack", 0, 0, 0.0},
+        {"Sample Metadata", 0, 0, 0.0},
+        {"Module Unload", 0, 0, 0.0},
+        {"Batch Symbolizer", 0, 0, 0.0},
+        {"Symbols Cached", 0, 0, 0.0},
+        {"Format Templates", 0, 0, 0.0},
+        {"JSON Output", 0, 0, 0.0},
+        {"Wire Format", 0, 0, 0.0}
     };
     int num_tests = sizeof(tests) / sizeof(tests[0]);
     int i, total_passed = 0, total_failed = 0;
@@ -519,6 +3093,29 @@ main(void)
     test_edge_cases(&tests[1]);
     test_performance(&tests[2]);
     test_symbols_fd(&tests[3]);
+    test_symbols_lazy(&tests[4]);
+    test_resolve(&tests[5]);
+    test_symbols_r(&tests[6]);
+    test_foreach(&tests[7]);
+    test_cursor(&tests[8]);
+    test_filter(&tests[9]);
+    test_stack_usage(&tests[10]);
+    test_cct(&tests[11]);
+    test_topk(&tests[12]);
+    test_shm(&tests[13]);
+    test_samples(&tests[14]);
+    test_modrel(&tests[15]);
+    test_profile(&tests[16]);
+    test_control(&tests[17]);
+    test_remote(&tests[18]);
+    test_shadow(&tests[19]);
+    test_meta(&tests[20]);
+    test_unload(&tests[21]);
+    test_symbolize(&tests[22]);
+    test_symbols_cached(&tests[23]);
+    test_format(&tests[24]);
+    test_json(&tests[25]);
+    test_wire(&tests[26]);
 
     /* Print summary */
     safe_printf("\n=== Test Summary ===\n");
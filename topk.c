@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+#define TOPK_SHARDS 16           /* independently locked partitions */
+
+/*
+ * Heavy-hitter tracking with the Space-Saving algorithm.
+ *
+ * Every tracked stack has a counter; a stack that is not tracked takes
+ * over the counter with the smallest count and inherits that count as
+ * its error bound.  Any stack whose true count exceeds its shard's
+ * total/capacity is guaranteed to be tracked, and memory is fixed at
+ * creation time.
+ *
+ * The counters are split into shards selected by the stack hash, so a
+ * stack always lands in the same shard and the union of the shards is
+ * the summary.  Each shard has its own mutex, which keeps concurrent
+ * updates from different threads mostly uncontended, and an
+ * open-addressed index from stack hash to counter so that updating a
+ * tracked stack does not scan the shard.
+ */
+
+struct topk_counter {
+    uint64_t id;                 /* 0 = unused */
+    uint64_t count;
+    uint64_t error;
+    int depth;
+};
+
+struct topk_shard {
+    pthread_mutex_t lock;
+    int used;
+    struct topk_counter *counters;
+    void **frames;               /* cap * max_depth frames */
+    int32_t *index;              /* counter number + 1, 0 = empty */
+    uint32_t mask;
+};
+
+struct backtrace_topk {
+    int per_shard;
+    int max_depth;
+    struct topk_shard shards[TOPK_SHARDS];
+};
+
+backtrace_topk_t *
+backtrace_topk_new(int capacity, int max_depth)
+{
+    backtrace_topk_t *t;
+    struct topk_shard *sh;
+    uint32_t slots;
+    int i;
+
+    if (capacity <= 0 || max_depth <= 0 ||
+        max_depth > BACKTRACE_TOPK_MAX_DEPTH) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    t->per_shard = (capacity + TOPK_SHARDS - 1) / TOPK_SHARDS;
+    t->max_depth = max_depth;
+
+    for (slots = 4; slots < (uint32_t)t->per_shard * 2; slots <<= 1)
+        ;
+    for (i = 0; i < TOPK_SHARDS; i++) {
+        sh = &t->shards[i];
+        pthread_mutex_init(&sh->lock, NULL);
+        sh->counters = calloc((size_t)t->per_shard, sizeof(*sh->counters));
+        sh->frames = calloc((size_t)t->per_shard * (size_t)max_depth,
+                            sizeof(*sh->frames));
+        sh->index = calloc(slots, sizeof(*sh->index));
+        sh->mask = slots - 1;
+        if (sh->counters == NULL || sh->frames == NULL || sh->index == NULL) {
+            backtrace_topk_free(t);
+            return NULL;
+        }
+    }
+    return t;
+}
+
+void
+backtrace_topk_free(backtrace_topk_t *t)
+{
+    int i;
+
+    if (t == NULL)
+        return;
+    for (i = 0; i < TOPK_SHARDS; i++) {
+        pthread_mutex_destroy(&t->shards[i].lock);
+        free(t->shards[i].counters);
+        free(t->shards[i].frames);
+        free(t->shards[i].index);
+    }
+    free(t);
+}
+
+/* Index slot holding ID, or the empty slot where it would go */
+static uint32_t
+topk_find(const struct topk_shard *sh, uint64_t id)
+{
+    uint32_t s = (uint32_t)(id >> 32) & sh->mask;
+    int32_t c;
+
+    while ((c = sh->index[s]) != 0 && sh->counters[c - 1].id != id)
+        s = (s + 1) & sh->mask;
+    return s;
+}
+
+/* Remove index slot S, shifting later entries of its run back */
+static void
+topk_unindex(struct topk_shard *sh, uint32_t s)
+{
+    uint32_t next, home;
+
+    for (;;) {
+        sh->index[s] = 0;
+        next = s;
+        for (;;) {
+            next = (next + 1) & sh->mask;
+            if (sh->index[next] == 0)
+                return;
+            home = (uint32_t)(sh->counters[sh->index[next] - 1].id >> 32) &
+                   sh->mask;
+            /* Move it back unless its home lies cyclically in (s, next] */
+            if (s <= next ? (home <= s || home > next) :
+                            (home <= s && home > next))
+                break;
+        }
+        sh->index[s] = sh->index[next];
+        s = next;
+    }
+}
+
+int
+backtrace_topk_add(backtrace_topk_t *t, void *const *buffer, int size,
+                   uint64_t count)
+{
+    struct topk_shard *sh;
+    struct topk_counter *c;
+    uint64_t id;
+    uint32_t s;
+    int i, victim;
+
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size > t->max_depth)
+        size = t->max_depth;
+
+    id = backtrace_hash(buffer, size);
+    sh = &t->shards[id & (TOPK_SHARDS - 1)];
+
+    pthread_mutex_lock(&sh->lock);
+    s = topk_find(sh, id);
+    if (sh->index[s] != 0) {
+        sh->counters[sh->index[s] - 1].count += count;
+        pthread_mutex_unlock(&sh->lock);
+        return 0;
+    }
+
+    if (sh->used < t->per_shard) {
+        victim = sh->used++;
+        c = &sh->counters[victim];
+        c->count = count;
+        c->error = 0;
+    } else {
+        /* Evict the smallest counter; the newcomer inherits its count */
+        victim = 0;
+        for (i = 1; i < sh->used; i++) {
+            if (sh->counters[i].count < sh->counters[victim].count)
+                victim = i;
+        }
+        c = &sh->counters[victim];
+        topk_unindex(sh, topk_find(sh, c->id));
+        c->error = c->count;
+        c->count += count;
+        s = topk_find(sh, id);
+    }
+    c->id = id;
+    c->depth = size;
+    memcpy(&sh->frames[(size_t)victim * (size_t)t->max_depth], buffer,
+           (size_t)size * sizeof(void *));
+    sh->index[s] = victim + 1;
+    pthread_mutex_unlock(&sh->lock);
+    return 0;
+}
+
+static int
+topk_entry_cmp(const void *a, const void *b)
+{
+    const struct backtrace_topk_entry *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+int
+backtrace_topk_get(backtrace_topk_t *t, struct backtrace_topk_entry *entries,
+                   int n)
+{
+    struct backtrace_topk_entry *all, *e;
+    struct topk_shard *sh;
+    int i, j, total = 0;
+
+    if (n <= 0)
+        return 0;
+    all = malloc((size_t)t->per_shard * TOPK_SHARDS * sizeof(*all));
+    if (all == NULL)
+        return -1;
+
+    for (i = 0; i < TOPK_SHARDS; i++) {
+        sh = &t->shards[i];
+        pthread_mutex_lock(&sh->lock);
+        for (j = 0; j < sh->used; j++) {
+            e = &all[total++];
+            e->id = sh->counters[j].id;
+            e->count = sh->counters[j].count;
+            e->error = sh->counters[j].error;
+            e->depth = sh->counters[j].depth;
+            memcpy(e->frames, &sh->frames[(size_t)j * (size_t)t->max_depth],
+                   (size_t)e->depth * sizeof(void *));
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+
+    qsort(all, (size_t)total, sizeof(*all), topk_entry_cmp);
+    if (n > total)
+        n = total;
+    memcpy(entries, all, (size_t)n * sizeof(*all));
+    free(all);
+    return n;
+}
@@ -0,0 +1,663 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "execinfo.h"
+
+/*
+ * Binary trace streams.
+ *
+ * A stream is a header followed by records:
+ *
+ *   header    "EXECWIR" and a version byte
+ *   record    tag byte, varint payload length, payload
+ *
+ * Integers are unsigned LEB128 varints.  Records are:
+ *
+ *   module    index, key, build-id length and bytes, path length and bytes
+ *   symbol    index, name length and bytes
+ *   trace     zigzag timestamp delta, flags, depth, then per frame the
+ *             module index + 1 (0 = none) and offset, and with
+ *             WIRE_TRACE_SYMBOLS the symbol index + 1 (0 = none) and,
+ *             for a symbol, the offset into it
+ *
+ * Modules and symbols are numbered densely in order of first use and
+ * sent once, just before the first trace that refers to them, so a
+ * stream is only meaningful from its start.  The length prefix lets a
+ * reader skip records of unknown tags.
+ */
+
+#define WIRE_MAGIC "EXECWIR"
+#define WIRE_VERSION 1
+#define WIRE_HEADER 8
+#define WIRE_FLUSH (64 * 1024)           /* pending bytes written at once */
+#define WIRE_RECORD_MAX (1024 * 1024)    /* longest payload a reader takes */
+#define WIRE_VARINT_MAX 10
+#define WIRE_LENGTH_MAX 5                /* varint of a length < 2^32 */
+
+#define WIRE_MODULE 1
+#define WIRE_SYMBOL 2
+#define WIRE_TRACE 3
+
+#define WIRE_TRACE_SYMBOLS 0x1
+
+struct backtrace_wire_writer {
+    int fd;
+    int flags;
+    backtrace_modtab_t *modules;
+    uint32_t modules_sent;
+    char **symbols;
+    uint32_t nsymbols;
+    uint32_t symbols_cap;
+    uint32_t *symbol_index;          /* symbol number + 1, 0 = empty */
+    uint32_t symbol_mask;
+    uint64_t timestamp;              /* of the previous trace */
+    unsigned char *out;
+    size_t head;                     /* first pending byte */
+    size_t used;
+    size_t cap;
+};
+
+struct backtrace_wire_reader {
+    backtrace_wire_callback_t callback;
+    void *ctx;
+    unsigned char *buf;              /* undecoded bytes */
+    size_t used;
+    size_t cap;
+    int header;
+    int failed;
+    backtrace_modtab_t *modules;
+    char **symbols;
+    uint32_t nsymbols;
+    uint32_t symbols_cap;
+    uint64_t timestamp;
+    struct backtrace_wire_frame frames[EXECINFO_MAX_FRAMES];
+    struct backtrace_modrel rel[EXECINFO_MAX_FRAMES];
+};
+
+static unsigned char *
+wire_varint(unsigned char *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+/* Decode a varint from [*P, END); 0 if it is cut short, -1 if invalid */
+static int
+wire_get(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+    const unsigned char *q = *p;
+    unsigned shift = 0;
+
+    *v = 0;
+    for (; q < end; shift += 7) {
+        if (shift > 63 || (shift == 63 && (*q & 0x7e) != 0))
+            return -1;
+        *v |= (uint64_t)(*q & 0x7f) << shift;
+        if ((*q++ & 0x80) == 0) {
+            *p = q;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t
+wire_hash(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*s != '\0')
+        h = (h ^ (unsigned char)*s++) * 0x100000001b3ULL;
+    return h;
+}
+
+static int
+wire_reserve(backtrace_wire_writer_t *w, size_t len)
+{
+    size_t cap = w->cap ? w->cap : 4096;
+    unsigned char *p;
+
+    if (w->used + len <= w->cap)
+        return 0;
+    /* Reuse the space of bytes already taken */
+    if (w->head > 0) {
+        memmove(w->out, w->out + w->head, w->used - w->head);
+        w->used -= w->head;
+        w->head = 0;
+        if (w->used + len <= w->cap)
+            return 0;
+    }
+    while (cap < w->used + len)
+        cap *= 2;
+    p = realloc(w->out, cap);
+    if (p == NULL)
+        return -1;
+    w->out = p;
+    w->cap = cap;
+    return 0;
+}
+
+/* Start a record of at most MAX payload bytes; returns where it goes */
+static unsigned char *
+wire_begin(backtrace_wire_writer_t *w, size_t max)
+{
+    if (max > UINT32_MAX) {
+        errno = EOVERFLOW;
+        return NULL;
+    }
+    if (wire_reserve(w, 1 + WIRE_LENGTH_MAX + max) != 0)
+        return NULL;
+    return w->out + w->used + 1 + WIRE_LENGTH_MAX;
+}
+
+/* Finish the record begun by wire_begin(), ending at END */
+static void
+wire_end(backtrace_wire_writer_t *w, int tag, unsigned char *end)
+{
+    unsigned char *rec = w->out + w->used, *payload = rec + 1 + WIRE_LENGTH_MAX;
+    unsigned char *p;
+    size_t len = (size_t)(end - payload);
+
+    rec[0] = (unsigned char)tag;
+    p = wire_varint(rec + 1, len);
+    memmove(p, payload, len);
+    w->used = (size_t)(p - w->out) + len;
+}
+
+static int
+wire_write(backtrace_wire_writer_t *w)
+{
+    ssize_t n;
+
+    while (w->head < w->used) {
+        n = write(w->fd, w->out + w->head, w->used - w->head);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        w->head += (size_t)n;
+    }
+    w->head = w->used = 0;
+    return 0;
+}
+
+backtrace_wire_writer_t *
+backtrace_wire_writer_new(int fd, int flags)
+{
+    backtrace_wire_writer_t *w;
+
+    if (flags & ~BACKTRACE_WIRE_SYMBOLS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return NULL;
+    w->fd = fd;
+    w->flags = flags;
+    w->modules = backtrace_modtab_new();
+    if (w->modules == NULL || wire_reserve(w, WIRE_HEADER) != 0) {
+        backtrace_modtab_free(w->modules);
+        free(w);
+        return NULL;
+    }
+    memcpy(w->out, WIRE_MAGIC, WIRE_HEADER - 1);
+    w->out[WIRE_HEADER - 1] = WIRE_VERSION;
+    w->used = WIRE_HEADER;
+    return w;
+}
+
+/* Emit records for the modules added to the table since the last trace */
+static int
+wire_modules(backtrace_wire_writer_t *w)
+{
+    const struct backtrace_module *m;
+    unsigned char *p;
+    size_t len;
+
+    while (w->modules_sent < (uint32_t)backtrace_modtab_count(w->modules)) {
+        m = backtrace_modtab_get(w->modules, (int)w->modules_sent);
+        len = strlen(m->path);
+        p = wire_begin(w, 4 * WIRE_VARINT_MAX + BACKTRACE_BUILD_ID_MAX + len);
+        if (p == NULL)
+            return -1;
+        p = wire_varint(p, w->modules_sent);
+        p = wire_varint(p, m->key);
+        p = wire_varint(p, (uint64_t)m->build_id_len);
+        memcpy(p, m->build_id, (size_t)m->build_id_len);
+        p = wire_varint(p + m->build_id_len, len);
+        memcpy(p, m->path, len);
+        wire_end(w, WIRE_MODULE, p + len);
+        w->modules_sent++;
+    }
+    return 0;
+}
+
+static int
+wire_symbol_grow(backtrace_wire_writer_t *w)
+{
+    uint32_t mask = w->symbol_mask ? w->symbol_mask * 2 + 1 : 255, i, s;
+    uint32_t *index;
+
+    index = calloc((size_t)mask + 1, sizeof(*index));
+    if (index == NULL)
+        return -1;
+    for (i = 0; i < w->nsymbols; i++) {
+        for (s = (uint32_t)wire_hash(w->symbols[i]) & mask; index[s] != 0;
+             s = (s + 1) & mask)
+            ;
+        index[s] = i + 1;
+    }
+    free(w->symbol_index);
+    w->symbol_index = index;
+    w->symbol_mask = mask;
+    return 0;
+}
+
+/* Number NAME, sending it on first use; returns the number or -1 */
+static int64_t
+wire_symbol(backtrace_wire_writer_t *w, const char *name)
+{
+    unsigned char *p;
+    size_t len = strlen(name), cap;
+    uint32_t s;
+    char **symbols;
+
+    if ((w->nsymbols + 1) * 2 > w->symbol_mask + 1 && wire_symbol_grow(w) != 0)
+        return -1;
+    for (s = (uint32_t)wire_hash(name) & w->symbol_mask; w->symbol_index[s] != 0;
+         s = (s + 1) & w->symbol_mask) {
+        if (strcmp(w->symbols[w->symbol_index[s] - 1], name) == 0)
+            return w->symbol_index[s] - 1;
+    }
+
+    if (w->nsymbols == w->symbols_cap) {
+        cap = w->symbols_cap ? (size_t)w->symbols_cap * 2 : 64;
+        symbols = realloc(w->symbols, cap * sizeof(*symbols));
+        if (symbols == NULL)
+            return -1;
+        w->symbols = symbols;
+        w->symbols_cap = (uint32_t)cap;
+    }
+    if ((p = wire_begin(w, 2 * WIRE_VARINT_MAX + len)) == NULL ||
+        (w->symbols[w->nsymbols] = strdup(name)) == NULL)
+        return -1;
+    p = wire_varint(p, w->nsymbols);
+    p = wire_varint(p, len);
+    memcpy(p, name, len);
+    wire_end(w, WIRE_SYMBOL, p + len);
+    w->symbol_index[s] = ++w->nsymbols;
+    return w->nsymbols - 1;
+}
+
+int
+backtrace_wire_record(backtrace_wire_writer_t *w, uint64_t timestamp,
+                      void *const *buffer, int size)
+{
+    struct backtrace_modrel frames[EXECINFO_MAX_FRAMES];
+    uint64_t syms[EXECINFO_MAX_FRAMES], symoffs[EXECINFO_MAX_FRAMES];
+    struct timespec ts;
+    unsigned char *p;
+    Dl_info info;
+    int64_t sym;
+    int i;
+
+    if (size < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size > EXECINFO_MAX_FRAMES)
+        size = EXECINFO_MAX_FRAMES;
+    if (timestamp == 0) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    }
+    /*
+     * Module and symbol records go out as soon as the tables take the
+     * entries, so a failure below leaves a consistent stream that just
+     * lacks this trace.
+     */
+    if (backtrace_modrel(buffer, size, frames, w->modules) < 0 ||
+        wire_modules(w) != 0)
+        return -1;
+
+    if (w->flags & BACKTRACE_WIRE_SYMBOLS) {
+        for (i = 0; i < size; i++) {
+            syms[i] = 0;
+            symoffs[i] = 0;
+            if (buffer[i] == NULL || dladdr(buffer[i], &info) == 0 ||
+                info.dli_sname == NULL || info.dli_saddr == NULL)
+                continue;
+            if ((sym = wire_symbol(w, info.dli_sname)) < 0)
+                return -1;
+            syms[i] = (uint64_t)sym + 1;
+            symoffs[i] = (uint64_t)((char *)buffer[i] - (char *)info.dli_saddr);
+        }
+    }
+
+    p = wire_begin(w, (3 + 4 * (size_t)size) * WIRE_VARINT_MAX);
+    if (p == NULL)
+        return -1;
+    /* Zigzag keeps small steps short in either direction */
+    p = wire_varint(p, ((timestamp - w->timestamp) << 1) ^
+                       (uint64_t)-(int64_t)((timestamp - w->timestamp) >> 63));
+    p = wire_varint(p, (w->flags & BACKTRACE_WIRE_SYMBOLS) ? WIRE_TRACE_SYMBOLS : 0);
+    p = wire_varint(p, (uint64_t)size);
+    for (i = 0; i < size; i++) {
+        p = wire_varint(p, frames[i].module == BACKTRACE_MODREL_NONE ?
+                           0 : (uint64_t)frames[i].module + 1);
+        p = wire_varint(p, frames[i].offset);
+        if (w->flags & BACKTRACE_WIRE_SYMBOLS) {
+            p = wire_varint(p, syms[i]);
+            if (syms[i] != 0)
+                p = wire_varint(p, symoffs[i]);
+        }
+    }
+    wire_end(w, WIRE_TRACE, p);
+    w->timestamp = timestamp;
+
+    if (w->fd >= 0 && w->used - w->head >= WIRE_FLUSH && wire_write(w) != 0)
+        return -1;
+    return 0;
+}
+
+size_t
+backtrace_wire_take(backtrace_wire_writer_t *w, void *buf, size_t len)
+{
+    size_t n = w->used - w->head;
+
+    if (n > len)
+        n = len;
+    if (n == 0)
+        return 0;
+    memcpy(buf, w->out + w->head, n);
+    w->head += n;
+    if (w->head == w->used)
+        w->head = w->used = 0;
+    return n;
+}
+
+int
+backtrace_wire_flush(backtrace_wire_writer_t *w)
+{
+    if (w->fd < 0)
+        return 0;
+    return wire_write(w);
+}
+
+int
+backtrace_wire_writer_free(backtrace_wire_writer_t *w)
+{
+    uint32_t i;
+    int rc;
+
+    if (w == NULL)
+        return 0;
+    rc = backtrace_wire_flush(w);
+    backtrace_modtab_free(w->modules);
+    for (i = 0; i < w->nsymbols; i++)
+        free(w->symbols[i]);
+    free(w->symbols);
+    free(w->symbol_index);
+    free(w->out);
+    free(w);
+    return rc;
+}
+
+backtrace_wire_reader_t *
+backtrace_wire_reader_new(backtrace_wire_callback_t callback, void *ctx)
+{
+    backtrace_wire_reader_t *r;
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    r->callback = callback;
+    r->ctx = ctx;
+    r->modules = backtrace_modtab_new();
+    if (r->modules == NULL) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+static int
+wire_read_module(backtrace_wire_reader_t *r, const unsigned char *p,
+                 const unsigned char *end)
+{
+    struct backtrace_module m;
+    uint64_t index, build_id_len, len;
+    char *path;
+    int idx;
+
+    memset(&m, 0, sizeof(m));
+    if (wire_get(&p, end, &index) != 1 || wire_get(&p, end, &m.key) != 1 ||
+        wire_get(&p, end, &build_id_len) != 1 ||
+        index != (uint64_t)backtrace_modtab_count(r->modules) ||
+        build_id_len > BACKTRACE_BUILD_ID_MAX ||
+        build_id_len > (uint64_t)(end - p))
+        return -1;
+    memcpy(m.build_id, p, (size_t)build_id_len);
+    m.build_id_len = (int)build_id_len;
+    p += build_id_len;
+    if (wire_get(&p, end, &len) != 1 || len > (uint64_t)(end - p) ||
+        (path = strndup((const char *)p, (size_t)len)) == NULL)
+        return -1;
+    m.path = path;
+    /* Keys are unique in a stream, so the table keeps the writer's numbers */
+    idx = backtrace_modtab_add(r->modules, &m);
+    free(path);
+    return (uint64_t)idx == index ? 0 : -1;
+}
+
+static int
+wire_read_symbol(backtrace_wire_reader_t *r, const unsigned char *p,
+                 const unsigned char *end)
+{
+    uint64_t index, len;
+    size_t cap;
+    char **symbols;
+
+    if (wire_get(&p, end, &index) != 1 || index != r->nsymbols ||
+        wire_get(&p, end, &len) != 1 || len > (uint64_t)(end - p))
+        return -1;
+    if (r->nsymbols == r->symbols_cap) {
+        cap = r->symbols_cap ? (size_t)r->symbols_cap * 2 : 64;
+        symbols = realloc(r->symbols, cap * sizeof(*symbols));
+        if (symbols == NULL)
+            return -1;
+        r->symbols = symbols;
+        r->symbols_cap = (uint32_t)cap;
+    }
+    if ((r->symbols[r->nsymbols] = strndup((const char *)p, (size_t)len)) == NULL)
+        return -1;
+    r->nsymbols++;
+    return 0;
+}
+
+/* Decode a trace and deliver it; 1 if the callback asks to stop */
+static int
+wire_read_trace(backtrace_wire_reader_t *r, const unsigned char *p,
+                const unsigned char *end)
+{
+    struct backtrace_wire_trace trace;
+    struct backtrace_wire_frame *f;
+    uint64_t delta, flags, depth, module, sym;
+    uint32_t count = (uint32_t)backtrace_modtab_count(r->modules);
+    int i;
+
+    if (wire_get(&p, end, &delta) != 1 || wire_get(&p, end, &flags) != 1 ||
+        wire_get(&p, end, &depth) != 1 || depth > EXECINFO_MAX_FRAMES)
+        return -1;
+    for (i = 0; i < (int)depth; i++) {
+        f = &r->frames[i];
+        if (wire_get(&p, end, &module) != 1 || module > count ||
+            wire_get(&p, end, &f->offset) != 1)
+            return -1;
+        f->module = module == 0 ? BACKTRACE_MODREL_NONE : (uint32_t)module - 1;
+        f->symbol = NULL;
+        f->symbol_offset = 0;
+        if (flags & WIRE_TRACE_SYMBOLS) {
+            if (wire_get(&p, end, &sym) != 1 || sym > r->nsymbols ||
+                (sym != 0 && wire_get(&p, end, &f->symbol_offset) != 1))
+                return -1;
+            if (sym != 0)
+                f->symbol = r->symbols[sym - 1];
+        }
+        r->rel[i].module = f->module;
+        r->rel[i].offset = f->offset;
+    }
+
+    r->timestamp += (delta >> 1) ^ (uint64_t)-(int64_t)(delta & 1);
+    trace.timestamp = r->timestamp;
+    trace.id = backtrace_modrel_hash(r->rel, (int)depth, r->modules);
+    trace.depth = (int)depth;
+    trace.frames = r->frames;
+    trace.reader = r;
+    return r->callback(&trace, r->ctx) != 0;
+}
+
+/*
+ * Decode the complete records in [P, P + LEN).  Sets *USED to the bytes
+ * consumed and returns the number of traces delivered, or -1.
+ */
+static int
+wire_decode(backtrace_wire_reader_t *r, const unsigned char *p, size_t len,
+            size_t *used)
+{
+    const unsigned char *start = p, *end = p + len, *q;
+    uint64_t rlen;
+    int n = 0, rc, got, tag;
+
+    *used = 0;
+    errno = EINVAL;
+    if (!r->header) {
+        if (len < WIRE_HEADER)
+            return 0;
+        if (memcmp(p, WIRE_MAGIC, WIRE_HEADER - 1) != 0 ||
+            p[WIRE_HEADER - 1] != WIRE_VERSION)
+            return -1;
+        r->header = 1;
+        p += WIRE_HEADER;
+        *used = WIRE_HEADER;
+    }
+    while (p < end) {
+        tag = p[0];
+        q = p + 1;
+        if ((got = wire_get(&q, end, &rlen)) < 0 || rlen > WIRE_RECORD_MAX)
+            return -1;
+        if (got == 0 || rlen > (uint64_t)(end - q))
+            break;
+        errno = EINVAL;
+        switch (tag) {
+        case WIRE_MODULE:
+            rc = wire_read_module(r, q, q + rlen);
+            break;
+        case WIRE_SYMBOL:
+            rc = wire_read_symbol(r, q, q + rlen);
+            break;
+        case WIRE_TRACE:
+            rc = wire_read_trace(r, q, q + rlen);
+            break;
+        default:
+            rc = 0;             /* from a newer writer */
+            break;
+        }
+        if (rc < 0)
+            return -1;
+        p = q + rlen;
+        *used = (size_t)(p - start);
+        if (tag == WIRE_TRACE)
+            n++;
+        if (rc > 0)
+            break;
+    }
+    return n;
+}
+
+static int
+wire_append(backtrace_wire_reader_t *r, const void *data, size_t len)
+{
+    size_t cap = r->cap ? r->cap : 4096;
+    unsigned char *p;
+
+    if (r->used + len > r->cap) {
+        while (cap < r->used + len)
+            cap *= 2;
+        p = realloc(r->buf, cap);
+        if (p == NULL)
+            return -1;
+        r->buf = p;
+        r->cap = cap;
+    }
+    memcpy(r->buf + r->used, data, len);
+    r->used += len;
+    return 0;
+}
+
+int
+backtrace_wire_feed(backtrace_wire_reader_t *r, const void *data, size_t len)
+{
+    size_t used;
+    int n;
+
+    if (r->failed) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (r->used == 0) {
+        /* Nothing left over: decode in place and keep only the tail */
+        n = wire_decode(r, data, len, &used);
+    } else {
+        if (len > 0 && wire_append(r, data, len) != 0)
+            return -1;
+        n = wire_decode(r, r->buf, r->used, &used);
+        if (n >= 0) {
+            memmove(r->buf, r->buf + used, r->used - used);
+            r->used -= used;
+        }
+        used = len;
+    }
+    if (n < 0) {
+        r->failed = 1;
+        return -1;
+    }
+    if (used < len && wire_append(r, (const unsigned char *)data + used, len - used) != 0)
+        return -1;
+    return n;
+}
+
+const struct backtrace_module *
+backtrace_wire_module(const backtrace_wire_reader_t *r, uint32_t index)
+{
+    return backtrace_modtab_get(r->modules, (int)index);
+}
+
+void
+backtrace_wire_reader_free(backtrace_wire_reader_t *r)
+{
+    uint32_t i;
+
+    if (r == NULL)
+        return;
+    for (i = 0; i < r->nsymbols; i++)
+        free(r->symbols[i]);
+    free(r->symbols);
+    backtrace_modtab_free(r->modules);
+    free(r->buf);
+    free(r);
+}